@@ -0,0 +1,102 @@
+#ifndef _CALIBRATION_H_
+#define _CALIBRATION_H_
+
+/*
+ *  Per-unit calibration of the ADCs and the ISET DAC
+ *  Martin Kopka 2024
+ *
+ *  Each channel is described by a gain, an offset and CALIBRATION_SEGMENTS + 1 piecewise-linear correction points evenly spaced over the input range
+ *  the ISET DAC points are spaced in octaves of the current instead, so a linearization up to a few amps still spans most of the segments
+ *  the description is compiled into a table of per-segment gains and offsets, so a conversion is a single multiply-accumulate without any division
+ *  the calibration is stored in the last flash sector; the nominal conversion macros from hw_config.h are used if the sector is empty
+ */
+
+#include "common_defs.h"
+
+//---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum {
+
+    CAL_VSEN_INT = 0,       // VSEN ADC code -> load voltage with internal sense [mV]
+    CAL_VSEN_REM,           // VSEN ADC code -> load voltage with remote sense [mV]
+    CAL_ISEN,               // ISEN ADC code -> total load current [mA]
+    CAL_ISEN_L1,            // internal ADC code -> L1 sink current [mA]
+    CAL_ISEN_L2,            // internal ADC code -> L2 sink current [mA]
+    CAL_ISEN_R1,            // internal ADC code -> R1 sink current [mA]
+    CAL_ISEN_R2,            // internal ADC code -> R2 sink current [mA]
+    CAL_ISET_DAC,           // load current [mA] -> ISET DAC code
+
+    CAL_CHANNEL_COUNT
+
+} calibration_channel_t;
+
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// calibration of a single channel
+typedef struct {
+
+    int32_t gain;                                       // [output unit per input LSB] * 2^16
+    int32_t offset;                                     // output at input 0 [output unit]
+    int16_t correction[CALIBRATION_SEGMENTS + 1];       // correction added at the segment edges [output unit]
+
+} calibration_t;
+
+// linear function of a single input segment; output = (input * gain + offset) >> 16
+typedef struct {
+
+    int32_t gain;           // [output unit per input LSB] * 2^16
+    int64_t offset;         // [output unit] * 2^16, including the rounding constant
+
+} calibration_segment_t;
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// loads the calibration from the flash or the nominal values if there is no valid calibration stored
+void calibration_init(void);
+
+// returns the calibration of a channel
+const calibration_t *calibration_get(calibration_channel_t channel);
+
+// replaces the calibration of a channel; the change takes effect immediately but is lost after a reset unless saved
+void calibration_set(calibration_channel_t channel, const calibration_t *calibration);
+
+// restores the nominal calibration of a channel from hw_config.h
+void calibration_reset(calibration_channel_t channel);
+
+// stores the calibration of all channels in the flash; returns false if the load is enabled or the flash could not be written
+// the flash is stalled while the sector is erased (up to 2s), so the calibration is not saved while the load is enabled
+bool calibration_save(void);
+
+// measures the raw input of a channel and adds a calibration point with a reference output value; returns the number of collected points or 0 on failure
+// ADC channels: the input is measured and the reference is the externally measured voltage [mV] or current [mA]
+// ISET DAC: the input is the externally measured current [mA] and the reference is the DAC code currently written
+uint32_t calibration_add_point(calibration_channel_t channel, int32_t reference);
+
+// discards the collected calibration points
+void calibration_clear_points(void);
+
+// fits the gain, offset and correction points of a channel to the collected points; returns false if there are not enough points
+// two points fit the gain and the offset, each additional point contributes to the piecewise-linear correction
+bool calibration_fit(calibration_channel_t channel);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// converts a raw input of a channel using the calibration
+static inline int32_t calibration_apply(calibration_channel_t channel, uint32_t input) {
+
+    extern calibration_segment_t calibration_table[CAL_CHANNEL_COUNT][CALIBRATION_SEGMENTS];
+    extern const uint8_t calibration_segment_shift[CAL_CHANNEL_COUNT];
+
+    uint32_t segment = input >> calibration_segment_shift[channel];
+
+    // the ISET DAC segment is the octave of the current; the first two segments have the same width
+    if (channel == CAL_ISET_DAC && segment > 0) segment = 32 - __builtin_clz(segment);
+    if (segment >= CALIBRATION_SEGMENTS) segment = CALIBRATION_SEGMENTS - 1;
+
+    const calibration_segment_t *s = &calibration_table[channel][segment];
+    return ((int32_t)(((int64_t)(int32_t)input * s->gain + s->offset) >> 16));
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _CALIBRATION_H_ */
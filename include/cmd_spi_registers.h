@@ -20,6 +20,7 @@ typedef enum {
     CMD_ADDRESS_ID              = 0x00,     // Load ID register (r), always returns 0x10AD
     CMD_ADDRESS_STATUS          = 0x01,     // Load Status register (r)
     CMD_ADDRESS_CONFIG          = 0x02,     // Load Configuration Register (r/w)
+    CMD_ADDRESS_FILTER          = 0x03,     // Load Measurement Filter Configuration register (r/w)
     CMD_ADDRESS_FAULT           = 0x04,     // Load Fault Flag register (r)
     CMD_ADDRESS_FAULT_MASK      = 0x08,     // Load Fault Mask register (r/w)
     CMD_ADDRESS_WD_RELOAD       = 0x0C,     // Load Watchdog Reload register (w), write 0xBABA to reload the watchdog
@@ -29,29 +30,90 @@ typedef enum {
     CMD_ADDRESS_CR_LEVEL        = 0x12,     // Load CR Level register (r/w)
     CMD_ADDRESS_CP_LEVEL        = 0x13,     // Load CP Level register (r/w)
     CMD_ADDRESS_DISCH_LEVEL     = 0x14,     // Load Discharge Voltage register (r/w)
+    CMD_ADDRESS_BAT_CTRL        = 0x15,     // Battery Test Control register (r/w); the test settings are parameters (see param.h), the capacity is in the CHARGE and ENERGY registers
+    CMD_ADDRESS_BAT_IR          = 0x16,     // Battery Internal Resistance register (r), last DC internal resistance measurement [0.1 mOhm]
+    CMD_ADDRESS_BAT_LOG_COUNT   = 0x17,     // Battery Log Count register (r), number of records in the log
+    CMD_ADDRESS_BAT_LOG_PERIOD  = 0x18,     // Battery Log Period register (r), time between the records [s]; the first record is taken at the test start
+    CMD_ADDRESS_BAT_LOG_INDEX   = 0x19,     // Battery Log Index register (r/w), write the index of a record to load it into the DATA window
+    CMD_ADDRESS_BAT_LOG_DATA0   = 0x1A,     // Battery Log Data Window registers (r), voltage [10mV], current [mA], charge [mAh] and internal resistance [0.1 mOhm] of the record
+    CMD_ADDRESS_BAT_LOG_DATA3   = 0x1D,
     CMD_ADDRESS_AVLBL_CURRENT   = 0x1E,     // Load Available Current register (r)
     CMD_ADDRESS_AVLBL_POWER     = 0x1F,     // Load Available Power register (r)
     CMD_ADDRESS_VOLTAGE         = 0x20,     // Load Input Voltage register (r)
     CMD_ADDRESS_CURRENT         = 0x22,     // Load Total Current register (r)
     CMD_ADDRESS_POWER           = 0x23,     // Load Total Power register (r)
+    CMD_ADDRESS_MEAS_SEQ        = 0x24,     // Measurement Sequence register (r), odd while VOLTAGE, CURRENT and POWER are being updated (see the read protocol below)
     CMD_ADDRESS_CURRENT_L1      = 0x28,     // Load L1 Sink Current register (r)
     CMD_ADDRESS_CURRENT_L2      = 0x29,     // Load L2 Sink Current register (r)
     CMD_ADDRESS_CURRENT_R1      = 0x2A,     // Load R1 Sink Current register (r)
     CMD_ADDRESS_CURRENT_R2      = 0x2B,     // Load R2 Sink Current register (r)
+    CMD_ADDRESS_LIN_CTRL        = 0x2C,     // CC Linearization Control register (r/w); the highest current is the lin_max_ma parameter (see param.h)
+    CMD_ADDRESS_LIN_POINT       = 0x2D,     // CC Linearization Point register (r), number of measured calibration points
+    CMD_ADDRESS_CC_TRIM         = 0x2E,     // CC Trim register (r), signed offset added to the CC level by the trim [mA]
     CMD_ADDRESS_TEMP_L          = 0x30,     // Left Power Board Temperature register (r)
     CMD_ADDRESS_TEMP_R          = 0x31,     // Right Power Board Temperature register (r)
+    CMD_ADDRESS_SWEEP_CTRL      = 0x32,     // I-V Sweep Control register (r/w); the sweep settings are parameters (see param.h)
+    CMD_ADDRESS_SWEEP_INDEX     = 0x33,     // I-V Sweep Index register (r/w), write the index of a point to load it into the DATA window
+    CMD_ADDRESS_SWEEP_DATA0     = 0x34,     // I-V Sweep Data Window registers (r), setpoint [mA or 10mV], voltage [10mV], current [mA] and power [100mW] of the point
+    CMD_ADDRESS_SWEEP_DATA3     = 0x37,
     CMD_ADDRESS_FAN_RPM1        = 0x38,     // FAN1 RPM register (r)
     CMD_ADDRESS_FAN_RPM2        = 0x39,     // FAN2 RPM register (r)
+    CMD_ADDRESS_SWEEP_COUNT     = 0x3A,     // I-V Sweep Point Count register (r), number of measured points in the result table
+    CMD_ADDRESS_BAT_LOG_ENERGY  = 0x3B,     // Battery Log Energy register (r), energy since the test start of the record in the BAT_LOG_DATA window [mWh]
     CMD_ADDRESS_TOTAL_TIME_L    = 0x40,     // Load Total Running Time low register (r)
     CMD_ADDRESS_TOTAL_TIME_H    = 0x41,     // Load Total Running Time high register (r)
     CMD_ADDRESS_TOTAL_MAH_L     = 0x42,     // Load Total Milliamphours low register (r)
     CMD_ADDRESS_TOTAL_MAH_H     = 0x43,     // Load Total Milliamphours high register (r)
     CMD_ADDRESS_TOTAL_MWH_L     = 0x44,     // Load Total Milliwatthours low register (r)
     CMD_ADDRESS_TOTAL_MWH_H     = 0x45,     // Load Total Milliwatthours high register (r)
+    CMD_ADDRESS_SAMPLE_RATE     = 0x48,     // VI Sense Sample Rate register (r/w) [kHz]
+    CMD_ADDRESS_SAMPLE_JITTER   = 0x49,     // VI Sense Read Latency Spread register (r), difference between the maximum and minimum sample read latency [ns]
+    CMD_ADDRESS_SAMPLE_LATE     = 0x4A,     // VI Sense Late Read Count register (r), number of reads which overlapped the next conversion (saturates at 0xffff)
+    CMD_ADDRESS_CAPTURE_CTRL    = 0x4C,     // Waveform Capture Control register (r/w)
+    CMD_ADDRESS_CAPTURE_LEVEL   = 0x4D,     // Waveform Capture Trigger Level register (r/w) [10mV or mA]
+    CMD_ADDRESS_CAPTURE_PRETRIG = 0x4E,     // Waveform Capture Pre-trigger Depth register (r/w) [samples], reads back the depth of the capture after the trigger
+    CMD_ADDRESS_CAPTURE_INDEX   = 0x4F,     // Waveform Capture Read Index register (r/w), write the index of the first sample to be loaded into the DATA window
+    CMD_ADDRESS_CAPTURE_DATA0   = 0x50,     // Waveform Capture Data Window registers (r), voltage [10mV] and current [mA] pairs of LOAD_CAPTURE_WINDOW_SAMPLES samples
+    CMD_ADDRESS_CAPTURE_DATA7   = 0x57,
+    CMD_ADDRESS_INTEGRAL_LATCH  = 0x58,     // Integral Latch register (r/w), write any value to copy the integrals into the CHARGE and ENERGY registers; reads the number of latches
+    CMD_ADDRESS_CHARGE_L        = 0x59,     // Latched Charge registers (r), 48bit charge integrated at the sample rate since the load was enabled [uAh]
+    CMD_ADDRESS_CHARGE_M        = 0x5A,
+    CMD_ADDRESS_CHARGE_H        = 0x5B,
+    CMD_ADDRESS_ENERGY_L        = 0x5C,     // Latched Energy registers (r), 48bit energy integrated at the sample rate since the load was enabled [uWh]
+    CMD_ADDRESS_ENERGY_M        = 0x5D,
+    CMD_ADDRESS_ENERGY_H        = 0x5E,
+    CMD_ADDRESS_AUTOTUNE        = 0x5F,     // PID Autotune register (r/w), write the relay amplitude [mA] to tune the PID of the running CV, CR or CP mode, write 0 to abort; reads the autotune state
+    CMD_ADDRESS_PARAM_INDEX     = 0x60,     // Parameter Index register (r/w), write a param_id_t (see param.h) to load the parameter into the VALUE registers
+    CMD_ADDRESS_PARAM_VALUE_L   = 0x61,     // Parameter Value registers (r/w), 32bit signed value of the selected parameter; writing the high register applies the value
+    CMD_ADDRESS_PARAM_VALUE_H   = 0x62,     // the registers read back the actual value, so an out of range write reads back unchanged
+    CMD_ADDRESS_PROF_SELECT     = 0x63,     // Profiling Select register (r/w), write a handler or task and a page to load its statistics into the DATA window, write 0xffff to clear the statistics
+    CMD_ADDRESS_PROF_DATA0      = 0x64,     // Profiling Data Window registers (r), page layout below; all zeroes if the firmware is built without PROFILING_ENABLED
+    CMD_ADDRESS_PROF_DATA7      = 0x6B,
+    CMD_ADDRESS_DYN_CTRL        = 0x6C,     // Dynamic Mode Control register (r/w); the CC mode alternates between level A and level B while enabled
+    CMD_ADDRESS_DYN_LEVEL_A     = 0x6D,     // Dynamic Mode Level A register (r/w) [mA]
+    CMD_ADDRESS_DYN_LEVEL_B     = 0x6E,     // Dynamic Mode Level B register (r/w) [mA]
+    CMD_ADDRESS_DYN_FREQ        = 0x6F,     // Dynamic Mode Frequency register (r/w) [Hz]
+    CMD_ADDRESS_DYN_DUTY        = 0x70,     // Dynamic Mode Duty Cycle register (r/w), time from the start of the rise to the start of the fall [0.1 %]
+    CMD_ADDRESS_DYN_RISE        = 0x71,     // Dynamic Mode Rise Slew register (r/w), slew rate from level A to level B [mA/us]; 0 -> single step
+    CMD_ADDRESS_DYN_FALL        = 0x72,     // Dynamic Mode Fall Slew register (r/w), slew rate from level B to level A [mA/us]; 0 -> single step
+    CMD_ADDRESS_SEQ_CTRL        = 0x73,     // Sequence Control register (r/w); the loop count and the stop condition are parameters (see param.h)
+    CMD_ADDRESS_SEQ_INDEX       = 0x74,     // Sequence Index register (r/w), table position of the next step written through SEQ_DATA
+    CMD_ADDRESS_SEQ_DATA        = 0x75,     // Sequence Data register (w), a step is written as 4 words: mode, level, duration low, duration high [ms]
+    CMD_ADDRESS_SEQ_TIME_L      = 0x76,     // Sequence Time register (r), time since the sequence start [ms]
+    CMD_ADDRESS_SEQ_TIME_H      = 0x77,
+    CMD_ADDRESS_MPPT_CTRL       = 0x78,     // MPPT Control register (r/w); the CC mode tracks the maximum power point while enabled, the settings are parameters (see param.h)
+    CMD_ADDRESS_MPPT_VOLTAGE    = 0x79,     // MPPT Voltage register (r), average voltage at the tracked point since the last update [10mV]
+    CMD_ADDRESS_MPPT_CURRENT    = 0x7A,     // MPPT Current register (r), average current at the tracked point [mA]
+    CMD_ADDRESS_MPPT_POWER      = 0x7B,     // MPPT Power register (r), average power at the tracked point [100mW]
+    CMD_ADDRESS_MPPT_EFFICIENCY = 0x7C,     // MPPT Efficiency register (r), average power over the highest window power since the last update [0.1 %]
+    CMD_ADDRESS_SEQ_STEP        = 0x7D,     // Sequence Step register (r), table position of the running step
 
 } cmd_register_t;
 
-#define CMD_REGISTER_COUNT ((CMD_ADDRESS_TOTAL_MWH_H) + 1)
+#define CMD_REGISTER_COUNT ((CMD_ADDRESS_SEQ_STEP) + 1)
+
+// the master reads one register per frame and the measurement can be updated between the frames; VOLTAGE, CURRENT and POWER of the same update are read as:
+// read MEAS_SEQ, read VOLTAGE, CURRENT and POWER, read MEAS_SEQ again; the values are consistent if both MEAS_SEQ reads are equal and even, otherwise repeat
 
 // returns true if the specified address is in the load's register space
 #define cmd_address_valid(address) (((address) < CMD_REGISTER_COUNT))
@@ -98,6 +160,190 @@ typedef enum {
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
+// measurement filter register fields; the filter stages are applied in this order: median -> CIC decimator -> IIR -> rounding
+typedef enum {
+
+    LOAD_FILTER_CIC_ORDER       = (3 <<  0),    // number of cascaded CIC integrator/comb stages; 1 -> boxcar average, 2-3 -> steeper CIC (0 is treated as 1)
+    LOAD_FILTER_DECIMATION      = (7 <<  4),    // log2 of the decimation ratio; 0 -> 1 ... 5 -> 32 input windows of VI_SENSE_WINDOW_MS per output
+    LOAD_FILTER_IIR_SHIFT       = (7 <<  8),    // first-order IIR time constant of 2^n output periods; 0 -> IIR disabled
+    LOAD_FILTER_MEDIAN          = (1 << 12),    // enable the 3-point median spike filter in front of the decimator
+    LOAD_FILTER_ROUNDING        = (1 << 13)     // round the results to 50mV/50mA (100mV/100mA above 5A)
+
+} load_filter_t;
+
+#define LOAD_FILTER_CIC_ORDER_POS       0
+#define LOAD_FILTER_DECIMATION_POS      4
+#define LOAD_FILTER_IIR_SHIFT_POS       8
+#define LOAD_FILTER_MAX_CIC_ORDER       3
+#define LOAD_FILTER_MAX_DECIMATION      5
+
+// measurement filter on startup; boxcar over 8 windows, IIR with a time constant of 2 outputs, rounding
+#define LOAD_DEFAULT_FILTER     ((1 << LOAD_FILTER_CIC_ORDER_POS) | (3 << LOAD_FILTER_DECIMATION_POS) | (1 << LOAD_FILTER_IIR_SHIFT_POS) | LOAD_FILTER_ROUNDING)
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// waveform capture control register fields
+typedef enum {
+
+    LOAD_CAPTURE_TRIGGER        = (7 <<  0),    // trigger source (load_capture_trigger_t)
+    LOAD_CAPTURE_FALLING        = (1 <<  3),    // level and edge triggers fire below the level (above the level if cleared)
+    LOAD_CAPTURE_CURRENT        = (1 <<  4),    // level and edge triggers compare the current (voltage if cleared)
+    LOAD_CAPTURE_STATE          = (3 <<  8),    // capture state (load_capture_state_t); ignored in write commands
+    LOAD_CAPTURE_ARM            = (1 << 15)     // write 1 to arm the capture with the new settings, write 0 to stop it
+
+} load_capture_ctrl_t;
+
+#define LOAD_CAPTURE_STATE_POS  8
+
+// waveform capture trigger sources
+typedef enum {
+
+    LOAD_CAPTURE_TRIGGER_FORCE  = 0x0,          // trigger as soon as the pre-trigger part of the buffer is filled
+    LOAD_CAPTURE_TRIGGER_LEVEL  = 0x1,          // trigger while the signal is beyond the level
+    LOAD_CAPTURE_TRIGGER_EDGE   = 0x2,          // trigger when the signal crosses the level
+    LOAD_CAPTURE_TRIGGER_ENABLE = 0x3,          // trigger when the load is enabled; an event before the pre-trigger part is filled shortens the pre-trigger part
+    LOAD_CAPTURE_TRIGGER_FAULT  = 0x4           // trigger when a new fault flag is raised; the same as the enable trigger
+
+} load_capture_trigger_t;
+
+// waveform capture states
+typedef enum {
+
+    LOAD_CAPTURE_IDLE           = 0x0,          // capture is stopped
+    LOAD_CAPTURE_ARMED          = 0x1,          // recording, waiting for the trigger
+    LOAD_CAPTURE_TRIGGERED      = 0x2,          // recording the post-trigger samples
+    LOAD_CAPTURE_DONE           = 0x3           // the buffer is complete and can be read
+
+} load_capture_state_t;
+
+// number of samples in the CAPTURE_DATA window; the master writes CAPTURE_INDEX and waits until it reads back the same index
+#define LOAD_CAPTURE_WINDOW_SAMPLES ((CMD_ADDRESS_CAPTURE_DATA7 - CMD_ADDRESS_CAPTURE_DATA0 + 1) / 2)
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// PID autotune states
+typedef enum {
+
+    LOAD_AUTOTUNE_IDLE          = 0x0,          // no autotune since the startup or the last one was aborted
+    LOAD_AUTOTUNE_RUNNING       = 0x1,          // the relay oscillates the ISET DAC around the operating point
+    LOAD_AUTOTUNE_DONE          = 0x2,          // new gains were computed and applied
+    LOAD_AUTOTUNE_FAILED        = 0x3           // no stable oscillation was found or the load was disabled; the gains are unchanged
+
+} load_autotune_state_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// profiling select register fields
+typedef enum {
+
+    LOAD_PROF_SELECT_POINT      = (0xff << 0),  // profiled handler or task (prof_point_t in profiling.h)
+    LOAD_PROF_SELECT_PAGE       = (3 <<  8)     // DATA window page (load_prof_page_t)
+
+} load_prof_select_t;
+
+#define LOAD_PROF_SELECT_PAGE_POS   8
+#define LOAD_PROF_RESET             0xffff      // PROF_SELECT value which clears the statistics
+
+// profiling DATA window pages; the times are in CPU cycles (CORE_CLOCK_FREQUENCY_HZ), 32bit values are split into the low and the high register
+typedef enum {
+
+    LOAD_PROF_PAGE_SUMMARY          = 0x0,      // DATA0-1 call count, DATA2-3 minimum, DATA4-5 maximum, DATA6-7 mean time
+    LOAD_PROF_PAGE_NESTING          = 0x1,      // DATA0-1 number of calls which interrupted another handler, DATA2 CPU load since the last reset [0.01 %]
+    LOAD_PROF_PAGE_HISTOGRAM_LOW    = 0x2,      // DATA0-7 histogram bins 0-7 (see PROF_HISTOGRAM_BINS), saturated at 0xffff
+    LOAD_PROF_PAGE_HISTOGRAM_HIGH   = 0x3       // DATA0-7 histogram bins 8-15
+
+} load_prof_page_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// dynamic mode control register bits
+typedef enum {
+
+    LOAD_DYNAMIC_ENABLE         = (1 << 0),     // alternate between level A and level B in the CC mode; the waveform starts with the load enable
+    LOAD_DYNAMIC_RUNNING        = (1 << 1),     // the waveform is running; ignored in write commands
+    LOAD_DYNAMIC_STRETCHED      = (1 << 2)      // the ramps don't fit the period and the frequency is lower than set; ignored in write commands
+
+} load_dynamic_ctrl_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// sequence control register bits
+typedef enum {
+
+    LOAD_SEQUENCE_RUN           = (1 << 0),     // write 1 to start the sequence from the first step, 0 to stop it; reads 1 while the sequence runs
+    LOAD_SEQUENCE_CLEAR         = (1 << 1),     // write 1 to stop the sequence and clear the step table
+    LOAD_SEQUENCE_DONE          = (1 << 2),     // the last run completed all loops; ignored in write commands
+    LOAD_SEQUENCE_CONDITION     = (1 << 3),     // the last run was ended by the stop condition; ignored in write commands
+    LOAD_SEQUENCE_ABORTED       = (1 << 4)      // the last run was stopped, or ended by a fault or a change of the load setting; ignored in write commands
+
+} load_sequence_ctrl_t;
+
+// mode word of a sequence step; the level word is in the units of the mode level register
+typedef enum {
+
+    LOAD_SEQUENCE_STEP_MODE     = (0x3 << 0),   // load_mode_t of the step
+    LOAD_SEQUENCE_STEP_OFF      = (1 << 2)      // the load is disabled for the step; the level is ignored
+
+} load_sequence_step_mode_t;
+
+// sequence stop conditions; checked while the load is enabled
+typedef enum {
+
+    LOAD_SEQUENCE_STOP_NONE = 0,
+    LOAD_SEQUENCE_STOP_VOLTAGE_BELOW,       // the load voltage dropped bellow the stop level [mV]
+    LOAD_SEQUENCE_STOP_VOLTAGE_ABOVE,       // the load voltage rose above the stop level [mV]
+    LOAD_SEQUENCE_STOP_CURRENT_BELOW,       // the load current dropped bellow the stop level [mA]
+    LOAD_SEQUENCE_STOP_CURRENT_ABOVE        // the load current rose above the stop level [mA]
+
+} load_sequence_stop_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// battery test control register bits
+typedef enum {
+
+    LOAD_BATTERY_RUN            = (1 << 0),     // write 1 to start the test, 0 to stop it; reads 1 while the test runs
+    LOAD_BATTERY_CUTOFF         = (1 << 1),     // the last test ended at the cutoff voltage; ignored in write commands
+    LOAD_BATTERY_ABORTED        = (1 << 2)      // the last test was stopped, or ended by a fault or a change of the load setting; ignored in write commands
+
+} load_battery_ctrl_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// I-V sweep control register bits
+typedef enum {
+
+    LOAD_SWEEP_RUN              = (1 << 0),     // write 1 to start the sweep, 0 to stop it; reads 1 while the sweep runs
+    LOAD_SWEEP_DONE             = (1 << 1),     // the last sweep measured all points; ignored in write commands
+    LOAD_SWEEP_ABORTED          = (1 << 2)      // the last sweep was stopped, or ended by a fault or a change of the load setting; ignored in write commands
+
+} load_sweep_ctrl_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// MPPT control register bits
+typedef enum {
+
+    LOAD_MPPT_ENABLE            = (1 << 0),     // track the maximum power point while the load is enabled in the CC mode
+    LOAD_MPPT_TRACKING          = (1 << 1)      // the tracker is running; ignored in write commands
+
+} load_mppt_ctrl_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// CC linearization control register bits
+typedef enum {
+
+    LOAD_LINEARIZE_RUN          = (1 << 0),     // write 1 to start the linearization, 0 to stop it; reads 1 while the linearization runs
+    LOAD_LINEARIZE_DONE         = (1 << 1),     // the last linearization fitted the ISET DAC calibration; ignored in write commands
+    LOAD_LINEARIZE_ABORTED      = (1 << 2),     // the last linearization was stopped, ended by a fault or a change of the load setting, or the fit failed; ignored in write commands
+    LOAD_LINEARIZE_SAVE         = (1 << 3),     // write 1 with RUN 0 to store the calibration in the flash; ignored while the load is enabled, reads 0
+    LOAD_LINEARIZE_REJECTED     = (1 << 4)      // the points of the last linearization were not monotonic or too far from their CC levels, the calibration was kept; ignored in write commands
+
+} load_linearize_ctrl_t;
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
 // fault flags
 typedef enum {
 
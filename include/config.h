@@ -54,11 +54,99 @@
 #define LOAD_NO_REG_CUMULATIVE_COUNTS       16   // NO_REG flag will be raised after n cumulative no reg events
 #define LOAD_FUSE_FAULT_CUMULATIVE_COUNTS   16  // FUSE fault will be triggered after n cumulative faults
 
+// dynamic mode; the CC load alternates between level A and level B at a set frequency and duty cycle with independent rise and fall slew rates
+#define LOAD_DYNAMIC_MIN_FREQUENCY_HZ   1       // [Hz]
+#define LOAD_DYNAMIC_MAX_FREQUENCY_HZ   20000   // [Hz]
+#define LOAD_DYNAMIC_MAX_SLEW           5000    // maximum ramp slew rate [mA/us]; 0 changes the level in a single DAC step
+
+#define LOAD_START_DYNAMIC_LEVEL_A_MA   1000    // dynamic mode settings on startup
+#define LOAD_START_DYNAMIC_LEVEL_B_MA   5000
+#define LOAD_START_DYNAMIC_FREQUENCY_HZ 100
+#define LOAD_START_DYNAMIC_DUTY         500     // [0.1 %]
+#define LOAD_START_DYNAMIC_SLEW         100     // [mA/us]
+
+// sequence mode; a table of (mode, level, duration) steps timed by the sample timer
+#define LOAD_SEQUENCE_MAX_STEPS         256     // length of the step table
+#define LOAD_SEQUENCE_MAX_LOOPS         65535   // maximum number of repetitions of the table; 0 repeats it until stopped
+
+// battery test; a CC, CR or CP discharge to a cutoff voltage with periodic DC internal resistance pulses, see the bat_* parameters
+#define BATTERY_UPDATE_PERIOD_MS        10      // period of the cutoff check [ms]
+#define BATTERY_IR_WINDOW_MS            10      // length of the averaging windows before the IR pulse and at its end [ms]
+#define BATTERY_LOG_RECORDS             512     // records in the log; a full log drops every other record and continues with a doubled interval
+
+#define BATTERY_DEFAULT_LEVEL           1000    // battery test settings on startup [mA, mOhm or mW]
+#define BATTERY_DEFAULT_CUTOFF_MV       3000    // [mV]
+#define BATTERY_DEFAULT_HYSTERESIS_MV   100     // the voltage has to rise this much above the cutoff to reset the cutoff timer [mV]
+#define BATTERY_DEFAULT_CUTOFF_MS       1000    // time the voltage has to stay under the cutoff [ms]
+#define BATTERY_DEFAULT_IR_INTERVAL_S   60      // [s]; 0 -> no IR measurement
+#define BATTERY_DEFAULT_IR_PULSE        100     // current increase of the IR pulse [% of the discharge current]
+#define BATTERY_DEFAULT_IR_PULSE_MS     100     // [ms]
+#define BATTERY_DEFAULT_LOG_INTERVAL_S  10      // [s]
+
+// I-V sweep; a CC or CV staircase from the start to the stop level measured by the block interrupt, see the sweep_* parameters
+#define LOAD_SWEEP_MAX_POINTS           256     // length of the result table
+
+#define LOAD_SWEEP_DEFAULT_POINTS       100     // sweep settings on startup
+#define LOAD_SWEEP_DEFAULT_DWELL_US     1000    // settling time of each point before the averaging [us]
+#define LOAD_SWEEP_DEFAULT_SAMPLES      64      // samples averaged at each point; rounded up to whole blocks (VI_SENSE_BLOCK_SIZE)
+
+// maximum power point tracking; perturbs the CC level from the block interrupt, see the mppt_* parameters
+#define LOAD_MPPT_DEFAULT_WINDOW        8       // blocks averaged after each perturbation (640us at the default sample rate)
+#define LOAD_MPPT_DEFAULT_MIN_STEP_MA   5       // the step is halved on every reversal of the direction down to the minimum [mA]
+#define LOAD_MPPT_DEFAULT_MAX_STEP_MA   500     // the step grows by half while the direction holds up to the maximum [mA]
+#define LOAD_MPPT_DEFAULT_MIN_MV        1000    // the current is only decreased below this voltage [mV]
+
+// CC accuracy; the linearization fits the ISET DAC calibration to the ISEN readback, the trim integrates the CC error in the load control task, see the lin_* and trim_* parameters
+#define LOAD_LINEARIZE_DEFAULT_MAX_MA   10000   // highest current of the linearization; the source has to deliver it [mA]
+#define LOAD_LINEARIZE_MAX_ERROR_MA     200     // a point measured further from its CC level than this bound and the relative one rejects the fit [mA]
+#define LOAD_LINEARIZE_MAX_ERROR        50      // relative bound of the point error; 50 is 5 % of the CC level [0.1 %]
+#define LOAD_CC_TRIM_DEFAULT_GAIN       16      // part of the CC error added to the trim every LOAD_CONTROL_UPDATE_PERIOD_MS [1/256]
+#define LOAD_CC_TRIM_DEFAULT_LIMIT_MA   200     // trim limit [mA]
+
 #define LOAD_CONTROL_UPDATE_PERIOD_MS   100     // time period for checking the OPP and OCP state and updating load statistics [ms]
 
+// the CV, CR and CP regulation runs from a timer independently of the sample rate; every update uses the latest sample of the last completed block
+// keep the rate at or below the block rate (sample rate / VI_SENSE_BLOCK_SIZE) so every update sees a new sample
+#define LOAD_CONTROL_LOOP_RATE_HZ       12500   // default control loop rate [Hz]
+#define LOAD_CONTROL_LOOP_MIN_RATE_HZ   500     // [Hz]
+#define LOAD_CONTROL_LOOP_MAX_RATE_HZ   50000   // [Hz]
+
+// PID gains of the CV, CR and CP modes in Q16 format (see pid.h); the output is in ISET DAC codes
+// the integral and derivative gains are applied per control loop update, so they scale with LOAD_CONTROL_LOOP_RATE_HZ
+// CV and CR errors are in [mV] (the CR error is V - I * R), the CP error is in [mW]; the derivative gains are applied to the process change per update
+#define LOAD_CV_PID_KP      PID_GAIN(1, 50)
+#define LOAD_CV_PID_KI      PID_GAIN(1, 100)
+#define LOAD_CV_PID_KD      0
+#define LOAD_CR_PID_KP      PID_GAIN(1, 50)
+#define LOAD_CR_PID_KI      PID_GAIN(1, 100)
+#define LOAD_CR_PID_KD      0
+#define LOAD_CP_PID_KP      PID_GAIN(1, 60)
+#define LOAD_CP_PID_KI      PID_GAIN(1, 250)
+#define LOAD_CP_PID_KD      0
+
+#define LOAD_PID_D_FILTER_SHIFT     2       // time constant of the derivative low-pass filter (2^n PID updates)
+#define LOAD_PID_MAX_GAIN           PID_GAIN(256, 1)    // highest gain accepted at runtime (the "param" and "pid" shell commands, the autotune)
+
+// CR and CP feedforward; the DAC is driven with V / R or P / V directly and the PID only trims the residual error
+// the low-pass keeps the feedforward stable with a source resistance up to ~7x the CR level (the V / R iteration diverges above 1x without it)
+#define LOAD_FEEDFORWARD_FILTER_SHIFT   2       // time constant of the feedforward low-pass filter (2^n PID updates)
+#define LOAD_FEEDFORWARD_HOLD_SHIFT     4       // the PID is held while the feedforward is more than 1/2^n away from its target
+
+// relay autotune of the CV, CR and CP PID
+#define LOAD_AUTOTUNE_RELAY_MA          500     // default relay amplitude of the "pid tune" shell command [mA]
+#define LOAD_AUTOTUNE_HYSTERESIS        20      // relay hysteresis [mV in CV and CR mode, mW in CP mode]
+#define LOAD_AUTOTUNE_SETTLE_PERIODS    2       // oscillation periods skipped before the measurement
+#define LOAD_AUTOTUNE_MEASURED_PERIODS  4       // oscillation periods averaged for the ultimate gain and period
+#define LOAD_AUTOTUNE_TIMEOUT_MS        2000    // the autotune fails if the oscillation doesn't complete in this time [ms]
+
 //---- ISET DAC --------------------------------------------------------------------------------------------------------------------------------------------------
 
-#define SLEW_LIMIT_AMPS_PER_SECOND  20      // load slew rate when changing CC level or enabling the load [A/S]
+#define SLEW_LIMIT_MA_PER_SECOND        20000   // default load slew rate of the current rise and fall when changing CC level or enabling the load [mA/s]
+#define SLEW_LIMIT_MIN_MA_PER_SECOND    100     // slew rate range accepted at runtime [mA/s]; the maximum ramps the full range in a single slew timer update
+#define SLEW_LIMIT_MAX_MA_PER_SECOND    (LOAD_MAX_CC_LEVEL_MA * ISET_DAC_TIMER_FREQUENCY)
+
+#define ISET_DAC_RAMP_PERIOD_US         10      // DAC update period of the waveform ramps (dynamic mode) [us]
+#define ISET_DAC_MIN_HOLD_US            10      // shortest hold of a waveform level; the ramps are stretched if they don't fit [us]
 
 //---- VOLTAGE AND CURRENT SENSE ---------------------------------------------------------------------------------------------------------------------------------
 
@@ -67,8 +155,43 @@
 
 #define INTERNAL_ISEN_MIN_CURRENT 50     // lowest measured current of a single current sink (samples less than this will be equal to 0 mA)
 
+// number of internal ADC scans averaged by internal_adc_read() (power of 2, max 16); one scan of all channels takes 123us
+#define INTERNAL_ADC_OVERSAMPLING   16
+
 #define VI_SENSE_AUTO_VSENSRC_THRESHOLD_MV    100   // threshold meassured voltage for automatic switching of VSEN source [mV]
 
+#define VI_SENSE_SAMPLE_RATE_HZ     100000      // VSEN and ISEN ADC sample rate on startup [Hz]
+#define VI_SENSE_MIN_SAMPLE_RATE_HZ 1000        // minimum selectable sample rate [Hz]
+#define VI_SENSE_MAX_SAMPLE_RATE_HZ 250000      // maximum selectable sample rate [Hz]
+
+// number of samples per DMA block; the samples are processed and the PID is updated once per block
+// larger blocks save CPU time but add latency to the control loop (VI_SENSE_BLOCK_SIZE / VI_SENSE_SAMPLE_RATE_HZ; 80us with the default values)
+#define VI_SENSE_BLOCK_SIZE         8
+
+// the blocks completed during one window are averaged and fed into the measurement filter (see the FILTER register)
+#define VI_SENSE_WINDOW_MS          5
+
+// sample rate while the load is disabled; one block per window keeps the measurement running without a sample timer interrupt every 10 us [Hz]
+#define VI_SENSE_IDLE_SAMPLE_RATE_HZ    (VI_SENSE_BLOCK_SIZE * 1000 / VI_SENSE_WINDOW_MS)
+
+// number of piecewise-linear calibration segments per channel (power of 2)
+#define CALIBRATION_SEGMENTS        8
+#define CALIBRATION_MAX_POINTS      16      // maximum number of reference points collected for a calibration fit
+
+// number of raw voltage and current samples held by the waveform capture buffer (power of 2; 4 bytes per sample)
+#define VI_SENSE_CAPTURE_DEPTH      4096
+
+//---- TELEMETRY -------------------------------------------------------------------------------------------------------------------------------------------------
+
+#define TELEMETRY_MIN_RATE_HZ       20      // minimum telemetry sample rate (the timer reload is 16bit) [Hz]
+#define TELEMETRY_MAX_RATE_HZ       10000   // maximum telemetry sample rate; the UART bandwidth may limit the rate further [Hz]
+#define TELEMETRY_BUFFER_SAMPLES    64      // number of samples waiting for the transmission (power of 2); the samples are dropped when the buffer is full
+#define TELEMETRY_TX_BUFFER_SIZE    512     // size of each of the two DMA transmit buffers [bytes]
+
+//---- PROFILING -------------------------------------------------------------------------------------------------------------------------------------------------
+
+#define PROFILING_ENABLED   0       // time the interrupts and tasks with the DWT cycle counter (the "prof" shell command and the PROF registers); adds ~40 cycles per interrupt
+
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
 
 #endif /* _CONFIG_H_ */
\ No newline at end of file
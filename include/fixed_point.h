@@ -0,0 +1,48 @@
+#ifndef _FIXED_POINT_H_
+#define _FIXED_POINT_H_
+
+/*
+ *  64bit integer helpers
+ *  Martin Kopka 2024
+ *
+ *  The firmware is linked without the compiler runtime library, so 64bit divisions have to be done in software
+ *  the division is a plain shift-subtract loop; use it only outside of the interrupts and the control loop
+ */
+
+#include "common_defs.h"
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// unsigned 64bit division
+static inline uint64_t div_u64(uint64_t numerator, uint64_t denominator) {
+
+    uint64_t quotient = 0, remainder = 0;
+
+    for (int i = 63; i >= 0; i--) {
+
+        remainder = (remainder << 1) | ((numerator >> i) & 1);
+
+        if (remainder >= denominator) {
+
+            remainder -= denominator;
+            quotient |= (1ULL << i);
+        }
+    }
+
+    return (quotient);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// signed 64bit division; the quotient is rounded towards zero
+static inline int64_t div_s64(int64_t numerator, int64_t denominator) {
+
+    bool negative = (numerator < 0) != (denominator < 0);
+    uint64_t quotient = div_u64((numerator < 0) ? -numerator : numerator, (denominator < 0) ? -denominator : denominator);
+
+    return (negative ? -(int64_t)quotient : (int64_t)quotient);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _FIXED_POINT_H_ */
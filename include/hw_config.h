@@ -6,6 +6,12 @@
 #define HSE_OSC_FREQUENCY_HZ    25000000        // High Speed External oscillator frequency [Hz]
 #define CORE_CLOCK_FREQUENCY_HZ 96000000        // core clock frequency [Hz]
 
+//---- SCALING ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// x * num / den rounded down without a run-time division (for 0 <= x < 2^32 / den); num and den must be constants
+// the integer part of num / den is a plain multiplication, the remainder is a 0.32 fixed-point fraction generated at compile time (one UMULL instruction)
+#define SCALE_RATIO(x, num, den)    ((uint32_t)(x) * ((num) / (den)) + (uint32_t)(((uint64_t)(uint32_t)(x) * ((((uint64_t)((num) % (den)) << 32) + (den) - 1) / (den))) >> 32))
+
 //---- DEBUG UART ------------------------------------------------------------------------------------------------------------------------------------------------
 
 #define DEBUG_UART              USART1
@@ -13,6 +19,22 @@
 #define DEBUG_UART_TX_GPIO      GPIOB, 6
 #define DEBUG_UART_RX_GPIO      GPIOB, 7
 
+//---- TELEMETRY -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// the telemetry stream takes over the DEBUG_UART transmitter; USART1_TX request is mapped to DMA2 stream 7 channel 4
+#define TELEMETRY_UART_BAUD     921600                                      // DEBUG_UART baud rate while streaming (PCLK2 = 96MHz, 0.16% error)
+
+#define TELEMETRY_DMA_CLOCK     RCC_PERIPH_AHB1_DMA2
+#define TELEMETRY_DMA           DMA2
+#define TELEMETRY_DMA_STREAM    DMA2_Stream7
+#define TELEMETRY_DMA_CHANNEL   4
+
+// the timer paces the telemetry samples
+#define TELEMETRY_TIMER                 TIM11
+#define TELEMETRY_TIMER_IRQ             TIM1_TRG_COM_TIM11_IRQn
+#define TELEMETRY_TIMER_IRQ_HANDLER     TIM1_TRG_COM_TIM11_Handler
+#define TELEMETRY_TIMER_FREQUENCY       1000000                             // timer count frequency [Hz]
+
 //---- LEDS ------------------------------------------------------------------------------------------------------------------------------------------------------
 
 // green LED
@@ -57,19 +79,48 @@
 #define ISET_DAC_TIMER                  TIM9
 #define ISET_DAC_TIMER_IRQ              TIM1_BRK_TIM9_IRQn
 #define ISET_DAC_TIMER_IRQ_HANDLER      TIM1_BRK_TIM9_Handler
-#define ISET_DAC_TIMER_FREQUENCY        1000
-
-#define ISET_DAC_LSB_PER_MA(i_ma)       (-14919 * (int32_t)(i_ma) / 10000)
+#define ISET_DAC_TIMER_FREQUENCY        10000       // update rate of the slew limited ramps [Hz]
+#define ISET_DAC_WAVEFORM_TIMER_FREQUENCY   1000000     // counter frequency of the timer while it runs a waveform; the phase lengths are in timer ticks [Hz]
+
+// the ramps step in the timer interrupt, not from a DMA table: TIM9 has no DMA requests, and each code needs an SS pulse around its frame (the DAC latches the
+// code at the SS rising edge); the only free timer requests on DMA2 are TIM1_CH4 (stream 4) and TIM1_UP (stream 5), paced by the sample timer
+
+// the non-blocking writes are moved to the SPI by the DMA; SPI1_TX request is mapped to DMA2 stream 5 channel 3
+// the SPI RXNE interrupt marks the end of the frame and releases SS
+#define ISET_DAC_DMA_CLOCK              RCC_PERIPH_AHB1_DMA2
+#define ISET_DAC_DMA                    DMA2
+#define ISET_DAC_DMA_STREAM             DMA2_Stream5
+#define ISET_DAC_DMA_CHANNEL            3
+#define ISET_DAC_SPI_IRQ                SPI1_IRQn
+#define ISET_DAC_SPI_IRQ_HANDLER        SPI1_Handler
+
+#define ISET_DAC_LSB_PER_MA(i_ma)       (-(int32_t)SCALE_RATIO(i_ma, 14919, 10000))
 #define ISET_DAC_MA_TO_CODE(i_ma)       (ISET_DAC_LSB_PER_MA(i_ma) + 62647)
 #define ISET_DAC_ZERO_LEVEL_CODE        62430
 
+//---- CONTROL LOOP ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// the timer paces the CV, CR and CP regulation; the handler is in vi_sense-acquisition.c (the sample timer doesn't use the shared update interrupt)
+#define LOAD_CONTROL_TIMER              TIM10
+#define LOAD_CONTROL_TIMER_CLOCK        RCC_PERIPH_APB2_TIM10
+#define LOAD_CONTROL_TIMER_IRQ          TIM1_UP_TIM10_IRQn
+#define LOAD_CONTROL_TIMER_IRQ_HANDLER  TIM1_UP_TIM10_Handler
+#define LOAD_CONTROL_TIMER_FREQUENCY    12000000                            // timer count frequency [Hz]
+
 //---- VSEN ADC --------------------------------------------------------------------------------------------------------------------------------------------------
 
 #define VSEN_ADC_SPI            SPI5
 #define VSEN_ADC_SPI_CLOCK      RCC_PERIPH_APB2_SPI5
 #define VSEN_ADC_SPI_DIV        SPI_DIV_4                                   // PCLK2 = 96MHz, 96MHz / 4 = 24MHz
 #define VSEN_ADC_GPIO_AF        GPIO_ALTERNATE_FUNCTION_SPI2_SPI3_SPI4_SPI5
-#define VSEN_ADC_SPI_HANDLER    SPI5_Handler
+
+// SPI5_RX request is mapped to DMA2 stream 3 channel 2
+#define VSEN_ADC_DMA_CLOCK          RCC_PERIPH_AHB1_DMA2
+#define VSEN_ADC_DMA                DMA2
+#define VSEN_ADC_DMA_STREAM         DMA2_Stream3
+#define VSEN_ADC_DMA_CHANNEL        2
+#define VSEN_ADC_DMA_IRQ            DMA2_Stream3_IRQn
+#define VSEN_ADC_DMA_IRQ_HANDLER    DMA2_Stream3_Handler
 
 #define VSEN_ADC_SPI_SS_GPIO_CLOCK      RCC_PERIPH_AHB1_GPIOB
 #define VSEN_ADC_SPI_SS_GPIO            GPIOB, 1
@@ -83,8 +134,8 @@
 #define VSEN_SRC_GPIO_CLOCK             RCC_PERIPH_AHB1_GPIOB
 #define VSEN_SRC_GPIO                   GPIOB, 2
 
-#define VSEN_ADC_CODE_TO_MV_INT(code)   (((int32_t)(code) * 516 / 25) - 91)
-#define VSEN_ADC_CODE_TO_MV_REM(code)   (((int32_t)(code) * 2069 / 100) - 91)
+#define VSEN_ADC_CODE_TO_MV_INT(code)   ((int32_t)SCALE_RATIO(code, 516, 25) - 91)
+#define VSEN_ADC_CODE_TO_MV_REM(code)   ((int32_t)SCALE_RATIO(code, 2069, 100) - 91)
 
 //---- ISEN ADC --------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -93,8 +144,14 @@
 #define ISEN_ADC_SPI_DIV        SPI_DIV_2                                   // PCLK1 = 48MHz, 48MHz / 2 = 24MHz
 #define ISEN_ADC_GPIO_AF        GPIO_ALTERNATE_FUNCTION_SPI1_SPI2_SPI3
 
+// SPI2_RX request is mapped to DMA1 stream 3 channel 0
+#define ISEN_ADC_DMA_CLOCK          RCC_PERIPH_AHB1_DMA1
+#define ISEN_ADC_DMA                DMA1
+#define ISEN_ADC_DMA_STREAM         DMA1_Stream3
+#define ISEN_ADC_DMA_CHANNEL        0
+
 #define ISEN_ADC_SPI_SS_GPIO_CLOCK      RCC_PERIPH_AHB1_GPIOB
-#define ISEN_ADC_SPI_SS_GPIO            GPIOB, 12
+#define ISEN_ADC_SPI_SS_GPIO            GPIOB, 12                           // on the port of the VSEN SS pin; both are switched by one BSRR write
 #define ISEN_ADC_SPI_SCK_GPIO_CLOCK     RCC_PERIPH_AHB1_GPIOB
 #define ISEN_ADC_SPI_SCK_GPIO           GPIOB, 13
 #define ISEN_ADC_SPI_MISO_GPIO_CLOCK    RCC_PERIPH_AHB1_GPIOB
@@ -103,7 +160,30 @@
 #define ISEN_ADC_CONVST_GPIO_CLOCK      RCC_PERIPH_AHB1_GPIOB
 #define ISEN_ADC_CONVST_GPIO            GPIOB, 15
 
-#define ISEN_ADC_CODE_TO_MA(code)   (((int32_t)(code) * 1075 / 100) - 50)
+#define ISEN_ADC_CODE_TO_MA(code)   ((int32_t)SCALE_RATIO(code, 1075, 100) - 50)
+
+//---- VI SENSE SAMPLE TIMER -------------------------------------------------------------------------------------------------------------------------------------
+
+// the timer paces the conversions of both AD7091R ADCs; each update event starts one simultaneous conversion of the VSEN and ISEN ADC
+// and the CH4 compare event frames the read of both results
+#define VI_SENSE_SAMPLE_TIMER               TIM1
+#define VI_SENSE_SAMPLE_TIMER_CLOCK         RCC_PERIPH_APB2_TIM1
+#define VI_SENSE_SAMPLE_TIMER_IRQ           TIM1_CC_IRQn
+#define VI_SENSE_SAMPLE_TIMER_IRQ_HANDLER   TIM1_CC_Handler
+#define VI_SENSE_SAMPLE_TIMER_FREQUENCY     12000000        // timer count frequency [Hz]
+
+// the ISEN CONVST pin is the TIM1_CH3N output; CH3 in PWM mode 2 holds it low from the update event until the CH3 compare event
+// the VSEN CONVST pin has no timer output; the CH1 and CH2 compare events request one DMA stream that writes a circular table of two GPIO BSRR values
+#define ISEN_ADC_CONVST_GPIO_AF             GPIO_ALTERNATE_FUNCTION_TIM1_TIM2
+#define VSEN_ADC_CONVST_DMA_STREAM          DMA2_Stream6    // TIM1_CH1, TIM1_CH2 and TIM1_CH3 requests (CH3 doesn't request the DMA)
+#define VSEN_ADC_CONVST_DMA_CHANNEL         0
+
+#define VI_SENSE_CONVST_PULSE_TICKS         4               // !CONVST low pulse width (333ns; must end before the conversion is done, the DMA serves CH1 before CH2)
+#define VI_SENSE_READ_TICKS                 18              // the read is framed after the conversion start (1.5us; AD7091R conversion time is 650ns)
+
+// the read is framed by the CH4 interrupt, not by the DMA: with both SS edges and both SPI data register writes, the DMA would need four more TIM1 requests per
+// sample, but only CH4 (DMA2 stream 4 channel 6) and the update (DMA2 stream 5 channel 6, used by the ISET DAC) are left;
+// the CH1 and CH2 requests are taken by the VSEN CONVST stream and the CH3 request only maps to stream 6
 
 //---- POWER BOARD ENABLE GPIOS ----------------------------------------------------------------------------------------------------------------------------------
 
@@ -113,6 +193,18 @@
 #define LOAD_EN_R_GPIO_CLOCK    RCC_PERIPH_AHB1_GPIOC
 #define LOAD_EN_R_GPIO          GPIOC, 2
 
+//---- INTERNAL ADC ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// the internal ADC scans the current sink and temperature sensor channels continuously; the DMA moves the results into a circular buffer
+#define INTERNAL_ADC                ADC1
+#define INTERNAL_ADC_CLOCK          RCC_PERIPH_APB2_ADC1
+#define INTERNAL_ADC_SAMPLE_TIME    7                               // 480 cycles; ADCCLK = PCLK2 / 4 = 24MHz, 20.5us per conversion
+
+#define INTERNAL_ADC_DMA_CLOCK      RCC_PERIPH_AHB1_DMA2
+#define INTERNAL_ADC_DMA            DMA2
+#define INTERNAL_ADC_DMA_STREAM     DMA2_Stream0
+#define INTERNAL_ADC_DMA_CHANNEL    0
+
 //---- INTERNAL ADC CURRENT SENSE --------------------------------------------------------------------------------------------------------------------------------
 
 #define ISEN_L1_GPIO_CLOCK      RCC_PERIPH_AHB1_GPIOA
@@ -131,7 +223,7 @@
 #define ISEN_R2_GPIO            GPIOA, 2
 #define ISEN_R2_ADC_CH          2
 
-#define ISEN_INT_ADC_CODE_TO_MA(code)     (((int32_t)(code) * 2762 / 1000) - 12)
+#define ISEN_INT_ADC_CODE_TO_MA(code)     ((int32_t)SCALE_RATIO(code, 2762, 1000) - 12)
 
 //---- POWER TRANSISTOR TEMPERATURE SENSORS ----------------------------------------------------------------------------------------------------------------------
 
@@ -143,7 +235,6 @@
 #define TEMP_SEN_R_GPIO         GPIOC, 0
 #define TEMP_SEN_R_ADC_CH       10
 
-#define TEMP_SEN_READ_ATTEMPTS      3
 #define TEMP_SEN_OPEN_THRESHOLD     30
 #define TEMP_SEN_SHORT_THRESHOLD    30
 
@@ -174,6 +265,12 @@
 #define FAN_TACH_PULSES_PER_ROTATION        2           // number of FAN_TACH pin pulses per rotation
 #define FAN_TACH_NO_ROTATION_DETECT_TIME    150         // if the last FAN_TACH pulse is older than this time [ms]. The measurement logic will evaluate this as no fan rotation
 
+//---- CALIBRATION STORAGE ---------------------------------------------------------------------------------------------------------------------------------------
+
+// the calibration is kept in the last 128kB flash sector; the firmware image must not reach into it
+#define CALIBRATION_FLASH_SECTOR    7
+#define CALIBRATION_FLASH_ADDRESS   0x08060000
+
 //---- EXTERNAL FAULT PIN ----------------------------------------------------------------------------------------------------------------------------------------
 
 #define EXT_FAULT_GPIO_CLOCK    RCC_PERIPH_AHB1_GPIOA
@@ -0,0 +1,41 @@
+#ifndef _INTERNAL_ADC_H_
+#define _INTERNAL_ADC_H_
+
+/*
+ *  Internal ADC scan driver
+ *  Martin Kopka 2024
+ *
+ *  The ADC converts the current sink and temperature sensor channels in a continuous scan
+ *  the DMA moves the results into a circular buffer holding the last INTERNAL_ADC_OVERSAMPLING scans
+ *  the readers average the buffer without waiting for a conversion, so the current sense and temperature tasks never block on the ADC
+ */
+
+#include "common_defs.h"
+
+//---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// channels in the scan order
+typedef enum {
+
+    INTERNAL_ADC_ISEN_L1 = 0,
+    INTERNAL_ADC_ISEN_L2,
+    INTERNAL_ADC_ISEN_R1,
+    INTERNAL_ADC_ISEN_R2,
+    INTERNAL_ADC_TEMP_L,
+    INTERNAL_ADC_TEMP_R,
+
+    INTERNAL_ADC_CHANNEL_COUNT
+
+} internal_adc_channel_t;
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// initializes the analog inputs, starts the continuous scan and waits until the result buffer is filled
+void internal_adc_init(void);
+
+// returns the average ADC code of the last INTERNAL_ADC_OVERSAMPLING conversions of a channel with 4 fractional bits
+uint32_t internal_adc_read(internal_adc_channel_t channel);
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _INTERNAL_ADC_H_ */
@@ -20,10 +20,7 @@ typedef enum {
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
-// initializes the ADC for internal current sensing
-void internal_isen_init(void);
-
-// measures current of a individual current sink [mA]
+// measures current of a individual current sink [mA]; returns the average of the latest internal ADC scans without waiting for a conversion
 uint16_t internal_isen_read(internal_isen_t current_sink);
 
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
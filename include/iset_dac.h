@@ -10,11 +10,33 @@
  *  DAC settling time 1us
  *  DAC maximum SPI frequency: 50MHz
  *  https://cz.mouser.com/datasheet/2/609/26412fd-3125252.pdf
+ *
+ *  The slew timer either ramps the DAC to a new static level or runs a two-level waveform (dynamic mode); the waveform phases are timed by the timer reload
+ *  so the holds cost a single interrupt and only the ramps update the DAC every ISET_DAC_RAMP_PERIOD_US
+ *  the static ramps advance a Q16 code at ISET_DAC_TIMER_FREQUENCY with separate rise and fall rates and hand each code to the DMA without waiting for the frame;
+ *  SS is a GPIO which has to pulse for every code and TIM9 has no DMA request, so a timer paced DMA stream of the whole ramp is not possible on this board
+ *
+ *  All writes (tasks, control loop, block interrupt, slew timer) go through a single DMA path: a write starts a frame if the bus is idle, otherwise it leaves
+ *  the code in a one-deep mailbox which the SPI end-of-frame interrupt sends next; a newer code replaces the waiting one, so no writer waits for the bus
  */
 
 #include "common_defs.h"
 #include "hal/spi.h"
 
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// two-level waveform; a period is the rise from level A to level B, the hold at B, the fall back to A and the hold at A
+typedef struct {
+
+    uint16_t code_a;            // DAC codes of the two levels
+    uint16_t code_b;
+    uint16_t rise_step;         // DAC code change per ramp update from A to B; 0 changes the level in a single step
+    uint16_t fall_step;         // DAC code change per ramp update from B to A
+    uint32_t high_us;           // hold time at level B after the rise [us]
+    uint32_t low_us;            // hold time at level A after the fall [us]
+
+} iset_dac_waveform_t;
+
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
 // initializes the SPI communication with the I_SET DAC and sets it to the 0A current level
@@ -23,23 +45,40 @@ void iset_dac_init(void);
 // sets the I_SET DAC output voltage to the corresponding current value
 void iset_dac_set_current(uint32_t current_ma, bool slew_limit);
 
-// writes the specified 16bit code to the ISET_DAC
-void iset_dac_write_code(uint16_t code);
+// returns the calibrated DAC code of a current; the CC trim offset is included
+uint16_t iset_dac_current_to_code(uint32_t current_ma);
 
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// sets the offset added to the currents converted to DAC codes [mA]; the code already written is not changed
+void iset_dac_set_trim(int32_t offset_ma);
 
-// writes the specified 16bit code to the ISET_DAC (doesn't wait for the end of transmission and leaves the SS pin HIGH)
-static inline void iset_dac_write_code_non_blocking(uint16_t code) {
+// returns the offset added to the currents converted to DAC codes [mA]
+int32_t iset_dac_get_trim(void);
 
-    gpio_write(ISET_DAC_SPI_SS_GPIO, LOW);
-    spi_write(ISET_DAC_SPI, code);
-}
+// writes the specified 16bit code to the ISET_DAC by the DMA without waiting for the frame; SS is released by the SPI interrupt at the end of the frame
+// a code written during a frame waits in the mailbox and is replaced by any newer code, so the last written code always reaches the DAC
+void iset_dac_write_code(uint16_t code);
+
+// returns the most recent code sent to the ISET_DAC
+uint16_t iset_dac_get_code(void);
 
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// returns the number of codes written to the ISET_DAC (wraps around)
+uint32_t iset_dac_get_write_count(void);
 
 // returns true if the ISET_DAC is in a slew limited transient
 bool iset_dac_is_in_transient(void);
 
+// starts a two-level waveform; the DAC ramps from its present code to level A with the fall slew and the first period starts after the hold at level A
+void iset_dac_start_waveform(const iset_dac_waveform_t *waveform);
+
+// changes the running waveform at the start of the next period (before the rise to level B)
+void iset_dac_update_waveform(const iset_dac_waveform_t *waveform);
+
+// stops the waveform and returns the slew timer to the static ramps; the DAC keeps the last code
+void iset_dac_stop_waveform(void);
+
+// returns true while a waveform is running
+bool iset_dac_is_waveform_running(void);
+
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
 
 #endif /* _ISET_DAC_H_ */
\ No newline at end of file
@@ -3,6 +3,112 @@
 
 #include "common_defs.h"
 #include "cmd_spi_driver.h"
+#include "pid.h"
+
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// dynamic mode settings and state
+typedef struct {
+
+    bool enabled;               // the CC mode alternates between level A and level B
+    bool running;               // the waveform is running
+    bool stretched;             // the ramps don't fit the period and the frequency is lower than set
+    uint32_t level_a_ma;
+    uint32_t level_b_ma;
+    uint32_t frequency_hz;
+    uint32_t duty_permille;     // time from the start of the rise to the start of the fall [0.1 %]
+    uint32_t rise_slew;         // [mA/us]; 0 -> single step
+    uint32_t fall_slew;
+
+} load_dynamic_config_t;
+
+// step of the load sequence
+typedef struct {
+
+    uint16_t mode;              // load_sequence_step_mode_t
+    uint32_t level;             // level of the step mode [mA, mV, mOhm or mW]
+    uint32_t duration_ms;
+
+} load_sequence_step_t;
+
+// state of the load sequence
+typedef struct {
+
+    bool running;
+    uint16_t result;            // LOAD_SEQUENCE_DONE, LOAD_SEQUENCE_CONDITION or LOAD_SEQUENCE_ABORTED after the sequence ended; 0 while running
+    uint32_t length;            // number of steps in the table
+    uint32_t step;              // running step
+    uint32_t loop;              // completed repetitions of the table
+    uint32_t elapsed_ms;        // time since the sequence start
+    uint32_t step_elapsed_ms;   // time since the start of the running step
+
+} load_sequence_state_t;
+
+// record of the battery test log
+typedef struct {
+
+    uint16_t voltage;           // [10mV]
+    uint16_t current_ma;
+    uint16_t charge_mah;        // charge since the test start; saturates at 0xffff
+    uint16_t energy_mwh;        // energy since the test start; saturates at 0xffff
+    uint16_t ir;                // last internal resistance measurement [0.1 mOhm]; 0 -> not measured yet
+
+} load_battery_record_t;
+
+// state of the battery test
+typedef struct {
+
+    bool running;
+    uint16_t result;            // LOAD_BATTERY_CUTOFF or LOAD_BATTERY_ABORTED after the test ended; 0 while running
+    uint32_t elapsed_s;         // duration of the test
+    uint32_t ir;                // last internal resistance measurement [0.1 mOhm]
+    uint32_t log_count;         // number of records in the log
+    uint32_t log_period_s;      // time between the log records
+
+} load_battery_state_t;
+
+// point of the I-V sweep result table; the averages are taken over the samples after the dwell
+typedef struct {
+
+    uint32_t setpoint;          // CC or CV level of the point [mA or mV]
+    uint32_t voltage_mv;
+    uint32_t current_ma;
+    uint32_t power_mw;          // average of the block power
+
+} load_sweep_point_t;
+
+// state of the I-V sweep
+typedef struct {
+
+    bool running;
+    uint16_t result;            // LOAD_SWEEP_DONE or LOAD_SWEEP_ABORTED after the sweep ended; 0 while running
+    uint32_t points;            // number of measured points in the result table
+    uint32_t duration_us;       // time from the start of the first point to the end of the last measured one
+
+} load_sweep_state_t;
+
+// state of the maximum power point tracker; the averages are taken since the last update of the MPPT registers (LOAD_CONTROL_UPDATE_PERIOD_MS)
+typedef struct {
+
+    bool enabled;
+    bool tracking;              // the load is enabled in the CC mode and the tracker perturbs the CC level
+    uint32_t voltage_mv;
+    uint32_t current_ma;
+    uint32_t power_mw;
+    uint32_t efficiency;        // average power over the highest window power [0.1 %]
+    uint32_t step_ma;           // present perturbation step
+
+} load_mppt_state_t;
+
+// state of the CC linearization and the CC trim
+typedef struct {
+
+    bool running;
+    uint16_t result;            // LOAD_LINEARIZE_DONE, LOAD_LINEARIZE_REJECTED or LOAD_LINEARIZE_ABORTED after the linearization ended; 0 while running
+    uint32_t points;            // measured calibration points
+    int32_t trim_ma;            // offset added to the CC level by the trim
+
+} load_linearize_state_t;
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -42,6 +148,139 @@ void load_set_fault_mask(load_fault_t mask);
 // sets the ready flag in the status register
 void load_set_ready(bool ready);
 
+// sets the control loop rate of the CV, CR and CP regulation; returns false if the rate is out of range
+bool load_set_control_rate(uint32_t rate_hz);
+
+// returns the control loop rate of the CV, CR and CP regulation [Hz]
+uint32_t load_get_control_rate(void);
+
+// sets the PID gains of the CV, CR or CP mode; a running regulation switches to the new gains without a bump in the output
+// the gains are clamped to the limits of their parameters
+void load_set_pid_gains(load_mode_t mode, const pid_gains_t *gains);
+
+// returns the PID gains of the CV, CR or CP mode
+void load_get_pid_gains(load_mode_t mode, pid_gains_t *gains);
+
+// starts the PID autotune of the running CV, CR or CP regulation; the relay oscillates the load current by +-amplitude_ma around the operating point
+// returns false if the load is not regulating in CV, CR or CP mode or the operating point is too close to the current limits
+bool load_autotune_start(uint32_t amplitude_ma);
+
+// aborts a running autotune; the PID continues from the operating point with the previous gains
+void load_autotune_abort(void);
+
+// returns the state of the last autotune
+load_autotune_state_t load_autotune_get_state(void);
+
+// returns the state of the last autotune and the measured ultimate period [us] and oscillation amplitude [mV or mW]
+load_autotune_state_t load_autotune_get_result(uint32_t *period_us, uint32_t *amplitude);
+
+// enables or disables the dynamic mode; the CC mode alternates between level A and level B instead of the CC level
+// a change stops a running sequence, battery test, sweep or linearization
+void load_set_dynamic_enable(bool enable);
+
+// sets level A or level B of the dynamic mode [mA]
+void load_set_dynamic_level(bool level_b, uint32_t current_ma);
+
+// sets the frequency of the dynamic mode [Hz]
+void load_set_dynamic_frequency(uint32_t frequency);
+
+// sets the duty cycle of the dynamic mode; the time from the start of the rise to the start of the fall [0.1 %]
+void load_set_dynamic_duty(uint32_t duty);
+
+// sets the rise (level A to B) or fall (level B to A) slew rate of the dynamic mode [mA/us]; 0 changes the level in a single step
+void load_set_dynamic_slew(bool fall, uint32_t slew);
+
+// returns the dynamic mode settings and state
+void load_get_dynamic_config(load_dynamic_config_t *config);
+
+// writes a step into the sequence table; the table grows by appending at its end; returns false if the position is out of the table or the sequence runs
+bool load_sequence_set_step(uint32_t index, const load_sequence_step_t *step);
+
+// reads a step from the sequence table; returns false if the position is out of the table
+bool load_sequence_get_step(uint32_t index, load_sequence_step_t *step);
+
+// stops the sequence and clears the step table
+void load_sequence_clear(void);
+
+// starts the sequence from the first step; returns false if the table is empty or the load can't be enabled
+bool load_sequence_start(void);
+
+// stops the sequence; the load keeps the setting of the running step
+void load_sequence_stop(void);
+
+// returns the state of the sequence
+void load_sequence_get_state(load_sequence_state_t *state);
+
+// starts the battery test with the bat_* parameters; returns false if the discharge mode is invalid, the dynamic mode or the MPPT is enabled for a CC test or the load can't be enabled
+bool load_battery_start(void);
+
+// stops the battery test and disables the load
+void load_battery_stop(void);
+
+// returns the state of the battery test
+void load_battery_get_state(load_battery_state_t *state);
+
+// reads a record of the battery test log (0 is the record of the test start); returns false if the index is out of the log
+bool load_battery_get_record(uint32_t index, load_battery_record_t *record);
+
+// loads a record of the battery test log into the BAT_LOG_DATA window; an index out of the log loads zeroes
+void load_battery_load_window(uint32_t index);
+
+// starts the I-V sweep with the sweep_* parameters; returns false if the mode is invalid or the load can't be enabled
+bool load_sweep_start(void);
+
+// stops the I-V sweep; the load keeps the level of the last point
+void load_sweep_stop(void);
+
+// returns the state of the I-V sweep
+void load_sweep_get_state(load_sweep_state_t *state);
+
+// reads a point of the I-V sweep result table; returns false if the point is not measured
+bool load_sweep_get_point(uint32_t index, load_sweep_point_t *point);
+
+// loads a point of the I-V sweep result table into the SWEEP_DATA window; an index out of the table loads zeroes
+void load_sweep_load_window(uint32_t index);
+
+// enables or disables the maximum power point tracking; the CC level follows the tracker while the load is enabled in the CC mode
+// a change stops a running sequence, battery test, sweep or linearization
+void load_set_mppt_enable(bool enable);
+
+// returns the state of the maximum power point tracker
+void load_get_mppt_state(load_mppt_state_t *state);
+
+// starts the CC linearization up to the lin_max_ma parameter; returns false if the dynamic mode or the MPPT is enabled or the load can't be enabled
+bool load_linearize_start(void);
+
+// stops the CC linearization and disables the load; the calibration is not changed
+void load_linearize_stop(void);
+
+// stores the ISET DAC calibration in the flash; returns false if the load is enabled or the flash write failed
+bool load_linearize_save(void);
+
+// returns the state of the CC linearization and the CC trim
+void load_linearize_get_state(load_linearize_state_t *state);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// advances the sequence clock by one sample timer period; the sequence task applies the steps by this clock; called by the sample timer interrupt
+// while the load is disabled, the sample timer runs at the idle rate and the clock advances in its longer periods
+static inline void load_sequence_clock(uint32_t period_ticks) {
+
+    extern volatile bool sequence_running;
+    extern uint32_t sequence_clock_ticks;
+    extern volatile uint32_t sequence_clock_ms;
+
+    if (!sequence_running) return;
+
+    sequence_clock_ticks += period_ticks;
+
+    if (sequence_clock_ticks >= VI_SENSE_SAMPLE_TIMER_FREQUENCY / 1000) {
+
+        sequence_clock_ticks -= VI_SENSE_SAMPLE_TIMER_FREQUENCY / 1000;
+        sequence_clock_ms++;
+    }
+}
+
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
 // returns the load status register
@@ -0,0 +1,104 @@
+#ifndef _PARAM_H_
+#define _PARAM_H_
+
+/*
+ *  Runtime-tunable control parameters
+ *  Martin Kopka 2024
+ *
+ *  The regulation and protection constants from config.h are loaded into a parameter table on startup and can be changed at runtime
+ *  (the "param" shell command and the PARAM CMD registers); every write is validated against the limits of the parameter
+ *  the tasks read the table directly; values used by the interrupts are copied into the interrupt state by an apply function with the interrupts disabled
+ */
+
+#include "common_defs.h"
+
+//---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum {
+
+    PARAM_CV_KP = 0,            // PID gains of the CV, CR and CP modes [Q16]; the kp, ki and kd of a mode are consecutive
+    PARAM_CV_KI,
+    PARAM_CV_KD,
+    PARAM_CR_KP,
+    PARAM_CR_KI,
+    PARAM_CR_KD,
+    PARAM_CP_KP,
+    PARAM_CP_KI,
+    PARAM_CP_KD,
+    PARAM_CONTROL_RATE,         // CV, CR and CP control loop rate [Hz]
+    PARAM_SLEW_RATE_UP,         // CC level slew rate of a current rise [mA/s]
+    PARAM_SLEW_RATE_DOWN,       // CC level slew rate of a current fall [mA/s]
+    PARAM_OCP_THRESHOLD,        // overcurrent protection threshold [mA]
+    PARAM_OPP_THRESHOLD,        // overpower protection threshold [mW]
+    PARAM_NO_REG_THRESHOLD_CC,  // NO_REG thresholds [mA, mV, mOhm, mW]
+    PARAM_NO_REG_THRESHOLD_CV,
+    PARAM_NO_REG_THRESHOLD_CR,
+    PARAM_NO_REG_THRESHOLD_CP,
+    PARAM_NO_REG_COUNTS,        // cumulative NO_REG events before the REG fault
+    PARAM_FUSE_FAULT_COUNTS,    // cumulative zero sink current readings before a FUSE fault
+    PARAM_SEQ_LOOPS,            // number of sequence table repetitions; 0 repeats until stopped
+    PARAM_SEQ_STOP_CONDITION,   // load_sequence_stop_t
+    PARAM_SEQ_STOP_LEVEL,       // voltage or current threshold of the stop condition [mV or mA]
+    PARAM_BAT_MODE,             // battery test discharge mode; LOAD_MODE_CC, LOAD_MODE_CR or LOAD_MODE_CP
+    PARAM_BAT_LEVEL,            // battery test discharge level [mA, mOhm or mW]
+    PARAM_BAT_CUTOFF,           // battery test cutoff voltage [mV]
+    PARAM_BAT_HYSTERESIS,       // cutoff hysteresis [mV]
+    PARAM_BAT_CUTOFF_TIME,      // time under the cutoff voltage which ends the test [ms]
+    PARAM_BAT_IR_INTERVAL,      // internal resistance measurement interval [s]; 0 -> no measurement
+    PARAM_BAT_IR_PULSE,         // current increase of the internal resistance pulse [% of the discharge current]
+    PARAM_BAT_IR_PULSE_TIME,    // internal resistance pulse length [ms]
+    PARAM_BAT_LOG_INTERVAL,     // battery log interval at the test start [s]
+    PARAM_SWEEP_MODE,           // I-V sweep mode; LOAD_MODE_CC or LOAD_MODE_CV
+    PARAM_SWEEP_START,          // first sweep point [mA or mV]
+    PARAM_SWEEP_STOP,           // last sweep point [mA or mV]; may be lower than the start
+    PARAM_SWEEP_POINTS,         // number of sweep points
+    PARAM_SWEEP_DWELL,          // settling time of each point [us]
+    PARAM_SWEEP_SAMPLES,        // samples averaged at each point
+    PARAM_MPPT_WINDOW,          // blocks averaged after each MPPT perturbation
+    PARAM_MPPT_MIN_STEP,        // MPPT perturbation step limits [mA]
+    PARAM_MPPT_MAX_STEP,
+    PARAM_MPPT_MIN_VOLTAGE,     // voltage below which the MPPT only decreases the current [mV]
+    PARAM_LIN_MAX,              // highest current of the CC linearization [mA]
+    PARAM_CC_TRIM,              // 1 -> the CC trim follows the measured current, 0 -> the trim is cleared
+    PARAM_CC_TRIM_GAIN,         // part of the CC error added to the trim every load control update [1/256]
+    PARAM_CC_TRIM_LIMIT,        // trim limit [mA]
+
+    PARAM_COUNT
+
+} param_id_t;
+
+// first gain parameter of a CV, CR or CP mode
+#define PARAM_PID_KP(mode)      ((param_id_t)(PARAM_CV_KP + 3 * ((mode) - LOAD_MODE_CV)))
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// loads the default values from config.h into the parameter table
+void param_init(void);
+
+// sets a parameter and applies it; returns false if the value is out of the parameter limits
+bool param_set(param_id_t id, int32_t value);
+
+// sets consecutive parameters at once and applies them; returns false without a change if a value is out of the limits of its parameter
+bool param_set_many(param_id_t first, const int32_t *values, uint32_t count);
+
+// returns the name of a parameter used by the shell
+const char *param_get_name(param_id_t id);
+
+// returns the limits of a parameter
+void param_get_limits(param_id_t id, int32_t *min, int32_t *max);
+
+// returns the parameter with the specified name; returns PARAM_COUNT if there is no such parameter
+param_id_t param_find(const char *name);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the value of a parameter
+static inline int32_t param_get(param_id_t id) {
+
+    extern int32_t param_values[PARAM_COUNT];
+    return param_values[id];
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _PARAM_H_ */
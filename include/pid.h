@@ -0,0 +1,70 @@
+#ifndef _PID_H_
+#define _PID_H_
+
+/*
+ *  Fixed-point PID controller
+ *  Martin Kopka 2024
+ *
+ *  The gains are Q16 fixed-point multipliers, so an update takes a constant number of cycles without a division
+ *  the integral is frozen while the output is saturated and the error drives it further into the saturation (conditional integration)
+ *  the derivative is taken from the process value instead of the error, so setpoint steps don't kick the output; a first-order low-pass filters it
+ *  the integral holds the integrated contribution (ki * error), so the gains can change at runtime without a bump in the output
+ */
+
+#include "common_defs.h"
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+#define PID_GAIN_FRACTIONAL_BITS    16
+
+// converts a num / den ratio into a Q16 gain at compile time
+#define PID_GAIN(num, den)          ((int32_t)(((int64_t)(num) << PID_GAIN_FRACTIONAL_BITS) / (den)))
+
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// controller gains [output units per error unit] in Q16 format; ki is applied once per update, kd to the process change per update
+typedef struct {
+
+    int32_t kp;
+    int32_t ki;
+    int32_t kd;
+
+} pid_gains_t;
+
+// controller configuration and state
+typedef struct {
+
+    pid_gains_t gains;
+    int32_t output_min;             // output saturation limits
+    int32_t output_max;
+    uint8_t d_filter_shift;         // time constant of the derivative low-pass filter (2^n updates)
+
+    int64_t integral;               // integral term in Q16 format; kept within the output limits
+    int32_t derivative;             // filtered process change per update in Q8 format
+    int32_t prev_process;           // process value of the previous update
+    int32_t prev_error;             // error of the previous update; used to keep the output continuous when kp changes
+    bool first_update;              // there is no previous process value for the derivative yet
+
+} pid_controller_t;
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// sets the gains, the output limits and the derivative filter time constant of a controller and resets it to output_min
+void pid_init(pid_controller_t *pid, const pid_gains_t *gains, int32_t output_min, int32_t output_max, uint8_t d_filter_shift);
+
+// resets the controller state so the next update continues from the specified output without a bump (bumpless transfer)
+void pid_reset(pid_controller_t *pid, int32_t output);
+
+// changes the gains; the integral is corrected so the output doesn't jump with the new proportional gain
+void pid_set_gains(pid_controller_t *pid, const pid_gains_t *gains);
+
+// changes the output limits; used when a feedforward term shares the actuator range with the controller
+void pid_set_output_limits(pid_controller_t *pid, int32_t output_min, int32_t output_max);
+
+// updates the controller and returns the new output within the output limits
+// the error and the process value have the same sign convention; a positive error increases the output
+int32_t pid_update(pid_controller_t *pid, int32_t error, int32_t process);
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _PID_H_ */
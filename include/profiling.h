@@ -0,0 +1,115 @@
+#ifndef _PROFILING_H_
+#define _PROFILING_H_
+
+/*
+ *  Cycle-count profiling of the interrupts and tasks
+ *  Martin Kopka 2024
+ *
+ *  The DWT cycle counter times every interrupt handler and every pass of the task loops; the "prof" shell command and the PROF CMD registers report the statistics
+ *  interrupt times are exclusive, the interrupts nested in a handler are subtracted from it; task times exclude all interrupts, but include the other tasks if the task sleeps in the measured pass
+ *  the profiling is enabled by PROFILING_ENABLED in config.h; without it the instrumentation macros are empty and nothing is compiled in
+ */
+
+#include "common_defs.h"
+
+//---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// profiled interrupt handlers and tasks; the order is the PROF_SELECT index of the CMD registers
+typedef enum {
+
+    PROF_SAMPLE_TIMER_IRQ = 0,  // VI_SENSE_SAMPLE_TIMER_IRQ_HANDLER (read framing)
+    PROF_CONTROL_LOOP,          // LOAD_CONTROL_TIMER_IRQ_HANDLER (load_update_pid)
+    PROF_VSEN_DMA_IRQ,          // VSEN_ADC_DMA_IRQ_HANDLER (block conversion)
+    PROF_CMD_SPI_IRQ,           // CMD_SPI_IRQ_HANDLER
+    PROF_ISET_DAC_SPI_IRQ,      // ISET_DAC_SPI_IRQ_HANDLER
+    PROF_ISET_DAC_TIMER_IRQ,    // ISET_DAC_TIMER_IRQ_HANDLER (slew ramp and dynamic mode waveform)
+    PROF_TELEMETRY_IRQ,         // TELEMETRY_TIMER_IRQ_HANDLER
+    PROF_FAN1_TACH_IRQ,         // FAN1_TACH_IRQ_HANDLER
+    PROF_FAN2_TACH_IRQ,         // FAN2_TACH_IRQ_HANDLER
+    PROF_WATCHDOG_TASK,         // one pass of a task loop
+    PROF_DEBUG_UART_TASK,
+    PROF_TEMP_CONTROL_TASK,
+    PROF_FAN_REGULATOR_TASK,
+    PROF_LOAD_CONTROL_TASK,
+    PROF_LOAD_CMD_TASK,
+    PROF_VI_SENSE_TASK,
+    PROF_EXT_FAULT_TASK,
+    PROF_BATTERY_TASK,
+    PROF_SEQUENCE_TASK,
+
+    PROF_COUNT
+
+} prof_point_t;
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// logarithmic histogram; bin 0 counts the times below 32 cycles, bin n from 2^(n + 4) to 2^(n + 5) - 1 cycles, the last bin everything above
+#define PROF_HISTOGRAM_BINS     16
+
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// statistics of a profiled handler or task [CPU cycles]
+typedef struct {
+
+    uint32_t count;             // number of calls or task passes
+    uint32_t nested;            // number of calls which interrupted another profiled handler
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;               // total time; the mean is sum / count
+    uint32_t histogram[PROF_HISTOGRAM_BINS];
+
+} prof_stats_t;
+
+#if PROFILING_ENABLED
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the DWT cycle counter and clears the statistics
+void prof_init(void);
+
+// clears the statistics
+void prof_reset(void);
+
+// copies the statistics of a handler or task
+void prof_get_stats(prof_point_t point, prof_stats_t *stats);
+
+// returns the CPU time taken by a handler or task since the last reset [0.01 %]
+uint32_t prof_get_load(prof_point_t point);
+
+// returns the name of a handler or task used by the shell
+const char *prof_get_name(prof_point_t point);
+
+// loads the statistics of a handler or task into the PROF DATA registers; bits 0-7 of select are the prof_point_t, bits 8-9 the page (see cmd_spi_registers.h)
+void prof_load_window(uint16_t select);
+
+// marks the entry of a profiled interrupt handler
+void prof_irq_enter(prof_point_t point);
+
+// marks the exit of a profiled interrupt handler and records its time without the nested handlers
+void prof_irq_exit(prof_point_t point);
+
+// marks the start of a task loop pass
+void prof_task_start(prof_point_t point);
+
+// marks the end of a task loop pass and records its time without the interrupts
+void prof_task_stop(prof_point_t point);
+
+//---- INSTRUMENTATION -------------------------------------------------------------------------------------------------------------------------------------------
+
+#define PROF_IRQ_ENTER(point)       prof_irq_enter(point)
+#define PROF_IRQ_EXIT(point)        prof_irq_exit(point)
+#define PROF_TASK_START(point)      prof_task_start(point)
+#define PROF_TASK_STOP(point)       prof_task_stop(point)
+
+#else
+
+#define PROF_IRQ_ENTER(point)
+#define PROF_IRQ_EXIT(point)
+#define PROF_TASK_START(point)
+#define PROF_TASK_STOP(point)
+
+#endif /* PROFILING_ENABLED */
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _PROFILING_H_ */
@@ -0,0 +1,70 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+/*
+ *  Binary telemetry stream
+ *  Martin Kopka 2024
+ *
+ *  A timer samples the selected channels at a fixed rate, the debug_uart_task encodes the samples into frames and the DMA sends them via DEBUG_UART
+ *  the UART runs at TELEMETRY_UART_BAUD while streaming; the shell keeps receiving commands but its text output is suppressed
+ *
+ *  frame (little-endian): version (u8), channels (u16), sequence (u32), time [us] (u32), selected channels in the bit order, CRC-16/CCITT-FALSE (u16)
+ *  each frame is COBS encoded and terminated by a zero byte; a gap in the sequence numbers shows the samples dropped by a full buffer
+ *  tools/telemetry_decoder.cpp decodes the stream into CSV
+ */
+
+#include "common_defs.h"
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+#define TELEMETRY_FRAME_VERSION     1
+
+//---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// channels of a telemetry frame
+typedef enum {
+
+    TELEMETRY_VOLTAGE   = 0x0001,       // load voltage [mV] (i32); average of the blocks since the previous sample
+    TELEMETRY_CURRENT   = 0x0002,       // load current [mA] (i32); average of the blocks since the previous sample
+    TELEMETRY_POWER     = 0x0004,       // load power [mW] (i32)
+    TELEMETRY_SINKS     = 0x0008,       // L1, L2, R1 and R2 current sink currents [mA] (4x u16)
+    TELEMETRY_TEMPS     = 0x0010,       // L and R power transistor temperatures [°C] in UQ8.2 format (2x u16)
+    TELEMETRY_RPM       = 0x0020,       // FAN1 and FAN2 speeds [rpm] (2x u16)
+    TELEMETRY_STATUS    = 0x0040,       // STATUS and FAULT registers (2x u16)
+
+    TELEMETRY_ALL       = 0x007f
+
+} telemetry_channel_t;
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// initializes the telemetry sample timer and the transmit DMA
+void telemetry_init(void);
+
+// switches DEBUG_UART to TELEMETRY_UART_BAUD and starts streaming the selected channels; the rate must not exceed telemetry_get_max_rate()
+void telemetry_start(uint32_t rate_hz, uint16_t channels);
+
+// stops the stream after the last frame is sent and switches DEBUG_UART back to DEBUG_UART_BAUD
+void telemetry_stop(void);
+
+// returns the highest sample rate the UART can carry with the selected channels [Hz]
+uint32_t telemetry_get_max_rate(uint16_t channels);
+
+// returns the number of samples of the last stream and the number of samples dropped because the transmit buffer was full
+void telemetry_get_statistics(uint32_t *samples, uint32_t *dropped);
+
+// encodes the pending samples and starts their transmission; called by the debug_uart_task
+void telemetry_update(void);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns true if the telemetry stream is running
+static inline bool telemetry_is_streaming(void) {
+
+    extern volatile bool telemetry_streaming;
+    return (telemetry_streaming);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _TELEMETRY_H_ */
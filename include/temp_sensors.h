@@ -8,7 +8,7 @@
 
 #include "common_defs.h"
 #include "fan_control.h"
-#include "hal/adc.h"
+#include "internal_adc.h"
 
 //---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -32,9 +32,6 @@ typedef enum {
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
-// initializes the ADC for power transistor temperature sensing
-void temp_sensor_init(void);
-
 // measures a power transistor temperature and returns it [°C]. Returns 255 in case of a fault
 uint8_t temp_sensor_read(temp_sensor_t sensor);
 
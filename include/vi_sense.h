@@ -6,6 +6,7 @@
  *  Martin Kopka 2024
  *
  *  The driver communicates with 2 instances of the AD7091R ADC to sample load voltage and current
+ *  conversions are paced by a timer, the results are moved by the DMA into ping-pong blocks which are processed once per VI_SENSE_BLOCK_SIZE samples
  *  ADC resolution: 12bits
  *  ADC maximum SPI frequency: 50MHz
  *  https://cz.mouser.com/datasheet/2/609/AD7091R-3118521.pdf
@@ -13,6 +14,7 @@
 
 #include "common_defs.h"
 #include "internal_isen.h"
+#include "cmd_spi_registers.h"
 
 //---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -23,6 +25,28 @@ typedef enum {
 
 } vsen_src_t;
 
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// consistent set of averaged load measurements; published by the vi_sense_task once per averaging window
+typedef struct {
+
+    uint32_t sequence;              // number of the averaging window the values belong to
+    kernel_time_t timestamp;        // time the snapshot was published [ms]
+    uint32_t voltage_mv;            // load voltage [mV]
+    uint32_t current_ma;            // load current [mA]
+    uint32_t power_mw;              // load power [mW]
+
+} vi_sense_snapshot_t;
+
+// running sums of the block averages; the difference of two reads is the sum over the blocks completed between them
+typedef struct {
+
+    uint32_t count;                 // number of blocks included in the averages
+    uint32_t voltage_sum;           // sum of the voltage block averages; wraps around [mV]
+    uint32_t current_sum;           // sum of the current block averages; wraps around [mA]
+
+} vi_sense_block_sums_t;
+
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
 // samples load voltage and current and rounds the results
@@ -31,46 +55,82 @@ void vi_sense_task(void);
 // sets the VSEN ADC source (either VSEN_SRC_INTERNAL or VSEN_SRC_REMOTE)
 void vi_sense_set_vsen_source(vsen_src_t source);
 
+// copies the latest published voltage, current and power snapshot; the values always belong to the same averaging window
+void vi_sense_read_snapshot(vi_sense_snapshot_t *snapshot);
+
 // enables or disables the automatic VSEN source switching feature
 void vi_sense_set_automatic_vsen_source(bool enable);
 
-// enables or disables the Continuous Conversion Mode (new conversion trigger and read is triggered immediately after reading the last one)
+// enables or disables the Continuous Conversion Mode (the PID is running)
 void vi_sense_set_continuous_conversion_mode(bool enabled);
 
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// sets the VSEN and ISEN ADC sample rate; resets the sample timing statistics
+void vi_sense_set_sample_rate(uint32_t rate_hz);
 
-// returns the selected voltage sense source
-static inline vsen_src_t vi_sense_get_vsen_source(void) {
+// returns the VSEN and ISEN ADC sample rate [Hz]
+uint32_t vi_sense_get_sample_rate(void);
 
-    extern vsen_src_t vsen_src;
-    return (vsen_src);
-}
+// slows the acquisition down to VI_SENSE_IDLE_SAMPLE_RATE_HZ while the load is disabled; the full rate is restored before the load is enabled
+// the waveform capture, the telemetry stream and the raw code reads keep the selected rate while they run
+void vi_sense_set_idle(bool load_idle);
 
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// sets the measurement filter configuration (LOAD_FILTER_* fields of the FILTER register); the filter restarts with the new settings
+void vi_sense_set_filter(uint16_t config);
 
-// returns current load voltage [mV]
-static inline uint32_t vi_sense_get_voltage(void) {
+// returns the measurement filter configuration
+uint16_t vi_sense_get_filter(void);
 
-    extern int32_t load_voltage_mv;
-    return (load_voltage_mv);
-}
+// arms the waveform capture; config contains the trigger fields of the CAPTURE_CTRL register, level is in [mV] or [mA]
+void vi_sense_capture_arm(uint16_t config, int32_t level, uint32_t pretrigger);
 
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// stops the waveform capture; a completed capture stays readable
+void vi_sense_capture_stop(void);
 
-// returns current load current [mA]
-static inline uint32_t vi_sense_get_current(void) {
+// returns the waveform capture state
+load_capture_state_t vi_sense_capture_get_state(void);
 
-    extern int32_t load_current_ma;
-    return (load_current_ma);
-}
+// returns the number of samples before the trigger in the captured waveform
+uint32_t vi_sense_capture_get_pretrigger(void);
+
+// signals a load event to the waveform capture (LOAD_CAPTURE_TRIGGER_ENABLE or LOAD_CAPTURE_TRIGGER_FAULT)
+void vi_sense_capture_event(load_capture_trigger_t event);
+
+// reads a sample of the completed capture (0 is the oldest sample); returns false if there is no completed capture or the index is out of range
+bool vi_sense_capture_read(uint32_t index, int32_t *voltage_mv, int32_t *current_ma);
+
+// loads LOAD_CAPTURE_WINDOW_SAMPLES samples starting at index into the CAPTURE_DATA window; CAPTURE_INDEX is updated last to signal a valid window
+void vi_sense_capture_load_window(uint32_t index);
+
+// returns the number of blocks included in the averages and the running sums of their voltage [mV] and current [mA] averages
+// the sums wrap around, only the differences between two reads are meaningful; can be called from an interrupt with a lower priority than the block interrupt
+void vi_sense_read_block_sums(vi_sense_block_sums_t *sums);
+
+// returns the average voltage [uV] and current [uA] of the blocks completed between two reads of the block sums; returns false if there is no such block
+bool vi_sense_window_average(const vi_sense_block_sums_t *start, const vi_sense_block_sums_t *end, int32_t *voltage_uv, int32_t *current_ua);
+
+// returns the minimum and maximum delay between the conversion period start and the start of the read [ns] and the number of late reads
+// the conversion instants are set by the timer hardware; the read delay only shows the margin of the read framing interrupt
+void vi_sense_get_sample_timing(uint32_t *latency_min_ns, uint32_t *latency_max_ns, uint32_t *late_reads);
+
+// starts the charge and energy integration from zero or stops it; the integrated values remain readable after a stop
+void vi_sense_set_integration(bool enabled);
+
+// returns the charge [uAs] and energy [uWs] integrated at the sample rate since the integration was started
+void vi_sense_read_integrals(int64_t *charge, int64_t *energy);
+
+// copies the integrals into the CHARGE and ENERGY registers; INTEGRAL_LATCH is updated last to signal a consistent set
+void vi_sense_latch_integrals(void);
+
+// waits for the specified number of new blocks (max 4096) and returns the average raw VSEN and ISEN ADC codes with 4 fractional bits
+void vi_sense_read_raw_codes(uint32_t blocks, uint32_t *vsen_code_q4, uint32_t *isen_code_q4);
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-// returns current load power [mW]
-static inline uint32_t vi_sense_get_power(void) {
+// returns the selected voltage sense source
+static inline vsen_src_t vi_sense_get_vsen_source(void) {
 
-    extern int32_t load_power_mw;
-    return (load_power_mw);
+    extern volatile vsen_src_t vsen_src;
+    return (vsen_src);
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
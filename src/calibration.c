@@ -0,0 +1,361 @@
+#include "calibration.h"
+#include "fixed_point.h"
+#include "hal/iwdg.h"
+#include "vi_sense.h"
+#include "iset_dac.h"
+#include "internal_adc.h"
+#include "load_control.h"
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+#define CALIBRATION_MAGIC       0xCA11B001          // marks a valid calibration record in the flash; changed with the ISET DAC segments
+#define CALIBRATION_ADC_BLOCKS  1024                // number of VSEN/ISEN blocks averaged for a calibration point
+#define CALIBRATION_INT_READS   32                  // number of internal ADC buffer averages taken for a calibration point (one every 2ms)
+
+// input LSBs per segment as a power of 2 (12bit ADC codes)
+#define SEGMENT_SHIFT(input_bits)   ((input_bits) - __builtin_ctz(CALIBRATION_SEGMENTS))
+
+// input LSBs of the first two octave segments as a power of 2 (16bit current in mA for the DAC); the following segments double in width up to the full range
+#define OCTAVE_SHIFT(input_bits)    ((input_bits) - CALIBRATION_SEGMENTS + 1)
+
+//---- STRUCTS ---------------------------------------------------------------------------------------------------------------------------------------------------
+
+// calibration record stored in the flash
+typedef struct {
+
+    uint32_t magic;                                 // CALIBRATION_MAGIC if the record is valid
+    calibration_t channel[CAL_CHANNEL_COUNT];
+    uint32_t checksum;                              // complement of the sum of all preceding words
+
+} calibration_record_t;
+
+// reference point for a calibration fit
+typedef struct {
+
+    int32_t input;          // raw input with 4 fractional bits
+    int32_t output;         // reference output
+
+} calibration_point_t;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+calibration_segment_t calibration_table[CAL_CHANNEL_COUNT][CALIBRATION_SEGMENTS];  // compiled per-segment gains and offsets used by calibration_apply()
+
+const uint8_t calibration_segment_shift[CAL_CHANNEL_COUNT] = {
+
+    SEGMENT_SHIFT(12), SEGMENT_SHIFT(12), SEGMENT_SHIFT(12), SEGMENT_SHIFT(12), SEGMENT_SHIFT(12), SEGMENT_SHIFT(12), SEGMENT_SHIFT(12), OCTAVE_SHIFT(16)
+};
+
+static calibration_record_t calibration;                            // calibration of all channels
+static calibration_point_t points[CALIBRATION_MAX_POINTS];          // collected reference points
+static uint32_t point_count = 0;
+static calibration_channel_t point_channel = CAL_CHANNEL_COUNT;     // channel the collected points belong to
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the checksum of a calibration record
+static uint32_t __record_checksum(const calibration_record_t *record) {
+
+    const uint32_t *word = (const uint32_t*)record;
+    uint32_t sum = 0;
+
+    for (int i = 0; i < sizeof(calibration_record_t) / 4 - 1; i++) sum += word[i];
+    return (~sum);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the input at the lower edge of a segment; the segment CALIBRATION_SEGMENTS gives the upper edge of the last one
+static uint32_t __segment_edge(calibration_channel_t channel, int segment) {
+
+    uint8_t shift = calibration_segment_shift[channel];
+
+    if (channel == CAL_ISET_DAC) return ((segment == 0) ? 0 : (1 << (shift + segment - 1)));
+    return (segment << shift);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// compiles the calibration of a channel into the per-segment table
+static void __compile_channel(calibration_channel_t channel) {
+
+    const calibration_t *cal = &calibration.channel[channel];
+    calibration_segment_t segments[CALIBRATION_SEGMENTS];
+
+    for (int s = 0; s < CALIBRATION_SEGMENTS; s++) {
+
+        // the correction is interpolated linearly between the two points at the segment edges; the segment widths are powers of 2
+        int32_t delta = cal->correction[s + 1] - cal->correction[s];
+        uint32_t start = __segment_edge(channel, s);
+        uint8_t shift = __builtin_ctz(__segment_edge(channel, s + 1) - start);
+
+        segments[s].gain = cal->gain + (delta << (16 - shift));
+        segments[s].offset = ((int64_t)(cal->offset + cal->correction[s]) << 16) - ((int64_t)delta * start << (16 - shift)) + (1 << 15);
+    }
+
+    // the block interrupt must not see a half updated channel
+    __disable_irq();
+    for (int s = 0; s < CALIBRATION_SEGMENTS; s++) calibration_table[channel][s] = segments[s];
+    __enable_irq();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// writes a calibration record into the calibration flash sector; returns false on a programming error
+static bool __flash_write(const calibration_record_t *record) {
+
+    const uint32_t *source = (const uint32_t*)record;
+    volatile uint32_t *destination = (volatile uint32_t*)CALIBRATION_FLASH_ADDRESS;
+    const uint32_t errors = FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR;
+
+    // unlock the flash control register and clear old error flags
+    FLASH->KEYR = 0x45670123;
+    FLASH->KEYR = 0xCDEF89AB;
+    while (bit_is_set(FLASH->SR, FLASH_SR_BSY));
+    FLASH->SR = errors;
+
+    // the sector erase takes up to 2s; extend the watchdog timeout for the time of the erase
+    iwdg_init(IWDG_PR_256, 0xfff);
+
+    // erase the sector with 32bit parallelism
+    FLASH->CR = FLASH_CR_PSIZE_1 | (CALIBRATION_FLASH_SECTOR << FLASH_CR_SNB_Pos) | FLASH_CR_SER;
+    FLASH->CR |= FLASH_CR_STRT;
+    while (bit_is_set(FLASH->SR, FLASH_SR_BSY));
+
+    iwdg_init(IWDG_PR_8, 0xfff);
+
+    // program the record word by word
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+
+    for (int i = 0; i < sizeof(calibration_record_t) / 4; i++) {
+
+        destination[i] = source[i];
+        while (bit_is_set(FLASH->SR, FLASH_SR_BSY));
+    }
+
+    FLASH->CR = FLASH_CR_LOCK;
+
+    // reset the data cache so the new record is not shadowed by stale cache lines
+    clear_bits(FLASH->ACR, FLASH_ACR_DCEN);
+    set_bits(FLASH->ACR, FLASH_ACR_DCRST);
+    clear_bits(FLASH->ACR, FLASH_ACR_DCRST);
+    set_bits(FLASH->ACR, FLASH_ACR_DCEN);
+
+    if (FLASH->SR & errors) return false;
+
+    // verify the written record
+    for (int i = 0; i < sizeof(calibration_record_t) / 4; i++) if (destination[i] != source[i]) return false;
+    return true;
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// loads the calibration from the flash or the nominal values if there is no valid calibration stored
+void calibration_init(void) {
+
+    const calibration_record_t *stored = (const calibration_record_t*)CALIBRATION_FLASH_ADDRESS;
+
+    if (stored->magic == CALIBRATION_MAGIC && stored->checksum == __record_checksum(stored)) {
+
+        calibration = *stored;
+        for (int channel = 0; channel < CAL_CHANNEL_COUNT; channel++) __compile_channel(channel);
+
+    } else {
+
+        for (int channel = 0; channel < CAL_CHANNEL_COUNT; channel++) calibration_reset(channel);
+    }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the calibration of a channel
+const calibration_t *calibration_get(calibration_channel_t channel) {
+
+    if (channel >= CAL_CHANNEL_COUNT) channel = CAL_VSEN_INT;
+    return (&calibration.channel[channel]);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// replaces the calibration of a channel; the change takes effect immediately but is lost after a reset unless saved
+void calibration_set(calibration_channel_t channel, const calibration_t *cal) {
+
+    if (channel >= CAL_CHANNEL_COUNT) return;
+
+    calibration.channel[channel] = *cal;
+    __compile_channel(channel);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// restores the nominal calibration of a channel from hw_config.h
+void calibration_reset(calibration_channel_t channel) {
+
+    calibration_t cal = {0};
+
+    // the conversion macros are exact up to an input of 65536, which gives the gain with 16 fractional bits
+    switch (channel) {
+
+        case CAL_VSEN_INT: cal.offset = VSEN_ADC_CODE_TO_MV_INT(0); cal.gain = VSEN_ADC_CODE_TO_MV_INT(65536) - cal.offset; break;
+        case CAL_VSEN_REM: cal.offset = VSEN_ADC_CODE_TO_MV_REM(0); cal.gain = VSEN_ADC_CODE_TO_MV_REM(65536) - cal.offset; break;
+        case CAL_ISEN:     cal.offset = ISEN_ADC_CODE_TO_MA(0);     cal.gain = ISEN_ADC_CODE_TO_MA(65536) - cal.offset;     break;
+        case CAL_ISET_DAC: cal.offset = ISET_DAC_MA_TO_CODE(0);     cal.gain = ISET_DAC_MA_TO_CODE(65536) - cal.offset;     break;
+        case CAL_ISEN_L1:
+        case CAL_ISEN_L2:
+        case CAL_ISEN_R1:
+        case CAL_ISEN_R2:  cal.offset = ISEN_INT_ADC_CODE_TO_MA(0); cal.gain = ISEN_INT_ADC_CODE_TO_MA(65536) - cal.offset; break;
+        default: return;
+    }
+
+    calibration_set(channel, &cal);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stores the calibration of all channels in the flash; returns false if the load is enabled or the flash could not be written
+// the flash is stalled while the sector is erased (up to 2s), so the calibration is not saved while the load is enabled
+bool calibration_save(void) {
+
+    if (load_get_status() & LOAD_STATUS_ENABLED) return false;
+
+    calibration.magic = CALIBRATION_MAGIC;
+    calibration.checksum = __record_checksum(&calibration);
+
+    return (__flash_write(&calibration));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// measures the raw input of a channel and adds a calibration point with a reference output value; returns the number of collected points or 0 on failure
+// ADC channels: the input is measured and the reference is the externally measured voltage [mV] or current [mA]
+// ISET DAC: the input is the externally measured current [mA] and the reference is the DAC code currently written
+uint32_t calibration_add_point(calibration_channel_t channel, int32_t reference) {
+
+    if (channel >= CAL_CHANNEL_COUNT) return 0;
+
+    // the points of a different channel are discarded
+    if (channel != point_channel) calibration_clear_points();
+    if (point_count == CALIBRATION_MAX_POINTS) return 0;
+
+    calibration_point_t point = {.output = reference};
+
+    if (channel == CAL_VSEN_INT || channel == CAL_VSEN_REM || channel == CAL_ISEN) {
+
+        // the voltage has to be measured with the sense source which is calibrated
+        if (channel == CAL_VSEN_INT && vi_sense_get_vsen_source() != VSEN_SRC_INTERNAL) return 0;
+        if (channel == CAL_VSEN_REM && vi_sense_get_vsen_source() != VSEN_SRC_REMOTE) return 0;
+
+        uint32_t vsen_code_q4, isen_code_q4;
+        vi_sense_read_raw_codes(CALIBRATION_ADC_BLOCKS, &vsen_code_q4, &isen_code_q4);
+        point.input = (channel == CAL_ISEN) ? isen_code_q4 : vsen_code_q4;
+
+    } else if (channel == CAL_ISET_DAC) {
+
+        point.input = reference << 4;
+        point.output = iset_dac_get_code();
+
+    } else {
+
+        // the scan buffer is refreshed every 2ms
+        uint32_t sum = 0;
+
+        for (int i = 0; i < CALIBRATION_INT_READS; i++) {
+
+            sum += internal_adc_read(INTERNAL_ADC_ISEN_L1 + channel - CAL_ISEN_L1);
+            kernel_sleep_ms(2);
+        }
+
+        point.input = sum / CALIBRATION_INT_READS;
+    }
+
+    // keep the points sorted by input for the correction interpolation
+    int i = point_count++;
+    for (; i > 0 && points[i - 1].input > point.input; i--) points[i] = points[i - 1];
+    points[i] = point;
+
+    point_channel = channel;
+    return (point_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// discards the collected calibration points
+void calibration_clear_points(void) {
+
+    point_count = 0;
+    point_channel = CAL_CHANNEL_COUNT;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// fits the gain, offset and correction points of a channel to the collected points; returns false if there are not enough points
+// two points fit the gain and the offset, each additional point contributes to the piecewise-linear correction
+bool calibration_fit(calibration_channel_t channel) {
+
+    if (channel != point_channel || point_count < 2) return false;
+
+    //---- LEAST SQUARES LINE ------------------------------------------------------------------------------------------------------------------------------------
+
+    int32_t input_mean = 0, output_mean = 0;
+
+    for (int i = 0; i < point_count; i++) {
+
+        input_mean += points[i].input;
+        output_mean += points[i].output;
+    }
+
+    input_mean /= (int32_t)point_count;
+    output_mean /= (int32_t)point_count;
+
+    int64_t sxx = 0, sxy = 0;
+
+    for (int i = 0; i < point_count; i++) {
+
+        int64_t dx = points[i].input - input_mean;
+        sxx += dx * dx;
+        sxy += dx * (points[i].output - output_mean);
+    }
+
+    if (sxx == 0) return false;     // all points have the same input
+
+    calibration_t cal = {0};
+
+    // the inputs have 4 fractional bits, the gain has 16 fractional bits
+    cal.gain = div_s64(sxy << 20, sxx);
+    cal.offset = output_mean - (int32_t)(((int64_t)cal.gain * input_mean) >> 20);
+
+    //---- PIECEWISE-LINEAR CORRECTION ---------------------------------------------------------------------------------------------------------------------------
+
+    // the residuals of the line are interpolated at the segment edges; outside of the measured range the nearest residual is held
+    if (point_count > 2) {
+
+        int32_t residual[CALIBRATION_MAX_POINTS];
+        for (int i = 0; i < point_count; i++) residual[i] = points[i].output - (cal.offset + (int32_t)(((int64_t)cal.gain * points[i].input) >> 20));
+
+        for (int k = 0; k <= CALIBRATION_SEGMENTS; k++) {
+
+            int32_t edge = __segment_edge(channel, k) << 4;
+            int32_t correction;
+
+            if (edge <= points[0].input) correction = residual[0];
+            else if (edge >= points[point_count - 1].input) correction = residual[point_count - 1];
+            else {
+
+                int i = 0;
+                while (points[i + 1].input < edge) i++;
+
+                int32_t span = points[i + 1].input - points[i].input;
+                correction = residual[i] + (span ? div_s64((int64_t)(residual[i + 1] - residual[i]) * (edge - points[i].input), span) : 0);
+            }
+
+            if (correction > INT16_MAX) correction = INT16_MAX;
+            if (correction < INT16_MIN) correction = INT16_MIN;
+            cal.correction[k] = correction;
+        }
+    }
+
+    calibration_set(channel, &cal);
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1,5 +1,6 @@
 #include "cmd_spi_driver.h"
 #include "hal/spi.h"
+#include "profiling.h"
 
 //---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -155,6 +156,8 @@ void CMD_SPI_IRQ_HANDLER(void) {
     static load_cmd_state_machine_t frame_state = STATE_WAITING_FOR_FRAME_SYNC;     // tracking the current part of a frame being sent or received
     static uint32_t data_frame = 0;                                                 // for assembling the received or transmitted data frame
 
+    PROF_IRQ_ENTER(PROF_CMD_SPI_IRQ);
+
     //---- READING WRITE COMMANDS FROM MASTER --------------------------------------------------------------------------------------------------------------------
 
     if (spi_rx_not_empty(CMD_SPI)) {
@@ -248,6 +251,8 @@ void CMD_SPI_IRQ_HANDLER(void) {
     }
 
     //------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+    PROF_IRQ_EXIT(PROF_CMD_SPI_IRQ);
 }
 
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -2,6 +2,20 @@
 #include "cmd_spi_driver.h"
 #include "load_control.h"
 #include "vi_sense.h"
+#include "param.h"
+#include "profiling.h"
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// loads a parameter into the PARAM registers
+static void __load_param(param_id_t id) {
+
+    int32_t value = param_get(id);
+
+    cmd_write(CMD_ADDRESS_PARAM_INDEX, id);
+    cmd_write(CMD_ADDRESS_PARAM_VALUE_L, (uint32_t)value & 0xffff);
+    cmd_write(CMD_ADDRESS_PARAM_VALUE_H, (uint32_t)value >> 16);
+}
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -9,12 +23,22 @@
 void load_cmd_task(void) {
 
     kernel_time_t last_watchdog_reload = 0;     // absolute time of last watchdog reload write command
+    uint16_t capture_level = 0;                 // waveform capture trigger level written by the master [10mV or mA]
+    uint16_t capture_pretrigger = 0;            // waveform capture pre-trigger depth written by the master [samples]
+    param_id_t param_index = 0;                 // parameter selected by the master
+    uint16_t param_value_l = 0;                 // low half of the parameter value written by the master
+    uint32_t seq_index = 0;                     // sequence table position of the step written through SEQ_DATA
+    uint32_t seq_word = 0;                      // next word of the step written through SEQ_DATA
+    uint16_t seq_words[3];                      // mode, level and duration low words of the step
 
     cmd_driver_init();
     cmd_write(CMD_ADDRESS_ID, LOAD_ID_CODE);
+    __load_param(param_index);
 
     while (1) {
 
+        PROF_TASK_START(PROF_LOAD_CMD_TASK);
+
         // handle write commands from the master if the RX fifo is not empty
         if (cmd_has_data()) {
 
@@ -50,6 +74,15 @@ void load_cmd_task(void) {
 
                     //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
+                    // Load Measurement Filter Configuration register
+                    case CMD_ADDRESS_FILTER: {
+
+                        vi_sense_set_filter(data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
                     // Load Fault register
                     case CMD_ADDRESS_FAULT: {
 
@@ -131,6 +164,287 @@ void load_cmd_task(void) {
                     } break;
 
                     //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // VI Sense Sample Rate register
+                    case CMD_ADDRESS_SAMPLE_RATE: {
+
+                        vi_sense_set_sample_rate(data * 1000);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Waveform Capture Control register
+                    case CMD_ADDRESS_CAPTURE_CTRL: {
+
+                        int32_t level = (data & LOAD_CAPTURE_CURRENT) ? capture_level : capture_level * 10;
+
+                        if (data & LOAD_CAPTURE_ARM) vi_sense_capture_arm(data, level, capture_pretrigger);
+                        else vi_sense_capture_stop();
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Waveform Capture Trigger Level register; applied when the capture is armed
+                    case CMD_ADDRESS_CAPTURE_LEVEL: {
+
+                        capture_level = data;
+                        cmd_write(CMD_ADDRESS_CAPTURE_LEVEL, data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Waveform Capture Pre-trigger Depth register; applied when the capture is armed
+                    case CMD_ADDRESS_CAPTURE_PRETRIG: {
+
+                        capture_pretrigger = data;
+                        cmd_write(CMD_ADDRESS_CAPTURE_PRETRIG, data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Waveform Capture Read Index register
+                    case CMD_ADDRESS_CAPTURE_INDEX: {
+
+                        vi_sense_capture_load_window(data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Integral Latch register
+                    case CMD_ADDRESS_INTEGRAL_LATCH: {
+
+                        vi_sense_latch_integrals();
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Autotune register; the register reads back the autotune state
+                    case CMD_ADDRESS_AUTOTUNE: {
+
+                        if (data) load_autotune_start(data);
+                        else load_autotune_abort();
+
+                        cmd_write(CMD_ADDRESS_AUTOTUNE, load_autotune_get_state());
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Parameter Index register; an invalid index is ignored and the previous parameter stays selected
+                    case CMD_ADDRESS_PARAM_INDEX: {
+
+                        if (data < PARAM_COUNT) param_index = data;
+                        __load_param(param_index);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Parameter Value low register; applied with the high register
+                    case CMD_ADDRESS_PARAM_VALUE_L: {
+
+                        param_value_l = data;
+                        cmd_write(CMD_ADDRESS_PARAM_VALUE_L, data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Parameter Value high register; the registers read back the value in effect
+                    case CMD_ADDRESS_PARAM_VALUE_H: {
+
+                        param_set(param_index, (int32_t)(((uint32_t)data << 16) | param_value_l));
+                        __load_param(param_index);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Dynamic Mode Control register
+                    case CMD_ADDRESS_DYN_CTRL: {
+
+                        load_set_dynamic_enable(data & LOAD_DYNAMIC_ENABLE);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Dynamic Mode Level A and Level B registers
+                    case CMD_ADDRESS_DYN_LEVEL_A:
+                    case CMD_ADDRESS_DYN_LEVEL_B: {
+
+                        load_set_dynamic_level(address == CMD_ADDRESS_DYN_LEVEL_B, data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Dynamic Mode Frequency register
+                    case CMD_ADDRESS_DYN_FREQ: {
+
+                        load_set_dynamic_frequency(data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Dynamic Mode Duty Cycle register
+                    case CMD_ADDRESS_DYN_DUTY: {
+
+                        load_set_dynamic_duty(data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Dynamic Mode Rise and Fall Slew registers
+                    case CMD_ADDRESS_DYN_RISE:
+                    case CMD_ADDRESS_DYN_FALL: {
+
+                        load_set_dynamic_slew(address == CMD_ADDRESS_DYN_FALL, data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Sequence Control register
+                    case CMD_ADDRESS_SEQ_CTRL: {
+
+                        if (data & LOAD_SEQUENCE_CLEAR) load_sequence_clear();
+
+                        load_sequence_state_t state;
+                        load_sequence_get_state(&state);
+
+                        if (!(data & LOAD_SEQUENCE_RUN)) load_sequence_stop();
+                        else if (!state.running) load_sequence_start();
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Sequence Index register; selects the table position of the next step written through SEQ_DATA
+                    case CMD_ADDRESS_SEQ_INDEX: {
+
+                        seq_index = data;
+                        seq_word = 0;
+                        cmd_write(CMD_ADDRESS_SEQ_INDEX, seq_index);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Sequence Data register; the fourth word writes the step and moves to the next table position
+                    case CMD_ADDRESS_SEQ_DATA: {
+
+                        if (seq_word < 3) seq_words[seq_word++] = data;
+                        else {
+
+                            // the level word is in the units of the CC, CV, CR or CP level register
+                            static const uint32_t level_units[4] = {1, 10, 10, 100};
+
+                            load_sequence_step_t step;
+                            step.mode = seq_words[0];
+                            step.level = seq_words[1] * level_units[seq_words[0] & LOAD_SEQUENCE_STEP_MODE];
+                            step.duration_ms = ((uint32_t)data << 16) | seq_words[2];
+
+                            if (load_sequence_set_step(seq_index, &step)) seq_index++;
+                            seq_word = 0;
+                            cmd_write(CMD_ADDRESS_SEQ_INDEX, seq_index);
+                        }
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Battery Test Control register
+                    case CMD_ADDRESS_BAT_CTRL: {
+
+                        load_battery_state_t state;
+                        load_battery_get_state(&state);
+
+                        if (!(data & LOAD_BATTERY_RUN)) load_battery_stop();
+                        else if (!state.running) load_battery_start();
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Battery Test Log Index register; loads the record into the BAT_LOG_DATA registers
+                    case CMD_ADDRESS_BAT_LOG_INDEX: {
+
+                        load_battery_load_window(data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // I-V Sweep Control register
+                    case CMD_ADDRESS_SWEEP_CTRL: {
+
+                        load_sweep_state_t state;
+                        load_sweep_get_state(&state);
+
+                        if (!(data & LOAD_SWEEP_RUN)) load_sweep_stop();
+                        else if (!state.running) load_sweep_start();
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // I-V Sweep Index register; loads the point into the SWEEP_DATA registers
+                    case CMD_ADDRESS_SWEEP_INDEX: {
+
+                        load_sweep_load_window(data);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // MPPT Control register
+                    case CMD_ADDRESS_MPPT_CTRL: {
+
+                        load_set_mppt_enable(data & LOAD_MPPT_ENABLE);
+
+                    } break;
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // CC Linearization Control register
+                    case CMD_ADDRESS_LIN_CTRL: {
+
+                        load_linearize_state_t state;
+                        load_linearize_get_state(&state);
+
+                        if (!(data & LOAD_LINEARIZE_RUN)) {
+
+                            load_linearize_stop();
+                            if (data & LOAD_LINEARIZE_SAVE) load_linearize_save();
+
+                        } else if (!state.running) load_linearize_start();
+
+                    } break;
+
+#if PROFILING_ENABLED
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+                    // Profiling Select register
+                    case CMD_ADDRESS_PROF_SELECT: {
+
+                        if (data == LOAD_PROF_RESET) prof_reset();
+                        prof_load_window((data == LOAD_PROF_RESET) ? 0 : data);
+
+                    } break;
+
+#endif
+
+                    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
                 }
             }
         }
@@ -141,6 +455,7 @@ void load_cmd_task(void) {
             load_trigger_fault(LOAD_FAULT_COM);
         }
 
+        PROF_TASK_STOP(PROF_LOAD_CMD_TASK);
         kernel_yield();
     }
 }
@@ -6,6 +6,11 @@
 #include "fan_control.h"
 #include "temp_sensors.h"
 #include "vi_sense.h"
+#include "calibration.h"
+#include "telemetry.h"
+#include "param.h"
+#include "profiling.h"
+#include "fixed_point.h"
 
 //---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
 
@@ -77,6 +82,71 @@ void shell_update(char *buffer) {
 
     //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
+    // starts or stops the binary telemetry stream
+    else if (SHELL_CMD("stream")) {
+
+        static const char channel_letters[] = "vipctrs";   // in the telemetry_channel_t bit order
+
+        uint32_t samples, dropped;
+
+        if (argc == 1 || COMPARE_ARG(1, "stop")) {
+
+            telemetry_stop();
+            telemetry_get_statistics(&samples, &dropped);
+
+            debug_print("stream stopped, ");
+            debug_print_int(samples);
+            debug_print(" samples, ");
+            debug_print_int(dropped);
+            debug_print(" dropped.\n");
+            return;
+        }
+
+        int rate = atoi(args[1]);
+        uint16_t channels = 0;
+
+        // channels are selected by letters (e.g. "vip"); voltage, current and power are streamed by default
+        if (argc > 2) {
+
+            for (char *c = args[2]; *c != '\0'; c++) {
+
+                int bit = 0;
+                while (channel_letters[bit] != '\0' && channel_letters[bit] != *c) bit++;
+
+                if (channel_letters[bit] == '\0') {
+
+                    debug_print("(!) invalid channel. Use v, i, p, c (sinks), t (temps), r (rpm) or s (status).\n");
+                    return;
+                }
+
+                channels |= (1 << bit);
+            }
+
+        } else channels = TELEMETRY_VOLTAGE | TELEMETRY_CURRENT | TELEMETRY_POWER;
+
+        uint32_t max_rate = telemetry_get_max_rate(channels);
+
+        if (rate < TELEMETRY_MIN_RATE_HZ || rate > max_rate) {
+
+            debug_print("(!) rate range for the selected channels is <");
+            debug_print_int(TELEMETRY_MIN_RATE_HZ);
+            debug_print(" - ");
+            debug_print_int(max_rate);
+            debug_print("> Hz.\n");
+            return;
+        }
+
+        debug_print("streaming at ");
+        debug_print_int(rate);
+        debug_print(" Hz, switching to ");
+        debug_print_int(TELEMETRY_UART_BAUD);
+        debug_print(" baud.\n");
+
+        telemetry_start(rate, channels);
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
     // resets the processor
     else if (SHELL_CMD("reboot")) {
 
@@ -369,11 +439,109 @@ void shell_update(char *buffer) {
 
     //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
+    // prints or sets the PID gains of the CV, CR and CP modes
+    else if (SHELL_CMD("pid")) {
+
+        static const char *mode_names[] = {"cc", "cv", "cr", "cp"};
+        pid_gains_t gains;
+
+        if (argc == 1) {
+
+            for (int mode = LOAD_MODE_CV; mode <= LOAD_MODE_CP; mode++) {
+
+                load_get_pid_gains(mode, &gains);
+
+                debug_print(mode_names[mode]);
+                debug_print(": kp ");
+                debug_print_int(gains.kp);
+                debug_print(", ki ");
+                debug_print_int(gains.ki);
+                debug_print(", kd ");
+                debug_print_int(gains.kd);
+                debug_print("\n");
+            }
+
+            debug_print("(gains in Q16 format, 65536 = 1)\n");
+            return;
+        }
+
+        // relay autotune of the running mode
+        if (COMPARE_ARG(1, "tune")) {
+
+            uint32_t amplitude_ma = (argc > 2) ? atoi(args[2]) : LOAD_AUTOTUNE_RELAY_MA;
+            load_mode_t mode = load_get_mode();
+
+            if (!load_autotune_start(amplitude_ma)) {
+
+                debug_print("(!) the load must be enabled in CV, CR or CP mode with the current at least the amplitude from both limits.\n");
+                return;
+            }
+
+            while (load_autotune_get_state() == LOAD_AUTOTUNE_RUNNING) kernel_sleep_ms(LOAD_CONTROL_UPDATE_PERIOD_MS);
+
+            uint32_t period_us, amplitude;
+
+            if (load_autotune_get_result(&period_us, &amplitude) != LOAD_AUTOTUNE_DONE) {
+
+                debug_print("(!) autotune failed; the oscillation was too small, too fast or didn't settle. The previous gains are kept.\n");
+                return;
+            }
+
+            load_get_pid_gains(mode, &gains);
+
+            debug_print("oscillation amplitude: ");
+            debug_print_int(amplitude);
+            debug_print((mode == LOAD_MODE_CP) ? " mW, period: " : " mV, period: ");
+            debug_print_int(period_us);
+            debug_print(" us\n");
+            debug_print(mode_names[mode]);
+            debug_print(": kp ");
+            debug_print_int(gains.kp);
+            debug_print(", ki ");
+            debug_print_int(gains.ki);
+            debug_print(", kd ");
+            debug_print_int(gains.kd);
+            debug_print("\n");
+            return;
+        }
+
+        shell_assert_argc(3);
+
+        int mode = LOAD_MODE_CV;
+        while (mode <= LOAD_MODE_CP && !COMPARE_ARG(1, mode_names[mode])) mode++;
+
+        if (mode > LOAD_MODE_CP) {
+
+            debug_print("(!) invalid mode. Use \"cv\", \"cr\" or \"cp\".\n");
+            return;
+        }
+
+        gains.kp = atoi(args[2]);
+        gains.ki = atoi(args[3]);
+        gains.kd = (argc > 4) ? atoi(args[4]) : 0;
+
+        if (gains.kp < 0 || gains.ki < 0 || gains.kd < 0 || gains.kp > LOAD_PID_MAX_GAIN || gains.ki > LOAD_PID_MAX_GAIN || gains.kd > LOAD_PID_MAX_GAIN) {
+
+            debug_print("(!) the gains must be in range <0 - ");
+            debug_print_int(LOAD_PID_MAX_GAIN);
+            debug_print(">.\n");
+            return;
+        }
+
+        load_set_pid_gains(mode, &gains);
+        debug_print("PID gains set.\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
     // prints the load voltage
     else if (SHELL_CMD("vsen")) {
 
+        vi_sense_snapshot_t measurement;
+        vi_sense_read_snapshot(&measurement);
+
         debug_print("load input voltage: ");
-        debug_print_int_dec(vi_sense_get_voltage(), 2);
+        debug_print_int_dec(measurement.voltage_mv, 2);
         debug_print(" V\n");
     }
 
@@ -382,8 +550,11 @@ void shell_update(char *buffer) {
     // prints total load current
     else if (SHELL_CMD("isen")) {
 
+        vi_sense_snapshot_t measurement;
+        vi_sense_read_snapshot(&measurement);
+
         debug_print("load current: ");
-        debug_print_int_dec(vi_sense_get_current(), 2);
+        debug_print_int_dec(measurement.current_ma, 2);
         debug_print(" A\n");
     }
 
@@ -408,8 +579,11 @@ void shell_update(char *buffer) {
     // prints total load current
     else if (SHELL_CMD("psen")) {
 
+        vi_sense_snapshot_t measurement;
+        vi_sense_read_snapshot(&measurement);
+
         debug_print("load power: ");
-        debug_print_int_dec(vi_sense_get_power(), 1);
+        debug_print_int_dec(measurement.power_mw, 1);
         debug_print(" W\n");
     }
 
@@ -449,6 +623,924 @@ void shell_update(char *buffer) {
 
     //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
+    // sets the VSEN and ISEN ADC sample rate; prints the sample rate and sample timing statistics if the command is used without an argument
+    else if (SHELL_CMD("srate")) {
+
+        if (argc == 1) {
+
+            uint32_t latency_min_ns, latency_max_ns, late_reads;
+            vi_sense_get_sample_timing(&latency_min_ns, &latency_max_ns, &late_reads);
+
+            debug_print("sample rate: ");
+            debug_print_int(vi_sense_get_sample_rate());
+            debug_print(" Hz\nread latency min: ");
+            debug_print_int(latency_min_ns);
+            debug_print(" ns, max: ");
+            debug_print_int(latency_max_ns);
+            debug_print(" ns, jitter: ");
+            debug_print_int(latency_max_ns - latency_min_ns);
+            debug_print(" ns\nlate reads: ");
+            debug_print_int(late_reads);
+            debug_print("\n");
+
+        } else {
+
+            int rate = atoi(args[1]);
+
+            if (rate >= VI_SENSE_MIN_SAMPLE_RATE_HZ && rate <= VI_SENSE_MAX_SAMPLE_RATE_HZ) {
+
+                vi_sense_set_sample_rate(rate);
+
+                debug_print("sample rate set to ");
+                debug_print_int(vi_sense_get_sample_rate());
+                debug_print(" Hz.\n");
+
+            } else {
+
+                debug_print("(!) srate range is <");
+                debug_print_int(VI_SENSE_MIN_SAMPLE_RATE_HZ);
+                debug_print(" - ");
+                debug_print_int(VI_SENSE_MAX_SAMPLE_RATE_HZ);
+                debug_print(">.\n");
+            }
+        }
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // sets the CV, CR and CP control loop rate
+    else if (SHELL_CMD("crate")) {
+
+        if (argc == 1) {
+
+            debug_print("control loop rate: ");
+            debug_print_int(load_get_control_rate());
+            debug_print(" Hz, block rate: ");
+            debug_print_int(vi_sense_get_sample_rate() / VI_SENSE_BLOCK_SIZE);
+            debug_print(" Hz\n");
+
+        } else if (load_set_control_rate(atoi(args[1]))) {
+
+            debug_print("control loop rate set to ");
+            debug_print_int(load_get_control_rate());
+            debug_print(" Hz.\n");
+
+        } else {
+
+            debug_print("(!) crate range is <");
+            debug_print_int(LOAD_CONTROL_LOOP_MIN_RATE_HZ);
+            debug_print(" - ");
+            debug_print_int(LOAD_CONTROL_LOOP_MAX_RATE_HZ);
+            debug_print(">.\n");
+        }
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // configures the dynamic CC mode, prints the configuration without an argument
+    else if (SHELL_CMD("dyn")) {
+
+        load_dynamic_config_t config;
+
+        if (argc == 1) {
+
+            load_get_dynamic_config(&config);
+
+            debug_print("dynamic mode ");
+            debug_print(config.enabled ? "enabled" : "disabled");
+            debug_print(config.running ? ", running" : "");
+            debug_print(config.stretched ? ", ramps don't fit the period" : "");
+            debug_print("\nlevel A: ");
+            debug_print_int(config.level_a_ma);
+            debug_print(" mA, level B: ");
+            debug_print_int(config.level_b_ma);
+            debug_print(" mA\nfrequency: ");
+            debug_print_int(config.frequency_hz);
+            debug_print(" Hz, duty: ");
+            debug_print_int_dec(config.duty_permille * 100, 1);
+            debug_print(" %\n");
+            kernel_sleep_ms(50);
+            debug_print("rise: ");
+            debug_print_int(config.rise_slew);
+            debug_print(" mA/us, fall: ");
+            debug_print_int(config.fall_slew);
+            debug_print(" mA/us\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "on") || COMPARE_ARG(1, "off")) {
+
+            load_set_dynamic_enable(COMPARE_ARG(1, "on"));
+            debug_print(COMPARE_ARG(1, "on") ? "dynamic mode enabled.\n" : "dynamic mode disabled.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "level")) {
+
+            shell_assert_argc(3);
+
+            load_set_dynamic_level(false, atoi(args[2]));
+            load_set_dynamic_level(true, atoi(args[3]));
+        }
+
+        else if (COMPARE_ARG(1, "timing")) {
+
+            shell_assert_argc(2);
+
+            load_set_dynamic_frequency(atoi(args[2]));
+            if (argc > 3) load_set_dynamic_duty(atoi(args[3]));
+        }
+
+        else if (COMPARE_ARG(1, "slew")) {
+
+            shell_assert_argc(2);
+
+            // a single slew rate sets both ramps
+            load_set_dynamic_slew(false, atoi(args[2]));
+            load_set_dynamic_slew(true, atoi((argc > 3) ? args[3] : args[2]));
+        }
+
+        else {
+
+            debug_print("(!) invalid argument. Use \"on\", \"off\", \"level\", \"timing\" or \"slew\".\n");
+            return;
+        }
+
+        // the setters clamp the values to the limits; print what was applied
+        load_get_dynamic_config(&config);
+
+        debug_print("dynamic mode set to ");
+        debug_print_int(config.level_a_ma);
+        debug_print(" / ");
+        debug_print_int(config.level_b_ma);
+        debug_print(" mA, ");
+        debug_print_int(config.frequency_hz);
+        debug_print(" Hz, ");
+        debug_print_int_dec(config.duty_permille * 100, 1);
+        debug_print(" %, ");
+        debug_print_int(config.rise_slew);
+        debug_print(" / ");
+        debug_print_int(config.fall_slew);
+        debug_print(" mA/us.\n");
+        if (config.stretched) debug_print("(!) the ramps don't fit the period, the frequency is lower than set.\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // edits, runs and prints the load sequence
+    else if (SHELL_CMD("seq")) {
+
+        static const char *mode_names[4] = {"cc", "cv", "cr", "cp"};
+        static const char *level_units[4] = {" mA", " mV", " mOhm", " mW"};
+
+        load_sequence_state_t state;
+        load_sequence_step_t step;
+
+        if (argc == 1) {
+
+            load_sequence_get_state(&state);
+
+            debug_print(state.running ? "running step " : "stopped at step ");
+            debug_print_int(state.step);
+            debug_print(" of ");
+            debug_print_int(state.length);
+            debug_print(", loop ");
+            debug_print_int(state.loop);
+            debug_print(", ");
+            debug_print_int(state.step_elapsed_ms);
+            debug_print(" ms in the step, ");
+            debug_print_int(state.elapsed_ms);
+            debug_print(" ms total\n");
+
+            if (state.result & LOAD_SEQUENCE_DONE) debug_print("the last run completed all loops.\n");
+            if (state.result & LOAD_SEQUENCE_CONDITION) debug_print("the last run ended on the stop condition.\n");
+            if (state.result & LOAD_SEQUENCE_ABORTED) debug_print("the last run was stopped.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "add")) {
+
+            shell_assert_argc(3);
+
+            bool off = COMPARE_ARG(2, "off");
+            uint16_t mode = 0;
+            while (mode < 4 && !COMPARE_ARG(2, mode_names[mode])) mode++;
+
+            if (!off && mode == 4) {
+
+                debug_print("(!) invalid mode. Use \"cc\", \"cv\", \"cr\", \"cp\" or \"off\".\n");
+                return;
+            }
+
+            if (!off) shell_assert_argc(4);
+
+            step.mode = off ? LOAD_SEQUENCE_STEP_OFF : mode;
+            step.level = off ? 0 : atoi(args[3]);
+            step.duration_ms = atoi(args[off ? 3 : 4]);
+
+            load_sequence_get_state(&state);
+
+            if (load_sequence_set_step(state.length, &step)) {
+
+                debug_print("step ");
+                debug_print_int(state.length);
+                debug_print(" added.\n");
+
+            } else debug_print("(!) the table is full or the sequence runs.\n");
+
+            return;
+        }
+
+        if (COMPARE_ARG(1, "list")) {
+
+            for (uint32_t index = 0; load_sequence_get_step(index, &step); index++) {
+
+                debug_print_int(index);
+                debug_print(": ");
+
+                if (step.mode & LOAD_SEQUENCE_STEP_OFF) debug_print("off");
+                else {
+
+                    debug_print(mode_names[step.mode & LOAD_SEQUENCE_STEP_MODE]);
+                    debug_print(" ");
+                    debug_print_int(step.level);
+                    debug_print(level_units[step.mode & LOAD_SEQUENCE_STEP_MODE]);
+                }
+
+                debug_print(", ");
+                debug_print_int(step.duration_ms);
+                debug_print(" ms\n");
+
+                if ((index & 0xf) == 0xf) kernel_sleep_ms(50);
+            }
+
+            return;
+        }
+
+        if (COMPARE_ARG(1, "clear")) {
+
+            load_sequence_clear();
+            debug_print("sequence cleared.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "start")) {
+
+            if (load_sequence_start()) debug_print("sequence started.\n");
+            else debug_print("(!) the table is empty or the load can't be enabled.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "stop")) {
+
+            load_sequence_stop();
+            debug_print("sequence stopped.\n");
+            return;
+        }
+
+        debug_print("(!) invalid argument. Use \"add\", \"list\", \"clear\", \"start\" or \"stop\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // runs the battery discharge test and prints its log
+    else if (SHELL_CMD("bat")) {
+
+        load_battery_state_t state;
+        load_battery_get_state(&state);
+
+        if (argc == 1) {
+
+            debug_print(state.running ? "running for " : "stopped after ");
+            debug_print_int(state.elapsed_s);
+            debug_print(" s, internal resistance ");
+            debug_print_int(state.ir / 10);
+            debug_print(".");
+            debug_print_int(state.ir % 10);
+            debug_print(" mOhm, ");
+            debug_print_int(state.log_count);
+            debug_print(" records every ");
+            debug_print_int(state.log_period_s);
+            debug_print(" s\n");
+
+            if (state.result & LOAD_BATTERY_CUTOFF) debug_print("the last test reached the cutoff voltage.\n");
+            if (state.result & LOAD_BATTERY_ABORTED) debug_print("the last test was stopped.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "start")) {
+
+            if (load_battery_start()) debug_print("battery test started.\n");
+            else debug_print("(!) the CV mode can't discharge a battery, the dynamic mode or the MPPT is enabled for a CC test, or the load can't be enabled.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "stop")) {
+
+            load_battery_stop();
+            debug_print("battery test stopped.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "log")) {
+
+            load_battery_record_t record;
+
+            for (uint32_t index = 0; load_battery_get_record(index, &record); index++) {
+
+                debug_print_int(index * state.log_period_s);
+                debug_print(" s: ");
+                debug_print_int(record.voltage * 10);
+                debug_print(" mV, ");
+                debug_print_int(record.current_ma);
+                debug_print(" mA, ");
+                debug_print_int(record.charge_mah);
+                debug_print(" mAh, ");
+                debug_print_int(record.energy_mwh);
+                debug_print(" mWh, ");
+                debug_print_int(record.ir);
+                debug_print(" x0.1 mOhm\n");
+
+                if ((index & 0xf) == 0xf) kernel_sleep_ms(50);
+            }
+
+            return;
+        }
+
+        debug_print("(!) invalid argument. Use \"start\", \"stop\" or \"log\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // runs the I-V sweep and prints its result table
+    else if (SHELL_CMD("sweep")) {
+
+        load_sweep_state_t state;
+        load_sweep_get_state(&state);
+
+        if (argc == 1) {
+
+            debug_print(state.running ? "running, " : "stopped, ");
+            debug_print_int(state.points);
+            debug_print(" points measured in ");
+            debug_print_int(state.duration_us);
+            debug_print(" us\n");
+
+            if (state.result & LOAD_SWEEP_DONE) debug_print("the last sweep measured all points.\n");
+            if (state.result & LOAD_SWEEP_ABORTED) debug_print("the last sweep was stopped.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "start")) {
+
+            if (load_sweep_start()) debug_print("sweep started.\n");
+            else debug_print("(!) the mode is not CC or CV, the dynamic mode is enabled or the load can't be enabled.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "stop")) {
+
+            load_sweep_stop();
+            debug_print("sweep stopped.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "list")) {
+
+            load_sweep_point_t point;
+
+            for (uint32_t index = 0; load_sweep_get_point(index, &point); index++) {
+
+                debug_print_int(index);
+                debug_print(": ");
+                debug_print_int(point.setpoint);
+                debug_print(" -> ");
+                debug_print_int(point.voltage_mv);
+                debug_print(" mV, ");
+                debug_print_int(point.current_ma);
+                debug_print(" mA, ");
+                debug_print_int(point.power_mw);
+                debug_print(" mW\n");
+
+                if ((index & 0xf) == 0xf) kernel_sleep_ms(50);
+            }
+
+            return;
+        }
+
+        debug_print("(!) invalid argument. Use \"start\", \"stop\" or \"list\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // enables the maximum power point tracking, prints the tracked point without an argument
+    else if (SHELL_CMD("mppt")) {
+
+        if (argc == 1) {
+
+            load_mppt_state_t state;
+            load_get_mppt_state(&state);
+
+            debug_print(state.enabled ? (state.tracking ? "tracking at " : "enabled, waiting for the CC mode at ") : "disabled, last point ");
+            debug_print_int(state.voltage_mv);
+            debug_print(" mV, ");
+            debug_print_int(state.current_ma);
+            debug_print(" mA, ");
+            debug_print_int(state.power_mw);
+            debug_print(" mW, efficiency ");
+            debug_print_int(state.efficiency / 10);
+            debug_print(".");
+            debug_print_int(state.efficiency % 10);
+            debug_print(" %, step ");
+            debug_print_int(state.step_ma);
+            debug_print(" mA\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "on") || COMPARE_ARG(1, "off")) {
+
+            load_set_mppt_enable(COMPARE_ARG(1, "on"));
+            debug_print(COMPARE_ARG(1, "on") ? "MPPT enabled.\n" : "MPPT disabled.\n");
+            return;
+        }
+
+        debug_print("(!) invalid argument. Use \"on\" or \"off\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // runs the CC linearization, prints its state and the CC trim without an argument
+    else if (SHELL_CMD("lin")) {
+
+        if (argc == 1) {
+
+            load_linearize_state_t state;
+            load_linearize_get_state(&state);
+
+            debug_print(state.running ? "running, " : "stopped, ");
+            debug_print_int(state.points);
+            debug_print(" points measured, trim ");
+            debug_print_int(state.trim_ma);
+            debug_print(" mA\n");
+
+            if (state.result & LOAD_LINEARIZE_DONE) debug_print("the last linearization fitted the ISET DAC calibration, use \"lin save\" to store it.\n");
+            if (state.result & LOAD_LINEARIZE_ABORTED) debug_print("the last linearization was stopped or the fit failed.\n");
+            if (state.result & LOAD_LINEARIZE_REJECTED) debug_print("the points of the last linearization were rejected, the calibration was kept.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "start")) {
+
+            if (load_linearize_start()) debug_print("linearization started.\n");
+            else debug_print("(!) the dynamic mode or the MPPT is enabled or the load can't be enabled.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "stop")) {
+
+            load_linearize_stop();
+            debug_print("linearization stopped.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "save")) {
+
+            debug_print(load_linearize_save() ? "calibration saved.\n" : "(!) the load is enabled or the flash write failed.\n");
+            return;
+        }
+
+        debug_print("(!) invalid argument. Use \"start\", \"stop\" or \"save\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // prints or sets the runtime parameters
+    else if (SHELL_CMD("param")) {
+
+        int32_t min, max;
+
+        if (argc == 1 || COMPARE_ARG(1, "list")) {
+
+            for (param_id_t id = 0; id < PARAM_COUNT; id++) {
+
+                param_get_limits(id, &min, &max);
+
+                debug_print(param_get_name(id));
+                debug_print(": ");
+                debug_print_int(param_get(id));
+                debug_print(" <");
+                debug_print_int(min);
+                debug_print(" - ");
+                debug_print_int(max);
+                debug_print(">\n");
+
+                if ((id & 0x3) == 0x3) kernel_sleep_ms(50);
+            }
+
+            return;
+        }
+
+        shell_assert_argc(2);
+
+        param_id_t id = param_find(args[2]);
+
+        if (id == PARAM_COUNT) {
+
+            debug_print("(!) unknown parameter. Use \"param list\" to print the parameters.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "get")) {
+
+            debug_print(param_get_name(id));
+            debug_print(": ");
+            debug_print_int(param_get(id));
+            debug_print("\n");
+
+        } else if (COMPARE_ARG(1, "set")) {
+
+            shell_assert_argc(3);
+
+            if (param_set(id, atoi(args[3]))) {
+
+                debug_print(param_get_name(id));
+                debug_print(" set to ");
+                debug_print_int(param_get(id));
+                debug_print(".\n");
+
+            } else {
+
+                param_get_limits(id, &min, &max);
+
+                debug_print("(!) ");
+                debug_print(param_get_name(id));
+                debug_print(" range is <");
+                debug_print_int(min);
+                debug_print(" - ");
+                debug_print_int(max);
+                debug_print(">.\n");
+            }
+
+        } else debug_print("(!) invalid argument. Use \"list\", \"get\" or \"set\".\n");
+    }
+
+#if PROFILING_ENABLED
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // prints the interrupt and task timing statistics
+    else if (SHELL_CMD("prof")) {
+
+        prof_stats_t stats;
+
+        if (argc == 1) {
+
+            debug_print("name: count, nested, min / mean / max [cycles], load\n");
+
+            for (prof_point_t point = 0; point < PROF_COUNT; point++) {
+
+                prof_get_stats(point, &stats);
+                uint32_t load = prof_get_load(point);
+
+                debug_print(prof_get_name(point));
+                debug_print(": ");
+                debug_print_int(stats.count);
+                debug_print(", ");
+                debug_print_int(stats.nested);
+                debug_print(", ");
+                debug_print_int(stats.min);
+                debug_print(" / ");
+                debug_print_int((stats.count > 0) ? (uint32_t)div_u64(stats.sum, stats.count) : 0);
+                debug_print(" / ");
+                debug_print_int(stats.max);
+                debug_print(", ");
+                debug_print_int_dec(load * 10, 2);
+                debug_print(" %\n");
+
+                if ((point & 0x3) == 0x3) kernel_sleep_ms(50);
+            }
+
+            debug_print("(");
+            debug_print_int(CORE_CLOCK_FREQUENCY_HZ / 1000000);
+            debug_print(" cycles per us)\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "reset")) {
+
+            prof_reset();
+            debug_print("profiling statistics cleared.\n");
+            return;
+        }
+
+        if (COMPARE_ARG(1, "hist")) {
+
+            shell_assert_argc(2);
+
+            prof_point_t point = 0;
+            while (point < PROF_COUNT && !COMPARE_ARG(2, prof_get_name(point))) point++;
+
+            if (point == PROF_COUNT) {
+
+                debug_print("(!) unknown handler or task. Use \"prof\" to print the names.\n");
+                return;
+            }
+
+            prof_get_stats(point, &stats);
+
+            for (int bin = 0; bin < PROF_HISTOGRAM_BINS; bin++) {
+
+                debug_print((bin == 0) ? "0" : "");
+                if (bin > 0) debug_print_int(1 << (bin + 4));
+                debug_print((bin == PROF_HISTOGRAM_BINS - 1) ? "+" : " - ");
+                if (bin < PROF_HISTOGRAM_BINS - 1) debug_print_int((1 << (bin + 5)) - 1);
+                debug_print(": ");
+                debug_print_int(stats.histogram[bin]);
+                debug_print("\n");
+
+                if ((bin & 0x7) == 0x7) kernel_sleep_ms(50);
+            }
+
+            return;
+        }
+
+        debug_print("(!) invalid argument. Use \"reset\" or \"hist\".\n");
+    }
+
+#endif
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // configures the measurement filter pipeline
+    else if (SHELL_CMD("filter")) {
+
+        uint16_t config = vi_sense_get_filter();
+
+        if (argc == 1) {
+
+            uint32_t order = (config & LOAD_FILTER_CIC_ORDER) >> LOAD_FILTER_CIC_ORDER_POS;
+            uint32_t decimation = 1 << ((config & LOAD_FILTER_DECIMATION) >> LOAD_FILTER_DECIMATION_POS);
+            uint32_t iir_shift = (config & LOAD_FILTER_IIR_SHIFT) >> LOAD_FILTER_IIR_SHIFT_POS;
+
+            debug_print("median: ");
+            debug_print((config & LOAD_FILTER_MEDIAN) ? "on" : "off");
+            debug_print("\ncic order: ");
+            debug_print_int(order);
+            debug_print(", decimation: ");
+            debug_print_int(decimation);
+            debug_print(" (output every ");
+            debug_print_int(decimation * VI_SENSE_WINDOW_MS);
+            debug_print(" ms)\niir: ");
+
+            if (iir_shift == 0) debug_print("off");
+            else {
+
+                debug_print("time constant ");
+                debug_print_int(1 << iir_shift);
+                debug_print(" outputs");
+            }
+
+            debug_print("\nrounding: ");
+            debug_print((config & LOAD_FILTER_ROUNDING) ? "on" : "off");
+            debug_print("\n");
+
+        } else if (COMPARE_ARG(1, "cic")) {
+
+            shell_assert_argc(3);
+            int order = atoi(args[2]);
+            int decimation_shift = 0;
+
+            while ((1 << decimation_shift) < atoi(args[3]) && decimation_shift < LOAD_FILTER_MAX_DECIMATION) decimation_shift++;
+
+            if (order >= 1 && order <= LOAD_FILTER_MAX_CIC_ORDER) {
+
+                config &= ~(LOAD_FILTER_CIC_ORDER | LOAD_FILTER_DECIMATION);
+                vi_sense_set_filter(config | (order << LOAD_FILTER_CIC_ORDER_POS) | (decimation_shift << LOAD_FILTER_DECIMATION_POS));
+
+                debug_print("cic order set to ");
+                debug_print_int((vi_sense_get_filter() & LOAD_FILTER_CIC_ORDER) >> LOAD_FILTER_CIC_ORDER_POS);
+                debug_print(", decimation set to ");
+                debug_print_int(1 << ((vi_sense_get_filter() & LOAD_FILTER_DECIMATION) >> LOAD_FILTER_DECIMATION_POS));
+                debug_print(".\n");
+
+            } else {
+
+                debug_print("(!) cic order range is <1 - ");
+                debug_print_int(LOAD_FILTER_MAX_CIC_ORDER);
+                debug_print(">.\n");
+            }
+
+        } else if (COMPARE_ARG(1, "iir")) {
+
+            shell_assert_argc(2);
+            int iir_shift = atoi(args[2]);
+
+            if (iir_shift >= 0 && iir_shift <= 7) {
+
+                vi_sense_set_filter((config & ~LOAD_FILTER_IIR_SHIFT) | (iir_shift << LOAD_FILTER_IIR_SHIFT_POS));
+                debug_print("iir time constant set to 2^");
+                debug_print_int(iir_shift);
+                debug_print(" outputs.\n");
+
+            } else debug_print("(!) iir range is <0 - 7>, 0 disables the iir.\n");
+
+        } else if (COMPARE_ARG(1, "median") || COMPARE_ARG(1, "round")) {
+
+            shell_assert_argc(2);
+            uint16_t bit = COMPARE_ARG(1, "median") ? LOAD_FILTER_MEDIAN : LOAD_FILTER_ROUNDING;
+
+            if (COMPARE_ARG(2, "1")) vi_sense_set_filter(config | bit);
+            else if (COMPARE_ARG(2, "0")) vi_sense_set_filter(config & ~bit);
+            else {
+                
+                debug_print("(!) invalid argument. Use \"1\" to enable or \"0\" to disable.\n");
+                return;
+            }
+
+            debug_print(args[1]);
+            debug_print((vi_sense_get_filter() & bit) ? " enabled.\n" : " disabled.\n");
+
+        } else debug_print("(!) invalid argument. Use \"cic\", \"iir\", \"median\" or \"round\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // arms, stops or prints the waveform capture
+    else if (SHELL_CMD("capture")) {
+
+        static const char *trigger_names[] = {"force", "level", "edge", "enable", "fault"};
+        static const char *state_names[] = {"idle", "armed", "triggered", "done"};
+
+        if (argc == 1) {
+
+            debug_print("capture is ");
+            debug_print(state_names[vi_sense_capture_get_state()]);
+            debug_print(", ");
+            debug_print_int(VI_SENSE_CAPTURE_DEPTH);
+            debug_print(" samples, ");
+            debug_print_int(vi_sense_capture_get_pretrigger());
+            debug_print(" before the trigger.\n");
+
+        } else if (COMPARE_ARG(1, "arm")) {
+
+            shell_assert_argc(2);
+
+            int source = 0;
+            while (source <= LOAD_CAPTURE_TRIGGER_FAULT && !COMPARE_ARG(2, trigger_names[source])) source++;
+
+            if (source > LOAD_CAPTURE_TRIGGER_FAULT) {
+
+                debug_print("(!) invalid trigger. Use \"force\", \"level\", \"edge\", \"enable\" or \"fault\".\n");
+                return;
+            }
+
+            uint16_t config = source;
+            int32_t level = 0;
+            uint8_t pretrigger_arg = 3;
+
+            // level and edge triggers need a condition in the <v or i><'>' or '<'><level> format (e.g. v<11500)
+            if (source == LOAD_CAPTURE_TRIGGER_LEVEL || source == LOAD_CAPTURE_TRIGGER_EDGE) {
+
+                shell_assert_argc(3);
+                char *condition = args[3];
+
+                if ((condition[0] != 'v' && condition[0] != 'i') || (condition[1] != '>' && condition[1] != '<')) {
+
+                    debug_print("(!) invalid condition. Use <v or i><'>' or '<'><level_mv or level_ma>.\n");
+                    return;
+                }
+
+                if (condition[0] == 'i') config |= LOAD_CAPTURE_CURRENT;
+                if (condition[1] == '<') config |= LOAD_CAPTURE_FALLING;
+                level = atoi(&condition[2]);
+                pretrigger_arg = 4;
+            }
+
+            uint32_t pretrigger = (argc > pretrigger_arg) ? atoi(args[pretrigger_arg]) : 0;
+            vi_sense_capture_arm(config, level, pretrigger);
+
+            debug_print("capture armed.\n");
+
+        } else if (COMPARE_ARG(1, "stop")) {
+
+            vi_sense_capture_stop();
+            debug_print("capture stopped.\n");
+
+        } else if (COMPARE_ARG(1, "dump")) {
+
+            if (vi_sense_capture_get_state() != LOAD_CAPTURE_DONE) {
+
+                debug_print("(!) there is no completed capture.\n");
+                return;
+            }
+
+            uint32_t start = (argc > 2) ? atoi(args[2]) : 0;
+            uint32_t count = (argc > 3) ? atoi(args[3]) : VI_SENSE_CAPTURE_DEPTH;
+            int32_t voltage_mv, current_ma;
+
+            debug_print("sample, voltage [mV], current [mA] (trigger at sample ");
+            debug_print_int(vi_sense_capture_get_pretrigger());
+            debug_print(")\n");
+
+            for (uint32_t i = start; i < start + count && vi_sense_capture_read(i, &voltage_mv, &current_ma); i++) {
+
+                debug_print_int(i);
+                debug_print(", ");
+                debug_print_int(voltage_mv);
+                debug_print(", ");
+                debug_print_int(current_ma);
+                debug_print("\n");
+
+                // at most 16 lines of 22 characters fit in the tx fifo
+                if ((i & 0xf) == 0xf) kernel_sleep_ms(40);
+            }
+
+        } else debug_print("(!) invalid argument. Use \"arm\", \"stop\" or \"dump\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+    // prints, fits and stores the calibration of the ADCs and the ISET DAC
+    else if (SHELL_CMD("cal")) {
+
+        static const char *channel_names[] = {"vint", "vrem", "isen", "l1", "l2", "r1", "r2", "iset"};
+
+        // find the channel argument
+        int channel = 0;
+        while (argc > 2 && channel < CAL_CHANNEL_COUNT && !COMPARE_ARG(2, channel_names[channel])) channel++;
+
+        if (argc == 1) {
+
+            for (channel = 0; channel < CAL_CHANNEL_COUNT; channel++) {
+
+                const calibration_t *cal = calibration_get(channel);
+
+                debug_print(channel_names[channel]);
+                debug_print(": gain ");
+                debug_print_int(cal->gain);
+                debug_print("/65536, offset ");
+                debug_print_int(cal->offset);
+                debug_print(", correction");
+
+                for (int i = 0; i <= CALIBRATION_SEGMENTS; i++) {
+
+                    debug_print(" ");
+                    debug_print_int(cal->correction[i]);
+                }
+
+                debug_print("\n");
+                if (channel & 1) kernel_sleep_ms(50);
+            }
+
+        } else if (COMPARE_ARG(1, "save")) {
+
+            // the flash is stalled during the sector erase, the calibration is not saved while the load is enabled
+            if (calibration_save()) debug_print("calibration saved.\n");
+            else debug_print((load_get_status() & LOAD_STATUS_ENABLED) ? "(!) disable the load before saving the calibration.\n" : "(!) flash write failed.\n");
+
+        } else if (COMPARE_ARG(1, "clear")) {
+
+            calibration_clear_points();
+            debug_print("calibration points cleared.\n");
+
+        } else if (COMPARE_ARG(1, "point") || COMPARE_ARG(1, "fit") || COMPARE_ARG(1, "reset")) {
+
+            shell_assert_argc(2);
+
+            if (channel == CAL_CHANNEL_COUNT) {
+
+                debug_print("(!) invalid channel. Use \"vint\", \"vrem\", \"isen\", \"l1\", \"l2\", \"r1\", \"r2\" or \"iset\".\n");
+                return;
+            }
+
+            if (COMPARE_ARG(1, "point")) {
+
+                shell_assert_argc(3);
+                uint32_t count = calibration_add_point(channel, atoi(args[3]));
+
+                if (count > 0) {
+
+                    debug_print("point ");
+                    debug_print_int(count);
+                    debug_print(" added.\n");
+
+                } else debug_print("(!) point not added. Check the point count and the voltage sense source.\n");
+
+            } else if (COMPARE_ARG(1, "fit")) {
+
+                debug_print(calibration_fit(channel) ? "calibration fitted, use \"cal save\" to store it.\n" : "(!) at least 2 points with different inputs are required.\n");
+
+            } else {
+
+                calibration_reset(channel);
+                debug_print("nominal calibration restored.\n");
+            }
+
+        } else debug_print("(!) invalid argument. Use \"point\", \"fit\", \"reset\", \"clear\" or \"save\".\n");
+    }
+
+    //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
     // sets the automatic disable voltage level
     else if (SHELL_CMD("vdis")) {
 
@@ -536,6 +1628,8 @@ void shell_update(char *buffer) {
 
         debug_print("\nlist of available commands:\n");
         debug_print("repeat <period_ms> <command> - periodically repeat a command\n");
+        debug_print("stream <<rate_hz> [v][i][p][c][t][r][s] | stop> - stream binary telemetry frames (decode with tools/telemetry_decoder.cpp)\n");
+        kernel_sleep_ms(50);
         debug_print("reboot - restart the system\n");
         debug_print("status - print the load status\n");
         debug_print("clearfaults - clear all load fault flags\n");
@@ -545,12 +1639,41 @@ void shell_update(char *buffer) {
         debug_print("vset <voltage_mv> - set the load CV level\n");
         debug_print("rset <resistance_mr> - set the load CR level\n");
         debug_print("pset <power_mw> - set the load CP level\n");
+        debug_print("dyn <on | off | level <a_ma> <b_ma> | timing <freq_hz> [duty_0.1%] | slew <rise> [fall]> - configure the dynamic CC mode, slew in mA/us\n");
+        kernel_sleep_ms(50);
+        debug_print("seq <add <cc | cv | cr | cp> <level> <duration_ms> | add off <duration_ms> | list | clear | start | stop> - edit and run the load sequence, the seq_* parameters set the loops and the stop condition\n");
+        kernel_sleep_ms(50);
+        debug_print("bat <start | stop | log> - run the battery discharge test and print its log, print the state without an argument; the bat_* parameters set the test\n");
+        kernel_sleep_ms(50);
+        debug_print("sweep <start | stop | list> - run the I-V sweep and print its points, print the state without an argument; the sweep_* parameters set the sweep\n");
+        kernel_sleep_ms(50);
+        debug_print("mppt <on | off> - track the maximum power point in the CC mode, print the tracked point without an argument; the mppt_* parameters set the tracker\n");
+        kernel_sleep_ms(50);
+        debug_print("lin <start | stop | save> - fit the ISET DAC calibration to the ISEN readback up to lin_max_ma, print the state and the CC trim without an argument; the trim* parameters set the trim\n");
+        kernel_sleep_ms(50);
+        debug_print("pid <cv, cr or cp> <kp> <ki> [kd] - set the PID gains of a mode (Q16), print the gains without an argument\n");
+        kernel_sleep_ms(50);
+        debug_print("pid tune [amplitude_ma] - relay autotune of the PID of the running CV, CR or CP mode\n");
         debug_print("vsen - read the load input voltage\n");
         kernel_sleep_ms(50);
         debug_print("isen - read the total load current\n");
         debug_print("isen-int - read the individual current sink currents\n");
         debug_print("psen - read the load power\n");
         debug_print("vsensrc <internal or remote> - set the voltage sense source\n");
+        kernel_sleep_ms(50);
+        debug_print("srate <rate_hz> - set the voltage and current sample rate, print sample timing statistics without an argument\n");
+        debug_print("crate <rate_hz> - set the CV, CR and CP control loop rate, print it without an argument\n");
+        debug_print("param <list | get <name> | set <name> <value>> - print or set the runtime control and protection parameters\n");
+        kernel_sleep_ms(50);
+#if PROFILING_ENABLED
+        debug_print("prof <reset | hist <name>> - print the interrupt and task cycle counts, print a histogram of one of them\n");
+        kernel_sleep_ms(50);
+#endif
+        debug_print("filter <cic <order> <decimation> | iir <0 - 7> | median <1 or 0> | round <1 or 0>> - configure the measurement filter\n");
+        kernel_sleep_ms(50);
+        debug_print("capture <arm <trigger> [<v or i><'>' or '<'><level>] [pretrigger] | stop | dump [start] [count]> - capture raw voltage and current waveforms\n");
+        kernel_sleep_ms(50);
+        debug_print("cal <point <channel> <reference> | fit <channel> | reset <channel> | clear | save> - calibrate the ADCs and the ISET DAC, print the calibration without an argument\n");
         debug_print("vdis <voltage_mv> - disable the load automatically when the source voltage drops bellow a threshold\n");
         debug_print("temp - read the power transistor temperatures\n");
         debug_print("fan <0 - 255> - set the fan pwm\n");
@@ -1,5 +1,7 @@
 #include "debug_uart.h"
 #include "hal/uart.h"
+#include "telemetry.h"
+#include "profiling.h"
 
 //---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -27,10 +29,13 @@ void debug_uart_task(void) {
     uint32_t buffer_pos = 0;        // current index into the message_buffer
 
     uart_init(DEBUG_UART, DEBUG_UART_BAUD, DEBUG_UART_TX_GPIO, DEBUG_UART_RX_GPIO, (char*)&tx_fifo, sizeof(tx_fifo), (char*)&rx_fifo, sizeof(rx_fifo));
+    telemetry_init();
     shell_print_header();
 
     while (1) {
 
+        PROF_TASK_START(PROF_DEBUG_UART_TASK);
+
         uint32_t bytes_parsed = 0;          // limit parsed bytes per update to avoid missed deadlines of other tasks or infinite loop in case of a fault
 
         // handle incomming communication via UART
@@ -57,6 +62,10 @@ void debug_uart_task(void) {
             shell_update(repeat_command);
         }
 
+        // encode and send the telemetry frames while the stream is running
+        telemetry_update();
+
+        PROF_TASK_STOP(PROF_DEBUG_UART_TASK);
         kernel_yield();
     }
 }
@@ -66,6 +75,9 @@ void debug_uart_task(void) {
 // transmits a null-terminated string via DEBUG_UART
 void debug_print(const char *str) {
 
+    // the telemetry stream owns the transmitter
+    if (telemetry_is_streaming()) return;
+
     uart_puts(DEBUG_UART, str);
 }
 
@@ -74,6 +86,8 @@ void debug_print(const char *str) {
 // converts a number to string and sends it via DEBUG_UART
 void debug_print_int(int num) {
 
+    if (telemetry_is_streaming()) return;
+
     uart_puti(DEBUG_UART, num);
 }
 
@@ -82,6 +96,8 @@ void debug_print_int(int num) {
 // divides a number by 1000, converts it to string and sends it via DEBUG_UART with selected number of decimal places
 void debug_print_int_dec(int value, uint8_t dec_places) {
 
+    if (telemetry_is_streaming()) return;
+
     char string[16];        // stores the string generated from the input integer
     int buff_index = 0;     // write head to the string array
     int remainder = value;
@@ -1,5 +1,6 @@
 #include "fan_control.h"
 #include "hal/timer.h"
+#include "profiling.h"
 
 //---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -46,6 +47,8 @@ void fan_regulator_task(void) {
 
         while (timer_get_pwm_duty(FAN1_PWM_TIMER_CH) == target_pwm) kernel_yield();       // nothing to do, yield with low priority
 
+        PROF_TASK_START(PROF_FAN_REGULATOR_TASK);
+
         uint8_t pwm = timer_get_pwm_duty(FAN1_PWM_TIMER_CH);
 
         if (target_pwm > pwm) pwm++;
@@ -53,7 +56,8 @@ void fan_regulator_task(void) {
         
         timer_set_pwm_duty(FAN1_PWM_TIMER_CH, pwm);
         timer_set_pwm_duty(FAN2_PWM_TIMER_CH, pwm);
-        
+
+        PROF_TASK_STOP(PROF_FAN_REGULATOR_TASK);
         kernel_sleep_ms(FAN_RAMP_SLOPE / FAN_PWM_RELOAD_VAL);
     }
 }
@@ -127,7 +131,9 @@ static force_inline void tach_interrupt_handler(uint8_t fan_num) {
 // triggered on a falling edge of FAN1_TACH
 void FAN1_TACH_IRQ_HANDLER(void) {
 
+    PROF_IRQ_ENTER(PROF_FAN1_TACH_IRQ);
     tach_interrupt_handler(FAN1);
+    PROF_IRQ_EXIT(PROF_FAN1_TACH_IRQ);
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -135,7 +141,9 @@ void FAN1_TACH_IRQ_HANDLER(void) {
 // triggered on a falling edge of FAN2_TACH
 void FAN2_TACH_IRQ_HANDLER(void) {
 
+    PROF_IRQ_ENTER(PROF_FAN2_TACH_IRQ);
     tach_interrupt_handler(FAN2);
+    PROF_IRQ_EXIT(PROF_FAN2_TACH_IRQ);
 }
 
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,92 @@
+#include "internal_adc.h"
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// ADC input channels in the scan order
+static const uint8_t scan_channels[INTERNAL_ADC_CHANNEL_COUNT] = {
+
+    ISEN_L1_ADC_CH, ISEN_L2_ADC_CH, ISEN_R1_ADC_CH, ISEN_R2_ADC_CH, TEMP_SEN_L_ADC_CH, TEMP_SEN_R_ADC_CH
+};
+
+// last INTERNAL_ADC_OVERSAMPLING scans written by the DMA; the oldest scan is overwritten continuously
+static volatile uint16_t scan_buffer[INTERNAL_ADC_OVERSAMPLING][INTERNAL_ADC_CHANNEL_COUNT];
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// initializes the analog inputs, starts the continuous scan and waits until the result buffer is filled
+void internal_adc_init(void) {
+
+    rcc_enable_peripheral_clock(ISEN_L1_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_L2_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_R1_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_R2_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(TEMP_SEN_L_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(TEMP_SEN_R_GPIO_CLOCK);
+    gpio_set_mode(ISEN_L1_GPIO, GPIO_MODE_ANALOG);
+    gpio_set_mode(ISEN_L2_GPIO, GPIO_MODE_ANALOG);
+    gpio_set_mode(ISEN_R1_GPIO, GPIO_MODE_ANALOG);
+    gpio_set_mode(ISEN_R2_GPIO, GPIO_MODE_ANALOG);
+    gpio_set_mode(TEMP_SEN_L_GPIO, GPIO_MODE_ANALOG);
+    gpio_set_mode(TEMP_SEN_R_GPIO, GPIO_MODE_ANALOG);
+
+    //---- ADC INIT ----------------------------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(INTERNAL_ADC_CLOCK);
+
+    ADC1_COMMON->CCR = ADC_CCR_ADCPRE_0;    // ADCCLK = PCLK2 / 4
+    INTERNAL_ADC->CR1 = ADC_CR1_SCAN;       // 12bit resolution, scan mode
+    INTERNAL_ADC->SMPR1 = 0;
+    INTERNAL_ADC->SMPR2 = 0;
+    INTERNAL_ADC->SQR1 = (INTERNAL_ADC_CHANNEL_COUNT - 1) << ADC_SQR1_L_Pos;
+    INTERNAL_ADC->SQR3 = 0;
+
+    // the sources have a high impedance; use the longest sample time on all channels
+    for (int i = 0; i < INTERNAL_ADC_CHANNEL_COUNT; i++) {
+
+        uint8_t channel = scan_channels[i];
+
+        if (channel < 10) INTERNAL_ADC->SMPR2 |= INTERNAL_ADC_SAMPLE_TIME << (3 * channel);
+        else INTERNAL_ADC->SMPR1 |= INTERNAL_ADC_SAMPLE_TIME << (3 * (channel - 10));
+
+        INTERNAL_ADC->SQR3 |= channel << (5 * i);
+    }
+
+    //---- DMA INIT ----------------------------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(INTERNAL_ADC_DMA_CLOCK);
+
+    // peripheral to memory, 16bit transfers, memory increment, circular mode over the whole buffer
+    INTERNAL_ADC_DMA_STREAM->CR   = 0;
+    INTERNAL_ADC_DMA_STREAM->PAR  = (uint32_t)&INTERNAL_ADC->DR;
+    INTERNAL_ADC_DMA_STREAM->M0AR = (uint32_t)scan_buffer;
+    INTERNAL_ADC_DMA_STREAM->NDTR = INTERNAL_ADC_OVERSAMPLING * INTERNAL_ADC_CHANNEL_COUNT;
+    INTERNAL_ADC_DMA_STREAM->FCR  = 0;
+    INTERNAL_ADC_DMA_STREAM->CR   = (INTERNAL_ADC_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_CIRC;
+    INTERNAL_ADC_DMA->LIFCR = DMA_LIFCR_CTCIF0;
+    INTERNAL_ADC_DMA_STREAM->CR  |= DMA_SxCR_EN;
+
+    //---- START -------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // continuous conversion, a DMA request after every conversion
+    INTERNAL_ADC->CR2 = ADC_CR2_CONT | ADC_CR2_DMA | ADC_CR2_DDS | ADC_CR2_ADON;
+    INTERNAL_ADC->CR2 |= ADC_CR2_SWSTART;
+
+    // the first pass through the buffer takes about 2ms
+    while (!(INTERNAL_ADC_DMA->LISR & DMA_LISR_TCIF0));
+    INTERNAL_ADC_DMA->LIFCR = DMA_LIFCR_CTCIF0;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the average ADC code of the last INTERNAL_ADC_OVERSAMPLING conversions of a channel with 4 fractional bits
+uint32_t internal_adc_read(internal_adc_channel_t channel) {
+
+    if (channel >= INTERNAL_ADC_CHANNEL_COUNT) return 0;
+
+    uint32_t sum = 0;
+    for (int i = 0; i < INTERNAL_ADC_OVERSAMPLING; i++) sum += scan_buffer[i][channel];
+
+    return ((sum * 16) / INTERNAL_ADC_OVERSAMPLING);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
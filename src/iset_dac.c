@@ -1,12 +1,203 @@
 #include "iset_dac.h"
+#include "calibration.h"
 #include "hal/spi.h"
 #include "hal/timer.h"
+#include "fixed_point.h"
+#include "param.h"
+#include "profiling.h"
 
 //---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
 
 static volatile bool is_in_transient = false;   // ISET_DAC is in a slew limited transient
 static volatile int32_t current_code = 0;       // most recent code sent to the DAC (used in slew limit logic)
 static uint16_t target_code = 0;                // target DAC code in slew limited ramp
+static int64_t ramp_position = 0;               // DAC code of the running ramp with 16 fractional bits; the fraction accumulates the slow ramps
+static int32_t ramp_step = 0;                   // DAC code change per slew timer interrupt of the running ramp (Q16)
+static int32_t slew_step_up = 0;                // DAC code change per slew timer interrupt of a current rise and fall (Q16, unsigned)
+static int32_t slew_step_down = 0;
+static volatile int32_t trim_ma = 0;            // offset added to the currents converted to DAC codes by the CC trim [mA]
+static volatile uint32_t write_count = 0;       // number of codes written to the DAC; the CC trim only uses the windows without a write
+
+static volatile bool dma_transfer_pending = false;  // a frame is in progress; SS is released by the SPI RXNE interrupt
+static uint16_t dma_code = 0;                       // source of the frame in progress
+static volatile bool mailbox_full = false;          // a code waits for the end of the frame in progress; a newer code replaces it (the latest write wins)
+static uint16_t mailbox_code = 0;
+
+// two-level waveform of the dynamic mode
+typedef enum {
+
+    WAVEFORM_RISE,      // ramp from level A to level B
+    WAVEFORM_HIGH,      // hold at level B
+    WAVEFORM_FALL,      // ramp from level B to level A
+    WAVEFORM_LOW        // hold at level A
+
+} waveform_phase_t;
+
+static volatile bool waveform_running = false;      // the slew timer runs the waveform instead of the static ramps
+static iset_dac_waveform_t waveform;                // running waveform
+static iset_dac_waveform_t next_waveform;           // waveform applied at the start of the next period
+static volatile bool waveform_update_pending = false;
+static waveform_phase_t waveform_phase = WAVEFORM_FALL;
+static int32_t waveform_code = 0;                   // DAC code of the waveform
+static uint32_t hold_remaining_us = 0;              // rest of a hold longer than the timer range
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// sets up the slew timer counter and its update interrupt; the counter is left stopped
+static void __timer_setup(uint32_t frequency, uint32_t reload) {
+
+    timer_init_counter(ISET_DAC_TIMER, frequency, TIMER_DIR_UP, reload);
+
+    ISET_DAC_TIMER->CR1 |= TIM_CR1_URS;
+    ISET_DAC_TIMER->CR1 &= ~TIM_CR1_ARPE;       // the waveform writes the reload of the running period
+    ISET_DAC_TIMER->EGR |= TIM_EGR_UG;
+    ISET_DAC_TIMER->DIER |= TIM_DIER_UIE;
+    ISET_DAC_TIMER->SR &= ~TIM_SR_UIF;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// pulls SS low and starts the DMA transfer of a code; the SPI interrupt releases SS at the end of the frame
+static void __start_frame(uint16_t code) {
+
+    dma_transfer_pending = true;
+    dma_code = code;
+
+    gpio_write(ISET_DAC_SPI_SS_GPIO, LOW);
+
+    ISET_DAC_DMA->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+    ISET_DAC_DMA_STREAM->NDTR = 1;
+    ISET_DAC_DMA_STREAM->CR  |= DMA_SxCR_EN;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// starts the frame of a code, or leaves the code in the mailbox if a frame is in progress; never waits for the bus
+// the writers run in the tasks and in interrupts of all priorities, so the check of the frame and the mailbox update can't be split
+static void __post(uint16_t code) {
+
+    __disable_irq();
+
+    current_code = code;
+    write_count++;
+
+    if (dma_transfer_pending) {
+
+        mailbox_code = code;
+        mailbox_full = true;
+
+    } else __start_frame(code);
+
+    __enable_irq();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the time to the next waveform interrupt; holds longer than the 16bit timer range are split into 32768us parts
+static void __waveform_schedule(uint32_t time_us) {
+
+    uint32_t ticks = (time_us > 0xffff) ? 0x8000 : time_us;
+    hold_remaining_us = time_us - ticks;
+
+    ISET_DAC_TIMER->ARR = ticks - 1;
+
+    // the interrupt was delayed past the new reload; update at the next count instead of after the counter wraps around
+    if (ISET_DAC_TIMER->CNT >= ticks - 1) ISET_DAC_TIMER->CNT = ticks - 1;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// moves the waveform code one step towards the target; returns true when the target is reached
+static bool __waveform_ramp(int32_t target, int32_t step) {
+
+    int32_t distance = target - waveform_code;
+    if (distance < 0) distance = -distance;
+
+    // the last step is shortened to the target
+    if (step == 0 || distance <= step) {
+
+        waveform_code = target;
+        return true;
+    }
+
+    waveform_code += (waveform_code < target) ? step : -step;
+    return false;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// advances the waveform by a ramp step or to the next phase; called from the slew timer interrupt
+static void __waveform_update(void) {
+
+    // a long hold continues
+    if (hold_remaining_us > 0) {
+
+        __waveform_schedule(hold_remaining_us);
+        return;
+    }
+
+    switch (waveform_phase) {
+
+        // the period starts with the rise; a new waveform is applied here so the running period is not broken
+        case WAVEFORM_LOW:
+
+            if (waveform_update_pending) {
+
+                waveform = next_waveform;
+                waveform_update_pending = false;
+            }
+
+            waveform_phase = WAVEFORM_RISE;
+            /* fall through */
+
+        case WAVEFORM_RISE:
+
+            if (__waveform_ramp(waveform.code_b, waveform.rise_step)) {
+
+                waveform_phase = WAVEFORM_HIGH;
+                __waveform_schedule(waveform.high_us);
+
+            } else __waveform_schedule(ISET_DAC_RAMP_PERIOD_US);
+            break;
+
+        case WAVEFORM_HIGH:
+
+            waveform_phase = WAVEFORM_FALL;
+            /* fall through */
+
+        case WAVEFORM_FALL:
+
+            if (__waveform_ramp(waveform.code_a, waveform.fall_step)) {
+
+                waveform_phase = WAVEFORM_LOW;
+                __waveform_schedule(waveform.low_us);
+
+            } else __waveform_schedule(ISET_DAC_RAMP_PERIOD_US);
+            break;
+    }
+
+    __post(waveform_code);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the DAC code change per slew timer interrupt of a slew rate [mA/s] with 16 fractional bits; the DAC has 1.4919 codes per mA (ISET_DAC_LSB_PER_MA)
+static int32_t __slew_step(uint32_t rate_ma_per_s) {
+
+    uint64_t ma_per_interrupt_q16 = div_u64((uint64_t)rate_ma_per_s << 16, ISET_DAC_TIMER_FREQUENCY);
+    uint64_t step = div_u64(ma_per_interrupt_q16 * 14919, 10000);
+
+    return (step > INT32_MAX) ? INT32_MAX : (int32_t)step;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// recomputes the slew steps from the slew rate parameters; a running ramp keeps its step
+void __iset_dac_apply_slew_rate(void) {
+
+    slew_step_up = __slew_step(param_get(PARAM_SLEW_RATE_UP));
+    slew_step_down = __slew_step(param_get(PARAM_SLEW_RATE_DOWN));
+}
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -28,19 +219,28 @@ void iset_dac_init(void) {
 
     // software slave management, 16bit format, master mode, baud divisor
     ISET_DAC_SPI->CR1  = SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_DFF | SPI_CR1_MSTR | ISET_DAC_SPI_DIV;
-    ISET_DAC_SPI->CR2  = 0;
+    ISET_DAC_SPI->CR2  = SPI_CR2_TXDMAEN | SPI_CR2_RXNEIE;     // transmitted data is moved by the DMA, the received word marks the end of the frame
     ISET_DAC_SPI->CR1 |= SPI_CR1_SPE;       // spi enable
 
+    // the DMA moves a single code per frame
+    rcc_enable_peripheral_clock(ISET_DAC_DMA_CLOCK);
+
+    ISET_DAC_DMA_STREAM->CR   = 0;
+    ISET_DAC_DMA_STREAM->PAR  = (uint32_t)&ISET_DAC_SPI->DR;
+    ISET_DAC_DMA_STREAM->M0AR = (uint32_t)&dma_code;
+    ISET_DAC_DMA_STREAM->FCR  = 0;
+    ISET_DAC_DMA_STREAM->CR   = (ISET_DAC_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_DIR_0;
+
+    NVIC_SetPriority(ISET_DAC_SPI_IRQ, 0);
+    NVIC_EnableIRQ(ISET_DAC_SPI_IRQ);
+
     iset_dac_write_code(0xffff);
 
+    __iset_dac_apply_slew_rate();
+
     // setup the timer to trigger an interrupt in regular interval while the load current is in transition
     // set the timer frequency at 10x the required interrupt frequency and reload at 9 (interrupt every 10 counts)
-    timer_init_counter(ISET_DAC_TIMER, ISET_DAC_TIMER_FREQUENCY * 10, TIMER_DIR_UP, 9);
-
-    ISET_DAC_TIMER->CR1 |= TIM_CR1_URS;
-    ISET_DAC_TIMER->EGR |= TIM_EGR_UG;
-    ISET_DAC_TIMER->DIER |= TIM_DIER_UIE;
-    ISET_DAC_TIMER->SR &= ~TIM_SR_UIF;
+    __timer_setup(ISET_DAC_TIMER_FREQUENCY * 10, 9);
 
     NVIC_SetPriority(ISET_DAC_TIMER_IRQ, 1);
     NVIC_EnableIRQ(ISET_DAC_TIMER_IRQ);
@@ -51,27 +251,90 @@ void iset_dac_init(void) {
 // sets the I_SET DAC output voltage to the corresponding current value
 void iset_dac_set_current(uint32_t current_ma, bool slew_limit) {
 
+    uint16_t code = iset_dac_current_to_code(current_ma);
+
     if (slew_limit) {       // change the DAC value in regular intervals until the target current is reached
 
-        target_code = ISET_DAC_MA_TO_CODE(current_ma);
+        // the waveform owns the slew timer; the level is set again when the waveform stops
+        if (waveform_running) return;
+
+        // a ramp in progress is redirected from the last written code
+        timer_stop_count(ISET_DAC_TIMER);
+
+        // the DAC is inverted; a lower code is a higher current
+        target_code = code;
+        ramp_position = (int64_t)current_code << 16;
+        ramp_step = (code < current_code) ? -slew_step_up : slew_step_down;
+
         is_in_transient = true;
         timer_start_count(ISET_DAC_TIMER);
 
-    } else iset_dac_write_code(ISET_DAC_MA_TO_CODE(current_ma));
+    } else iset_dac_write_code(code);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// returns the calibrated DAC code of a current; the CC trim offset is included
+uint16_t iset_dac_current_to_code(uint32_t current_ma) {
+
+    int32_t trimmed_ma = (int32_t)current_ma + trim_ma;
+    if (trimmed_ma < 0) trimmed_ma = 0;
+
+    int32_t code = calibration_apply(CAL_ISET_DAC, trimmed_ma);
+
+    // check limits
+    if (code < 0x0000) code = 0x0000;
+    if (code > 0xffff) code = 0xffff;
+
+    return (code);
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-// writes the specified 16bit code to the ISET_DAC
+// sets the offset added to the currents converted to DAC codes [mA]; the code already written is not changed
+void iset_dac_set_trim(int32_t offset_ma) {
+
+    trim_ma = offset_ma;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// returns the offset added to the currents converted to DAC codes [mA]
+int32_t iset_dac_get_trim(void) {
+
+    return (trim_ma);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// writes the specified 16bit code to the ISET_DAC by the DMA without waiting for the frame; SS is released by the SPI interrupt at the end of the frame
+// a code written during a frame waits in the mailbox and is replaced by any newer code, so the last written code always reaches the DAC
 void iset_dac_write_code(uint16_t code) {
 
-    gpio_write(ISET_DAC_SPI_SS_GPIO, LOW);
-    spi_write(ISET_DAC_SPI, code);
+    // a slew limited ramp in progress is abandoned
+    if (is_in_transient) {
 
-    while (!spi_tx_done(ISET_DAC_SPI));
-    gpio_write(ISET_DAC_SPI_SS_GPIO, HIGH);
+        timer_stop_count(ISET_DAC_TIMER);
+        is_in_transient = false;
+    }
 
-    current_code = code;
+    __post(code);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// returns the most recent code sent to the ISET_DAC
+uint16_t iset_dac_get_code(void) {
+
+    return (current_code);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// returns the number of codes written to the ISET_DAC (wraps around)
+uint32_t iset_dac_get_write_count(void) {
+
+    return (write_count);
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -82,37 +345,132 @@ bool iset_dac_is_in_transient(void) {
     return (is_in_transient);
 }
 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// starts a two-level waveform; the DAC ramps from its present code to level A with the fall slew and the first period starts after the hold at level A
+void iset_dac_start_waveform(const iset_dac_waveform_t *new_waveform) {
+
+    iset_dac_stop_waveform();
+
+    // a static ramp in progress is abandoned; the waveform continues from the present code
+    timer_stop_count(ISET_DAC_TIMER);
+    is_in_transient = false;
+
+    waveform = *new_waveform;
+    waveform_update_pending = false;
+    waveform_phase = WAVEFORM_FALL;
+    waveform_code = current_code;
+    hold_remaining_us = 0;
+
+    __timer_setup(ISET_DAC_WAVEFORM_TIMER_FREQUENCY, ISET_DAC_RAMP_PERIOD_US - 1);
+
+    waveform_running = true;
+    timer_start_count(ISET_DAC_TIMER);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// changes the running waveform at the start of the next period (before the rise to level B)
+void iset_dac_update_waveform(const iset_dac_waveform_t *new_waveform) {
+
+    __disable_irq();
+
+    next_waveform = *new_waveform;
+    waveform_update_pending = true;
+
+    __enable_irq();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// stops the waveform and returns the slew timer to the static ramps; the DAC keeps the last code
+void iset_dac_stop_waveform(void) {
+
+    if (!waveform_running) return;
+
+    timer_stop_count(ISET_DAC_TIMER);
+    waveform_running = false;
+
+    // a pending update interrupt is cleared by the setup and finds no flag
+    __timer_setup(ISET_DAC_TIMER_FREQUENCY * 10, 9);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// returns true while a waveform is running
+bool iset_dac_is_waveform_running(void) {
+
+    return (waveform_running);
+}
+
 //---- IRQ HANDLERS ----------------------------------------------------------------------------------------------------------------------------------------------
 
-// triggered in regular intervals while the load current is in transient to slowly ramp the dac
-void ISET_DAC_TIMER_IRQ_HANDLER(void) {
+// triggered at the end of every SPI frame; releases SS so the DAC latches the code and starts the frame of the code waiting in the mailbox
+void ISET_DAC_SPI_IRQ_HANDLER(void) {
 
-    if (bit_is_set(ISET_DAC_TIMER->SR, TIM_SR_UIF)) {
+    PROF_IRQ_ENTER(PROF_ISET_DAC_SPI_IRQ);
 
-        if (current_code < target_code) {       // negative DAC ramp (positive current ramp)
+    if (bit_is_set(ISET_DAC_SPI->SR, SPI_SR_RXNE)) {
 
-            current_code -= ISET_DAC_LSB_PER_MA(SLEW_LIMIT_AMPS_PER_SECOND);
-            if (current_code >= target_code) {      // target value reached, stop count
-                
-                current_code = target_code;
-                is_in_transient = false;
-                timer_stop_count(ISET_DAC_TIMER);
-            }
+        (void)ISET_DAC_SPI->DR;     // nothing is connected to MISO; the read clears the flag
 
-        } else {                                // positive DAC ramp (negative current ramp)
+        if (dma_transfer_pending) {
 
-            current_code += ISET_DAC_LSB_PER_MA(SLEW_LIMIT_AMPS_PER_SECOND);
-            if (current_code <= target_code) {      // target value reached, stop count    
-                
-                current_code = target_code;
-                is_in_transient = false;
-                timer_stop_count(ISET_DAC_TIMER);
-            }
+            gpio_write(ISET_DAC_SPI_SS_GPIO, HIGH);
+
+            // the DMA setup keeps SS high for well over the minimum of the DAC
+            if (mailbox_full) {
+
+                mailbox_full = false;
+                __start_frame(mailbox_code);
+
+            } else dma_transfer_pending = false;
         }
+    }
+
+    PROF_IRQ_EXIT(PROF_ISET_DAC_SPI_IRQ);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+// triggered at ISET_DAC_TIMER_FREQUENCY while the load current is in transient to ramp the dac at the rise or fall slew rate
+void ISET_DAC_TIMER_IRQ_HANDLER(void) {
+
+    PROF_IRQ_ENTER(PROF_ISET_DAC_TIMER_IRQ);
+
+    // the dynamic mode waveform replaces the static ramps
+    if (waveform_running && bit_is_set(ISET_DAC_TIMER->SR, TIM_SR_UIF)) {
+
+        clear_bits(ISET_DAC_TIMER->SR, TIM_SR_UIF);
+        __waveform_update();
+
+    // an update left pending by an abandoned ramp must not overwrite the code which replaced it
+    } else if (bit_is_set(ISET_DAC_TIMER->SR, TIM_SR_UIF) && !is_in_transient) {
 
-        iset_dac_write_code(current_code);
         clear_bits(ISET_DAC_TIMER->SR, TIM_SR_UIF);
+
+    } else if (bit_is_set(ISET_DAC_TIMER->SR, TIM_SR_UIF)) {
+
+        clear_bits(ISET_DAC_TIMER->SR, TIM_SR_UIF);
+
+        ramp_position += ramp_step;
+
+        int32_t code = ramp_position >> 16;
+        bool done = (ramp_step < 0) ? (code <= target_code) : (code >= target_code);
+
+        if (done) code = target_code;
+
+        // the step is written by the DMA without waiting for the frame; a step posted during a frame is replaced by the next one, the target is never lost
+        __post(code);
+
+        if (done) {
+
+            is_in_transient = false;
+            timer_stop_count(ISET_DAC_TIMER);
+        }
     }
+
+    PROF_IRQ_EXIT(PROF_ISET_DAC_TIMER_IRQ);
 }
 
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
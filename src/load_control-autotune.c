@@ -0,0 +1,254 @@
+#include "load_control.h"
+#include "cmd_spi_driver.h"
+#include "fixed_point.h"
+
+extern load_mode_t load_mode;
+extern bool enabled;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+int32_t __pid_get_output(void);
+void __pid_resume(int32_t output);
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static load_autotune_state_t autotune_state = LOAD_AUTOTUNE_IDLE;
+
+// relay; the control loop interrupt switches the ISET DAC between center + amplitude and center - amplitude when the error crosses the hysteresis band
+static volatile bool relay_active = false;          // the control loop interrupt runs the relay instead of the PID
+static volatile bool relay_timeout = false;         // the relay finished without enough oscillation periods
+static int32_t relay_center = 0;                    // PID output at the start of the autotune [DAC codes]
+static int32_t relay_amplitude = 0;                 // [DAC codes]
+static bool relay_high = false;                     // the relay output is center + amplitude
+
+// oscillation measurement
+static uint32_t update_count = 0;                   // number of relay updates since the start
+static uint32_t timeout_updates = 0;                // the relay is stopped after this many updates
+static uint32_t period_start = 0;                   // update of the last rising relay switch
+static int32_t error_max = 0, error_min = 0;        // error extremes during the current period
+static uint32_t periods = 0;                        // number of completed periods
+static uint32_t amplitude_sum = 0;                  // sum of the measured error amplitudes (half of peak-to-peak)
+static uint32_t period_sum = 0;                     // sum of the measured periods [updates]
+
+// result of the last autotune
+static uint32_t ultimate_period = 0;                // [updates]
+static uint32_t oscillation_amplitude = 0;          // [mV or mW]
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the integer square root of a 64bit number
+static uint32_t __isqrt64(uint64_t x) {
+
+    uint64_t root = 0, bit = 1ULL << 62;
+
+    while (bit > x) bit >>= 2;
+
+    while (bit != 0) {
+
+        if (x >= root + bit) {
+
+            x -= root + bit;
+            root = (root >> 1) + bit;
+
+        } else root >>= 1;
+
+        bit >>= 2;
+    }
+
+    return (root);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the autotune state and updates the AUTOTUNE register
+static void __set_state(load_autotune_state_t state) {
+
+    autotune_state = state;
+    cmd_write(CMD_ADDRESS_AUTOTUNE, state);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the relay and hands the ISET DAC back to the PID at the operating point; called from the control loop interrupt
+static void __relay_stop(bool timeout) {
+
+    relay_timeout = timeout;
+    relay_active = false;
+    __pid_resume(relay_center);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the relay instead of the PID while the autotune is active; returns false if the PID should run; called from the control loop interrupt
+bool __autotune_update(int32_t error, int32_t *output) {
+
+    if (!relay_active) return false;
+
+    update_count++;
+
+    if (error > error_max) error_max = error;
+    if (error < error_min) error_min = error;
+
+    // the relay switches down when the error falls below the hysteresis band
+    if (relay_high && error < -LOAD_AUTOTUNE_HYSTERESIS) relay_high = false;
+
+    // the relay switches up when the error rises above the hysteresis band; this closes a period
+    else if (!relay_high && error > LOAD_AUTOTUNE_HYSTERESIS) {
+
+        relay_high = true;
+
+        // the first periods settle the oscillation and are not measured
+        if (periods >= LOAD_AUTOTUNE_SETTLE_PERIODS) {
+
+            amplitude_sum += (error_max - error_min) / 2;
+            period_sum += update_count - period_start;
+        }
+
+        period_start = update_count;
+        error_max = error;
+        error_min = error;
+
+        if (++periods == LOAD_AUTOTUNE_SETTLE_PERIODS + LOAD_AUTOTUNE_MEASURED_PERIODS) {
+
+            __relay_stop(false);
+            return false;
+        }
+    }
+
+    if (update_count >= timeout_updates) {
+
+        __relay_stop(true);
+        return false;
+    }
+
+    *output = relay_high ? (relay_center + relay_amplitude) : (relay_center - relay_amplitude);
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// computes the new gains after the relay has stopped; called periodically by the load_control_task
+void __autotune_finish(void) {
+
+    if (autotune_state != LOAD_AUTOTUNE_RUNNING || relay_active) return;
+
+    if (relay_timeout || !enabled) {
+
+        __set_state(LOAD_AUTOTUNE_FAILED);
+        return;
+    }
+
+    uint32_t amplitude = amplitude_sum / LOAD_AUTOTUNE_MEASURED_PERIODS;
+    uint32_t period = period_sum / LOAD_AUTOTUNE_MEASURED_PERIODS;
+
+    oscillation_amplitude = amplitude;
+    ultimate_period = period;
+
+    // the oscillation must be clearly outside of the hysteresis band; the shortest possible period is two updates (the relay switches every update)
+    if (amplitude <= 2 * LOAD_AUTOTUNE_HYSTERESIS || period < 2) {
+
+        __set_state(LOAD_AUTOTUNE_FAILED);
+        return;
+    }
+
+    // describing function of a relay with hysteresis: Ku = 4 * d / (pi * sqrt(a^2 - e^2))
+    uint32_t effective_amplitude = __isqrt64((uint64_t)amplitude * amplitude - LOAD_AUTOTUNE_HYSTERESIS * LOAD_AUTOTUNE_HYSTERESIS);
+
+    // Tyreus-Luyben PI tuning: Kp = Ku / 3.2, Ti = 2.2 * Tu; 4 / (3.2 * pi) = 0.39789 is 26076 in Q16
+    // ki = kp / Ti per update; the sum of the periods keeps the fractional part of the period
+    pid_gains_t gains;
+    uint64_t kp = div_u64((uint64_t)relay_amplitude * 26076, effective_amplitude);
+    uint64_t ki = div_u64(kp * 10 * LOAD_AUTOTUNE_MEASURED_PERIODS, 22 * period_sum);
+
+    gains.kp = (kp > LOAD_PID_MAX_GAIN) ? LOAD_PID_MAX_GAIN : kp;
+    gains.ki = (ki > LOAD_PID_MAX_GAIN) ? LOAD_PID_MAX_GAIN : (ki == 0) ? 1 : ki;
+    gains.kd = 0;
+
+    // the control loop interrupt picks up the new gains without a bump in the output
+    load_set_pid_gains(load_mode, &gains);
+    __set_state(LOAD_AUTOTUNE_DONE);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the PID autotune of the running CV, CR or CP regulation; the relay oscillates the load current by +-amplitude_ma around the operating point
+// returns false if the load is not regulating in CV, CR or CP mode or the operating point is too close to the current limits
+bool load_autotune_start(uint32_t amplitude_ma) {
+
+    if (!enabled || load_mode == LOAD_MODE_CC || relay_active) return false;
+    if (amplitude_ma == 0 || amplitude_ma > LOAD_MAX_CC_LEVEL_MA) return false;
+
+    int32_t amplitude = -ISET_DAC_LSB_PER_MA(amplitude_ma);
+
+    __disable_irq();
+
+    int32_t center = __pid_get_output();
+
+    // the relay output must stay within the DAC range on both sides of the operating point
+    if (center - amplitude < 0 || center + amplitude > ISET_DAC_ZERO_LEVEL_CODE) {
+
+        __enable_irq();
+        return false;
+    }
+
+    relay_center = center;
+    relay_amplitude = amplitude;
+    relay_high = false;
+    relay_timeout = false;
+
+    update_count = 0;
+    timeout_updates = load_get_control_rate() * (LOAD_AUTOTUNE_TIMEOUT_MS / 100) / 10;
+    period_start = 0;
+    error_max = INT32_MIN;
+    error_min = INT32_MAX;
+    periods = 0;
+    amplitude_sum = 0;
+    period_sum = 0;
+
+    relay_active = true;
+
+    __enable_irq();
+
+    __set_state(LOAD_AUTOTUNE_RUNNING);
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// aborts a running autotune; the PID continues from the operating point with the previous gains
+void load_autotune_abort(void) {
+
+    __disable_irq();
+
+    if (relay_active) {
+
+        relay_active = false;
+        __pid_resume(relay_center);
+    }
+
+    __enable_irq();
+
+    if (autotune_state == LOAD_AUTOTUNE_RUNNING) __set_state(LOAD_AUTOTUNE_IDLE);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the last autotune
+load_autotune_state_t load_autotune_get_state(void) {
+
+    return (autotune_state);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the last autotune and the measured ultimate period [us] and oscillation amplitude [mV or mW]
+load_autotune_state_t load_autotune_get_result(uint32_t *period_us, uint32_t *amplitude) {
+
+    *period_us = ultimate_period * (1000000 / load_get_control_rate());
+    *amplitude = oscillation_amplitude;
+
+    return (autotune_state);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,366 @@
+#include "load_control.h"
+#include "iset_dac.h"
+#include "vi_sense.h"
+#include "fixed_point.h"
+#include "param.h"
+#include "profiling.h"
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static volatile bool battery_running = false;
+static bool applying_setting = false;               // the load settings are changed by the battery test
+static uint16_t result = 0;                         // load_battery_ctrl_t result flag of the last test
+
+// settings of the running test
+static load_mode_t mode;
+static uint32_t level;                              // discharge level [mA, mOhm or mW]
+static uint32_t pulse_level;                        // level during the internal resistance pulse
+
+static kernel_time_t start_time;                    // test start [ms]
+static kernel_time_t end_time;                      // test end [ms]
+static kernel_time_t last_ir_time;                  // start of the last internal resistance measurement [ms]
+static kernel_time_t last_log_time;                 // time of the last log record [ms]
+static kernel_time_t below_cutoff_time;             // time the voltage dropped under the cutoff [ms]
+static bool below_cutoff = false;                   // the voltage is under the cutoff and didn't rise above the hysteresis since
+static vi_sense_block_sums_t cutoff_sums;           // block sums at the start of the cutoff check window
+static uint32_t ir = 0;                             // last internal resistance measurement [0.1 mOhm]
+
+static load_battery_record_t records[BATTERY_LOG_RECORDS];
+static uint32_t log_count = 0;
+static uint32_t log_period_s = BATTERY_DEFAULT_LOG_INTERVAL_S;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// updates the BAT_CTRL and BAT_IR registers
+static void __update_registers(void) {
+
+    cmd_write(CMD_ADDRESS_BAT_CTRL, (battery_running ? LOAD_BATTERY_RUN : 0) | result);
+    cmd_write(CMD_ADDRESS_BAT_IR, (ir > 0xffff) ? 0xffff : ir);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the charge [mAh] and the energy [mWh] since the test start
+static void __read_integrals(uint32_t *charge_mah, uint32_t *energy_mwh) {
+
+    int64_t charge_uas, energy_uws;
+    vi_sense_read_integrals(&charge_uas, &energy_uws);
+
+    *charge_mah = (charge_uas > 0) ? div_u64(charge_uas, 1000 * 60 * 60) : 0;
+    *energy_mwh = (energy_uws > 0) ? div_u64(energy_uws, 1000 * 60 * 60) : 0;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// appends a record with the latest measurement to the log; a full log drops every other record and doubles the period
+static void __log_record(void) {
+
+    if (log_count == BATTERY_LOG_RECORDS) {
+
+        for (uint32_t i = 0; i < BATTERY_LOG_RECORDS / 2; i++) records[i] = records[2 * i];
+
+        log_count = BATTERY_LOG_RECORDS / 2;
+        log_period_s *= 2;
+    }
+
+    vi_sense_snapshot_t measurement;
+    vi_sense_read_snapshot(&measurement);
+
+    uint32_t charge_mah, energy_mwh;
+    __read_integrals(&charge_mah, &energy_mwh);
+
+    load_battery_record_t *record = &records[log_count++];
+    record->voltage = measurement.voltage_mv / 10;
+    record->current_ma = measurement.current_ma;
+    record->charge_mah = (charge_mah > 0xffff) ? 0xffff : charge_mah;
+    record->energy_mwh = (energy_mwh > 0xffff) ? 0xffff : energy_mwh;
+    record->ir = (ir > 0xffff) ? 0xffff : ir;
+
+    cmd_write(CMD_ADDRESS_BAT_LOG_COUNT, log_count);
+    cmd_write(CMD_ADDRESS_BAT_LOG_PERIOD, log_period_s);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// ends the test with a result flag; the load is disabled unless somebody else took it over
+static void __battery_end(uint16_t end_result, bool disable) {
+
+    battery_running = false;
+    result = end_result;
+    end_time = kernel_get_time_ms();
+
+    if (disable) {
+
+        applying_setting = true;
+        load_set_enable(false);
+        applying_setting = false;
+    }
+
+    __update_registers();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// switches between the discharge level and the internal resistance pulse level
+static void __set_pulse(bool pulse) {
+
+    uint32_t value = pulse ? pulse_level : level;
+
+    // the CC pulse edges skip the slew limit; the ramp would take most of the pulse
+    if (mode == LOAD_MODE_CC) iset_dac_set_current(value, false);
+    else {
+
+        applying_setting = true;
+
+        if (mode == LOAD_MODE_CR) load_set_cr_level(value);
+        else load_set_cp_level(value);
+
+        applying_setting = false;
+    }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// measures the DC internal resistance with a pulse of the discharge current
+// the voltage and current are averaged over the blocks of the window before the pulse and of the window at its end; both windows end at a level change
+static void __measure_ir(void) {
+
+    vi_sense_block_sums_t base_start, base_end, pulse_start, pulse_end;
+
+    vi_sense_read_block_sums(&base_start);
+    kernel_sleep_ms(BATTERY_IR_WINDOW_MS);
+    vi_sense_read_block_sums(&base_end);
+
+    if (!battery_running) return;
+    __set_pulse(true);
+
+    kernel_sleep_ms(param_get(PARAM_BAT_IR_PULSE_TIME) - BATTERY_IR_WINDOW_MS);
+    vi_sense_read_block_sums(&pulse_start);
+    kernel_sleep_ms(BATTERY_IR_WINDOW_MS);
+    vi_sense_read_block_sums(&pulse_end);
+
+    // the test ended during the pulse; the load belongs to whoever ended it
+    if (!battery_running) return;
+    __set_pulse(false);
+
+    // the recovery after the pulse is not part of the cutoff check
+    cutoff_sums = pulse_end;
+
+    int32_t base_voltage_uv, base_current_ua, pulse_voltage_uv, pulse_current_ua;
+
+    if (!vi_sense_window_average(&base_start, &base_end, &base_voltage_uv, &base_current_ua)) return;
+    if (!vi_sense_window_average(&pulse_start, &pulse_end, &pulse_voltage_uv, &pulse_current_ua)) return;
+
+    // a current step bellow 10mA gives no usable resolution
+    if (pulse_current_ua < base_current_ua + 10000 || pulse_voltage_uv >= base_voltage_uv) return;
+
+    // R = dV / dI [Ohm] = dV[uV] * 10000 / dI[uA] [0.1 mOhm]
+    ir = div_u64((uint64_t)(base_voltage_uv - pulse_voltage_uv) * 10000, pulse_current_ua - base_current_ua);
+    __update_registers();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// checks the voltage averaged since the last check against the cutoff; the voltage has to stay under the cutoff for the cutoff time
+static void __check_cutoff(void) {
+
+    vi_sense_block_sums_t sums;
+    vi_sense_read_block_sums(&sums);
+
+    int32_t voltage_uv, current_ua;
+    if (!vi_sense_window_average(&cutoff_sums, &sums, &voltage_uv, &current_ua)) return;
+
+    cutoff_sums = sums;
+
+    // the offset noise can make the average of a shorted battery slightly negative
+    uint32_t voltage_mv = (voltage_uv > 0) ? voltage_uv / 1000 : 0;
+    uint32_t cutoff_mv = param_get(PARAM_BAT_CUTOFF);
+
+    if (voltage_mv < cutoff_mv) {
+
+        if (!below_cutoff) below_cutoff_time = kernel_get_time_ms();
+        below_cutoff = true;
+
+    } else if (voltage_mv > cutoff_mv + param_get(PARAM_BAT_HYSTERESIS)) below_cutoff = false;
+
+    if (below_cutoff && kernel_get_time_since(below_cutoff_time) >= (uint32_t)param_get(PARAM_BAT_CUTOFF_TIME)) {
+
+        __log_record();
+        __battery_end(LOAD_BATTERY_CUTOFF, true);
+    }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// moves the battery test level into the limits of a new battery test mode; applies the bat_mode parameter
+void __battery_apply_mode(void) {
+
+    int32_t min, max;
+    param_get_limits(PARAM_BAT_LEVEL, &min, &max);
+
+    int32_t value = param_get(PARAM_BAT_LEVEL);
+
+    if (value < min) param_set(PARAM_BAT_LEVEL, min);
+    if (value > max) param_set(PARAM_BAT_LEVEL, max);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops a running test if the load settings are changed by anything else than the test; called by the load setting functions
+void __battery_override(void) {
+
+    if (battery_running && !applying_setting) __battery_end(LOAD_BATTERY_ABORTED, false);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the cutoff check, the internal resistance measurements and the log of the battery test
+void battery_test_task(void) {
+
+    while (1) {
+
+        if (battery_running) {
+
+            PROF_TASK_START(PROF_BATTERY_TASK);
+
+            __check_cutoff();
+
+            uint32_t ir_interval_s = param_get(PARAM_BAT_IR_INTERVAL);
+
+            if (battery_running && ir_interval_s > 0 && kernel_get_time_since(last_ir_time) >= ir_interval_s * 1000) {
+
+                last_ir_time += ir_interval_s * 1000;
+                __measure_ir();
+            }
+
+            if (battery_running && kernel_get_time_since(last_log_time) >= log_period_s * 1000) {
+
+                last_log_time += log_period_s * 1000;
+                __log_record();
+            }
+
+            PROF_TASK_STOP(PROF_BATTERY_TASK);
+        }
+
+        kernel_sleep_ms(BATTERY_UPDATE_PERIOD_MS);
+    }
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the battery test with the bat_* parameters; returns false if the discharge mode is invalid, the dynamic mode or the MPPT is enabled for a CC test or the load can't be enabled
+bool load_battery_start(void) {
+
+    mode = param_get(PARAM_BAT_MODE);
+    level = param_get(PARAM_BAT_LEVEL);
+
+    if (mode == LOAD_MODE_CV) return false;
+
+    // the dynamic mode waveform and the maximum power point tracker would replace the CC level and the pulse
+    load_dynamic_config_t dynamic;
+    load_mppt_state_t mppt;
+    load_get_dynamic_config(&dynamic);
+    load_get_mppt_state(&mppt);
+    if (mode == LOAD_MODE_CC && (dynamic.enabled || mppt.enabled)) return false;
+
+    // the pulse raises the current by the set percentage; the CR mode gets there with a lower resistance
+    uint32_t pulse = param_get(PARAM_BAT_IR_PULSE);
+
+    if (mode == LOAD_MODE_CR) pulse_level = level * 100 / (100 + pulse);
+    else pulse_level = level * (100 + pulse) / 100;
+
+    // check limits; the CC pulse goes to the DAC without the limits of the CC level setter
+    if (mode == LOAD_MODE_CC) {
+
+        if (level < LOAD_MIN_CC_LEVEL_MA) level = LOAD_MIN_CC_LEVEL_MA;
+        if (level > LOAD_MAX_CC_LEVEL_MA) level = LOAD_MAX_CC_LEVEL_MA;
+        if (pulse_level < LOAD_MIN_CC_LEVEL_MA) pulse_level = LOAD_MIN_CC_LEVEL_MA;
+        if (pulse_level > LOAD_MAX_CC_LEVEL_MA) pulse_level = LOAD_MAX_CC_LEVEL_MA;
+    }
+
+    if (battery_running) __battery_end(LOAD_BATTERY_ABORTED, false);
+
+    // the load enable restarts the charge and energy integration
+    applying_setting = true;
+
+    load_set_enable(false);
+    load_set_mode(mode);
+
+    if      (mode == LOAD_MODE_CC) load_set_cc_level(level);
+    else if (mode == LOAD_MODE_CR) load_set_cr_level(level);
+    else                           load_set_cp_level(level);
+
+    bool enabled = load_set_enable(true);
+
+    applying_setting = false;
+
+    if (!enabled) return false;
+
+    start_time = kernel_get_time_ms();
+    last_ir_time = start_time;
+    last_log_time = start_time;
+    below_cutoff = false;
+    ir = 0;
+    result = 0;
+    log_count = 0;
+    log_period_s = param_get(PARAM_BAT_LOG_INTERVAL);
+    vi_sense_read_block_sums(&cutoff_sums);
+
+    battery_running = true;
+
+    __log_record();
+    __update_registers();
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the battery test and disables the load
+void load_battery_stop(void) {
+
+    if (battery_running) __battery_end(LOAD_BATTERY_ABORTED, true);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the battery test
+void load_battery_get_state(load_battery_state_t *state) {
+
+    state->running = battery_running;
+    state->result = result;
+    state->elapsed_s = ((battery_running ? kernel_get_time_ms() : end_time) - start_time) / 1000;
+    state->ir = ir;
+    state->log_count = log_count;
+    state->log_period_s = log_period_s;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// reads a record of the battery test log (0 is the record of the test start); returns false if the index is out of the log
+bool load_battery_get_record(uint32_t index, load_battery_record_t *record) {
+
+    if (index >= log_count) return false;
+
+    *record = records[index];
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// loads a record of the battery test log into the BAT_LOG_DATA window; an index out of the log loads zeroes
+void load_battery_load_window(uint32_t index) {
+
+    load_battery_record_t record = {0};
+    load_battery_get_record(index, &record);
+
+    cmd_write(CMD_ADDRESS_BAT_LOG_DATA0, record.voltage);
+    cmd_write(CMD_ADDRESS_BAT_LOG_DATA0 + 1, record.current_ma);
+    cmd_write(CMD_ADDRESS_BAT_LOG_DATA0 + 2, record.charge_mah);
+    cmd_write(CMD_ADDRESS_BAT_LOG_DATA3, record.ir);
+    cmd_write(CMD_ADDRESS_BAT_LOG_ENERGY, record.energy_mwh);
+
+    cmd_write(CMD_ADDRESS_BAT_LOG_INDEX, index);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
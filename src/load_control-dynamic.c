@@ -0,0 +1,238 @@
+#include "load_control.h"
+#include "iset_dac.h"
+
+extern load_mode_t load_mode;
+extern bool enabled;
+extern uint32_t cc_level_ma;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static bool dynamic_enabled = false;        // the CC mode alternates between level A and level B
+static bool stretched = false;              // the ramps don't fit the period; the holds are at their minimum
+
+static uint32_t level_a_ma = LOAD_START_DYNAMIC_LEVEL_A_MA;
+static uint32_t level_b_ma = LOAD_START_DYNAMIC_LEVEL_B_MA;
+static uint32_t frequency_hz = LOAD_START_DYNAMIC_FREQUENCY_HZ;
+static uint32_t duty_permille = LOAD_START_DYNAMIC_DUTY;    // time of the rise and level B within a period [0.1 %]
+static uint32_t rise_slew = LOAD_START_DYNAMIC_SLEW;        // ramp slew rate from level A to level B [mA/us]
+static uint32_t fall_slew = LOAD_START_DYNAMIC_SLEW;        // ramp slew rate from level B to level A [mA/us]
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+void __settings_changed(void);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the DYN_CTRL register
+static void __update_ctrl_register(void) {
+
+    uint16_t ctrl = 0;
+
+    if (dynamic_enabled) ctrl |= LOAD_DYNAMIC_ENABLE;
+    if (iset_dac_is_waveform_running()) ctrl |= LOAD_DYNAMIC_RUNNING;
+    if (stretched) ctrl |= LOAD_DYNAMIC_STRETCHED;
+
+    cmd_write(CMD_ADDRESS_DYN_CTRL, ctrl);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the DAC code step of a ramp over delta_codes (delta_ma) at the specified slew rate and the duration of the ramp [us]
+static uint16_t __ramp_step(uint32_t delta_ma, uint32_t delta_codes, uint32_t slew, uint32_t *ramp_us) {
+
+    *ramp_us = 0;
+    if (slew == 0 || delta_codes == 0) return 0;
+
+    uint32_t step_ma = slew * ISET_DAC_RAMP_PERIOD_US;
+    uint32_t steps = (delta_ma + step_ma - 1) / step_ma;
+    if (steps == 0) steps = 1;
+
+    uint32_t step = (delta_codes + steps - 1) / steps;
+
+    // the first step is written at the start of the ramp, so the ramp takes one update period less than the number of steps
+    steps = (delta_codes + step - 1) / step;
+    *ramp_us = (steps - 1) * ISET_DAC_RAMP_PERIOD_US;
+
+    return (step);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// computes the waveform from the dynamic mode settings; returns false if the ramps don't fit the period and the holds were stretched
+static bool __compute_waveform(iset_dac_waveform_t *waveform) {
+
+    // the period starts with the rise; the duty cycle is the time from the start of the rise to the start of the fall
+    uint32_t period_us = 1000000 / frequency_hz;
+    uint32_t high_us = period_us * duty_permille / 1000;
+    uint32_t low_us = period_us - high_us;
+
+    waveform->code_a = iset_dac_current_to_code(level_a_ma);
+    waveform->code_b = iset_dac_current_to_code(level_b_ma);
+
+    uint32_t delta_ma = (level_b_ma > level_a_ma) ? (level_b_ma - level_a_ma) : (level_a_ma - level_b_ma);
+    uint32_t delta_codes = (waveform->code_b > waveform->code_a) ? (waveform->code_b - waveform->code_a) : (waveform->code_a - waveform->code_b);
+
+    uint32_t rise_us, fall_us;
+    waveform->rise_step = __ramp_step(delta_ma, delta_codes, rise_slew, &rise_us);
+    waveform->fall_step = __ramp_step(delta_ma, delta_codes, fall_slew, &fall_us);
+
+    bool fits = true;
+
+    if (high_us >= rise_us + ISET_DAC_MIN_HOLD_US) waveform->high_us = high_us - rise_us;
+    else {
+
+        waveform->high_us = ISET_DAC_MIN_HOLD_US;
+        fits = false;
+    }
+
+    if (low_us >= fall_us + ISET_DAC_MIN_HOLD_US) waveform->low_us = low_us - fall_us;
+    else {
+
+        waveform->low_us = ISET_DAC_MIN_HOLD_US;
+        fits = false;
+    }
+
+    return (fits);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// recomputes the waveform after a setting changed; a running waveform switches to it at the start of the next period
+static void __apply_settings(void) {
+
+    iset_dac_waveform_t waveform;
+    stretched = !__compute_waveform(&waveform);
+
+    if (iset_dac_is_waveform_running()) iset_dac_update_waveform(&waveform);
+
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// starts the waveform if the dynamic mode is enabled; returns false if the CC level should be set instead; called when the load is enabled in the CC mode
+bool __dynamic_start(void) {
+
+    if (!dynamic_enabled) return false;
+
+    iset_dac_waveform_t waveform;
+    stretched = !__compute_waveform(&waveform);
+
+    iset_dac_start_waveform(&waveform);
+    __update_ctrl_register();
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the waveform; called when the load is disabled
+void __dynamic_stop(void) {
+
+    iset_dac_stop_waveform();
+    __update_ctrl_register();
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// enables or disables the dynamic mode; the CC mode alternates between level A and level B instead of the CC level
+// a change stops a running sequence, battery test, sweep or linearization
+void load_set_dynamic_enable(bool enable) {
+
+    if (enable == dynamic_enabled) return;
+
+    // the waveform would take over the DAC of the running program
+    __settings_changed();
+
+    dynamic_enabled = enable;
+
+    // switch the running load between the waveform and the CC level
+    if (enabled && load_mode == LOAD_MODE_CC) {
+
+        if (enable) __dynamic_start();
+        else {
+
+            iset_dac_stop_waveform();
+            iset_dac_set_current(cc_level_ma, true);
+        }
+    }
+
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets level A or level B of the dynamic mode [mA]
+void load_set_dynamic_level(bool level_b, uint32_t current_ma) {
+
+    // check limits
+    if (current_ma < LOAD_MIN_CC_LEVEL_MA) current_ma = LOAD_MIN_CC_LEVEL_MA;
+    if (current_ma > LOAD_MAX_CC_LEVEL_MA) current_ma = LOAD_MAX_CC_LEVEL_MA;
+
+    if (level_b) level_b_ma = current_ma;
+    else level_a_ma = current_ma;
+
+    cmd_write(level_b ? CMD_ADDRESS_DYN_LEVEL_B : CMD_ADDRESS_DYN_LEVEL_A, current_ma);
+    __apply_settings();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the frequency of the dynamic mode [Hz]
+void load_set_dynamic_frequency(uint32_t frequency) {
+
+    // check limits
+    if (frequency < LOAD_DYNAMIC_MIN_FREQUENCY_HZ) frequency = LOAD_DYNAMIC_MIN_FREQUENCY_HZ;
+    if (frequency > LOAD_DYNAMIC_MAX_FREQUENCY_HZ) frequency = LOAD_DYNAMIC_MAX_FREQUENCY_HZ;
+
+    frequency_hz = frequency;
+    cmd_write(CMD_ADDRESS_DYN_FREQ, frequency);
+    __apply_settings();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the duty cycle of the dynamic mode; the time from the start of the rise to the start of the fall [0.1 %]
+void load_set_dynamic_duty(uint32_t duty) {
+
+    // check limits
+    if (duty < 1) duty = 1;
+    if (duty > 999) duty = 999;
+
+    duty_permille = duty;
+    cmd_write(CMD_ADDRESS_DYN_DUTY, duty);
+    __apply_settings();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the rise (level A to B) or fall (level B to A) slew rate of the dynamic mode [mA/us]; 0 changes the level in a single step
+void load_set_dynamic_slew(bool fall, uint32_t slew) {
+
+    // check limits
+    if (slew > LOAD_DYNAMIC_MAX_SLEW) slew = LOAD_DYNAMIC_MAX_SLEW;
+
+    if (fall) fall_slew = slew;
+    else rise_slew = slew;
+
+    cmd_write(fall ? CMD_ADDRESS_DYN_FALL : CMD_ADDRESS_DYN_RISE, slew);
+    __apply_settings();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the dynamic mode settings and state
+void load_get_dynamic_config(load_dynamic_config_t *config) {
+
+    config->enabled = dynamic_enabled;
+    config->running = iset_dac_is_waveform_running();
+    config->stretched = stretched;
+    config->level_a_ma = level_a_ma;
+    config->level_b_ma = level_b_ma;
+    config->frequency_hz = frequency_hz;
+    config->duty_permille = duty_permille;
+    config->rise_slew = rise_slew;
+    config->fall_slew = fall_slew;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
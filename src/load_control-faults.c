@@ -1,5 +1,7 @@
 #include "load_control.h"
 #include "cmd_spi_driver.h"
+#include "vi_sense.h"
+#include "profiling.h"
 
 //---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -21,6 +23,7 @@ void load_trigger_fault(load_fault_t fault) {
     fault_register |= fault;
     if (old_fault_register == fault_register) return;   // fault already triggered, skip
 
+    vi_sense_capture_event(LOAD_CAPTURE_TRIGGER_FAULT);
     __check_fault_conditions();     // test fault status with fault mask and disable the load if the fault conditions are met
     
     cmd_write(CMD_ADDRESS_FAULT, fault_register);       // update the fault register
@@ -96,6 +99,8 @@ void ext_fault_task(void) {
 
     while (1) {
 
+        PROF_TASK_START(PROF_EXT_FAULT_TASK);
+
         static uint8_t debounce_counter = 0xff;
         static bool triggered = false;
 
@@ -111,6 +116,7 @@ void ext_fault_task(void) {
 
         } else if (debounce_counter == 0xff) triggered = false;
 
+        PROF_TASK_STOP(PROF_EXT_FAULT_TASK);
         kernel_yield();
     }
 }
@@ -0,0 +1,289 @@
+#include "load_control.h"
+#include "iset_dac.h"
+#include "vi_sense.h"
+#include "calibration.h"
+#include "param.h"
+
+extern load_mode_t load_mode;
+extern bool enabled;
+extern uint32_t cc_level_ma;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum {
+
+    LINEARIZE_IDLE = 0,
+    LINEARIZE_SETTLING,         // the CC level of the point ramps; the measurement starts with the next update after the ramp
+    LINEARIZE_MEASURING         // the blocks until the next update are averaged into the point
+
+} linearize_state_t;
+
+static linearize_state_t linearize_state = LINEARIZE_IDLE;
+static bool applying_setting = false;               // the load settings are changed by the linearization
+static uint16_t result = 0;                         // load_linearize_ctrl_t result flag of the last linearization
+static uint32_t max_level_ma;                       // highest current of the running linearization
+static uint32_t point_count = 0;                    // measured calibration points
+static int32_t point_ma[CALIBRATION_MAX_POINTS];    // currents measured at the points [mA]
+static vi_sense_block_sums_t point_sums;            // block sums at the start of the point measurement
+
+// CC trim; the integrated error of the CC level is added to the currents converted to DAC codes
+static int32_t trim_ua = 0;                         // integrated CC error [uA]
+static bool trim_window_valid = false;              // the DAC sat at the trimmed CC level at the start of the window
+static uint32_t trim_write_count = 0;               // DAC writes at the start of the window
+static vi_sense_block_sums_t trim_sums;             // block sums at the start of the window
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// updates the LIN_CTRL and LIN_POINT registers
+static void __update_registers(void) {
+
+    cmd_write(CMD_ADDRESS_LIN_CTRL, ((linearize_state != LINEARIZE_IDLE) ? LOAD_LINEARIZE_RUN : 0) | result);
+    cmd_write(CMD_ADDRESS_LIN_POINT, point_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the CC level of a point; the points are evenly spaced from the minimum CC level to the highest current
+static uint32_t __setpoint(uint32_t index) {
+
+    return (LOAD_MIN_CC_LEVEL_MA + (max_level_ma - LOAD_MIN_CC_LEVEL_MA) * index / (CALIBRATION_MAX_POINTS - 1));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns true if the measured currents rise with the CC levels and each of them is within the error bound of its level
+// a source that couldn't deliver the current or a sense fault would otherwise be fitted into the calibration
+static bool __points_valid(void) {
+
+    for (uint32_t index = 0; index < CALIBRATION_MAX_POINTS; index++) {
+
+        int32_t setpoint = __setpoint(index);
+        int32_t error = point_ma[index] - setpoint;
+        int32_t bound = LOAD_LINEARIZE_MAX_ERROR_MA + setpoint * LOAD_LINEARIZE_MAX_ERROR / 1000;
+
+        if (error > bound || error < -bound) return false;
+        if (index > 0 && point_ma[index] <= point_ma[index - 1]) return false;
+    }
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns true if the DAC follows the CC level alone; the waveform, the ramps, the MPPT, the sweep and the linearization write their own codes
+static bool __trim_allowed(void) {
+
+    if (!enabled || load_mode != LOAD_MODE_CC || linearize_state != LINEARIZE_IDLE) return false;
+    if (iset_dac_is_in_transient() || iset_dac_is_waveform_running()) return false;
+
+    load_mppt_state_t mppt;
+    load_sweep_state_t sweep;
+    load_get_mppt_state(&mppt);
+    load_sweep_get_state(&sweep);
+
+    return (!mppt.enabled && !sweep.running);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the CC trim and writes the CC level again with it if the DAC sits at the level with the previous trim
+static void __set_trim(int32_t new_trim_ua) {
+
+    uint16_t previous_code = iset_dac_current_to_code(cc_level_ma);
+
+    trim_ua = new_trim_ua;
+    iset_dac_set_trim(trim_ua / 1000);
+
+    uint16_t code = iset_dac_current_to_code(cc_level_ma);
+    if (__trim_allowed() && iset_dac_get_code() == previous_code && code != previous_code) iset_dac_write_code(code);
+
+    cmd_write(CMD_ADDRESS_CC_TRIM, (uint16_t)(int16_t)(trim_ua / 1000));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// ends the linearization with a result flag; the finished and the stopped linearization disable the load
+static void __linearize_end(uint16_t end_result, bool disable) {
+
+    linearize_state = LINEARIZE_IDLE;
+    result = end_result;
+
+    if (disable) {
+
+        applying_setting = true;
+        load_set_enable(false);
+        applying_setting = false;
+    }
+
+    __update_registers();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops a running linearization if the load settings are changed by anything else than the linearization; called by the load setting functions
+void __linearize_override(void) {
+
+    if (linearize_state != LINEARIZE_IDLE && !applying_setting) __linearize_end(LOAD_LINEARIZE_ABORTED, false);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// measures the point in progress and sets the next one; fits the ISET DAC calibration after the last point; called by the load control task
+// each point pairs the DAC code with the current measured by ISEN over one update period; invalid points keep the previous calibration
+void __linearize_update(void) {
+
+    if (linearize_state == LINEARIZE_IDLE) return;
+
+    vi_sense_block_sums_t sums;
+    vi_sense_read_block_sums(&sums);
+
+    if (linearize_state == LINEARIZE_SETTLING) {
+
+        if (iset_dac_is_in_transient()) return;
+
+        point_sums = sums;
+        linearize_state = LINEARIZE_MEASURING;
+        return;
+    }
+
+    int32_t voltage_uv, current_ua;
+    if (!vi_sense_window_average(&point_sums, &sums, &voltage_uv, &current_ua)) return;
+
+    point_ma[point_count] = (current_ua + 500) / 1000;
+
+    if (calibration_add_point(CAL_ISET_DAC, point_ma[point_count]) == 0) {
+
+        __linearize_end(LOAD_LINEARIZE_ABORTED, true);
+        return;
+    }
+
+    if (++point_count == CALIBRATION_MAX_POINTS) {
+
+        // the fit replaces the calibration at once, so the points are checked before it
+        if (!__points_valid()) __linearize_end(LOAD_LINEARIZE_REJECTED, true);
+        else __linearize_end(calibration_fit(CAL_ISET_DAC) ? LOAD_LINEARIZE_DONE : LOAD_LINEARIZE_ABORTED, true);
+        return;
+    }
+
+    applying_setting = true;
+    load_set_cc_level(__setpoint(point_count));
+    applying_setting = false;
+
+    linearize_state = LINEARIZE_SETTLING;
+    cmd_write(CMD_ADDRESS_LIN_POINT, point_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// adds a part of the CC error measured since the last update to the trim; called by the load control task
+// only the windows in which the DAC sat at the trimmed CC level without any write are used, so the ramps, the battery test pulses and the level changes are skipped
+void __trim_update(void) {
+
+    vi_sense_block_sums_t sums;
+    vi_sense_read_block_sums(&sums);
+
+    if (!param_get(PARAM_CC_TRIM)) {
+
+        if (trim_ua != 0) __set_trim(0);
+        trim_window_valid = false;
+        return;
+    }
+
+    int32_t voltage_uv, current_ua;
+
+    if (trim_window_valid && __trim_allowed() && iset_dac_get_write_count() == trim_write_count && vi_sense_window_average(&trim_sums, &sums, &voltage_uv, &current_ua)) {
+
+        int32_t error_ua = (int32_t)cc_level_ma * 1000 - current_ua;
+        int32_t limit_ua = param_get(PARAM_CC_TRIM_LIMIT) * 1000;
+        int32_t trim = trim_ua + (int32_t)(((int64_t)error_ua * param_get(PARAM_CC_TRIM_GAIN)) >> 8);
+
+        // check limits
+        if (trim > limit_ua) trim = limit_ua;
+        if (trim < -limit_ua) trim = -limit_ua;
+
+        __set_trim(trim);
+    }
+
+    // the next window starts after the write of the new trim
+    trim_window_valid = __trim_allowed() && iset_dac_get_code() == iset_dac_current_to_code(cc_level_ma);
+    trim_write_count = iset_dac_get_write_count();
+    vi_sense_read_block_sums(&trim_sums);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the CC linearization up to the lin_max_ma parameter; returns false if the dynamic mode or the MPPT is enabled or the load can't be enabled
+bool load_linearize_start(void) {
+
+    // the dynamic mode waveform and the maximum power point tracker would replace the CC level
+    load_dynamic_config_t dynamic;
+    load_mppt_state_t mppt;
+    load_get_dynamic_config(&dynamic);
+    load_get_mppt_state(&mppt);
+    if (dynamic.enabled || mppt.enabled) return false;
+
+    load_linearize_stop();
+
+    max_level_ma = param_get(PARAM_LIN_MAX);
+    point_count = 0;
+    result = 0;
+
+    // the points are taken with the present calibration alone
+    calibration_clear_points();
+    __set_trim(0);
+
+    applying_setting = true;
+
+    load_set_enable(false);
+    load_set_mode(LOAD_MODE_CC);
+    load_set_cc_level(__setpoint(0));
+    bool success = load_set_enable(true);
+
+    applying_setting = false;
+
+    if (!success) {
+
+        __linearize_end(LOAD_LINEARIZE_ABORTED, false);
+        return false;
+    }
+
+    // the load control task takes over from here
+    linearize_state = LINEARIZE_SETTLING;
+    __update_registers();
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the CC linearization and disables the load; the calibration is not changed
+void load_linearize_stop(void) {
+
+    if (linearize_state != LINEARIZE_IDLE) __linearize_end(LOAD_LINEARIZE_ABORTED, true);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stores the ISET DAC calibration in the flash; returns false if the load is enabled or the flash write failed
+bool load_linearize_save(void) {
+
+    // the register reads back the result flags without the SAVE bit
+    __update_registers();
+
+    // calibration_save refuses while the load is enabled
+    if (linearize_state != LINEARIZE_IDLE) return false;
+
+    return (calibration_save());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the CC linearization and the CC trim
+void load_linearize_get_state(load_linearize_state_t *state) {
+
+    state->running = (linearize_state != LINEARIZE_IDLE);
+    state->result = result;
+    state->points = point_count;
+    state->trim_ma = trim_ua / 1000;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,235 @@
+#include "load_control.h"
+#include "iset_dac.h"
+#include "fixed_point.h"
+#include "param.h"
+
+extern load_mode_t load_mode;
+extern bool enabled;
+extern uint32_t cc_level_ma;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static bool mppt_enabled = false;
+static volatile bool tracking = false;              // the tracker perturbs the CC level; set by the block interrupt
+
+// state of the tracker; owned by the block interrupt
+static bool settling = false;                       // the block in progress at the last perturbation is skipped
+static bool has_previous = false;                   // the previous window is valid for the comparison
+static bool increase = true;                        // direction of the last perturbation
+static uint32_t step_ma = 0;                        // size of the next perturbation
+static uint32_t blocks = 0;                         // blocks averaged into the present window
+static int32_t voltage_sum = 0;                     // sums of the block averages of the present window [mV, mA]
+static int32_t current_sum = 0;
+static int32_t previous_voltage_mv = 0;             // averages of the previous window
+static int32_t previous_current_ma = 0;
+
+// statistics for the MPPT registers; reset by every update
+static uint32_t report_windows = 0;
+static uint32_t report_voltage_sum = 0;             // sums of the window averages [mV, mA, mW]
+static uint32_t report_current_sum = 0;
+static uint64_t report_power_sum = 0;
+static uint32_t report_peak_power = 0;              // highest window power [mW]
+
+static load_mppt_state_t reported = {0};
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+void __settings_changed(void);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the MPPT_CTRL register
+static void __update_ctrl_register(void) {
+
+    cmd_write(CMD_ADDRESS_MPPT_CTRL, (mppt_enabled ? LOAD_MPPT_ENABLE : 0) | (tracking ? LOAD_MPPT_TRACKING : 0));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// chooses the direction and size of the next perturbation from a completed window
+// the direction comes from the incremental conductance dP/dI = V + I * dV/dI of the last perturbation; if the current didn't follow the perturbation,
+// the direction comes from the change of the power (perturb and observe); the step grows by half while the direction holds and halves on every reversal
+static void __track(int32_t voltage_mv, int32_t current_ma) {
+
+    uint32_t min_step = param_get(PARAM_MPPT_MIN_STEP);
+    uint32_t max_step = param_get(PARAM_MPPT_MAX_STEP);
+    bool next_increase = increase;
+
+    if (!has_previous) step_ma = min_step;
+    else {
+
+        int32_t dv = voltage_mv - previous_voltage_mv;
+        int32_t di = current_ma - previous_current_ma;
+
+        if (di != 0) {
+
+            int64_t slope = (int64_t)voltage_mv * di + (int64_t)current_ma * dv;       // dP [uW] of the measured current change
+            next_increase = ((slope > 0) == (di > 0));
+
+        } else {
+
+            int64_t dp = (int64_t)voltage_mv * current_ma - (int64_t)previous_voltage_mv * previous_current_ma;
+            if (dp < 0) next_increase = !increase;
+        }
+
+        if (next_increase == increase) step_ma += step_ma / 2 + 1;
+        else step_ma /= 2;
+
+        if (step_ma < min_step) step_ma = min_step;
+        if (step_ma > max_step) step_ma = max_step;
+    }
+
+    // below the minimum voltage the panel is past its knee; back off
+    if (voltage_mv < param_get(PARAM_MPPT_MIN_VOLTAGE)) next_increase = false;
+
+    previous_voltage_mv = voltage_mv;
+    previous_current_ma = current_ma;
+    has_previous = true;
+    increase = next_increase;
+
+    uint32_t level = cc_level_ma;
+
+    if (increase) level += step_ma;
+    else level = (level > step_ma) ? level - step_ma : 0;
+
+    // check limits
+    if (level < LOAD_MIN_CC_LEVEL_MA) level = LOAD_MIN_CC_LEVEL_MA;
+    if (level > LOAD_MAX_CC_LEVEL_MA) level = LOAD_MAX_CC_LEVEL_MA;
+
+    cc_level_ma = level;
+    iset_dac_write_code(iset_dac_current_to_code(level));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// averages the blocks into windows and perturbs the CC level after each window; called from the block interrupt for every block included in the averages
+// the tracker holds while the CC level ramps after the load enable or a level change and while the dynamic mode waveform runs
+void __mppt_block(int32_t voltage_mv, int32_t current_ma) {
+
+    bool run = mppt_enabled && enabled && load_mode == LOAD_MODE_CC && !iset_dac_is_waveform_running() && !iset_dac_is_in_transient();
+
+    if (!run) {
+
+        tracking = false;
+        return;
+    }
+
+    // start from the present CC level with the minimum step
+    if (!tracking) {
+
+        tracking = true;
+        has_previous = false;
+        settling = false;
+        blocks = 0;
+        voltage_sum = 0;
+        current_sum = 0;
+    }
+
+    if (settling) {
+
+        settling = false;
+        return;
+    }
+
+    voltage_sum += voltage_mv;
+    current_sum += current_ma;
+
+    if (++blocks < (uint32_t)param_get(PARAM_MPPT_WINDOW)) return;
+
+    int32_t window_voltage_mv = voltage_sum / (int32_t)blocks;
+    int32_t window_current_ma = current_sum / (int32_t)blocks;
+    uint32_t window_power_mw = (window_voltage_mv > 0 && window_current_ma > 0) ? (uint64_t)window_voltage_mv * window_current_ma / 1000 : 0;
+
+    blocks = 0;
+    voltage_sum = 0;
+    current_sum = 0;
+
+    if (window_voltage_mv > 0) report_voltage_sum += window_voltage_mv;
+    if (window_current_ma > 0) report_current_sum += window_current_ma;
+    report_power_sum += window_power_mw;
+    if (window_power_mw > report_peak_power) report_peak_power = window_power_mw;
+    report_windows++;
+
+    __track(window_voltage_mv, window_current_ma);
+    settling = true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the MPPT registers with the averages since the last update; called by the load control task
+void __mppt_update(void) {
+
+    __disable_irq();
+
+    uint32_t windows = report_windows;
+    uint32_t voltage_total = report_voltage_sum;
+    uint32_t current_total = report_current_sum;
+    uint64_t power_total = report_power_sum;
+    uint32_t peak_power = report_peak_power;
+
+    report_windows = 0;
+    report_voltage_sum = 0;
+    report_current_sum = 0;
+    report_power_sum = 0;
+    report_peak_power = 0;
+
+    __enable_irq();
+
+    reported.enabled = mppt_enabled;
+    reported.tracking = tracking;
+    reported.step_ma = tracking ? step_ma : 0;
+
+    if (windows > 0) {
+
+        reported.voltage_mv = voltage_total / windows;
+        reported.current_ma = current_total / windows;
+        reported.power_mw = div_u64(power_total, windows);
+        reported.efficiency = (peak_power > 0) ? div_u64(power_total * 1000, (uint64_t)peak_power * windows) : 0;
+
+        // the CC level register follows the tracker
+        cmd_write(CMD_ADDRESS_CC_LEVEL, cc_level_ma);
+
+    } else {
+
+        reported.voltage_mv = 0;
+        reported.current_ma = 0;
+        reported.power_mw = 0;
+        reported.efficiency = 0;
+    }
+
+    uint32_t power = reported.power_mw / 100;
+
+    cmd_write(CMD_ADDRESS_MPPT_VOLTAGE, reported.voltage_mv / 10);
+    cmd_write(CMD_ADDRESS_MPPT_CURRENT, reported.current_ma);
+    cmd_write(CMD_ADDRESS_MPPT_POWER, (power > 0xffff) ? 0xffff : power);
+    cmd_write(CMD_ADDRESS_MPPT_EFFICIENCY, reported.efficiency);
+
+    __update_ctrl_register();
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// enables or disables the maximum power point tracking; the CC level follows the tracker while the load is enabled in the CC mode
+// a change stops a running sequence, battery test, sweep or linearization
+void load_set_mppt_enable(bool enable) {
+
+    if (enable == mppt_enabled) return;
+
+    // the tracker would take over the CC level of the running program
+    __settings_changed();
+
+    mppt_enabled = enable;
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the maximum power point tracker
+void load_get_mppt_state(load_mppt_state_t *state) {
+
+    *state = reported;
+    state->enabled = mppt_enabled;
+    state->tracking = tracking;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1,105 +1,245 @@
 #include "load_control.h"
 #include "iset_dac.h"
 #include "vi_sense.h"
+#include "hal/timer.h"
+#include "param.h"
 
 extern load_mode_t load_mode;
 extern bool enabled;
 extern uint32_t cv_level_mv;
 extern uint32_t cr_level_mr;
-extern uint32_t cp_level_uw;  
+extern uint32_t cp_level_uw;
 
-int32_t cv_Kp = 50;
-int32_t cv_Ki = 100;
-int32_t cr_Kp = 50;
-int32_t cr_Ki = 100;
-int32_t cp_Kp = 60000;
-int32_t cp_Ki = 250000;
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
 
-int32_t integral = 0;
+// the output is the load current demand in ISET DAC codes below ISET_DAC_ZERO_LEVEL_CODE
+static pid_controller_t pid;
+static int32_t pid_output = 0;      // most recent output written to the ISET DAC
+
+// CR and CP feedforward; the PID output is added to it and trims the residual error
+static int32_t feedforward_q8 = 0;  // filtered feedforward current [mA] in Q8 format
+static int32_t feedforward = 0;     // [ISET DAC codes below ISET_DAC_ZERO_LEVEL_CODE]
 
 //---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
 
-void __pid_reset(void) {
+bool __autotune_update(int32_t error, int32_t *output);
+uint32_t __regulation_error(load_mode_t mode, uint32_t level, uint32_t voltage, uint32_t current, int32_t *error, int32_t *process);
+int32_t __regulation_feedforward(int32_t *feedforward_q8, uint32_t target, bool *hold);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// reads the gain set of a CV, CR or CP mode from the parameter table
+static void __pid_read_gains(load_mode_t mode, pid_gains_t *gains) {
+
+    param_id_t kp = PARAM_PID_KP(mode);
 
-    integral = 0;
+    gains->kp = param_get(kp);
+    gains->ki = param_get(kp + 1);
+    gains->kd = param_get(kp + 2);
 }
 
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void load_update_pid(uint32_t voltage, uint32_t current) {
+// switches the running regulation to the gain parameters of the current mode without a bump in the output
+void __pid_apply_gains(void) {
 
-    gpio_write(ISET_DAC_SPI_SS_GPIO, HIGH);
+    if (load_mode == LOAD_MODE_CC) return;
 
-    if (!enabled) return;
+    pid_gains_t gains;
+    __pid_read_gains(load_mode, &gains);
 
-    int32_t error;
-    int32_t output = 0;
+    __disable_irq();
+    pid_set_gains(&pid, &gains);
+    __enable_irq();
+}
 
-    switch (load_mode) {
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-        //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// sets the control loop timer period from the control rate parameter
+void __control_loop_apply_rate(void) {
 
-        case LOAD_MODE_CV: {
+    __disable_irq();
 
-            error = voltage - cv_level_mv;
+    LOAD_CONTROL_TIMER->ARR = LOAD_CONTROL_TIMER_FREQUENCY / param_get(PARAM_CONTROL_RATE) - 1;
+    LOAD_CONTROL_TIMER->EGR |= TIM_EGR_UG;      // restart the period; the counter could be above the new reload value
 
-            int proportional = error / cv_Kp;
-            integral += error / cv_Ki;
+    __enable_irq();
+}
 
-            if (integral > 100000) integral = 100000;
-            if (integral < -100000) integral = -100000;
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-            output = ISET_DAC_ZERO_LEVEL_CODE - (proportional + integral);
+// initializes the control loop timer; the interrupt vector is shared with the sample timer and enabled by the vi_sense
+void __control_loop_init(void) {
 
-        } break;
+    rcc_enable_peripheral_clock(LOAD_CONTROL_TIMER_CLOCK);
+    timer_init_counter(LOAD_CONTROL_TIMER, LOAD_CONTROL_TIMER_FREQUENCY, TIMER_DIR_UP, LOAD_CONTROL_TIMER_FREQUENCY / param_get(PARAM_CONTROL_RATE) - 1);
 
-        //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+    LOAD_CONTROL_TIMER->CR1 |= TIM_CR1_URS;
+    LOAD_CONTROL_TIMER->DIER |= TIM_DIER_UIE;
+    LOAD_CONTROL_TIMER->SR &= ~TIM_SR_UIF;
+}
 
-        case LOAD_MODE_CR: {
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-            uint32_t resistance = (voltage * 1000) / current;
-            error = resistance - cr_level_mr;
+// starts or stops the periodic control loop updates
+void __control_loop_run(bool run) {
 
-            int32_t proportional = error / cr_Kp;
-            integral += error / cr_Ki;
+    if (run) {
 
-            if (integral > 100000) integral = 100000;
-            if (integral < -100000) integral = -100000;
+        LOAD_CONTROL_TIMER->EGR |= TIM_EGR_UG;
+        LOAD_CONTROL_TIMER->SR &= ~TIM_SR_UIF;
+        timer_start_count(LOAD_CONTROL_TIMER);
 
-            output = ISET_DAC_ZERO_LEVEL_CODE - (proportional + integral);
+    } else {
 
-        } break;
+        timer_stop_count(LOAD_CONTROL_TIMER);
+        LOAD_CONTROL_TIMER->SR &= ~TIM_SR_UIF;
+    }
+}
 
-        //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-        case LOAD_MODE_CP: {
+// loads the gain set of the current mode and restarts the PID and the feedforward from zero current
+void __pid_reset(void) {
 
-            uint32_t power = voltage * current;
-            error = cp_level_uw - power;
-                
-            int32_t proportional = error / cp_Kp;
-            integral += error / cp_Ki;
+    pid_gains_t gains;
+    if (load_mode != LOAD_MODE_CC) __pid_read_gains(load_mode, &gains);
+    else gains = (pid_gains_t){0, 0, 0};
 
-            if (integral > 100000) integral = 100000;
-            if (integral < -100000) integral = -100000;
+    __disable_irq();
 
-            output = ISET_DAC_ZERO_LEVEL_CODE - (proportional + integral);
+    pid_init(&pid, &gains, 0, ISET_DAC_ZERO_LEVEL_CODE, LOAD_PID_D_FILTER_SHIFT);
+    pid_output = 0;
+    feedforward_q8 = 0;
+    feedforward = 0;
 
-        } break;
+    __enable_irq();
+}
 
-        //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-        default:
-            return;
-            break;
-    }
+// restarts the regulation of the current mode from the specified total output without a bump; used when an enabled load changes the mode
+// the CR and CP feedforward starts at the output and the PID trims from zero; the CV PID carries the whole output
+void __pid_start(int32_t output) {
 
-    // clamp the PID output
-    if (output < 0x0000) output = 0x0000;
+    if (output < 0) output = 0;
     if (output > ISET_DAC_ZERO_LEVEL_CODE) output = ISET_DAC_ZERO_LEVEL_CODE;
 
+    __pid_reset();
+
+    __disable_irq();
+
+    if (load_mode == LOAD_MODE_CR || load_mode == LOAD_MODE_CP) {
+
+        // the inverse of ISET_DAC_LSB_PER_MA; mA = code * 10000 / 14919
+        uint32_t current_ma = SCALE_RATIO(output, 10000, 14919);
+
+        feedforward_q8 = current_ma << 8;
+        feedforward = -ISET_DAC_LSB_PER_MA(current_ma);
+    }
+
+    pid_reset(&pid, output - feedforward);
+    pid_output = output;
+
+    __enable_irq();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the most recent PID output [ISET DAC codes below ISET_DAC_ZERO_LEVEL_CODE]
+int32_t __pid_get_output(void) {
+
+    return (pid_output);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// restarts the PID from the specified total output without a bump; called from the control loop interrupt or with the interrupts disabled
+void __pid_resume(int32_t output) {
+
+    pid_reset(&pid, output - feedforward);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// updates the CV, CR or CP regulation with the latest voltage [mV] and current [mA] sample; called from the control loop timer interrupt
+void load_update_pid(uint32_t voltage, uint32_t current) {
+
+    if (!enabled) return;
+
+    uint32_t level;
+
+    if      (load_mode == LOAD_MODE_CV) level = cv_level_mv;
+    else if (load_mode == LOAD_MODE_CR) level = cr_level_mr;
+    else if (load_mode == LOAD_MODE_CP) level = cp_level_uw;
+    else return;
+
+    int32_t error, process;
+    bool hold;
+
+    uint32_t target = __regulation_error(load_mode, level, voltage, current, &error, &process);
+    feedforward = __regulation_feedforward(&feedforward_q8, target, &hold);
+
+    // the PID trims within the DAC range left by the feedforward
+    pid_set_output_limits(&pid, -feedforward, ISET_DAC_ZERO_LEVEL_CODE - feedforward);
+
+    int32_t output;
+
+    // the relay of a running autotune replaces the PID output
+    if (!__autotune_update(error, &output)) output = pid_update(&pid, hold ? 0 : error, process) + feedforward;
+    pid_output = output;
+
     // update ISET_DAC
-    iset_dac_write_code_non_blocking(output);
+    iset_dac_write_code(ISET_DAC_ZERO_LEVEL_CODE - output);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the control loop rate of the CV, CR and CP regulation; returns false if the rate is out of range
+bool load_set_control_rate(uint32_t rate_hz) {
+
+    return param_set(PARAM_CONTROL_RATE, rate_hz);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the control loop rate of the CV, CR and CP regulation [Hz]
+uint32_t load_get_control_rate(void) {
+
+    return (param_get(PARAM_CONTROL_RATE));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the PID gains of the CV, CR or CP mode; a running regulation switches to the new gains without a bump in the output
+// the gains are clamped to the limits of their parameters
+void load_set_pid_gains(load_mode_t mode, const pid_gains_t *gains) {
+
+    if (mode != LOAD_MODE_CV && mode != LOAD_MODE_CR && mode != LOAD_MODE_CP) return;
+
+    param_id_t kp = PARAM_PID_KP(mode);
+    int32_t values[3] = {gains->kp, gains->ki, gains->kd};
+
+    for (int i = 0; i < 3; i++) {
+
+        int32_t min, max;
+        param_get_limits(kp + i, &min, &max);
+
+        if (values[i] < min) values[i] = min;
+        if (values[i] > max) values[i] = max;
+    }
+
+    // the gains are written at once and applied to the running regulation by __pid_apply_gains
+    param_set_many(kp, values, 3);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the PID gains of the CV, CR or CP mode
+void load_get_pid_gains(load_mode_t mode, pid_gains_t *gains) {
+
+    if (mode != LOAD_MODE_CR && mode != LOAD_MODE_CP) mode = LOAD_MODE_CV;
+    __pid_read_gains(mode, gains);
 }
 
 //----------------------------------------------------------------------------------------------------------------------------------------------------------------
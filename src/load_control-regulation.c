@@ -0,0 +1,66 @@
+#include "load_control.h"
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// computes the error and the process value of the CV, CR or CP regulation from a voltage [mV] and current [mA] sample and the level of the mode
+// returns the feedforward current of the mode [mA]; the errors are positive when the load has to sink more current
+uint32_t __regulation_error(load_mode_t mode, uint32_t level, uint32_t voltage, uint32_t current, int32_t *error, int32_t *process) {
+
+    // the offset noise can make the samples slightly negative
+    if ((int32_t)voltage < 0) voltage = 0;
+    if ((int32_t)current < 0) current = 0;
+
+    uint32_t target = 0;
+
+    switch (mode) {
+
+        case LOAD_MODE_CR:
+
+            // the resistance error is expressed as the voltage difference from V = I * R at the present current; no division by the current
+            // mA * mOhm / 1000 = mV; the division is a multiplication by 2^32 / 1000
+            *process = voltage - (int32_t)(((uint64_t)current * level * 4294967) >> 32);
+            *error = *process;
+
+            // I = V / R; mV * 1000 / mOhm = mA (32bit hardware division)
+            target = (level > 0) ? (voltage * 1000 / level) : LOAD_MAX_CC_LEVEL_MA;
+            break;
+
+        case LOAD_MODE_CP:
+
+            // uW / 1000 = mW; the division is a multiplication by 2^32 / 1000
+            *process = -(int32_t)(((uint64_t)voltage * current * 4294967) >> 32);
+            *error = (int32_t)(level / 1000) + *process;
+
+            // I = P / V; uW / mV = mA
+            target = (voltage > 0) ? (level / voltage) : 0;
+            break;
+
+        default:
+
+            *process = voltage;
+            *error = voltage - level;
+            break;
+    }
+
+    if (target > LOAD_MAX_CC_LEVEL_MA) target = LOAD_MAX_CC_LEVEL_MA;
+
+    return (target);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// moves the filtered feedforward current [mA in Q8] toward the target current and returns the feedforward [ISET DAC codes below ISET_DAC_ZERO_LEVEL_CODE]
+// hold is set while the feedforward is far from the target; the PID is held then, otherwise the integral winds up on the transient
+int32_t __regulation_feedforward(int32_t *feedforward_q8, uint32_t target, bool *hold) {
+
+    // the low-pass filter breaks the algebraic loop through the source resistance (the current drops the voltage the feedforward is computed from)
+    *feedforward_q8 += (int32_t)((target << 8) - *feedforward_q8) >> LOAD_FEEDFORWARD_FILTER_SHIFT;
+
+    int32_t feedforward_error = (target << 8) - *feedforward_q8;
+    if (feedforward_error < 0) feedforward_error = -feedforward_error;
+    *hold = feedforward_error > (int32_t)((target << 8) >> LOAD_FEEDFORWARD_HOLD_SHIFT);
+
+    return (-ISET_DAC_LSB_PER_MA(*feedforward_q8 >> 8));
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
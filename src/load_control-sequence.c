@@ -0,0 +1,256 @@
+#include "load_control.h"
+#include "param.h"
+#include "profiling.h"
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static load_sequence_step_t steps[LOAD_SEQUENCE_MAX_STEPS];
+static uint32_t sequence_length = 0;                // number of steps in the table
+
+volatile bool sequence_running = false;
+uint32_t sequence_clock_ticks = 0;                  // sample timer ticks since the last sequence clock millisecond; advanced by the sample timer interrupt
+volatile uint32_t sequence_clock_ms = 0;            // time since the sequence start counted by the sample timer interrupt [ms]
+
+static uint32_t processed_ms = 0;                   // sequence clock time already handled by the sequence task [ms]
+static uint32_t step_index = 0;                     // running step
+static uint32_t step_start_ms = 0;                  // sequence time of the running step start [ms]
+static uint32_t loop_count = 0;                     // completed repetitions of the table
+static uint32_t loops = 0;                          // repetitions of the running sequence; 0 -> until stopped
+static uint16_t result = 0;                         // load_sequence_ctrl_t result flag of the last run
+
+static bool applying_step = false;                  // the load settings are changed by the sequence; set while a step is applied
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+void __switch_mode(load_mode_t mode);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the SEQ_CTRL register
+static void __update_ctrl_register(void) {
+
+    cmd_write(CMD_ADDRESS_SEQ_CTRL, (sequence_running ? LOAD_SEQUENCE_RUN : 0) | result);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the load to the mode and level of a step; returns false if the load can't be enabled
+// a CC level still passes through the slew limit, so the current reaches the level of the step after the ramp and not at the step time
+// the load stays enabled through a mode change; the regulation of the new mode continues from the present current
+static bool __apply_step(uint32_t index) {
+
+    const load_sequence_step_t *step = &steps[index];
+    bool success = true;
+
+    applying_step = true;
+
+    if (step->mode & LOAD_SEQUENCE_STEP_OFF) load_set_enable(false);
+    else {
+
+        load_mode_t mode = step->mode & LOAD_SEQUENCE_STEP_MODE;
+
+        // the level is set first, so the new mode starts regulating to the level of the step
+        if      (mode == LOAD_MODE_CC) load_set_cc_level(step->level);
+        else if (mode == LOAD_MODE_CV) load_set_cv_level(step->level);
+        else if (mode == LOAD_MODE_CR) load_set_cr_level(step->level);
+        else                           load_set_cp_level(step->level);
+
+        __switch_mode(mode);
+        success = load_set_enable(true);
+    }
+
+    applying_step = false;
+
+    cmd_write(CMD_ADDRESS_SEQ_STEP, index);
+    return (success);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// ends the sequence with a result flag; a completed sequence and a met stop condition disable the load
+static void __sequence_end(uint16_t end_result) {
+
+    sequence_running = false;
+    result = end_result;
+
+    if (end_result != LOAD_SEQUENCE_ABORTED) {
+
+        applying_step = true;
+        load_set_enable(false);
+        applying_step = false;
+    }
+
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// applies the steps of the running sequence; the sample timer interrupt counts the sequence clock and the task catches up with all the milliseconds counted since its last pass
+// the steps call the load setting functions, so they are applied in the task context like every other setting; the short deadline keeps the latency of a step low
+// the latency doesn't accumulate, a step ends at its sequence clock time no matter when the previous one was applied
+void sequence_task(void) {
+
+    while (1) {
+
+        if (sequence_running && processed_ms != sequence_clock_ms) {
+
+            PROF_TASK_START(PROF_SEQUENCE_TASK);
+
+            while (sequence_running && processed_ms != sequence_clock_ms) {
+
+                processed_ms++;
+
+                if (processed_ms - step_start_ms < steps[step_index].duration_ms) continue;
+
+                step_start_ms = processed_ms;
+
+                if (++step_index >= sequence_length) {
+
+                    step_index = 0;
+
+                    if (++loop_count == loops) {
+
+                        __sequence_end(LOAD_SEQUENCE_DONE);
+                        break;
+                    }
+                }
+
+                if (!__apply_step(step_index)) __sequence_end(LOAD_SEQUENCE_ABORTED);
+            }
+
+            cmd_write(CMD_ADDRESS_SEQ_TIME_L, processed_ms & 0xffff);
+            cmd_write(CMD_ADDRESS_SEQ_TIME_H, processed_ms >> 16);
+
+            PROF_TASK_STOP(PROF_SEQUENCE_TASK);
+        }
+
+        kernel_yield();
+    }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops a running sequence if the load settings are changed by anything else than the sequence; called by the load setting functions
+void __sequence_override(void) {
+
+    if (sequence_running && !applying_step) __sequence_end(LOAD_SEQUENCE_ABORTED);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// ends the sequence if the stop condition is met; called by the load control task with the latest measurement
+void __sequence_check_stop_condition(uint32_t voltage_mv, uint32_t current_ma) {
+
+    if (!sequence_running) return;
+
+    uint32_t level = param_get(PARAM_SEQ_STOP_LEVEL);
+    bool stop = false;
+
+    switch (param_get(PARAM_SEQ_STOP_CONDITION)) {
+
+        case LOAD_SEQUENCE_STOP_VOLTAGE_BELOW: stop = (voltage_mv < level); break;
+        case LOAD_SEQUENCE_STOP_VOLTAGE_ABOVE: stop = (voltage_mv > level); break;
+        case LOAD_SEQUENCE_STOP_CURRENT_BELOW: stop = (current_ma < level); break;
+        case LOAD_SEQUENCE_STOP_CURRENT_ABOVE: stop = (current_ma > level); break;
+        default: break;
+    }
+
+    if (!stop) return;
+
+    __sequence_end(LOAD_SEQUENCE_CONDITION);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// writes a step into the sequence table; the table grows by appending at its end; returns false if the position is out of the table or the sequence runs
+bool load_sequence_set_step(uint32_t index, const load_sequence_step_t *step) {
+
+    if (sequence_running) return false;
+    if (index > sequence_length || index >= LOAD_SEQUENCE_MAX_STEPS) return false;
+
+    steps[index] = *step;
+    steps[index].mode &= LOAD_SEQUENCE_STEP_MODE | LOAD_SEQUENCE_STEP_OFF;
+
+    // the sequence clock advances in whole milliseconds
+    if (steps[index].duration_ms == 0) steps[index].duration_ms = 1;
+
+    if (index == sequence_length) sequence_length++;
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// reads a step from the sequence table; returns false if the position is out of the table
+bool load_sequence_get_step(uint32_t index, load_sequence_step_t *step) {
+
+    if (index >= sequence_length) return false;
+
+    *step = steps[index];
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the sequence and clears the step table
+void load_sequence_clear(void) {
+
+    load_sequence_stop();
+    sequence_length = 0;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// starts the sequence from the first step; returns false if the table is empty or the load can't be enabled
+bool load_sequence_start(void) {
+
+    if (sequence_length == 0) return false;
+
+    load_sequence_stop();
+
+    step_index = 0;
+    step_start_ms = 0;
+    processed_ms = 0;
+    loop_count = 0;
+    loops = param_get(PARAM_SEQ_LOOPS);
+    result = 0;
+
+    // the sequence clock is stopped; the sample timer interrupt doesn't touch it until the sequence runs
+    sequence_clock_ticks = 0;
+    sequence_clock_ms = 0;
+
+    if (!__apply_step(0)) {
+
+        __sequence_end(LOAD_SEQUENCE_ABORTED);
+        return false;
+    }
+
+    sequence_running = true;
+    __update_ctrl_register();
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the sequence; the load keeps the setting of the running step
+void load_sequence_stop(void) {
+
+    if (sequence_running) __sequence_end(LOAD_SEQUENCE_ABORTED);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the sequence
+void load_sequence_get_state(load_sequence_state_t *state) {
+
+    state->running = sequence_running;
+    state->result = result;
+    state->length = sequence_length;
+    state->step = step_index;
+    state->loop = loop_count;
+    state->elapsed_ms = processed_ms;
+    state->step_elapsed_ms = processed_ms - step_start_ms;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,279 @@
+#include "load_control.h"
+#include "iset_dac.h"
+#include "vi_sense.h"
+#include "fixed_point.h"
+#include "param.h"
+
+extern uint32_t cc_level_ma;
+extern uint32_t cv_level_mv;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum {
+
+    SWEEP_IDLE = 0,
+    SWEEP_SETTLING,             // the setpoint of the point was changed; the blocks of the dwell are skipped
+    SWEEP_MEASURING,            // the blocks are averaged into the point
+    SWEEP_FINISHED              // all points are measured; the load control task ends the sweep
+
+} sweep_state_t;
+
+static volatile sweep_state_t sweep_state = SWEEP_IDLE;
+static bool applying_setting = false;               // the load settings are changed by the sweep
+static uint16_t result = 0;                         // load_sweep_ctrl_t result flag of the last sweep
+
+// settings of the running sweep
+static load_mode_t mode;
+static int32_t start_level;                         // first and last setpoint [mA or mV]
+static int32_t stop_level;
+static uint32_t point_total;                        // number of points
+static uint32_t dwell_blocks;                       // blocks skipped after a setpoint change
+static uint32_t sample_blocks;                      // blocks averaged into a point
+static uint32_t sample_rate_hz;                     // sample rate at the sweep start
+
+// state of the point in progress; owned by the block interrupt while the sweep runs
+static uint32_t blocks = 0;                         // blocks of the present phase
+static uint32_t sweep_blocks = 0;                   // blocks since the first point settled
+static int32_t voltage_sum = 0;                     // sums of the block averages [mV, mA]
+static int32_t current_sum = 0;
+static int64_t power_sum = 0;                       // sum of the block powers [uW]
+
+static load_sweep_point_t points[LOAD_SWEEP_MAX_POINTS];
+static volatile uint32_t point_count = 0;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// updates the SWEEP_CTRL and SWEEP_COUNT registers
+static void __update_registers(void) {
+
+    bool running = (sweep_state != SWEEP_IDLE);
+
+    cmd_write(CMD_ADDRESS_SWEEP_CTRL, (running ? LOAD_SWEEP_RUN : 0) | result);
+    cmd_write(CMD_ADDRESS_SWEEP_COUNT, point_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the setpoint of a point; the points are evenly spaced from the start to the stop level
+static uint32_t __setpoint(uint32_t index) {
+
+    return start_level + (stop_level - start_level) * (int32_t)index / (int32_t)(point_total - 1);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// changes the setpoint to the next point; called from the block interrupt
+// the CC level goes to the DAC without the slew limit, the CV level is taken by the next control loop update
+static void __apply_point(uint32_t index) {
+
+    uint32_t level = __setpoint(index);
+
+    if (mode == LOAD_MODE_CC) {
+
+        cc_level_ma = level;
+        iset_dac_write_code(iset_dac_current_to_code(level));
+
+    } else cv_level_mv = level;
+
+    blocks = 0;
+    sweep_state = SWEEP_SETTLING;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// ends the sweep with a result flag; the level registers are updated with the last setpoint
+static void __sweep_end(uint16_t end_result, bool disable) {
+
+    sweep_state = SWEEP_IDLE;
+    result = end_result;
+
+    if (mode == LOAD_MODE_CC) cmd_write(CMD_ADDRESS_CC_LEVEL, cc_level_ma);
+    else cmd_write(CMD_ADDRESS_CV_LEVEL, cv_level_mv / 10);
+
+    if (disable) {
+
+        applying_setting = true;
+        load_set_enable(false);
+        applying_setting = false;
+    }
+
+    __update_registers();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops a running sweep if the load settings are changed by anything else than the sweep; called by the load setting functions
+void __sweep_override(void) {
+
+    if (sweep_state != SWEEP_IDLE && !applying_setting) __sweep_end(LOAD_SWEEP_ABORTED, false);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// reports the progress and disables the load after the last point was measured; called by the load control task
+void __sweep_update(void) {
+
+    if (sweep_state == SWEEP_FINISHED) __sweep_end(LOAD_SWEEP_DONE, true);
+    else if (sweep_state != SWEEP_IDLE) cmd_write(CMD_ADDRESS_SWEEP_COUNT, point_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// advances the sweep with the averages of a block; called from the block interrupt for every block included in the averages
+// the block in progress at a setpoint change is never averaged, even with no dwell
+void __sweep_block(int32_t voltage_mv, int32_t current_ma) {
+
+    if (sweep_state != SWEEP_SETTLING && sweep_state != SWEEP_MEASURING) return;
+
+    if (sweep_state == SWEEP_SETTLING) {
+
+        // the first point is reached by the slew limited ramp of the load enable
+        if (iset_dac_is_in_transient()) return;
+
+        sweep_blocks++;
+        if (blocks++ < dwell_blocks) return;
+
+        sweep_state = SWEEP_MEASURING;
+        blocks = 0;
+        voltage_sum = 0;
+        current_sum = 0;
+        power_sum = 0;
+        return;
+    }
+
+    sweep_blocks++;
+    voltage_sum += voltage_mv;
+    current_sum += current_ma;
+    power_sum += (int64_t)voltage_mv * current_ma;
+
+    if (++blocks < sample_blocks) return;
+
+    load_sweep_point_t *point = &points[point_count];
+    point->setpoint = __setpoint(point_count);
+    point->voltage_mv = (voltage_sum > 0) ? voltage_sum / (int32_t)blocks : 0;
+    point->current_ma = (current_sum > 0) ? current_sum / (int32_t)blocks : 0;
+    point->power_mw = (power_sum > 0) ? div_s64(power_sum, blocks * 1000) : 0;
+
+    if (++point_count == point_total) sweep_state = SWEEP_FINISHED;
+    else __apply_point(point_count);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the I-V sweep with the sweep_* parameters; returns false if the mode is invalid or the load can't be enabled
+bool load_sweep_start(void) {
+
+    load_mode_t sweep_mode = param_get(PARAM_SWEEP_MODE);
+    if (sweep_mode != LOAD_MODE_CC && sweep_mode != LOAD_MODE_CV) return false;
+
+    // the dynamic mode waveform and the maximum power point tracker would replace the CC level
+    load_dynamic_config_t dynamic;
+    load_mppt_state_t mppt;
+    load_get_dynamic_config(&dynamic);
+    load_get_mppt_state(&mppt);
+    if (sweep_mode == LOAD_MODE_CC && (dynamic.enabled || mppt.enabled)) return false;
+
+    load_sweep_stop();
+
+    mode = sweep_mode;
+    start_level = param_get(PARAM_SWEEP_START);
+    stop_level = param_get(PARAM_SWEEP_STOP);
+    point_total = param_get(PARAM_SWEEP_POINTS);
+
+    // check limits
+    int32_t min_level = (mode == LOAD_MODE_CC) ? LOAD_MIN_CC_LEVEL_MA : LOAD_MIN_CV_LEVEL_MV;
+    int32_t max_level = (mode == LOAD_MODE_CC) ? LOAD_MAX_CC_LEVEL_MA : LOAD_MAX_CV_LEVEL_MV;
+
+    if (start_level < min_level) start_level = min_level;
+    if (start_level > max_level) start_level = max_level;
+    if (stop_level < min_level) stop_level = min_level;
+    if (stop_level > max_level) stop_level = max_level;
+
+    // the dwell and the averaging are counted in whole blocks
+    sample_rate_hz = vi_sense_get_sample_rate();
+    uint64_t block_us = div_u64((uint64_t)VI_SENSE_BLOCK_SIZE * 1000000, sample_rate_hz);
+
+    dwell_blocks = div_u64(param_get(PARAM_SWEEP_DWELL) + block_us - 1, block_us);
+    sample_blocks = (param_get(PARAM_SWEEP_SAMPLES) + VI_SENSE_BLOCK_SIZE - 1) / VI_SENSE_BLOCK_SIZE;
+
+    point_count = 0;
+    sweep_blocks = 0;
+    blocks = 0;
+    result = 0;
+
+    // the first point is set by the regular level setters; the load enable ramps the CC level up with the slew limit
+    applying_setting = true;
+
+    load_set_enable(false);
+    load_set_mode(mode);
+
+    if (mode == LOAD_MODE_CC) load_set_cc_level(start_level);
+    else load_set_cv_level(start_level);
+
+    bool enabled = load_set_enable(true);
+
+    applying_setting = false;
+
+    if (!enabled) {
+
+        __sweep_end(LOAD_SWEEP_ABORTED, false);
+        return false;
+    }
+
+    // the block interrupt takes over from here
+    sweep_state = SWEEP_SETTLING;
+    __update_registers();
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the I-V sweep; the load keeps the level of the last point
+void load_sweep_stop(void) {
+
+    if (sweep_state != SWEEP_IDLE) __sweep_end(LOAD_SWEEP_ABORTED, false);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the state of the I-V sweep
+void load_sweep_get_state(load_sweep_state_t *state) {
+
+    state->running = (sweep_state != SWEEP_IDLE);
+    state->result = result;
+    state->points = point_count;
+    state->duration_us = (sample_rate_hz > 0) ? div_u64((uint64_t)sweep_blocks * VI_SENSE_BLOCK_SIZE * 1000000, sample_rate_hz) : 0;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// reads a point of the I-V sweep result table; returns false if the point is not measured
+bool load_sweep_get_point(uint32_t index, load_sweep_point_t *point) {
+
+    if (index >= point_count) return false;
+
+    *point = points[index];
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// loads a point of the I-V sweep result table into the SWEEP_DATA window; an index out of the table loads zeroes
+void load_sweep_load_window(uint32_t index) {
+
+    load_sweep_point_t point = {0};
+    load_sweep_get_point(index, &point);
+
+    // the setpoint is in the units of the CC or CV level register
+    uint32_t setpoint = (mode == LOAD_MODE_CV) ? point.setpoint / 10 : point.setpoint;
+    uint32_t power = point.power_mw / 100;
+
+    cmd_write(CMD_ADDRESS_SWEEP_DATA0, setpoint);
+    cmd_write(CMD_ADDRESS_SWEEP_DATA0 + 1, point.voltage_mv / 10);
+    cmd_write(CMD_ADDRESS_SWEEP_DATA0 + 2, point.current_ma);
+    cmd_write(CMD_ADDRESS_SWEEP_DATA3, (power > 0xffff) ? 0xffff : power);
+
+    cmd_write(CMD_ADDRESS_SWEEP_INDEX, index);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -2,6 +2,9 @@
 #include "cmd_spi_driver.h"
 #include "iset_dac.h"
 #include "vi_sense.h"
+#include "fixed_point.h"
+#include "param.h"
+#include "profiling.h"
 
 //---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -20,12 +23,19 @@ extern uint16_t fault_mask;             // fault mask; if the corresponding bit
 
 // statistics
 extern kernel_time_t last_enable_time;  // absolute time of last load enable (not cleared after a load disable)
-extern uint32_t total_mas;              // total cumulative current since the load was last enabled [mAs]
-extern uint32_t total_mws;              // total power dissipated since the load was last enabled [mWs]
 
 //---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
 
 void ext_fault_task(void);
+void battery_test_task(void);
+void __control_loop_init(void);
+void __autotune_finish(void);
+void sequence_task(void);
+void __sequence_check_stop_condition(uint32_t voltage_mv, uint32_t current_ma);
+void __sweep_update(void);
+void __mppt_update(void);
+void __linearize_update(void);
+void __trim_update(void);
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -47,11 +57,17 @@ void load_control_task(void) {
     gpio_set_mode(LOAD_EN_R_GPIO, GPIO_MODE_OUTPUT);
     
     iset_dac_init();
+    __control_loop_init();
 
-    uint32_t vi_sense_stack[64];
-    uint32_t ext_fault_stack[64];
+    // the stacks of the child tasks don't fit into the 256 word stack of this task
+    static uint32_t vi_sense_stack[64];
+    static uint32_t ext_fault_stack[64];
+    static uint32_t battery_test_stack[128];
+    static uint32_t sequence_stack[128];
     kernel_create_task(vi_sense_task, vi_sense_stack, sizeof(vi_sense_stack), 10);
     kernel_create_task(ext_fault_task, ext_fault_stack, sizeof(ext_fault_stack), 10);
+    kernel_create_task(battery_test_task, battery_test_stack, sizeof(battery_test_stack), 10);
+    kernel_create_task(sequence_task, sequence_stack, sizeof(sequence_stack), 1);
 
     // wait for the CMD SPI interface to be initialized and set the default CC level and fault mask
     kernel_sleep_ms(100);
@@ -62,27 +78,39 @@ void load_control_task(void) {
     load_set_cv_level(LOAD_START_CV_LEVEL_MV);
     load_set_cr_level(LOAD_START_CR_LEVEL_MR);
     load_set_cp_level(LOAD_START_CP_LEVEL_MW);
+    load_set_dynamic_level(false, LOAD_START_DYNAMIC_LEVEL_A_MA);
+    load_set_dynamic_level(true, LOAD_START_DYNAMIC_LEVEL_B_MA);
+    load_set_dynamic_frequency(LOAD_START_DYNAMIC_FREQUENCY_HZ);
+    load_set_dynamic_duty(LOAD_START_DYNAMIC_DUTY);
+    load_set_dynamic_slew(false, LOAD_START_DYNAMIC_SLEW);
+    load_set_dynamic_slew(true, LOAD_START_DYNAMIC_SLEW);
 
     cmd_write(CMD_ADDRESS_AVLBL_CURRENT, LOAD_AVAILABLE_CURRENT_A);
     cmd_write(CMD_ADDRESS_AVLBL_POWER, LOAD_AVAILABLE_POWER_W);
 
     while (1) {
 
+        PROF_TASK_START(PROF_LOAD_CONTROL_TASK);
+
         if (enabled) {
 
-            uint32_t load_voltage_mv = vi_sense_get_voltage();
-            uint32_t load_current_ma = vi_sense_get_current();
+            // voltage and current must come from the same averaging window, otherwise the CR and power checks see mismatched pairs
+            vi_sense_snapshot_t measurement;
+            vi_sense_read_snapshot(&measurement);
+
+            uint32_t load_voltage_mv = measurement.voltage_mv;
+            uint32_t load_current_ma = measurement.current_ma;
             uint32_t load_power_mw = load_voltage_mv * load_current_ma / 1000;
 
             //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
             // overcurrent protection
-            if (load_current_ma > LOAD_OCP_THRESHOLD_MA) load_trigger_fault(LOAD_FAULT_OCP);
+            if (load_current_ma > param_get(PARAM_OCP_THRESHOLD)) load_trigger_fault(LOAD_FAULT_OCP);
 
             //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
             // overpower protection
-            if (load_power_mw > LOAD_OPP_THRESHOLD_MW) load_trigger_fault(LOAD_FAULT_OPP);
+            if (load_power_mw > param_get(PARAM_OPP_THRESHOLD)) load_trigger_fault(LOAD_FAULT_OPP);
 
             //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
@@ -95,14 +123,15 @@ void load_control_task(void) {
                 if (current_error < 0) current_error = -current_error;
                 
                 // dac is not in transient and the current difference from setpoint is higher than the threshold
-                if (!iset_dac_is_in_transient() && current_error >= LOAD_NO_REG_THRESHOLD_CC) not_in_regulation = true;
+                // the dynamic mode alternates the current on purpose
+                if (!iset_dac_is_in_transient() && !iset_dac_is_waveform_running() && current_error >= param_get(PARAM_NO_REG_THRESHOLD_CC)) not_in_regulation = true;
 
             } else if (load_mode == LOAD_MODE_CV) {
 
                 int32_t error = cv_level_mv - load_voltage_mv;
                 if (error < 0) error = -error;
                 
-                if (error >= LOAD_NO_REG_THRESHOLD_CV) not_in_regulation = true;
+                if (error >= param_get(PARAM_NO_REG_THRESHOLD_CV)) not_in_regulation = true;
 
             } else if (load_mode == LOAD_MODE_CR) {
 
@@ -110,29 +139,32 @@ void load_control_task(void) {
                 int32_t error = cr_level_mr - resistance;
                 if (error < 0) error = -error;
                 
-                if (error >= LOAD_NO_REG_THRESHOLD_CR) not_in_regulation = true;
+                if (error >= param_get(PARAM_NO_REG_THRESHOLD_CR)) not_in_regulation = true;
 
             } else {
 
                 int32_t error = (cp_level_uw / 1000) - load_power_mw;
                 if (error < 0) error = -error;
                 
-                if (error >= LOAD_NO_REG_THRESHOLD_CP) not_in_regulation = true;
+                if (error >= param_get(PARAM_NO_REG_THRESHOLD_CP)) not_in_regulation = true;
             }
             
             static uint8_t no_reg_cumulative_counter = 0;
 
+            // the relay of a running autotune keeps the load out of regulation on purpose
+            if (load_autotune_get_state() == LOAD_AUTOTUNE_RUNNING) not_in_regulation = false;
+
             if (not_in_regulation) {
 
                 // raise NO_REG flag after enough cumulative faults
-                if (++no_reg_cumulative_counter == LOAD_NO_REG_CUMULATIVE_COUNTS) {
+                if (++no_reg_cumulative_counter >= param_get(PARAM_NO_REG_COUNTS)) {
 
                     status_register |= LOAD_STATUS_NO_REG;
                     cmd_write(CMD_ADDRESS_STATUS, status_register);
 
                     load_trigger_fault(LOAD_FAULT_REG);
 
-                    no_reg_cumulative_counter = LOAD_NO_REG_CUMULATIVE_COUNTS - 1;
+                    no_reg_cumulative_counter = param_get(PARAM_NO_REG_COUNTS) - 1;
                 }
 
             // load is in regulation, clear the NO_REG flag
@@ -157,14 +189,14 @@ void load_control_task(void) {
                     // trigger a fuse fault after enough cumulative faults
                     if (vi_sense_get_sink_current(sink) == 0) {
                         
-                        if (++fuse_fault_cumulative_counter[sink] == LOAD_FUSE_FAULT_CUMULATIVE_COUNTS) {
+                        if (++fuse_fault_cumulative_counter[sink] >= param_get(PARAM_FUSE_FAULT_COUNTS)) {
 
                             if      (sink == CURRENT_L1) load_trigger_fault(LOAD_FAULT_FUSE_L1);
                             else if (sink == CURRENT_L2) load_trigger_fault(LOAD_FAULT_FUSE_L2);
                             else if (sink == CURRENT_R1) load_trigger_fault(LOAD_FAULT_FUSE_R1);
                             else if (sink == CURRENT_R2) load_trigger_fault(LOAD_FAULT_FUSE_R2);
 
-                            fuse_fault_cumulative_counter[sink] = LOAD_FUSE_FAULT_CUMULATIVE_COUNTS - 1;
+                            fuse_fault_cumulative_counter[sink] = param_get(PARAM_FUSE_FAULT_COUNTS) - 1;
                         }
 
                     } else if (fuse_fault_cumulative_counter[sink] > 0) fuse_fault_cumulative_counter[sink]--;
@@ -176,28 +208,46 @@ void load_control_task(void) {
             // disable the load if voltage dropped bellow threshold
             if (load_voltage_mv < discharge_voltage_mv) load_set_enable(false);
 
+            // end a running sequence if its stop condition is met
+            __sequence_check_stop_condition(load_voltage_mv, load_current_ma);
+
             //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
             // handle load statistics
             uint32_t enable_time_s = kernel_get_time_since(last_enable_time) / 1000;
 
-            total_mas += load_current_ma / (1000 / LOAD_CONTROL_UPDATE_PERIOD_MS);
-            total_mws += load_power_mw / (1000 / LOAD_CONTROL_UPDATE_PERIOD_MS);
-
             cmd_write(CMD_ADDRESS_TOTAL_TIME_L, enable_time_s & 0xffff);
             cmd_write(CMD_ADDRESS_TOTAL_TIME_H, enable_time_s >> 16);
 
-            uint32_t total_mah = total_mas / (60 * 60);
+            // the charge and energy are integrated at the sample rate by the vi_sense block interrupt
+            int64_t charge_uas, energy_uws;
+            vi_sense_read_integrals(&charge_uas, &energy_uws);
+
+            uint32_t total_mah = (charge_uas > 0) ? div_u64(charge_uas, 1000 * 60 * 60) : 0;
             cmd_write(CMD_ADDRESS_TOTAL_MAH_L, total_mah & 0xffff);
             cmd_write(CMD_ADDRESS_TOTAL_MAH_H, total_mah >> 16);
 
-            uint32_t total_mwh = total_mws / (60 * 60);
+            uint32_t total_mwh = (energy_uws > 0) ? div_u64(energy_uws, 1000 * 60 * 60) : 0;
             cmd_write(CMD_ADDRESS_TOTAL_MWH_L, total_mwh & 0xffff);
             cmd_write(CMD_ADDRESS_TOTAL_MWH_H, total_mwh >> 16);
 
             //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
         }
 
+        // compute the new PID gains when the autotune relay finishes
+        __autotune_finish();
+
+        // disable the load after the last point of an I-V sweep
+        __sweep_update();
+
+        // report the tracked maximum power point
+        __mppt_update();
+
+        // measure the next CC linearization point and integrate the CC error into the trim
+        __linearize_update();
+        __trim_update();
+
+        PROF_TASK_STOP(PROF_LOAD_CONTROL_TASK);
         kernel_sleep_ms(LOAD_CONTROL_UPDATE_PERIOD_MS);
     }
 }
@@ -22,12 +22,79 @@ uint16_t fault_mask      = 0;       // fault mask; if the corresponding bit in t
 
 // statistics
 kernel_time_t last_enable_time = 0;  // absolute time of last load enable (not cleared after a load disable)
-uint32_t total_mas = 0;              // total cumulative current since the load was last enabled [mAs]
-uint32_t total_mws = 0;              // total power dissipated since the load was last enabled [mWs]
 
 //---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
 
 void __pid_reset(void);
+void __pid_start(int32_t output);
+void __control_loop_run(bool run);
+bool __dynamic_start(void);
+void __dynamic_stop(void);
+void __sequence_override(void);
+void __battery_override(void);
+void __sweep_override(void);
+void __linearize_override(void);
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the mode bits of the config register
+static void __update_mode_bits(load_mode_t mode) {
+
+    if (mode & (1 << 0)) cmd_set_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE0);
+    else cmd_clear_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE0);
+    if (mode & (1 << 1)) cmd_set_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE1);
+    else cmd_clear_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE1);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the sequence, the battery test, the sweep and the linearization unless they changed the setting themselves; called by every load setting function
+void __settings_changed(void) {
+
+    __sequence_override();
+    __battery_override();
+    __sweep_override();
+    __linearize_override();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// changes the mode of an enabled load without disabling it; the regulation of the new mode continues from the present DAC code
+// used by the sequence steps; load_set_mode disables the load instead, a disabled load just takes the mode
+void __switch_mode(load_mode_t mode) {
+
+    if (!enabled) {
+
+        load_set_mode(mode);
+        return;
+    }
+
+    if (mode == load_mode) return;
+    if (mode != LOAD_MODE_CC && mode != LOAD_MODE_CV && mode != LOAD_MODE_CR && mode != LOAD_MODE_CP) return;
+
+    __settings_changed();
+
+    // stop the regulation of the old mode; the DAC keeps the last code
+    load_autotune_abort();
+    __dynamic_stop();
+    __control_loop_run(false);
+
+    load_mode = mode;
+    __update_mode_bits(mode);
+
+    if (mode == LOAD_MODE_CC) {
+
+        // the slew limited ramp starts from the last code of the PID
+        vi_sense_set_continuous_conversion_mode(false);
+        if (!__dynamic_start()) iset_dac_set_current(cc_level_ma, true);
+
+    } else {
+
+        __pid_start(ISET_DAC_ZERO_LEVEL_CODE - (int32_t)iset_dac_get_code());
+        vi_sense_set_continuous_conversion_mode(true);
+        __control_loop_run(true);
+    }
+}
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -35,41 +102,56 @@ void __pid_reset(void);
 bool load_set_enable(bool state) {
 
     if (state == enabled) return true;                                  // load is already in the specified state
+
+    __settings_changed();                                               // a load enable or disable from outside of the sequence, the battery test, the sweep or the linearization stops them
     if (state && !(status_register & LOAD_STATUS_READY)) return false;  // load is performing a self test (not ready)
     if (state && (fault_register & fault_mask)) return false;           // load is in fault; enable not allowed until all masked faults are cleared
 
     if (state) {    // enable the load
 
+        // the sample timer leaves the idle rate with its next period, before the current starts to flow
+        vi_sense_set_idle(false);
+        vi_sense_capture_event(LOAD_CAPTURE_TRIGGER_ENABLE);
+
         // enable the power boards and slowly increase the current to CC level
         iset_dac_write_code(0xffff);
         gpio_write(LOAD_EN_L_GPIO, HIGH);
         gpio_write(LOAD_EN_R_GPIO, HIGH);
 
-        if (load_mode == LOAD_MODE_CC) iset_dac_set_current(cc_level_ma, true);
-        else {
+        // the dynamic mode runs its waveform instead of the CC level
+        if (load_mode == LOAD_MODE_CC) {
+
+            if (!__dynamic_start()) iset_dac_set_current(cc_level_ma, true);
+
+        } else {
 
             // setup the PID for CV, CR or CP
             __pid_reset();
             vi_sense_set_continuous_conversion_mode(true);
+            __control_loop_run(true);
         }
 
         gpio_write(LOAD_ENABLE_LED_GPIO, LOW);
 
         last_enable_time = kernel_get_time_ms();
-        total_mas = 0;
-        total_mws = 0;
+        vi_sense_set_integration(true);
 
         status_register |=  LOAD_STATUS_ENABLED;
 
     } else {    // disable the load
 
+        load_autotune_abort();
+        __dynamic_stop();
+        __control_loop_run(false);
         vi_sense_set_continuous_conversion_mode(false);
+        vi_sense_set_integration(false);
 
         // disable the power boards and write zero-current code to I_SET DAC
         gpio_write(LOAD_EN_L_GPIO, LOW);
         gpio_write(LOAD_EN_R_GPIO, LOW);
         iset_dac_write_code(0xffff);
         gpio_write(LOAD_ENABLE_LED_GPIO, HIGH);
+        vi_sense_set_idle(true);
 
         status_register &= ~(LOAD_STATUS_ENABLED | LOAD_STATUS_NO_REG);
     }
@@ -88,15 +170,12 @@ void load_set_mode(load_mode_t mode) {
     if (mode == load_mode) return;
     if (mode != LOAD_MODE_CC && mode != LOAD_MODE_CV && mode != LOAD_MODE_CR && mode != LOAD_MODE_CP) return;
 
+    __settings_changed();
+
     load_set_enable(false);
 
     load_mode = mode;
-
-    // update the config register
-    if (mode & (1 << 0)) cmd_set_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE0);
-    else cmd_clear_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE0);
-    if (mode & (1 << 1)) cmd_set_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE1);
-    else cmd_clear_bit(CMD_ADDRESS_CONFIG, LOAD_CONFIG_MODE1);
+    __update_mode_bits(mode);
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -104,11 +183,14 @@ void load_set_mode(load_mode_t mode) {
 // sets the load current in Constant Current mode
 void load_set_cc_level(uint32_t current_ma) {
 
+    __settings_changed();
+
     // check limits
     if (current_ma < LOAD_MIN_CC_LEVEL_MA) current_ma = LOAD_MIN_CC_LEVEL_MA;
     if (current_ma > LOAD_MAX_CC_LEVEL_MA) current_ma = LOAD_MAX_CC_LEVEL_MA;
 
-    if (enabled) iset_dac_set_current(current_ma, true);    // if the load is enabled write new value to the I_SET dac with a slew rate limit
+    // if the load is enabled write new value to the I_SET dac with a slew rate limit; the dynamic mode waveform ignores the CC level
+    if (enabled && !iset_dac_is_waveform_running()) iset_dac_set_current(current_ma, true);
 
     cc_level_ma = current_ma;
     cmd_write(CMD_ADDRESS_CC_LEVEL, current_ma);        // update the register
@@ -119,6 +201,8 @@ void load_set_cc_level(uint32_t current_ma) {
 // sets the load voltage in Constant Voltage mode
 void load_set_cv_level(uint32_t voltage_mv) {
 
+    __settings_changed();
+
     // check limits
     if (voltage_mv < LOAD_MIN_CV_LEVEL_MV) voltage_mv = LOAD_MIN_CV_LEVEL_MV;
     if (voltage_mv > LOAD_MAX_CV_LEVEL_MV) voltage_mv = LOAD_MAX_CV_LEVEL_MV;
@@ -132,6 +216,8 @@ void load_set_cv_level(uint32_t voltage_mv) {
 // sets the load resistance in Constant Resistance mode
 void load_set_cr_level(uint32_t resistance_mohm) {
 
+    __settings_changed();
+
     // check limits
     if (resistance_mohm < LOAD_MIN_CR_LEVEL_MR) resistance_mohm = LOAD_MIN_CR_LEVEL_MR;
     if (resistance_mohm > LOAD_MAX_CR_LEVEL_MR) resistance_mohm = LOAD_MAX_CR_LEVEL_MR;
@@ -145,6 +231,8 @@ void load_set_cr_level(uint32_t resistance_mohm) {
 // sets the load power in Constant Power mode
 void load_set_cp_level(uint32_t power_mw) {
 
+    __settings_changed();
+
     // check limits
     if (power_mw < LOAD_MIN_CP_LEVEL_MW) power_mw = LOAD_MIN_CP_LEVEL_MW;
     if (power_mw > LOAD_MAX_CP_LEVEL_MW) power_mw = LOAD_MAX_CP_LEVEL_MW;
@@ -9,6 +9,10 @@
 #include "load_control.h"
 #include "temp_control.h"
 #include "cmd_spi_task.h"
+#include "calibration.h"
+#include "param.h"
+#include "profiling.h"
+#include "internal_adc.h"
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -29,6 +33,15 @@ int main() {
     rcc_pll_init(CORE_CLOCK_FREQUENCY_HZ, RCC_PLL_SOURCE_HSE);
     rcc_set_system_clock_source(RCC_SYSTEM_CLOCK_SOURCE_PLL);
 
+    param_init();           // the tasks and the interrupts read the parameter table from their init
+
+#if PROFILING_ENABLED
+    prof_init();            // the first interrupts are profiled already
+#endif
+
+    calibration_init();     // the conversions use the calibration tables from the first sample
+    internal_adc_init();    // the current sink and temperature readings are valid from the start of the tasks
+
     uint32_t watchdog_stack[32];
     uint32_t debug_uart_stack[512];
     uint32_t temp_control_stack[512];
@@ -55,7 +68,10 @@ void watchdog_task(void) {
 
     while (1) {
 
+        PROF_TASK_START(PROF_WATCHDOG_TASK);
         iwdg_reload();
+        PROF_TASK_STOP(PROF_WATCHDOG_TASK);
+
         kernel_yield();
     }
 }
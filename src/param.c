@@ -0,0 +1,178 @@
+#include "param.h"
+#include "pid.h"
+#include "cmd_spi_registers.h"
+#include "utils/string.h"
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+void __pid_apply_gains(void);
+void __control_loop_apply_rate(void);
+void __iset_dac_apply_slew_rate(void);
+void __battery_apply_mode(void);
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// description of a parameter
+typedef struct {
+
+    const char *name;
+    int32_t default_value;
+    int32_t min;
+    int32_t max;
+    void (*apply)(void);        // pushes the new value to the interrupt that uses it; NULL if only the tasks read the parameter
+
+} param_info_t;
+
+static const param_info_t param_info[PARAM_COUNT] = {
+
+    [PARAM_CV_KP]               = {"cv_kp",         LOAD_CV_PID_KP,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CV_KI]               = {"cv_ki",         LOAD_CV_PID_KI,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CV_KD]               = {"cv_kd",         LOAD_CV_PID_KD,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CR_KP]               = {"cr_kp",         LOAD_CR_PID_KP,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CR_KI]               = {"cr_ki",         LOAD_CR_PID_KI,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CR_KD]               = {"cr_kd",         LOAD_CR_PID_KD,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CP_KP]               = {"cp_kp",         LOAD_CP_PID_KP,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CP_KI]               = {"cp_ki",         LOAD_CP_PID_KI,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CP_KD]               = {"cp_kd",         LOAD_CP_PID_KD,                 0,                                  LOAD_PID_MAX_GAIN,                  __pid_apply_gains},
+    [PARAM_CONTROL_RATE]        = {"control_rate",  LOAD_CONTROL_LOOP_RATE_HZ,      LOAD_CONTROL_LOOP_MIN_RATE_HZ,      LOAD_CONTROL_LOOP_MAX_RATE_HZ,      __control_loop_apply_rate},
+    [PARAM_SLEW_RATE_UP]        = {"slew_up",       SLEW_LIMIT_MA_PER_SECOND,       SLEW_LIMIT_MIN_MA_PER_SECOND,       SLEW_LIMIT_MAX_MA_PER_SECOND,       __iset_dac_apply_slew_rate},
+    [PARAM_SLEW_RATE_DOWN]      = {"slew_down",     SLEW_LIMIT_MA_PER_SECOND,       SLEW_LIMIT_MIN_MA_PER_SECOND,       SLEW_LIMIT_MAX_MA_PER_SECOND,       __iset_dac_apply_slew_rate},
+    [PARAM_OCP_THRESHOLD]       = {"ocp_ma",        LOAD_OCP_THRESHOLD_MA,          LOAD_MIN_CC_LEVEL_MA,               LOAD_OCP_THRESHOLD_MA,              NULL},
+    [PARAM_OPP_THRESHOLD]       = {"opp_mw",        LOAD_OPP_THRESHOLD_MW,          LOAD_MIN_CP_LEVEL_MW,               LOAD_OPP_THRESHOLD_MW,              NULL},
+    [PARAM_NO_REG_THRESHOLD_CC] = {"noreg_cc_ma",   LOAD_NO_REG_THRESHOLD_CC,       1,                                  LOAD_MAX_CC_LEVEL_MA,               NULL},
+    [PARAM_NO_REG_THRESHOLD_CV] = {"noreg_cv_mv",   LOAD_NO_REG_THRESHOLD_CV,       1,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_NO_REG_THRESHOLD_CR] = {"noreg_cr_mr",   LOAD_NO_REG_THRESHOLD_CR,       1,                                  LOAD_MAX_CR_LEVEL_MR,               NULL},
+    [PARAM_NO_REG_THRESHOLD_CP] = {"noreg_cp_mw",   LOAD_NO_REG_THRESHOLD_CP,       1,                                  LOAD_MAX_CP_LEVEL_MW,               NULL},
+    [PARAM_NO_REG_COUNTS]       = {"noreg_counts",  LOAD_NO_REG_CUMULATIVE_COUNTS,  1,                                  255,                                NULL},
+    [PARAM_FUSE_FAULT_COUNTS]   = {"fuse_counts",   LOAD_FUSE_FAULT_CUMULATIVE_COUNTS, 1,                               255,                                NULL},
+    [PARAM_SEQ_LOOPS]           = {"seq_loops",     1,                              0,                                  LOAD_SEQUENCE_MAX_LOOPS,            NULL},
+    [PARAM_SEQ_STOP_CONDITION]  = {"seq_stop",      LOAD_SEQUENCE_STOP_NONE,        LOAD_SEQUENCE_STOP_NONE,            LOAD_SEQUENCE_STOP_CURRENT_ABOVE,   NULL},
+    [PARAM_SEQ_STOP_LEVEL]      = {"seq_stop_level", 0,                             0,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_BAT_MODE]            = {"bat_mode",      LOAD_MODE_CC,                   LOAD_MODE_CC,                       LOAD_MODE_CP,                       __battery_apply_mode},
+    [PARAM_BAT_LEVEL]           = {"bat_level",     BATTERY_DEFAULT_LEVEL,          0,                                  LOAD_MAX_CP_LEVEL_MW,               NULL},      // limited by the mode, see param_get_limits()
+    [PARAM_BAT_CUTOFF]          = {"bat_cutoff_mv", BATTERY_DEFAULT_CUTOFF_MV,      0,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_BAT_HYSTERESIS]      = {"bat_hyst_mv",   BATTERY_DEFAULT_HYSTERESIS_MV,  0,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_BAT_CUTOFF_TIME]     = {"bat_cutoff_ms", BATTERY_DEFAULT_CUTOFF_MS,      0,                                  60000,                              NULL},
+    [PARAM_BAT_IR_INTERVAL]     = {"bat_ir_s",      BATTERY_DEFAULT_IR_INTERVAL_S,  0,                                  3600,                               NULL},
+    [PARAM_BAT_IR_PULSE]        = {"bat_ir_pulse",  BATTERY_DEFAULT_IR_PULSE,       10,                                 300,                                NULL},
+    [PARAM_BAT_IR_PULSE_TIME]   = {"bat_ir_ms",     BATTERY_DEFAULT_IR_PULSE_MS,    2 * BATTERY_IR_WINDOW_MS,           1000,                               NULL},
+    [PARAM_BAT_LOG_INTERVAL]    = {"bat_log_s",     BATTERY_DEFAULT_LOG_INTERVAL_S, 1,                                  3600,                               NULL},
+    [PARAM_SWEEP_MODE]          = {"sweep_mode",    LOAD_MODE_CC,                   LOAD_MODE_CC,                       LOAD_MODE_CV,                       NULL},
+    [PARAM_SWEEP_START]         = {"sweep_start",   0,                              0,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_SWEEP_STOP]          = {"sweep_stop",    LOAD_START_CC_LEVEL_MA,         0,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_SWEEP_POINTS]        = {"sweep_points",  LOAD_SWEEP_DEFAULT_POINTS,      2,                                  LOAD_SWEEP_MAX_POINTS,              NULL},
+    [PARAM_SWEEP_DWELL]         = {"sweep_dwell_us", LOAD_SWEEP_DEFAULT_DWELL_US,   0,                                  1000000,                            NULL},
+    [PARAM_SWEEP_SAMPLES]       = {"sweep_samples", LOAD_SWEEP_DEFAULT_SAMPLES,     VI_SENSE_BLOCK_SIZE,                4096,                               NULL},
+    [PARAM_MPPT_WINDOW]         = {"mppt_window",   LOAD_MPPT_DEFAULT_WINDOW,       1,                                  1024,                               NULL},
+    [PARAM_MPPT_MIN_STEP]       = {"mppt_min_ma",   LOAD_MPPT_DEFAULT_MIN_STEP_MA,  1,                                  LOAD_MAX_CC_LEVEL_MA,               NULL},
+    [PARAM_MPPT_MAX_STEP]       = {"mppt_max_ma",   LOAD_MPPT_DEFAULT_MAX_STEP_MA,  1,                                  LOAD_MAX_CC_LEVEL_MA,               NULL},
+    [PARAM_MPPT_MIN_VOLTAGE]    = {"mppt_min_mv",   LOAD_MPPT_DEFAULT_MIN_MV,       0,                                  LOAD_MAX_CV_LEVEL_MV,               NULL},
+    [PARAM_LIN_MAX]             = {"lin_max_ma",    LOAD_LINEARIZE_DEFAULT_MAX_MA,  LOAD_MIN_CC_LEVEL_MA + 1000,        LOAD_MAX_CC_LEVEL_MA,               NULL},
+    [PARAM_CC_TRIM]             = {"trim",          1,                              0,                                  1,                                  NULL},
+    [PARAM_CC_TRIM_GAIN]        = {"trim_gain",     LOAD_CC_TRIM_DEFAULT_GAIN,      1,                                  256,                                NULL},
+    [PARAM_CC_TRIM_LIMIT]       = {"trim_limit",    LOAD_CC_TRIM_DEFAULT_LIMIT_MA,  0,                                  2000,                               NULL}
+};
+
+// limits of the battery test level in each mode [mA, mV, mOhm or mW]; the CV mode can't discharge a battery and keeps the limits of the table
+static const int32_t bat_level_limits[4][2] = {
+
+    [LOAD_MODE_CC] = {LOAD_MIN_CC_LEVEL_MA, LOAD_MAX_CC_LEVEL_MA},
+    [LOAD_MODE_CV] = {0,                    LOAD_MAX_CP_LEVEL_MW},
+    [LOAD_MODE_CR] = {LOAD_MIN_CR_LEVEL_MR, LOAD_MAX_CR_LEVEL_MR},
+    [LOAD_MODE_CP] = {LOAD_MIN_CP_LEVEL_MW, LOAD_MAX_CP_LEVEL_MW}
+};
+
+int32_t param_values[PARAM_COUNT];
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// loads the default values from config.h into the parameter table
+void param_init(void) {
+
+    for (int i = 0; i < PARAM_COUNT; i++) param_values[i] = param_info[i].default_value;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets a parameter and applies it; returns false if the value is out of the parameter limits
+bool param_set(param_id_t id, int32_t value) {
+
+    if (id >= PARAM_COUNT) return false;
+
+    int32_t min, max;
+    param_get_limits(id, &min, &max);
+    if (value < min || value > max) return false;
+
+    // a 32bit write is atomic; the tasks see either the old or the new value
+    param_values[id] = value;
+    if (param_info[id].apply) param_info[id].apply();
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets consecutive parameters at once and applies them; returns false without a change if a value is out of the limits of its parameter
+// the interrupts see either all old or all new values; each apply function is called once after all the values are written
+bool param_set_many(param_id_t first, const int32_t *values, uint32_t count) {
+
+    if (first >= PARAM_COUNT || count > PARAM_COUNT - first) return false;
+
+    for (uint32_t i = 0; i < count; i++) {
+
+        int32_t min, max;
+        param_get_limits(first + i, &min, &max);
+        if (values[i] < min || values[i] > max) return false;
+    }
+
+    __disable_irq();
+    for (uint32_t i = 0; i < count; i++) param_values[first + i] = values[i];
+    __enable_irq();
+
+    // the parameters of one apply function are consecutive in the table
+    for (uint32_t i = 0; i < count; i++) {
+
+        void (*apply)(void) = param_info[first + i].apply;
+        if (apply && (i == 0 || apply != param_info[first + i - 1].apply)) apply();
+    }
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the name of a parameter used by the shell
+const char *param_get_name(param_id_t id) {
+
+    return (id < PARAM_COUNT) ? param_info[id].name : "";
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the limits of a parameter; the limits of the battery test level follow the battery test mode
+void param_get_limits(param_id_t id, int32_t *min, int32_t *max) {
+
+    if (id >= PARAM_COUNT) id = 0;
+
+    *min = param_info[id].min;
+    *max = param_info[id].max;
+
+    if (id == PARAM_BAT_LEVEL) {
+
+        *min = bat_level_limits[param_values[PARAM_BAT_MODE]][0];
+        *max = bat_level_limits[param_values[PARAM_BAT_MODE]][1];
+    }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the parameter with the specified name; returns PARAM_COUNT if there is no such parameter
+param_id_t param_find(const char *name) {
+
+    param_id_t id = 0;
+    while (id < PARAM_COUNT && strcmp(name, param_info[id].name) != 0) id++;
+
+    return (id);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
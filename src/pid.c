@@ -0,0 +1,96 @@
+#include "pid.h"
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// sets the gains, the output limits and the derivative filter time constant of a controller and resets it to output_min
+void pid_init(pid_controller_t *pid, const pid_gains_t *gains, int32_t output_min, int32_t output_max, uint8_t d_filter_shift) {
+
+    pid->gains = *gains;
+    pid->output_min = output_min;
+    pid->output_max = output_max;
+    pid->d_filter_shift = d_filter_shift;
+
+    pid_reset(pid, output_min);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// resets the controller state so the next update continues from the specified output without a bump (bumpless transfer)
+void pid_reset(pid_controller_t *pid, int32_t output) {
+
+    if (output < pid->output_min) output = pid->output_min;
+    if (output > pid->output_max) output = pid->output_max;
+
+    // the whole output is carried by the integral; the proportional and derivative terms start from zero error
+    pid->integral = (int64_t)output << PID_GAIN_FRACTIONAL_BITS;
+    pid->derivative = 0;
+    pid->prev_process = 0;
+    pid->prev_error = 0;
+    pid->first_update = true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// changes the gains; the integral is corrected so the output doesn't jump with the new proportional gain
+void pid_set_gains(pid_controller_t *pid, const pid_gains_t *gains) {
+
+    int64_t output_min = (int64_t)pid->output_min << PID_GAIN_FRACTIONAL_BITS;
+    int64_t output_max = (int64_t)pid->output_max << PID_GAIN_FRACTIONAL_BITS;
+
+    pid->integral += (int64_t)(pid->gains.kp - gains->kp) * pid->prev_error;
+    if (pid->integral > output_max) pid->integral = output_max;
+    if (pid->integral < output_min) pid->integral = output_min;
+
+    pid->gains = *gains;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// changes the output limits; used when a feedforward term shares the actuator range with the controller
+void pid_set_output_limits(pid_controller_t *pid, int32_t output_min, int32_t output_max) {
+
+    // the integral is brought back within the new limits by the next update
+    pid->output_min = output_min;
+    pid->output_max = output_max;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the controller and returns the new output within the output limits
+// the error and the process value have the same sign convention; a positive error increases the output
+int32_t pid_update(pid_controller_t *pid, int32_t error, int32_t process) {
+
+    int64_t output_min = (int64_t)pid->output_min << PID_GAIN_FRACTIONAL_BITS;
+    int64_t output_max = (int64_t)pid->output_max << PID_GAIN_FRACTIONAL_BITS;
+
+    // process change per update in Q8, low-pass filtered with a 2^d_filter_shift update time constant
+    int32_t change = pid->first_update ? 0 : (process - pid->prev_process) * 256;
+    pid->derivative += (change - pid->derivative) >> pid->d_filter_shift;
+    pid->prev_process = process;
+    pid->prev_error = error;
+    pid->first_update = false;
+
+    int64_t proportional = (int64_t)pid->gains.kp * error;
+    int64_t derivative = ((int64_t)pid->gains.kd * pid->derivative) >> 8;
+    int64_t integral = pid->integral + (int64_t)pid->gains.ki * error;
+
+    // conditional integration; don't integrate further into the saturation
+    int64_t output = proportional + integral + derivative;
+    bool winding_up = (output > output_max && error > 0) || (output < output_min && error < 0);
+
+    if (!winding_up) {
+
+        if (integral > output_max) integral = output_max;
+        if (integral < output_min) integral = output_min;
+        pid->integral = integral;
+    }
+
+    output = proportional + pid->integral + derivative;
+
+    if (output > output_max) output = output_max;
+    if (output < output_min) output = output_min;
+
+    return (int32_t)(output >> PID_GAIN_FRACTIONAL_BITS);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
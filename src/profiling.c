@@ -0,0 +1,254 @@
+#include "profiling.h"
+#include "cmd_spi_driver.h"
+#include "fixed_point.h"
+
+#if PROFILING_ENABLED
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static const char *prof_names[PROF_COUNT] = {
+
+    [PROF_SAMPLE_TIMER_IRQ]     = "sample_irq",
+    [PROF_CONTROL_LOOP]         = "control_loop",
+    [PROF_VSEN_DMA_IRQ]         = "block_irq",
+    [PROF_CMD_SPI_IRQ]          = "cmd_spi_irq",
+    [PROF_ISET_DAC_SPI_IRQ]     = "dac_spi_irq",
+    [PROF_ISET_DAC_TIMER_IRQ]   = "dac_slew_irq",
+    [PROF_TELEMETRY_IRQ]        = "telemetry_irq",
+    [PROF_FAN1_TACH_IRQ]        = "fan1_tach_irq",
+    [PROF_FAN2_TACH_IRQ]        = "fan2_tach_irq",
+    [PROF_WATCHDOG_TASK]        = "watchdog_task",
+    [PROF_DEBUG_UART_TASK]      = "debug_uart_task",
+    [PROF_TEMP_CONTROL_TASK]    = "temp_task",
+    [PROF_FAN_REGULATOR_TASK]   = "fan_task",
+    [PROF_LOAD_CONTROL_TASK]    = "load_task",
+    [PROF_LOAD_CMD_TASK]        = "cmd_task",
+    [PROF_VI_SENSE_TASK]        = "vi_sense_task",
+    [PROF_EXT_FAULT_TASK]       = "ext_fault_task",
+    [PROF_BATTERY_TASK]         = "battery_task",
+    [PROF_SEQUENCE_TASK]        = "sequence_task"
+};
+
+static prof_stats_t stats[PROF_COUNT];
+static kernel_time_t reset_time = 0;            // time of the last reset; the loads are relative to it
+
+// stack of the running interrupt handlers; a handler can't nest into itself, so there are at most PROF_COUNT entries
+static struct {
+
+    uint32_t start;             // cycle count at the entry
+    uint32_t nested_cycles;     // time of the handlers nested in this one
+
+} irq_stack[PROF_COUNT];
+
+static volatile uint32_t irq_depth = 0;         // number of running handlers
+static volatile uint32_t irq_cycles = 0;        // total time of the outermost handlers; subtracted from the task times (wraps around)
+
+// cycle count and interrupt time at the start of the task passes
+static uint32_t task_start[PROF_COUNT];
+static uint32_t task_irq_cycles[PROF_COUNT];
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// adds a measured time to the statistics
+static void __record(prof_point_t point, uint32_t cycles) {
+
+    prof_stats_t *s = &stats[point];
+
+    s->count++;
+    s->sum += cycles;
+    if (cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+
+    // 32 - 63 cycles have 26 leading zeros and go to bin 1
+    uint32_t bin = (cycles < 32) ? 0 : 27 - __CLZ(cycles);
+    if (bin >= PROF_HISTOGRAM_BINS) bin = PROF_HISTOGRAM_BINS - 1;
+
+    s->histogram[bin]++;
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the DWT cycle counter and clears the statistics
+void prof_init(void) {
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    prof_reset();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// clears the statistics
+void prof_reset(void) {
+
+    __disable_irq();
+
+    for (int point = 0; point < PROF_COUNT; point++) {
+
+        stats[point] = (prof_stats_t){0};
+        stats[point].min = UINT32_MAX;
+    }
+
+    reset_time = kernel_get_time_ms();
+
+    __enable_irq();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// copies the statistics of a handler or task
+void prof_get_stats(prof_point_t point, prof_stats_t *copy) {
+
+    if (point >= PROF_COUNT) point = 0;
+
+    __disable_irq();
+    *copy = stats[point];
+    __enable_irq();
+
+    if (copy->count == 0) copy->min = 0;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the CPU time taken by a handler or task since the last reset [0.01 %]
+uint32_t prof_get_load(prof_point_t point) {
+
+    prof_stats_t copy;
+    prof_get_stats(point, &copy);
+
+    uint64_t elapsed_cycles = (uint64_t)kernel_get_time_since(reset_time) * (CORE_CLOCK_FREQUENCY_HZ / 1000);
+
+    return (elapsed_cycles > 0) ? div_u64(copy.sum * 10000, elapsed_cycles) : 0;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the name of a handler or task used by the shell
+const char *prof_get_name(prof_point_t point) {
+
+    return (point < PROF_COUNT) ? prof_names[point] : "";
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// loads the statistics of a handler or task into the PROF DATA registers; bits 0-7 of select are the prof_point_t, bits 8-9 the page (see cmd_spi_registers.h)
+void prof_load_window(uint16_t select) {
+
+    prof_point_t point = select & LOAD_PROF_SELECT_POINT;
+    uint8_t page = (select & LOAD_PROF_SELECT_PAGE) >> LOAD_PROF_SELECT_PAGE_POS;
+
+    if (point >= PROF_COUNT) point = 0;
+
+    prof_stats_t s;
+    prof_get_stats(point, &s);
+
+    uint32_t data[8] = {0};
+
+    if (page == LOAD_PROF_PAGE_SUMMARY) {
+
+        uint32_t mean = (s.count > 0) ? div_u64(s.sum, s.count) : 0;
+        uint32_t words[4] = {s.count, s.min, s.max, mean};
+
+        for (int i = 0; i < 4; i++) {
+
+            data[2 * i] = words[i] & 0xffff;
+            data[2 * i + 1] = words[i] >> 16;
+        }
+
+    } else if (page == LOAD_PROF_PAGE_NESTING) {
+
+        data[0] = s.nested & 0xffff;
+        data[1] = s.nested >> 16;
+        data[2] = prof_get_load(point);
+
+    // histogram pages; the counts saturate at 0xffff
+    } else {
+
+        uint32_t first_bin = (page == LOAD_PROF_PAGE_HISTOGRAM_LOW) ? 0 : 8;
+        for (int i = 0; i < 8; i++) data[i] = (s.histogram[first_bin + i] > 0xffff) ? 0xffff : s.histogram[first_bin + i];
+    }
+
+    for (int i = 0; i < 8; i++) cmd_write(CMD_ADDRESS_PROF_DATA0 + i, data[i]);
+
+    cmd_write(CMD_ADDRESS_PROF_SELECT, (page << LOAD_PROF_SELECT_PAGE_POS) | point);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// marks the entry of a profiled interrupt handler
+void prof_irq_enter(prof_point_t point) {
+
+    uint32_t now = DWT->CYCCNT;
+
+    // the read-modify-write of the depth and the entry are not interruptible; the PRIMASK is restored, not cleared, as the caller may run with the
+    // interrupts disabled
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t depth = irq_depth++;
+
+    irq_stack[depth].start = now;
+    irq_stack[depth].nested_cycles = 0;
+
+    if (depth > 0) stats[point].nested++;
+
+    __set_PRIMASK(primask);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// marks the exit of a profiled interrupt handler and records its time without the nested handlers
+void prof_irq_exit(prof_point_t point) {
+
+    uint32_t now = DWT->CYCCNT;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t depth = irq_depth - 1;
+    uint32_t total = now - irq_stack[depth].start;
+
+    __record(point, total - irq_stack[depth].nested_cycles);
+
+    // the whole time of this handler is charged to the handler it interrupted, or to the task if it is the outermost one
+    if (depth > 0) irq_stack[depth - 1].nested_cycles += total;
+    else irq_cycles += total;
+
+    irq_depth = depth;
+
+    __set_PRIMASK(primask);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// marks the start of a task loop pass
+void prof_task_start(prof_point_t point) {
+
+    __disable_irq();
+
+    task_start[point] = DWT->CYCCNT;
+    task_irq_cycles[point] = irq_cycles;
+
+    __enable_irq();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// marks the end of a task loop pass and records its time without the interrupts
+void prof_task_stop(prof_point_t point) {
+
+    __disable_irq();
+
+    uint32_t cycles = DWT->CYCCNT - task_start[point];
+    uint32_t interrupted = irq_cycles - task_irq_cycles[point];
+
+    __record(point, cycles - interrupted);
+
+    __enable_irq();
+}
+
+#endif /* PROFILING_ENABLED */
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
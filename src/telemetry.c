@@ -0,0 +1,369 @@
+#include "telemetry.h"
+#include "vi_sense.h"
+#include "temp_sensors.h"
+#include "fan_control.h"
+#include "load_control.h"
+#include "hal/timer.h"
+#include "profiling.h"
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+#define HEADER_SIZE         11      // version, channels, sequence and time
+#define MAX_FRAME_SIZE      64      // maximum encoded frame size including the COBS overhead and the delimiter [bytes]
+
+// USART baud rate register value; USART1 is clocked by PCLK2 = CORE_CLOCK_FREQUENCY_HZ with 16x oversampling
+#define UART_BRR(baud)      ((CORE_CLOCK_FREQUENCY_HZ + (baud) / 2) / (baud))
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// sample taken by the telemetry timer interrupt
+typedef struct {
+
+    uint32_t sequence;              // sample number since the start of the stream
+    uint32_t time_us;               // time since the start of the stream [us]; wraps around after 71 minutes
+    int32_t voltage_mv;             // average load voltage since the previous sample [mV]
+    int32_t current_ma;             // average load current since the previous sample [mA]
+
+} telemetry_sample_t;
+
+volatile bool telemetry_streaming = false;          // the stream is running; DEBUG_UART is owned by the DMA
+static uint16_t stream_channels = 0;                // channels selected for the stream
+static uint32_t sample_period_us = 0;               // telemetry sample period [us]
+
+// samples written by the timer interrupt and encoded by the debug_uart_task; the indexes run freely
+static telemetry_sample_t sample_buffer[TELEMETRY_BUFFER_SAMPLES];
+static volatile uint32_t sample_head = 0;           // index of the next sample written by the timer interrupt
+static volatile uint32_t sample_tail = 0;           // index of the next sample encoded by the debug_uart_task
+static volatile uint32_t sample_sequence = 0;       // number of samples taken since the start of the stream
+static volatile uint32_t dropped_samples = 0;       // number of samples dropped because the buffer was full
+static uint32_t sample_time_us = 0;                 // time of the next sample [us]
+
+// block sums at the previous sample
+static vi_sense_block_sums_t prev_sums = {0};
+
+// the DMA sends one buffer while the other is filled with frames
+static uint8_t tx_buffer[2][TELEMETRY_TX_BUFFER_SIZE];
+static uint8_t tx_fill_index = 0;                   // buffer being filled with frames
+static uint32_t tx_fill_length = 0;                 // number of bytes in the buffer being filled
+
+// CRC-16/CCITT-FALSE lookup table for 4bit nibbles (polynomial 0x1021)
+static const uint16_t crc_table[16] = {
+
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7, 0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the CRC-16/CCITT-FALSE of a buffer
+static uint16_t __crc16(const uint8_t *data, uint32_t length) {
+
+    uint16_t crc = 0xffff;
+
+    for (uint32_t i = 0; i < length; i++) {
+
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (data[i] & 0x0f)];
+    }
+
+    return (crc);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// COBS encodes a buffer shorter than 254 bytes and appends the zero delimiter; returns the number of bytes written (length + 2)
+static uint32_t __cobs_encode(const uint8_t *input, uint32_t length, uint8_t *output) {
+
+    uint32_t code_index = 0;        // position of the code byte of the current block
+    uint32_t out = 1;
+    uint8_t code = 1;
+
+    for (uint32_t i = 0; i < length; i++) {
+
+        // a zero ends the block; the code byte holds the distance to it
+        if (input[i] == 0) {
+
+            output[code_index] = code;
+            code_index = out++;
+            code = 1;
+
+        } else {
+
+            output[out++] = input[i];
+            code++;
+        }
+    }
+
+    output[code_index] = code;
+    output[out++] = 0;
+
+    return (out);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// writes a little-endian 16bit value and returns the next write position
+static inline uint8_t *__put_u16(uint8_t *buffer, uint16_t value) {
+
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    return (buffer + 2);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// writes a little-endian 32bit value and returns the next write position
+static inline uint8_t *__put_u32(uint8_t *buffer, uint32_t value) {
+
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+    return (buffer + 4);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the size of a frame with the selected channels before the COBS encoding, including the CRC [bytes]
+static uint32_t __frame_size(uint16_t channels) {
+
+    uint32_t size = HEADER_SIZE + 2;
+
+    if (channels & TELEMETRY_VOLTAGE) size += 4;
+    if (channels & TELEMETRY_CURRENT) size += 4;
+    if (channels & TELEMETRY_POWER) size += 4;
+    if (channels & TELEMETRY_SINKS) size += 8;
+    if (channels & TELEMETRY_TEMPS) size += 4;
+    if (channels & TELEMETRY_RPM) size += 4;
+    if (channels & TELEMETRY_STATUS) size += 4;
+
+    return (size);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// waits until DEBUG_UART has sent everything written by the UART driver or the DMA
+static void __wait_for_tx_idle(void) {
+
+    while ((TELEMETRY_DMA_STREAM->CR & DMA_SxCR_EN) || (DEBUG_UART->CR1 & USART_CR1_TXEIE) || !(DEBUG_UART->SR & USART_SR_TC)) kernel_yield();
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// initializes the telemetry sample timer and the transmit DMA
+void telemetry_init(void) {
+
+    rcc_enable_peripheral_clock(TELEMETRY_DMA_CLOCK);
+
+    // memory to peripheral, 8bit transfers, memory increment; the transfer length is set for every buffer
+    TELEMETRY_DMA_STREAM->CR  = 0;
+    TELEMETRY_DMA_STREAM->PAR = (uint32_t)&DEBUG_UART->DR;
+    TELEMETRY_DMA_STREAM->FCR = 0;
+    TELEMETRY_DMA_STREAM->CR  = (TELEMETRY_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_DIR_0 | DMA_SxCR_MINC;
+
+    // the reload is set by telemetry_start()
+    timer_init_counter(TELEMETRY_TIMER, TELEMETRY_TIMER_FREQUENCY, TIMER_DIR_UP, TELEMETRY_TIMER_FREQUENCY / TELEMETRY_MAX_RATE_HZ - 1);
+
+    TELEMETRY_TIMER->CR1 |= TIM_CR1_URS;
+    TELEMETRY_TIMER->DIER |= TIM_DIER_UIE;
+    TELEMETRY_TIMER->SR &= ~TIM_SR_UIF;
+
+    // the sampling is not time critical; the block interrupt and the CMD SPI preempt it
+    NVIC_SetPriority(TELEMETRY_TIMER_IRQ, 2);
+    NVIC_EnableIRQ(TELEMETRY_TIMER_IRQ);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// switches DEBUG_UART to TELEMETRY_UART_BAUD and starts streaming the selected channels; the rate must not exceed telemetry_get_max_rate()
+void telemetry_start(uint32_t rate_hz, uint16_t channels) {
+
+    if (telemetry_streaming) telemetry_stop();
+
+    uint32_t max_rate = telemetry_get_max_rate(channels);
+    if (rate_hz > max_rate) rate_hz = max_rate;
+    if (rate_hz < TELEMETRY_MIN_RATE_HZ) rate_hz = TELEMETRY_MIN_RATE_HZ;
+
+    // let the UART driver finish the shell response; its output is suppressed from now on
+    __wait_for_tx_idle();
+    telemetry_streaming = true;
+
+    stream_channels = channels & TELEMETRY_ALL;
+    sample_period_us = 1000000 / rate_hz;
+    sample_head = 0;
+    sample_tail = 0;
+    sample_sequence = 0;
+    dropped_samples = 0;
+    sample_time_us = 0;
+    tx_fill_length = 0;
+    vi_sense_read_block_sums(&prev_sums);
+
+    DEBUG_UART->BRR = UART_BRR(TELEMETRY_UART_BAUD);
+    DEBUG_UART->CR3 |= USART_CR3_DMAT;
+
+    TELEMETRY_TIMER->ARR = TELEMETRY_TIMER_FREQUENCY / rate_hz - 1;
+    TELEMETRY_TIMER->EGR |= TIM_EGR_UG;
+    TELEMETRY_TIMER->SR &= ~TIM_SR_UIF;
+    timer_start_count(TELEMETRY_TIMER);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the stream after the last frame is sent and switches DEBUG_UART back to DEBUG_UART_BAUD
+void telemetry_stop(void) {
+
+    if (!telemetry_streaming) return;
+
+    timer_stop_count(TELEMETRY_TIMER);
+    __wait_for_tx_idle();
+
+    DEBUG_UART->CR3 &= ~USART_CR3_DMAT;
+    DEBUG_UART->BRR = UART_BRR(DEBUG_UART_BAUD);
+
+    telemetry_streaming = false;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the highest sample rate the UART can carry with the selected channels [Hz]
+uint32_t telemetry_get_max_rate(uint16_t channels) {
+
+    // worst case COBS overhead of a short frame is 1 byte plus the delimiter; 10 bits per byte
+    uint32_t frame_bits = (__frame_size(channels & TELEMETRY_ALL) + 2) * 10;
+    uint32_t max_rate = TELEMETRY_UART_BAUD / frame_bits;
+
+    return ((max_rate > TELEMETRY_MAX_RATE_HZ) ? TELEMETRY_MAX_RATE_HZ : max_rate);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the number of samples of the last stream and the number of samples dropped because the transmit buffer was full
+void telemetry_get_statistics(uint32_t *samples, uint32_t *dropped) {
+
+    *samples = sample_sequence;
+    *dropped = dropped_samples;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// encodes the pending samples and starts their transmission; called by the debug_uart_task
+void telemetry_update(void) {
+
+    if (!telemetry_streaming) return;
+
+    // the slow channels are read once per update and shared by all frames encoded in it
+    uint16_t sinks[4], temps[2], rpm[2];
+
+    for (int sink = CURRENT_L1; sink <= CURRENT_R2; sink++) sinks[sink] = vi_sense_get_sink_current(sink);
+    temps[0] = temp_sensor_read_fixed(TEMP_L);
+    temps[1] = temp_sensor_read_fixed(TEMP_R);
+    rpm[0] = fan_get_rpm(FAN1);
+    rpm[1] = fan_get_rpm(FAN2);
+
+    // encode the pending samples until the fill buffer is full
+    while (sample_tail != sample_head && tx_fill_length + MAX_FRAME_SIZE <= TELEMETRY_TX_BUFFER_SIZE) {
+
+        const telemetry_sample_t *sample = &sample_buffer[sample_tail & (TELEMETRY_BUFFER_SAMPLES - 1)];
+        uint8_t frame[MAX_FRAME_SIZE];
+        uint8_t *pos = frame;
+
+        *pos++ = TELEMETRY_FRAME_VERSION;
+        pos = __put_u16(pos, stream_channels);
+        pos = __put_u32(pos, sample->sequence);
+        pos = __put_u32(pos, sample->time_us);
+
+        if (stream_channels & TELEMETRY_VOLTAGE) pos = __put_u32(pos, sample->voltage_mv);
+        if (stream_channels & TELEMETRY_CURRENT) pos = __put_u32(pos, sample->current_ma);
+        // V * I overflows 32bits at full power; the division by 1000 is a multiplication by 2^32 / 1000
+        if (stream_channels & TELEMETRY_POWER) pos = __put_u32(pos, ((int64_t)sample->voltage_mv * sample->current_ma * 4294967) >> 32);
+
+        if (stream_channels & TELEMETRY_SINKS) {
+
+            for (int sink = 0; sink < 4; sink++) pos = __put_u16(pos, sinks[sink]);
+        }
+
+        if (stream_channels & TELEMETRY_TEMPS) {
+
+            pos = __put_u16(pos, temps[0]);
+            pos = __put_u16(pos, temps[1]);
+        }
+
+        if (stream_channels & TELEMETRY_RPM) {
+
+            pos = __put_u16(pos, rpm[0]);
+            pos = __put_u16(pos, rpm[1]);
+        }
+
+        if (stream_channels & TELEMETRY_STATUS) {
+
+            pos = __put_u16(pos, load_get_status());
+            pos = __put_u16(pos, load_get_faults(LOAD_FAULT_ALL));
+        }
+
+        pos = __put_u16(pos, __crc16(frame, pos - frame));
+
+        tx_fill_length += __cobs_encode(frame, pos - frame, &tx_buffer[tx_fill_index][tx_fill_length]);
+        sample_tail++;
+    }
+
+    // send the filled buffer when the previous transfer is finished and start filling the other one
+    if (tx_fill_length > 0 && !(TELEMETRY_DMA_STREAM->CR & DMA_SxCR_EN)) {
+
+        TELEMETRY_DMA->HIFCR = DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7 | DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7;
+        TELEMETRY_DMA_STREAM->M0AR = (uint32_t)tx_buffer[tx_fill_index];
+        TELEMETRY_DMA_STREAM->NDTR = tx_fill_length;
+        TELEMETRY_DMA_STREAM->CR  |= DMA_SxCR_EN;
+
+        tx_fill_index ^= 1;
+        tx_fill_length = 0;
+    }
+}
+
+//---- IRQ HANDLERS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// takes a telemetry sample; the voltage and current are averaged over the blocks completed since the previous sample
+void TELEMETRY_TIMER_IRQ_HANDLER(void) {
+
+    PROF_IRQ_ENTER(PROF_TELEMETRY_IRQ);
+
+    TELEMETRY_TIMER->SR &= ~TIM_SR_UIF;
+
+    vi_sense_block_sums_t sums;
+    vi_sense_read_block_sums(&sums);
+
+    telemetry_sample_t sample;
+    int32_t blocks = sums.count - prev_sums.count;
+
+    sample.sequence = sample_sequence++;
+    sample.time_us = sample_time_us;
+    sample_time_us += sample_period_us;
+
+    // the sample rate may be higher than the block rate; repeat the last block average then
+    if (blocks > 0) {
+
+        sample.voltage_mv = (int32_t)(sums.voltage_sum - prev_sums.voltage_sum) / blocks;
+        sample.current_ma = (int32_t)(sums.current_sum - prev_sums.current_sum) / blocks;
+
+        prev_sums = sums;
+
+    } else {
+
+        extern volatile int32_t voltage_block_average_mv;
+        extern volatile int32_t current_block_average_ma;
+
+        sample.voltage_mv = voltage_block_average_mv;
+        sample.current_ma = current_block_average_ma;
+    }
+
+    // the frames are not sent fast enough; the gap in the sequence numbers shows the drop
+    if (sample_head - sample_tail >= TELEMETRY_BUFFER_SAMPLES) dropped_samples++;
+
+    else {
+
+        sample_buffer[sample_head & (TELEMETRY_BUFFER_SAMPLES - 1)] = sample;
+        sample_head++;
+    }
+
+    PROF_IRQ_EXIT(PROF_TELEMETRY_IRQ);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1,6 +1,7 @@
 #include "temp_control.h"
 #include "load_control.h"
 #include "cmd_spi_driver.h"
+#include "profiling.h"
 
 //---- ENUMERATIONS ----------------------------------------------------------------------------------------------------------------------------------------------
 
@@ -22,8 +23,6 @@ void temp_control_task(void) {
     uint32_t fan_regulator_stack[64];
     kernel_create_task(fan_regulator_task, fan_regulator_stack, sizeof(fan_regulator_stack), 1000);
 
-    temp_sensor_init();
-
     //---- FAN TEST ----------------------------------------------------------------------------------------------------------------------------------------------
 
 #if FAN_TEST_ENABLED
@@ -61,6 +60,8 @@ void temp_control_task(void) {
 
     while (1) {
 
+        PROF_TASK_START(PROF_TEMP_CONTROL_TASK);
+
         //---- TEMPERATURE MEASUREMENT ---------------------------------------------------------------------------------------------------------------------------
         
         uint16_t temperature[2];
@@ -209,6 +210,7 @@ void temp_control_task(void) {
 
         //--------------------------------------------------------------------------------------------------------------------------------------------------------
 
+        PROF_TASK_STOP(PROF_TEMP_CONTROL_TASK);
         kernel_sleep_ms(500);
     }
 }
@@ -43,18 +43,6 @@ static temp_sensor_fault_t fault_flags[2] = {TEMP_SEN_FAULT_NONE};      // store
 
 //---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
 
-// initializes the ADC for power transistor temperature sensing
-void temp_sensor_init(void) {
-
-    rcc_enable_peripheral_clock(TEMP_SEN_L_GPIO_CLOCK);
-    rcc_enable_peripheral_clock(TEMP_SEN_R_GPIO_CLOCK);
-    gpio_set_mode(TEMP_SEN_L_GPIO, GPIO_MODE_ANALOG);
-    gpio_set_mode(TEMP_SEN_R_GPIO, GPIO_MODE_ANALOG);
-    adc_init();
-}
-
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-
 // measures a power transistor temperature and returns it [°C]. Returns 255 in case of a fault
 uint8_t temp_sensor_read(temp_sensor_t sensor) {
 
@@ -64,21 +52,26 @@ uint8_t temp_sensor_read(temp_sensor_t sensor) {
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
 // measures a power transistor temperature and returns it [°C] in UQ8.2 fixed point value. Returns 1023 in case of a fault
+// the value is the average of the latest internal ADC scans; the read doesn't wait for a conversion
 uint16_t temp_sensor_read_fixed(temp_sensor_t sensor) {
 
     if (sensor != TEMP_L && sensor != TEMP_R) return 1023;
 
-    for (int attempt = 0; attempt < TEMP_SEN_READ_ATTEMPTS; attempt++) {
+    // 12bit ADC code with 4 fractional bits
+    uint32_t code_q4 = internal_adc_read((sensor == TEMP_L) ? INTERNAL_ADC_TEMP_L : INTERNAL_ADC_TEMP_R);
+
+    if (code_q4 > (4095 - TEMP_SEN_OPEN_THRESHOLD) << 4) fault_flags[sensor] = TEMP_SEN_FAULT_OPEN;
+    else if (code_q4 < TEMP_SEN_SHORT_THRESHOLD << 4) fault_flags[sensor] = TEMP_SEN_FAULT_SHORT;
+    else {
 
-        uint16_t raw_val = adc_read((sensor == TEMP_L) ? TEMP_SEN_L_ADC_CH : TEMP_SEN_R_ADC_CH);
+        fault_flags[sensor] = TEMP_SEN_FAULT_NONE;
 
-        if (raw_val > 4095 - TEMP_SEN_OPEN_THRESHOLD) fault_flags[sensor] = TEMP_SEN_FAULT_OPEN;
-        else if (raw_val <  TEMP_SEN_SHORT_THRESHOLD) fault_flags[sensor] = TEMP_SEN_FAULT_SHORT;
-        else {
+        // the lookup table has a 10bit index; the 6 remaining bits interpolate between the neighbouring entries
+        uint32_t index = code_q4 >> 6;
+        int32_t fraction = code_q4 & 0x3f;
 
-            fault_flags[sensor] = TEMP_SEN_FAULT_NONE;
-            return (temp_sensor_lut[raw_val >> 2]);
-        }
+        if (index >= 1023) return (temp_sensor_lut[1023]);
+        return (temp_sensor_lut[index] + (((temp_sensor_lut[index + 1] - temp_sensor_lut[index]) * fraction) >> 6));
     }
 
     return 1023;       // measurement failed, return 255°C in case the callee doesn't read the fault flag
@@ -0,0 +1,596 @@
+#include "vi_sense.h"
+#include "load_control.h"
+#include "calibration.h"
+#include "fixed_point.h"
+#include "hal/spi.h"
+#include "hal/timer.h"
+#include "cmd_spi_driver.h"
+#include "telemetry.h"
+#include "profiling.h"
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+void load_update_pid(uint32_t voltage, uint32_t current);
+void __capture_block(volatile uint16_t *vsen_block, volatile uint16_t *isen_block, vsen_src_t source);
+void __integration_set_period(uint32_t period_ticks);
+void __integrate_block(int32_t current_sum, int64_t power_sum);
+void __sweep_block(int32_t voltage_mv, int32_t current_ma);
+void __mppt_block(int32_t voltage_mv, int32_t current_ma);
+bool __capture_running(void);
+
+// splits a "PORT, PIN" pair from hw_config.h
+#define __GPIO_PORT(port, pin)  (port)
+#define __GPIO_PIN(port, pin)   (pin)
+#define GPIO_PORT(gpio)         __GPIO_PORT(gpio)
+#define GPIO_PIN(gpio)          __GPIO_PIN(gpio)
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+extern volatile vsen_src_t vsen_src;
+
+int32_t voltage_latest_sample_mv;                   // latest VSEN ADC conversion result converted to mV
+int32_t current_latest_sample_ma;                   // latest ISEN ADC conversion result converted to mA
+volatile int32_t voltage_block_average_mv = 0;      // average of the voltage samples in the last completed block [mV]
+volatile int32_t current_block_average_ma = 0;      // average of the current samples in the last completed block [mA]
+volatile uint32_t block_count = 0;                  // number of processed blocks since the acquisition was started
+static volatile uint32_t valid_block_count = 0;     // number of processed blocks included in the averages (blocks converted during a VSEN mux switch are excluded)
+static volatile uint32_t voltage_block_sum = 0;     // running sum of the voltage block averages; wraps around, only differences are used [mV]
+static volatile uint32_t current_block_sum = 0;     // running sum of the current block averages; wraps around, only differences are used [mA]
+static volatile uint32_t voltage_code_sum = 0;      // running sum of the raw VSEN ADC codes; wraps around, only differences are used
+static volatile uint32_t current_code_sum = 0;      // running sum of the raw ISEN ADC codes; wraps around, only differences are used
+
+// ping-pong sample blocks filled by the DMA; while the DMA fills one block, the other is processed by the CPU
+static volatile uint16_t vsen_adc_block[2][VI_SENSE_BLOCK_SIZE];
+static volatile uint16_t isen_adc_block[2][VI_SENSE_BLOCK_SIZE];
+
+// VSEN CONVST GPIO BSRR values written by the DMA on the CH1 (conversion start) and CH2 (pulse end) compare events of the sample timer
+static uint32_t vsen_convst_bsrr[2] = {(1 << (GPIO_PIN(VSEN_ADC_CONVST_GPIO) + 16)), (1 << GPIO_PIN(VSEN_ADC_CONVST_GPIO))};
+
+// both SS pins are on one port; the read framing interrupt switches them with one BSRR write per edge
+#define ADC_SPI_SS_GPIO_PORT    GPIO_PORT(VSEN_ADC_SPI_SS_GPIO)
+#define ADC_SPI_SS_BSRR         ((1 << GPIO_PIN(VSEN_ADC_SPI_SS_GPIO)) | (1 << GPIO_PIN(ISEN_ADC_SPI_SS_GPIO)))
+
+static uint32_t sample_rate_hz = VI_SENSE_SAMPLE_RATE_HZ;   // selected sample rate [Hz]
+static uint32_t active_rate_hz = VI_SENSE_SAMPLE_RATE_HZ;   // rate the sample timer runs at; the idle rate while the load is disabled [Hz]
+static bool idle = true;                                    // the load is disabled
+static uint8_t full_rate_requests = 0;                      // raw code reads in progress; they need the selected rate while the load is disabled
+static volatile uint16_t read_latency_min = 0xffff;         // minimum delay between the CH4 compare event and the start of the read [timer ticks]
+static volatile uint16_t read_latency_max = 0;              // maximum delay between the CH4 compare event and the start of the read [timer ticks]
+static volatile uint32_t late_read_count = 0;               // number of reads started after the next conversion was already triggered
+
+// remote sense probe; the block interrupt switches the VSEN mux to remote sense for two blocks and measures the second one
+typedef enum {
+
+    PROBE_IDLE,             // no probe in progress
+    PROBE_REQUESTED,        // the mux is switched at the end of the next block
+    PROBE_SETTLING,         // the block in progress was converted partially before the switch
+    PROBE_MEASURING         // the block in progress is converted with remote sense only
+
+} probe_state_t;
+
+static volatile probe_state_t probe_state = PROBE_IDLE;
+static volatile uint8_t discard_blocks = 0;         // number of following blocks converted with an unknown VSEN mux setting
+volatile bool remote_sense_detected = false;        // the probe found a voltage on the remote sense input and switched the VSEN source
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// sets the sample timer period; the reload is preloaded and takes effect on the next update, the CONVST pulses and the read are at fixed offsets from the update
+static void __set_sample_period(uint32_t period_ticks) {
+
+    VI_SENSE_SAMPLE_TIMER->ARR = period_ticks - 1;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the sample timer at the selected rate, or at the idle rate while the load is disabled and neither the capture, the telemetry stream nor a raw code read needs the samples
+// called on every change of the conditions and by the vi_sense_task, which catches the start and the end of the capture and the telemetry stream; returns true if the rate changed
+bool __acquisition_update_rate(void) {
+
+    uint32_t rate = sample_rate_hz;
+
+    if (idle && full_rate_requests == 0 && !__capture_running() && !telemetry_is_streaming() && rate > VI_SENSE_IDLE_SAMPLE_RATE_HZ) rate = VI_SENSE_IDLE_SAMPLE_RATE_HZ;
+    if (rate == active_rate_hz) return false;
+
+    active_rate_hz = rate;
+    __set_sample_period(VI_SENSE_SAMPLE_TIMER_FREQUENCY / rate);
+    __integration_set_period(VI_SENSE_SAMPLE_TIMER_FREQUENCY / rate);
+
+    return true;
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// initializes the SPI interfaces of the VSEN and ISEN ADCs, the RX DMA streams and the sample timer
+void __acquisition_init(void) {
+
+    //---- VOLTAGE SENSE ADC SPI INIT ----------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(VSEN_ADC_SPI_CLOCK);
+    rcc_enable_peripheral_clock(VSEN_ADC_SPI_SS_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(VSEN_ADC_SPI_SCK_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(VSEN_ADC_SPI_MISO_GPIO_CLOCK);
+
+    gpio_write(VSEN_ADC_SPI_SS_GPIO, HIGH);
+    gpio_set_mode(VSEN_ADC_SPI_SS_GPIO, GPIO_MODE_OUTPUT);
+    gpio_set_mode(VSEN_ADC_SPI_SCK_GPIO, GPIO_MODE_ALTERNATE_FUNCTION);
+    gpio_set_mode(VSEN_ADC_SPI_MISO_GPIO, GPIO_MODE_ALTERNATE_FUNCTION);
+    gpio_set_alternate_function(VSEN_ADC_SPI_SCK_GPIO, VSEN_ADC_GPIO_AF);
+    gpio_set_alternate_function(VSEN_ADC_SPI_MISO_GPIO, VSEN_ADC_GPIO_AF);
+
+    // software slave management, 16bit format, master mode, baud divisor
+    VSEN_ADC_SPI->CR1  = SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_DFF | SPI_CR1_MSTR | VSEN_ADC_SPI_DIV;
+    VSEN_ADC_SPI->CR2  = SPI_CR2_RXDMAEN;   // received data is moved by the DMA
+    VSEN_ADC_SPI->CR1 |= SPI_CR1_SPE;       // spi enable
+
+    //---- VOLTAGE SENSE ADC CONVST INIT -------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(VSEN_ADC_CONVST_GPIO_CLOCK);
+    gpio_set_mode(VSEN_ADC_CONVST_GPIO, GPIO_MODE_OUTPUT);
+    gpio_write(VSEN_ADC_CONVST_GPIO, HIGH);
+
+    //---- VOLTAGE SENSE SOURCE INIT -----------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(VSEN_SRC_GPIO_CLOCK);
+    gpio_set_mode(VSEN_SRC_GPIO, GPIO_MODE_OUTPUT);
+    gpio_write(VSEN_SRC_GPIO, LOW);
+
+    //---- CURRENT SENSE ADC SPI INIT ----------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(ISEN_ADC_SPI_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_ADC_SPI_SS_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_ADC_SPI_SCK_GPIO_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_ADC_SPI_MISO_GPIO_CLOCK);
+
+    gpio_write(ISEN_ADC_SPI_SS_GPIO, HIGH);
+    gpio_set_mode(ISEN_ADC_SPI_SS_GPIO, GPIO_MODE_OUTPUT);
+    gpio_set_mode(ISEN_ADC_SPI_SCK_GPIO , GPIO_MODE_ALTERNATE_FUNCTION);
+    gpio_set_mode(ISEN_ADC_SPI_MISO_GPIO, GPIO_MODE_ALTERNATE_FUNCTION);
+
+    gpio_set_alternate_function(ISEN_ADC_SPI_SCK_GPIO, ISEN_ADC_GPIO_AF);
+    gpio_set_alternate_function(ISEN_ADC_SPI_MISO_GPIO, ISEN_ADC_GPIO_AF);
+
+    // software slave management, 16bit format, master mode, baud divisor
+    ISEN_ADC_SPI->CR1  = SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_DFF | SPI_CR1_MSTR | ISEN_ADC_SPI_DIV;
+    ISEN_ADC_SPI->CR2  = SPI_CR2_RXDMAEN;   // received data is moved by the DMA
+    ISEN_ADC_SPI->CR1 |= SPI_CR1_SPE;       // spi enable
+
+    //---- CURRENT SENSE ADC CONVST INIT -------------------------------------------------------------------------------------------------------------------------
+
+    // the pin is driven high until the acquisition is started; then the sample timer takes it over
+    rcc_enable_peripheral_clock(ISEN_ADC_CONVST_GPIO_CLOCK);
+    gpio_set_mode(ISEN_ADC_CONVST_GPIO, GPIO_MODE_OUTPUT);
+    gpio_write(ISEN_ADC_CONVST_GPIO, HIGH);
+    gpio_set_alternate_function(ISEN_ADC_CONVST_GPIO, ISEN_ADC_CONVST_GPIO_AF);
+
+    //---- RX DMA INIT -------------------------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(VSEN_ADC_DMA_CLOCK);
+    rcc_enable_peripheral_clock(ISEN_ADC_DMA_CLOCK);
+
+    // peripheral to memory, 16bit transfers, memory increment, double buffer mode (the stream switches between the two blocks automatically)
+    VSEN_ADC_DMA_STREAM->CR   = 0;
+    VSEN_ADC_DMA_STREAM->PAR  = (uint32_t)&VSEN_ADC_SPI->DR;
+    VSEN_ADC_DMA_STREAM->M0AR = (uint32_t)vsen_adc_block[0];
+    VSEN_ADC_DMA_STREAM->M1AR = (uint32_t)vsen_adc_block[1];
+    VSEN_ADC_DMA_STREAM->NDTR = VI_SENSE_BLOCK_SIZE;
+    VSEN_ADC_DMA_STREAM->FCR  = 0;
+    VSEN_ADC_DMA_STREAM->CR   = (VSEN_ADC_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL | DMA_SxCR_DBM | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_TCIE;
+
+    // the ISEN stream runs in lockstep with the VSEN stream; only the VSEN stream raises the block complete interrupt
+    ISEN_ADC_DMA_STREAM->CR   = 0;
+    ISEN_ADC_DMA_STREAM->PAR  = (uint32_t)&ISEN_ADC_SPI->DR;
+    ISEN_ADC_DMA_STREAM->M0AR = (uint32_t)isen_adc_block[0];
+    ISEN_ADC_DMA_STREAM->M1AR = (uint32_t)isen_adc_block[1];
+    ISEN_ADC_DMA_STREAM->NDTR = VI_SENSE_BLOCK_SIZE;
+    ISEN_ADC_DMA_STREAM->FCR  = 0;
+    ISEN_ADC_DMA_STREAM->CR   = (ISEN_ADC_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL | DMA_SxCR_DBM | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC;
+
+    // the block interrupt priority must be higher than the SVC interrupt priority so the block processing can preempt a kernel context switch
+    NVIC_SetPriority(SVCall_IRQn, 1);
+    NVIC_SetPriority(VSEN_ADC_DMA_IRQ, 0);
+    NVIC_EnableIRQ(VSEN_ADC_DMA_IRQ);
+
+    //---- SAMPLE TIMER INIT -------------------------------------------------------------------------------------------------------------------------------------
+
+    rcc_enable_peripheral_clock(VI_SENSE_SAMPLE_TIMER_CLOCK);
+    timer_init_counter(VI_SENSE_SAMPLE_TIMER, VI_SENSE_SAMPLE_TIMER_FREQUENCY, TIMER_DIR_UP, (VI_SENSE_SAMPLE_TIMER_FREQUENCY / active_rate_hz) - 1);
+
+    // CH1 and CH2 are frozen output compare channels; their compare events only request the VSEN CONVST DMA (CCR1 isn't 0, so the first event isn't missed at the start)
+    // CH3 in PWM mode 2 drives the ISEN CONVST pin through the complementary output, CH4 raises the read framing interrupt
+    VI_SENSE_SAMPLE_TIMER->CCMR1 = 0;
+    VI_SENSE_SAMPLE_TIMER->CCMR2 = TIM_CCMR2_OC3M_2 | TIM_CCMR2_OC3M_1 | TIM_CCMR2_OC3M_0;
+    VI_SENSE_SAMPLE_TIMER->CCR1  = 1;
+    VI_SENSE_SAMPLE_TIMER->CCR2  = 1 + VI_SENSE_CONVST_PULSE_TICKS;
+    VI_SENSE_SAMPLE_TIMER->CCR3  = VI_SENSE_CONVST_PULSE_TICKS;
+    VI_SENSE_SAMPLE_TIMER->CCR4  = VI_SENSE_READ_TICKS;
+    VI_SENSE_SAMPLE_TIMER->CCER  = TIM_CCER_CC3NE;
+    VI_SENSE_SAMPLE_TIMER->BDTR  = TIM_BDTR_MOE;
+    __set_sample_period(VI_SENSE_SAMPLE_TIMER_FREQUENCY / active_rate_hz);
+
+    VI_SENSE_SAMPLE_TIMER->CR1 |= TIM_CR1_URS | TIM_CR1_ARPE;
+    VI_SENSE_SAMPLE_TIMER->EGR |= TIM_EGR_UG;
+    VI_SENSE_SAMPLE_TIMER->DIER |= TIM_DIER_CC4IE | TIM_DIER_CC1DE | TIM_DIER_CC2DE;
+    VI_SENSE_SAMPLE_TIMER->SR &= ~TIM_SR_CC4IF;
+
+    //---- CONVST DMA INIT ---------------------------------------------------------------------------------------------------------------------------------------
+
+    // memory to peripheral, 32bit transfers, memory increment, circular mode; the CH1 request writes the first item, the CH2 request the second one
+    VSEN_ADC_CONVST_DMA_STREAM->CR   = 0;
+    VSEN_ADC_CONVST_DMA_STREAM->PAR  = (uint32_t)&GPIO_PORT(VSEN_ADC_CONVST_GPIO)->BSRR;
+    VSEN_ADC_CONVST_DMA_STREAM->M0AR = (uint32_t)vsen_convst_bsrr;
+    VSEN_ADC_CONVST_DMA_STREAM->NDTR = 2;
+    VSEN_ADC_CONVST_DMA_STREAM->FCR  = 0;
+    VSEN_ADC_CONVST_DMA_STREAM->CR   = (VSEN_ADC_CONVST_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL | DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_DIR_0;
+    VSEN_ADC_CONVST_DMA_STREAM->CR  |= DMA_SxCR_EN;
+
+    // the sample timer has the highest priority to keep the sampling period regular
+    NVIC_SetPriority(VI_SENSE_SAMPLE_TIMER_IRQ, 0);
+    NVIC_EnableIRQ(VI_SENSE_SAMPLE_TIMER_IRQ);
+
+    // the control loop has the priority of the block interrupt, so the latest samples are always a consistent pair
+    NVIC_SetPriority(LOAD_CONTROL_TIMER_IRQ, 0);
+    NVIC_EnableIRQ(LOAD_CONTROL_TIMER_IRQ);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// enables the DMA streams, hands the ISEN CONVST pin over to the sample timer and starts the free-running acquisition
+void __acquisition_start(void) {
+
+    set_bits(ISEN_ADC_DMA_STREAM->CR, DMA_SxCR_EN);
+    set_bits(VSEN_ADC_DMA_STREAM->CR, DMA_SxCR_EN);
+    gpio_set_mode(ISEN_ADC_CONVST_GPIO, GPIO_MODE_ALTERNATE_FUNCTION);
+    timer_start_count(VI_SENSE_SAMPLE_TIMER);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the VSEN and ISEN ADC sample rate; resets the sample timing statistics
+// while the load is disabled, the rate takes effect once the load is enabled or the samples are needed
+void vi_sense_set_sample_rate(uint32_t rate_hz) {
+
+    // check limits
+    if (rate_hz < VI_SENSE_MIN_SAMPLE_RATE_HZ) rate_hz = VI_SENSE_MIN_SAMPLE_RATE_HZ;
+    if (rate_hz > VI_SENSE_MAX_SAMPLE_RATE_HZ) rate_hz = VI_SENSE_MAX_SAMPLE_RATE_HZ;
+
+    sample_rate_hz = rate_hz;
+
+    // the active rate is compared with the new one, so it is forced to be set again
+    active_rate_hz = 0;
+    __acquisition_update_rate();
+
+    read_latency_min = 0xffff;
+    read_latency_max = 0;
+    late_read_count = 0;
+
+    cmd_write(CMD_ADDRESS_SAMPLE_RATE, rate_hz / 1000);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the VSEN and ISEN ADC sample rate [Hz]
+uint32_t vi_sense_get_sample_rate(void) {
+
+    return (sample_rate_hz);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// slows the acquisition down to VI_SENSE_IDLE_SAMPLE_RATE_HZ while the load is disabled; the full rate is restored before the load is enabled
+// the waveform capture, the telemetry stream and the raw code reads keep the selected rate while they run
+void vi_sense_set_idle(bool load_idle) {
+
+    idle = load_idle;
+    __acquisition_update_rate();
+}
+
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the number of blocks included in the averages and the running sums of their voltage [mV] and current [mA] averages
+// the sums wrap around, only the differences between two reads are meaningful; can be called from an interrupt with a lower priority than the block interrupt
+void vi_sense_read_block_sums(vi_sense_block_sums_t *sums) {
+
+    // the block interrupt may update the sums during the read; repeat until the block count is unchanged
+    do {
+
+        sums->count = valid_block_count;
+        sums->voltage_sum = voltage_block_sum;
+        sums->current_sum = current_block_sum;
+
+    } while (sums->count != valid_block_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the average voltage [uV] and current [uA] of the blocks completed between two reads of the block sums; returns false if there is no such block
+bool vi_sense_window_average(const vi_sense_block_sums_t *start, const vi_sense_block_sums_t *end, int32_t *voltage_uv, int32_t *current_ua) {
+
+    uint32_t count = end->count - start->count;
+    if (count == 0) return false;
+
+    // the differences of the wrapping sums are signed; the offset noise can make the averages slightly negative
+    *voltage_uv = div_s64((int64_t)(int32_t)(end->voltage_sum - start->voltage_sum) * 1000, count);
+    *current_ua = div_s64((int64_t)(int32_t)(end->current_sum - start->current_sum) * 1000, count);
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the minimum and maximum delay between the planned and the actual start of the read [ns] and the number of late reads
+// the conversion instants are set by the timer hardware; the read delay only shows the margin of the read framing interrupt
+void vi_sense_get_sample_timing(uint32_t *latency_min_ns, uint32_t *latency_max_ns, uint32_t *late_reads) {
+
+    uint32_t min = read_latency_min;
+    if (min == 0xffff) min = 0;
+
+    *latency_min_ns = min * (1000000000 / VI_SENSE_SAMPLE_TIMER_FREQUENCY);
+    *latency_max_ns = read_latency_max * (1000000000 / VI_SENSE_SAMPLE_TIMER_FREQUENCY);
+    *late_reads = late_read_count;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// waits until the specified number of new blocks is processed
+void __wait_for_blocks(uint32_t count) {
+
+    uint32_t start_count = block_count;
+    while (block_count - start_count < count) kernel_yield();
+}
+
+// returns the average of the blocks completed since the previous call
+void __read_window(int32_t *voltage_mv, int32_t *current_ma) {
+
+    static vi_sense_block_sums_t prev_sums = {0};
+    vi_sense_block_sums_t sums;
+
+    vi_sense_read_block_sums(&sums);
+    int32_t blocks = sums.count - prev_sums.count;
+
+    if (blocks > 0) {
+
+        *voltage_mv = (int32_t)(sums.voltage_sum - prev_sums.voltage_sum) / blocks;
+        *current_ma = (int32_t)(sums.current_sum - prev_sums.current_sum) / blocks;
+
+    } else {
+
+        *voltage_mv = voltage_block_average_mv;
+        *current_ma = current_block_average_ma;
+    }
+
+    prev_sums = sums;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// waits for the specified number of new blocks (max 4096) and returns the average raw VSEN and ISEN ADC codes with 4 fractional bits
+void vi_sense_read_raw_codes(uint32_t blocks, uint32_t *vsen_code_q4, uint32_t *isen_code_q4) {
+
+    uint32_t start_count, start_voltage_sum, start_current_sum, count, voltage_sum, current_sum;
+
+    if (blocks == 0) blocks = 1;
+
+    // the blocks are converted at the selected rate even if the load is disabled; the blocks at the idle rate are skipped
+    full_rate_requests++;
+    __acquisition_update_rate();
+    __wait_for_blocks(2);
+
+    // the block interrupt may update the sums during the read; repeat until the block count is unchanged
+    do {
+
+        start_count = valid_block_count;
+        start_voltage_sum = voltage_code_sum;
+        start_current_sum = current_code_sum;
+
+    } while (start_count != valid_block_count);
+
+    while (valid_block_count - start_count < blocks) kernel_yield();
+
+    do {
+
+        count = valid_block_count;
+        voltage_sum = voltage_code_sum;
+        current_sum = current_code_sum;
+
+    } while (count != valid_block_count);
+
+    full_rate_requests--;
+    __acquisition_update_rate();
+
+    uint32_t samples = (count - start_count) * VI_SENSE_BLOCK_SIZE;
+
+    *vsen_code_q4 = ((voltage_sum - start_voltage_sum) << 4) / samples;
+    *isen_code_q4 = ((current_sum - start_current_sum) << 4) / samples;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// requests a remote sense probe; the probe runs in the block interrupt, the result is signaled by remote_sense_detected
+void __probe_remote_sense(void) {
+
+    if (probe_state == PROBE_IDLE && discard_blocks == 0) probe_state = PROBE_REQUESTED;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// cancels a remote sense probe and excludes the blocks converted during a VSEN mux switch; called before the VSEN source is changed
+void __vsen_mux_switching(void) {
+
+    probe_state = PROBE_IDLE;
+
+    // the block interrupt may complete a block between this call and the switch; exclude the next two blocks
+    discard_blocks = 2;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// advances the remote sense probe after a completed block; block_voltage_mv is the remote sense voltage of a measuring block
+static void __probe_update(int32_t block_voltage_mv) {
+
+    switch (probe_state) {
+
+        case PROBE_REQUESTED:
+
+            gpio_write(VSEN_SRC_GPIO, HIGH);
+            probe_state = PROBE_SETTLING;
+            break;
+
+        case PROBE_SETTLING:
+
+            probe_state = PROBE_MEASURING;
+            break;
+
+        case PROBE_MEASURING:
+
+            // keep the remote sense if there is a voltage on the input, otherwise switch back and exclude the block in progress
+            if (block_voltage_mv >= VI_SENSE_AUTO_VSENSRC_THRESHOLD_MV) {
+
+                vsen_src = VSEN_SRC_REMOTE;
+                remote_sense_detected = true;
+
+            } else {
+
+                gpio_write(VSEN_SRC_GPIO, LOW);
+                discard_blocks = 1;
+            }
+
+            probe_state = PROBE_IDLE;
+            break;
+
+        default: break;
+    }
+}
+
+//---- IRQ HANDLERS ----------------------------------------------------------------------------------------------------------------------------------------------
+
+// terminates the previous SPI packet and starts reading the conversion triggered by the timer at the start of the period (for both ADCs simultaneously)
+// the received data is moved to the sample block by the DMA
+void VI_SENSE_SAMPLE_TIMER_IRQ_HANDLER(void) {
+
+    PROF_IRQ_ENTER(PROF_SAMPLE_TIMER_IRQ);
+
+    if (bit_is_set(VI_SENSE_SAMPLE_TIMER->SR, TIM_SR_CC4IF)) {
+
+        // pull SS of both ADCs high; the latency statistics keep it high for the minimum SS high time
+        ADC_SPI_SS_GPIO_PORT->BSRR = ADC_SPI_SS_BSRR;
+
+        uint32_t count = VI_SENSE_SAMPLE_TIMER->CNT;
+        clear_bits(VI_SENSE_SAMPLE_TIMER->SR, TIM_SR_CC4IF);
+
+        // the counter passed the update; the next conversion was started already and the read overlaps it
+        bool late = (count < VI_SENSE_READ_TICKS);
+        uint16_t latency = late ? count + VI_SENSE_SAMPLE_TIMER->ARR + 1 - VI_SENSE_READ_TICKS : count - VI_SENSE_READ_TICKS;
+
+        if (latency < read_latency_min) read_latency_min = latency;
+        if (latency > read_latency_max) read_latency_max = latency;
+        if (late) late_read_count++;
+
+        // read the conversion result; the ISEN read is started first so its DMA transfer is always done when the VSEN block completes
+        // the previous frames ended a period ago, so the transmit buffers are empty and the data register is written without waiting
+        ADC_SPI_SS_GPIO_PORT->BSRR = ADC_SPI_SS_BSRR << 16;
+        ISEN_ADC_SPI->DR = 0x0000;
+        VSEN_ADC_SPI->DR = 0x0000;
+
+        // the sequence is timed by the sample clock; the reload is the running period unless the sample rate was changed in it
+        load_sequence_clock(VI_SENSE_SAMPLE_TIMER->ARR + 1);
+    }
+
+    PROF_IRQ_EXIT(PROF_SAMPLE_TIMER_IRQ);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the CV, CR and CP regulation with the latest samples
+void LOAD_CONTROL_TIMER_IRQ_HANDLER(void) {
+
+    if (bit_is_set(LOAD_CONTROL_TIMER->SR, TIM_SR_UIF)) {
+
+        clear_bits(LOAD_CONTROL_TIMER->SR, TIM_SR_UIF);
+
+        PROF_IRQ_ENTER(PROF_CONTROL_LOOP);
+        load_update_pid(voltage_latest_sample_mv, current_latest_sample_ma);
+        PROF_IRQ_EXIT(PROF_CONTROL_LOOP);
+    }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// triggered once per VI_SENSE_BLOCK_SIZE samples; converts the completed block and records the raw samples
+void VSEN_ADC_DMA_IRQ_HANDLER(void) {
+
+    PROF_IRQ_ENTER(PROF_VSEN_DMA_IRQ);
+
+    if (VSEN_ADC_DMA->LISR & DMA_LISR_TCIF3) {
+
+        VSEN_ADC_DMA->LIFCR = DMA_LIFCR_CTCIF3;
+
+        // the DMA already fills the other block; CT points to the block currently in use by the DMA
+        uint8_t block = bit_is_set(VSEN_ADC_DMA_STREAM->CR, DMA_SxCR_CT) ? 0 : 1;
+
+        // blocks converted during a VSEN mux switch or with the probe mux setting are tagged; they are excluded from the averages and the PID holds the last valid voltage
+        bool probe_block = (probe_state == PROBE_MEASURING);
+        bool tagged = (probe_state == PROBE_SETTLING || probe_block || discard_blocks > 0);
+        vsen_src_t block_src = probe_block ? VSEN_SRC_REMOTE : vsen_src;
+
+        if (discard_blocks > 0) discard_blocks--;
+
+        int32_t voltage_sum = 0;
+        int32_t current_sum = 0;
+        uint32_t voltage_codes = 0;
+        uint32_t current_codes = 0;
+        int64_t power_sum = 0;
+        int32_t voltage_mv = 0;
+        calibration_channel_t voltage_channel = (block_src == VSEN_SRC_INTERNAL) ? CAL_VSEN_INT : CAL_VSEN_REM;
+
+        for (int i = 0; i < VI_SENSE_BLOCK_SIZE; i++) {
+
+            // the ADC is 12 bit and the SPI is 16bit; shift the value by 4 bits to get the right alignment
+            uint16_t voltage_code = vsen_adc_block[block][i] >> 4;
+            uint16_t current_code = isen_adc_block[block][i] >> 4;
+
+            voltage_mv = calibration_apply(voltage_channel, voltage_code);
+            current_latest_sample_ma = calibration_apply(CAL_ISEN, current_code);
+
+            voltage_sum += voltage_mv;
+            current_sum += current_latest_sample_ma;
+            voltage_codes += voltage_code;
+            current_codes += current_code;
+            power_sum += (int64_t)voltage_mv * current_latest_sample_ma;
+        }
+
+        if (!tagged) {
+
+            voltage_latest_sample_mv = voltage_mv;
+            voltage_block_average_mv = voltage_sum / VI_SENSE_BLOCK_SIZE;
+            current_block_average_ma = current_sum / VI_SENSE_BLOCK_SIZE;
+            voltage_block_sum += voltage_block_average_mv;
+            current_block_sum += current_block_average_ma;
+            voltage_code_sum += voltage_codes;
+            current_code_sum += current_codes;
+            valid_block_count++;
+        }
+
+        block_count++;
+
+        // the power of a tagged block is integrated with the last valid voltage
+        if (tagged) power_sum = (int64_t)voltage_latest_sample_mv * current_sum;
+        __integrate_block(current_sum, power_sum);
+
+        __probe_update(voltage_sum / VI_SENSE_BLOCK_SIZE);
+
+        // the I-V sweep and the maximum power point tracker measure and change the CC level in step with the blocks
+        if (!tagged) {
+
+            __sweep_block(voltage_block_average_mv, current_block_average_ma);
+            __mppt_block(voltage_block_average_mv, current_block_average_ma);
+        }
+
+        // the waveform capture runs last so it doesn't delay the control loop timer interrupt more than necessary
+        __capture_block(vsen_adc_block[block], isen_adc_block[block], block_src);
+    }
+
+    PROF_IRQ_EXIT(PROF_VSEN_DMA_IRQ);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,234 @@
+#include "vi_sense.h"
+#include "calibration.h"
+#include "cmd_spi_driver.h"
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+#define CAPTURE_INDEX_MASK (VI_SENSE_CAPTURE_DEPTH - 1)
+
+// raw samples; current ADC code (27:16), VSEN source (15), voltage ADC code (11:0)
+static uint32_t capture_buffer[VI_SENSE_CAPTURE_DEPTH];
+
+static volatile load_capture_state_t capture_state = LOAD_CAPTURE_IDLE;
+static load_capture_state_t reported_state = LOAD_CAPTURE_IDLE;     // state last written to the CAPTURE_CTRL register
+static uint16_t capture_config = 0;                                 // trigger fields of the CAPTURE_CTRL register
+static int32_t trigger_level = 0;                                   // level of the level and edge triggers [mV] or [mA]
+static uint32_t pretrigger_samples = 0;                             // number of samples kept before the trigger
+
+static uint32_t write_index = 0;                // buffer position of the next sample
+static uint32_t samples_recorded = 0;           // samples recorded since arming; a level, edge or force trigger is ignored until the pre-trigger part is filled
+static uint32_t samples_remaining = 0;          // post-trigger samples left to record
+static uint32_t start_index = 0;                // buffer position of the first sample of the capture
+static bool previous_beyond_level = true;       // the trigger signal was beyond the level at the previous sample; blocks an edge trigger right after arming
+static volatile uint8_t pending_events = 0;     // load events since arming (bit number == load_capture_trigger_t)
+static volatile uint8_t skip_blocks = 0;        // blocks not recorded after arming; they may contain samples at the idle rate of a disabled load
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+bool __acquisition_update_rate(void);
+
+// updates the state field of the CAPTURE_CTRL register
+static void __update_ctrl_register(void) {
+
+    reported_state = capture_state;
+    cmd_write(CMD_ADDRESS_CAPTURE_CTRL, capture_config | (reported_state << LOAD_CAPTURE_STATE_POS));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns true if the trigger condition is met by the sample
+static bool __trigger_condition(uint32_t sample) {
+
+    load_capture_trigger_t source = capture_config & LOAD_CAPTURE_TRIGGER;
+
+    if (source == LOAD_CAPTURE_TRIGGER_FORCE) return true;
+    if (source == LOAD_CAPTURE_TRIGGER_ENABLE || source == LOAD_CAPTURE_TRIGGER_FAULT) return (pending_events & (1 << source));
+
+    int32_t value;
+
+    if (capture_config & LOAD_CAPTURE_CURRENT) value = calibration_apply(CAL_ISEN, sample >> 16);
+    else if (sample & (1 << 15)) value = calibration_apply(CAL_VSEN_REM, sample & 0xfff);
+    else value = calibration_apply(CAL_VSEN_INT, sample & 0xfff);
+
+    bool beyond_level = (capture_config & LOAD_CAPTURE_FALLING) ? (value < trigger_level) : (value > trigger_level);
+    bool crossed = beyond_level && !previous_beyond_level;
+    previous_beyond_level = beyond_level;
+
+    return ((source == LOAD_CAPTURE_TRIGGER_LEVEL) ? beyond_level : crossed);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns true while the capture records; the acquisition keeps the selected sample rate then
+bool __capture_running(void) {
+
+    return (capture_state == LOAD_CAPTURE_ARMED || capture_state == LOAD_CAPTURE_TRIGGERED);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// arms the waveform capture; config contains the trigger fields of the CAPTURE_CTRL register, level is in [mV] or [mA]
+void vi_sense_capture_arm(uint16_t config, int32_t level, uint32_t pretrigger) {
+
+    if (pretrigger > VI_SENSE_CAPTURE_DEPTH - 1) pretrigger = VI_SENSE_CAPTURE_DEPTH - 1;
+    if ((config & LOAD_CAPTURE_TRIGGER) > LOAD_CAPTURE_TRIGGER_FAULT) config &= ~LOAD_CAPTURE_TRIGGER;
+
+    // stop the recording before the settings are changed
+    capture_state = LOAD_CAPTURE_IDLE;
+    __DMB();
+
+    capture_config = config & (LOAD_CAPTURE_TRIGGER | LOAD_CAPTURE_FALLING | LOAD_CAPTURE_CURRENT);
+    trigger_level = level;
+    pretrigger_samples = pretrigger;
+    samples_recorded = 0;
+    previous_beyond_level = true;
+    pending_events = 0;
+
+    skip_blocks = 2;
+
+    __DMB();
+    capture_state = LOAD_CAPTURE_ARMED;
+
+    // the acquisition leaves the idle rate of a disabled load with the next sample period; the block in progress and the next one are skipped then
+    if (!__acquisition_update_rate()) skip_blocks = 0;
+
+    cmd_write(CMD_ADDRESS_CAPTURE_LEVEL, (capture_config & LOAD_CAPTURE_CURRENT) ? level : level / 10);
+    cmd_write(CMD_ADDRESS_CAPTURE_PRETRIG, pretrigger);
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// stops the waveform capture; a completed capture stays readable
+void vi_sense_capture_stop(void) {
+
+    if (capture_state != LOAD_CAPTURE_DONE) capture_state = LOAD_CAPTURE_IDLE;
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the waveform capture state
+load_capture_state_t vi_sense_capture_get_state(void) {
+
+    return (capture_state);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the number of samples before the trigger in the captured waveform
+uint32_t vi_sense_capture_get_pretrigger(void) {
+
+    return (pretrigger_samples);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// signals a load event to the waveform capture (LOAD_CAPTURE_TRIGGER_ENABLE or LOAD_CAPTURE_TRIGGER_FAULT)
+void vi_sense_capture_event(load_capture_trigger_t event) {
+
+    if (capture_state == LOAD_CAPTURE_ARMED) pending_events |= (1 << event);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// reads a sample of the completed capture (0 is the oldest sample); returns false if there is no completed capture or the index is out of range
+bool vi_sense_capture_read(uint32_t index, int32_t *voltage_mv, int32_t *current_ma) {
+
+    if (capture_state != LOAD_CAPTURE_DONE || index >= VI_SENSE_CAPTURE_DEPTH) return false;
+
+    uint32_t sample = capture_buffer[(start_index + index) & CAPTURE_INDEX_MASK];
+
+    *voltage_mv = calibration_apply((sample & (1 << 15)) ? CAL_VSEN_REM : CAL_VSEN_INT, sample & 0xfff);
+    *current_ma = calibration_apply(CAL_ISEN, sample >> 16);
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// loads LOAD_CAPTURE_WINDOW_SAMPLES samples starting at index into the CAPTURE_DATA window; CAPTURE_INDEX is updated last to signal a valid window
+void vi_sense_capture_load_window(uint32_t index) {
+
+    for (int i = 0; i < LOAD_CAPTURE_WINDOW_SAMPLES; i++) {
+
+        int32_t voltage_mv = 0, current_ma = 0;
+        vi_sense_capture_read(index + i, &voltage_mv, &current_ma);
+
+        cmd_write(CMD_ADDRESS_CAPTURE_DATA0 + 2 * i, (voltage_mv > 0) ? voltage_mv / 10 : 0);
+        cmd_write(CMD_ADDRESS_CAPTURE_DATA0 + 2 * i + 1, (current_ma > 0) ? current_ma : 0);
+    }
+
+    cmd_write(CMD_ADDRESS_CAPTURE_INDEX, index);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// updates the state in the CAPTURE_CTRL register after the recording changed it; called by the vi_sense_task
+// the CAPTURE_PRETRIG register is updated first, an early enable or fault trigger may have shortened the pre-trigger part
+void __capture_update(void) {
+
+    if (capture_state == reported_state) return;
+
+    cmd_write(CMD_ADDRESS_CAPTURE_PRETRIG, pretrigger_samples);
+    __update_ctrl_register();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// records a block of raw ADC samples and evaluates the trigger; called from the block interrupt
+void __capture_block(volatile uint16_t *vsen_block, volatile uint16_t *isen_block, vsen_src_t source) {
+
+    if (capture_state == LOAD_CAPTURE_IDLE || capture_state == LOAD_CAPTURE_DONE) return;
+
+    if (skip_blocks > 0) {
+
+        skip_blocks--;
+        return;
+    }
+
+    for (int i = 0; i < VI_SENSE_BLOCK_SIZE; i++) {
+
+        // the ADC is 12 bit and the SPI is 16bit; shift the value by 4 bits to get the right alignment
+        uint32_t sample = ((uint32_t)(isen_block[i] >> 4) << 16) | (source << 15) | (vsen_block[i] >> 4);
+        uint32_t sample_index = write_index;
+
+        capture_buffer[sample_index] = sample;
+        write_index = (write_index + 1) & CAPTURE_INDEX_MASK;
+
+        if (capture_state == LOAD_CAPTURE_ARMED) {
+
+            bool trigger = __trigger_condition(sample);
+
+            // the pre-trigger part of the buffer has to be filled first; an enable or fault event doesn't come again,
+            // so it triggers at once and the pre-trigger part is shortened to the samples recorded so far
+            if (samples_recorded < pretrigger_samples) {
+
+                load_capture_trigger_t source = capture_config & LOAD_CAPTURE_TRIGGER;
+                bool event = (source == LOAD_CAPTURE_TRIGGER_ENABLE || source == LOAD_CAPTURE_TRIGGER_FAULT);
+
+                if (!(trigger && event)) {
+
+                    samples_recorded++;
+                    continue;
+                }
+
+                pretrigger_samples = samples_recorded;
+            }
+
+            if (trigger) {
+
+                start_index = (sample_index - pretrigger_samples) & CAPTURE_INDEX_MASK;
+                samples_remaining = VI_SENSE_CAPTURE_DEPTH - pretrigger_samples - 1;
+                capture_state = (samples_remaining == 0) ? LOAD_CAPTURE_DONE : LOAD_CAPTURE_TRIGGERED;
+            }
+
+        } else if (--samples_remaining == 0) {
+
+            capture_state = LOAD_CAPTURE_DONE;
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
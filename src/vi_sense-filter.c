@@ -0,0 +1,158 @@
+#include "vi_sense.h"
+#include "cmd_spi_driver.h"
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+#define IIR_FRACTIONAL_BITS 8       // fractional bits of the IIR filter state
+#define CIC_MAX_GAIN_BITS   14      // maximum CIC gain (decimation ratio^order) as a power of 2; keeps 100V in mV within the int32 range
+
+// filter state of a single channel (voltage or current)
+typedef struct {
+
+    int32_t median_history[2];                          // two previous inputs of the median filter
+    uint32_t integrator[LOAD_FILTER_MAX_CIC_ORDER];     // CIC integrators; wrap around on overflow, the combs cancel the wrap
+    uint32_t comb_delay[LOAD_FILTER_MAX_CIC_ORDER];     // CIC comb delay elements
+    int32_t iir_state;                                  // IIR filter output with IIR_FRACTIONAL_BITS fractional bits
+
+} filter_channel_t;
+
+static volatile uint16_t requested_config = LOAD_DEFAULT_FILTER;    // configuration written by the shell or the CMD interface
+static uint16_t active_config = 0;                                  // configuration used by the running filter; differs from requested_config before a restart
+
+static uint8_t cic_order;               // number of CIC stages
+static uint8_t decimation_shift;        // log2 of the decimation ratio
+static uint8_t iir_shift;               // IIR time constant as a power of 2 (0 -> IIR disabled)
+static bool median_enabled;             // median filter enabled
+
+static uint32_t input_count;            // number of inputs since the filter restart
+static uint32_t output_count;           // number of outputs since the filter restart
+static filter_channel_t voltage_channel;
+static filter_channel_t current_channel;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the median of three values
+static inline int32_t __median3(int32_t a, int32_t b, int32_t c) {
+
+    if (a > b) { int32_t t = a; a = b; b = t; }
+    if (b > c) b = c;
+    return ((a > b) ? a : b);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// restarts the filter with the requested configuration
+static void __filter_restart(void) {
+
+    active_config = requested_config;
+
+    cic_order = (active_config & LOAD_FILTER_CIC_ORDER) >> LOAD_FILTER_CIC_ORDER_POS;
+    decimation_shift = (active_config & LOAD_FILTER_DECIMATION) >> LOAD_FILTER_DECIMATION_POS;
+    iir_shift = (active_config & LOAD_FILTER_IIR_SHIFT) >> LOAD_FILTER_IIR_SHIFT_POS;
+    median_enabled = (active_config & LOAD_FILTER_MEDIAN);
+
+    input_count = 0;
+    output_count = 0;
+    voltage_channel = (filter_channel_t){0};
+    current_channel = (filter_channel_t){0};
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// feeds one input into the median and CIC integrator stages of a channel
+static void __channel_integrate(filter_channel_t *channel, int32_t input) {
+
+    if (median_enabled) {
+
+        // the history is filled with the first input after a restart so the filter does not start from zero
+        if (input_count == 0) channel->median_history[0] = channel->median_history[1] = input;
+
+        int32_t median = __median3(channel->median_history[0], channel->median_history[1], input);
+        channel->median_history[0] = channel->median_history[1];
+        channel->median_history[1] = input;
+        input = median;
+    }
+
+    channel->integrator[0] += (uint32_t)input;
+    for (int i = 1; i < cic_order; i++) channel->integrator[i] += channel->integrator[i - 1];
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the CIC comb and IIR stages of a channel at the output rate and returns the filtered value
+static int32_t __channel_output(filter_channel_t *channel) {
+
+    uint32_t value = channel->integrator[cic_order - 1];
+
+    for (int i = 0; i < cic_order; i++) {
+
+        uint32_t delayed = channel->comb_delay[i];
+        channel->comb_delay[i] = value;
+        value -= delayed;
+    }
+
+    // the CIC gain is (decimation ratio)^order, which is a power of 2
+    int32_t output = (int32_t)value >> (decimation_shift * cic_order);
+
+    if (iir_shift > 0) {
+
+        // y += (x - y) / 2^n; the first valid output loads the state directly
+        if (output_count < cic_order) channel->iir_state = output << IIR_FRACTIONAL_BITS;
+        else channel->iir_state += ((output << IIR_FRACTIONAL_BITS) - channel->iir_state) >> iir_shift;
+
+        output = (channel->iir_state + (1 << (IIR_FRACTIONAL_BITS - 1))) >> IIR_FRACTIONAL_BITS;
+    }
+
+    return (output);
+}
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// sets the measurement filter configuration (LOAD_FILTER_* fields of the FILTER register); the filter restarts with the new settings
+void vi_sense_set_filter(uint16_t config) {
+
+    uint16_t order = (config & LOAD_FILTER_CIC_ORDER) >> LOAD_FILTER_CIC_ORDER_POS;
+    uint16_t decimation = (config & LOAD_FILTER_DECIMATION) >> LOAD_FILTER_DECIMATION_POS;
+
+    // check limits
+    if (order == 0) order = 1;
+    if (decimation > LOAD_FILTER_MAX_DECIMATION) decimation = LOAD_FILTER_MAX_DECIMATION;
+    while (order * decimation > CIC_MAX_GAIN_BITS) decimation--;
+
+    config &= (LOAD_FILTER_IIR_SHIFT | LOAD_FILTER_MEDIAN | LOAD_FILTER_ROUNDING);
+    config |= (order << LOAD_FILTER_CIC_ORDER_POS) | (decimation << LOAD_FILTER_DECIMATION_POS);
+
+    requested_config = config;
+    cmd_write(CMD_ADDRESS_FILTER, config);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the measurement filter configuration
+uint16_t vi_sense_get_filter(void) {
+
+    return (requested_config);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// feeds one window average into the filter; returns true and the filtered values once per decimation period
+bool __filter_update(int32_t voltage_mv, int32_t current_ma, int32_t *filtered_voltage_mv, int32_t *filtered_current_ma) {
+
+    if (active_config != requested_config) __filter_restart();
+
+    __channel_integrate(&voltage_channel, voltage_mv);
+    __channel_integrate(&current_channel, current_ma);
+    input_count++;
+
+    // not at the end of a decimation period
+    if (input_count & ((1 << decimation_shift) - 1)) return false;
+
+    *filtered_voltage_mv = __channel_output(&voltage_channel);
+    *filtered_current_ma = __channel_output(&current_channel);
+
+    // the comb delays are empty after a restart; the first (order - 1) outputs of a higher order CIC cover a partially filled window
+    return (++output_count >= cic_order);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
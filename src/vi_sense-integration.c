@@ -0,0 +1,114 @@
+#include "vi_sense.h"
+#include "cmd_spi_driver.h"
+#include "fixed_point.h"
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+#define PERIOD_FRACTIONAL_BITS  36      // fractional bits of the sample period [s]; keeps the period error below 2 ppm at every sample rate and a 1kHz block of 100V * 42A within the int64 range
+
+static volatile bool integration_enabled = false;   // the block interrupt integrates the charge and energy
+static uint32_t sample_period_q36 = 0;              // sample period [s] with PERIOD_FRACTIONAL_BITS fractional bits
+
+// integrals; the fraction parts hold the sub-unit remainder so no charge or energy is lost between the blocks
+static volatile int64_t charge_uas = 0;             // integrated current [uAs]
+static volatile int64_t energy_uws = 0;             // integrated power [uWs]
+static int64_t charge_fraction = 0;                 // [uAs] * 2^PERIOD_FRACTIONAL_BITS
+static int64_t energy_fraction = 0;                 // [uWs] * 2^PERIOD_FRACTIONAL_BITS
+static volatile uint32_t integration_sequence = 0;  // incremented after every update of the integrals
+
+static uint16_t latch_count = 0;                    // number of latches of the integral registers
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// starts the charge and energy integration from zero or stops it; the integrated values remain readable after a stop
+void vi_sense_set_integration(bool enabled) {
+
+    if (enabled) {
+
+        integration_enabled = false;
+        __DMB();
+
+        charge_uas = 0;
+        energy_uws = 0;
+        charge_fraction = 0;
+        energy_fraction = 0;
+        integration_sequence++;
+
+        __DMB();
+    }
+
+    integration_enabled = enabled;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the charge [uAs] and energy [uWs] integrated at the sample rate since the integration was started
+void vi_sense_read_integrals(int64_t *charge, int64_t *energy) {
+
+    uint32_t sequence;
+
+    // the block interrupt may update the integrals during the read; repeat until the sequence is unchanged
+    do {
+
+        sequence = integration_sequence;
+        __DMB();
+
+        *charge = charge_uas;
+        *energy = energy_uws;
+
+        __DMB();
+
+    } while (sequence != integration_sequence);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// copies the integrals into the CHARGE and ENERGY registers; INTEGRAL_LATCH is updated last to signal a consistent set
+void vi_sense_latch_integrals(void) {
+
+    int64_t charge, energy;
+    vi_sense_read_integrals(&charge, &energy);
+
+    // the registers are unsigned; the offset noise can make the integrals slightly negative
+    uint64_t charge_uah = (charge > 0) ? div_u64(charge, 3600) : 0;
+    uint64_t energy_uwh = (energy > 0) ? div_u64(energy, 3600) : 0;
+
+    cmd_write(CMD_ADDRESS_CHARGE_L, charge_uah & 0xffff);
+    cmd_write(CMD_ADDRESS_CHARGE_M, (charge_uah >> 16) & 0xffff);
+    cmd_write(CMD_ADDRESS_CHARGE_H, (charge_uah >> 32) & 0xffff);
+    cmd_write(CMD_ADDRESS_ENERGY_L, energy_uwh & 0xffff);
+    cmd_write(CMD_ADDRESS_ENERGY_M, (energy_uwh >> 16) & 0xffff);
+    cmd_write(CMD_ADDRESS_ENERGY_H, (energy_uwh >> 32) & 0xffff);
+
+    cmd_write(CMD_ADDRESS_INTEGRAL_LATCH, ++latch_count);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets the sample period used by the integration; called when the sample rate changes
+void __integration_set_period(uint32_t period_ticks) {
+
+    uint64_t period = div_u64(((uint64_t)period_ticks << PERIOD_FRACTIONAL_BITS) + VI_SENSE_SAMPLE_TIMER_FREQUENCY / 2, VI_SENSE_SAMPLE_TIMER_FREQUENCY);
+    sample_period_q36 = period;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// adds a block to the integrals; current_sum [mA] and power_sum [uW] are sums over the block samples; called from the block interrupt
+void __integrate_block(int32_t current_sum, int64_t power_sum) {
+
+    if (!integration_enabled) return;
+
+    // the integer part is moved into the integrals, the fraction stays in [0, 1)
+    charge_fraction += (int64_t)current_sum * 1000 * sample_period_q36;
+    energy_fraction += power_sum * sample_period_q36;
+
+    charge_uas += charge_fraction >> PERIOD_FRACTIONAL_BITS;
+    energy_uws += energy_fraction >> PERIOD_FRACTIONAL_BITS;
+    charge_fraction &= (1ULL << PERIOD_FRACTIONAL_BITS) - 1;
+    energy_fraction &= (1ULL << PERIOD_FRACTIONAL_BITS) - 1;
+
+    integration_sequence++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
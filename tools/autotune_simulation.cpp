@@ -0,0 +1,304 @@
+/*
+ *  CV, CR and CP relay autotune closed-loop simulation
+ *  Martin Kopka 2024
+ *
+ *  Runs the relay autotune of src/load_control-autotune.c in the regulation of src/pid.c and src/load_control-regulation.c against the power stage
+ *  and source model of pid_simulation.cpp, and prints the measured ultimate period and amplitude, the tuned gains, and the overshoot and the 2 %
+ *  settling time of a 10 % setpoint step with the tuned gains in each mode
+ *  the regulation settles at the operating point with the default gains of include/config.h before the autotune starts; an operating point that
+ *  leaves no room for the relay amplitude in the ISET DAC range is reported as infeasible (load_autotune_start refuses it) and is not a failure
+ *  a relay amplitude whose voltage (or power) swing on the source doesn't clear twice the hysteresis fails the autotune, as it does in the firmware
+ *  the controller sources of the firmware are compiled against the host shim of host/
+ *
+ *  build:  gcc -std=gnu11 -O2 -Wall -Wno-unused-variable -Ihost -I../include -c ../src/pid.c ../src/load_control-regulation.c ../src/load_control-autotune.c
+ *          g++ -std=c++17 -O2 -Ihost -I../include -o autotune_simulation autotune_simulation.cpp pid.o load_control-regulation.o load_control-autotune.o
+ *  usage:  autotune_simulation [relay_ma]      exits with 1 if a feasible autotune fails or its step doesn't settle
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+
+#include "load_control.h"
+
+// internal functions of src/load_control-regulation.c and src/load_control-autotune.c
+uint32_t __regulation_error(load_mode_t mode, uint32_t level, uint32_t voltage, uint32_t current, int32_t *error, int32_t *process);
+int32_t __regulation_feedforward(int32_t *feedforward_q8, uint32_t target, bool *hold);
+bool __autotune_update(int32_t error, int32_t *output);
+void __autotune_finish(void);
+
+// state and functions of the firmware the autotune uses; provided by the simulation
+load_mode_t load_mode = LOAD_MODE_CV;
+bool enabled = false;
+
+int32_t __pid_get_output(void);
+void __pid_resume(int32_t output);
+void cmd_write(uint8_t address, uint16_t data);
+}
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static const double UPDATE_PERIOD_S = 1.0 / LOAD_CONTROL_LOOP_RATE_HZ;
+static const double SETTLE_DURATION_S = 0.5;        // time the regulation settles at the operating point before the autotune and the step
+static const double STEP_DURATION_S = 1.0;          // simulated time of the step; a step that doesn't settle within it fails
+
+static const double STAGE_TIME_CONSTANT_S = 20e-6;  // the power stage of pid_simulation.cpp
+static const double STAGE_GAIN_ERROR = 0.03;
+static const double STAGE_OFFSET_MA = 50;
+
+static const double SETTLING_BAND = 0.02;           // settled within 2 % of the current change
+static const double STEP_SIZE = 0.1;                // the setpoint step raises the load current by 10 %
+
+static const double OPERATING_CURRENT_MA = 2000;    // load current of the operating point; limited to a third of the short-circuit current of the source
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// a source the load is connected to
+typedef struct {
+
+    double voltage_mv;
+    double resistance_mohm;
+
+} source_t;
+
+// the simulated modes with their default gains
+static const load_mode_t MODES[] = {LOAD_MODE_CV, LOAD_MODE_CR, LOAD_MODE_CP};
+static const char *MODE_NAMES[] = {"CV", "CR", "CP"};
+static const pid_gains_t MODE_GAINS[] = {{LOAD_CV_PID_KP, LOAD_CV_PID_KI, LOAD_CV_PID_KD},
+                                         {LOAD_CR_PID_KP, LOAD_CR_PID_KI, LOAD_CR_PID_KD},
+                                         {LOAD_CP_PID_KP, LOAD_CP_PID_KI, LOAD_CP_PID_KD}};
+
+static const source_t SOURCES[] = {{12000, 100}, {12000, 1000}, {12000, 3300}, {12000, 10000}, {24000, 1000}, {5000, 200}};
+
+// regulation state of load_control-pid.c
+static pid_controller_t pid;
+static int32_t pid_output = 0;
+static int32_t feedforward_q8 = 0;
+static int32_t feedforward = 0;
+
+// plant state
+static double current_ma = 0;
+static int32_t measured_voltage = 0;
+static int32_t measured_current = 0;
+
+//---- FIRMWARE FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// __pid_get_output and __pid_resume of load_control-pid.c
+int32_t __pid_get_output(void) {
+
+    return (pid_output);
+}
+
+void __pid_resume(int32_t output) {
+
+    pid_reset(&pid, output - feedforward);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// the gains go straight to the controller; the firmware stores them in the parameter table and applies them the same way
+void load_set_pid_gains(load_mode_t mode, const pid_gains_t *gains) {
+
+    pid_set_gains(&pid, gains);
+}
+
+// the default control loop rate
+uint32_t load_get_control_rate(void) {
+
+    return (LOAD_CONTROL_LOOP_RATE_HZ);
+}
+
+// the AUTOTUNE register is not simulated; the state is read with load_autotune_get_result
+void cmd_write(uint8_t address, uint16_t data) {}
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// load_update_pid of load_control-pid.c; returns the output [ISET DAC codes below ISET_DAC_ZERO_LEVEL_CODE]
+static int32_t update_pid(uint32_t level, uint32_t voltage, uint32_t current) {
+
+    int32_t error, process, output;
+    bool hold;
+
+    uint32_t target = __regulation_error(load_mode, level, voltage, current, &error, &process);
+    feedforward = __regulation_feedforward(&feedforward_q8, target, &hold);
+
+    pid_set_output_limits(&pid, -feedforward, ISET_DAC_ZERO_LEVEL_CODE - feedforward);
+
+    if (!__autotune_update(error, &output)) output = pid_update(&pid, hold ? 0 : error, process) + feedforward;
+    pid_output = output;
+
+    return (output);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs one control loop update at a level and advances the power stage by one update period; returns the load current [mA]
+static double simulate_update(const source_t &source, uint32_t level) {
+
+    int32_t output = update_pid(level, measured_voltage, measured_current);
+
+    // the control loop uses the sample taken before the update
+    double voltage_mv = source.voltage_mv - current_ma * source.resistance_mohm / 1000;
+    measured_voltage = (int32_t)lround(voltage_mv);
+    measured_current = (int32_t)lround(current_ma);
+
+    // the power stage can't source current, and the voltage limits the current of the source
+    double demand_ma = output / 1.4919 * (1 + STAGE_GAIN_ERROR) + STAGE_OFFSET_MA;
+    if (demand_ma < 0) demand_ma = 0;
+    if (demand_ma > source.voltage_mv * 1000 / source.resistance_mohm) demand_ma = source.voltage_mv * 1000 / source.resistance_mohm;
+
+    current_ma += (demand_ma - current_ma) * (1 - exp(-UPDATE_PERIOD_S / STAGE_TIME_CONSTANT_S));
+
+    return (current_ma);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the level of a mode [mV, mOhm, uW] that sets a load current on a source
+static uint32_t mode_level(load_mode_t mode, const source_t &source, double load_ma) {
+
+    double voltage_mv = source.voltage_mv - load_ma * source.resistance_mohm / 1000;
+
+    if (mode == LOAD_MODE_CV) return (uint32_t)lround(voltage_mv);
+    if (mode == LOAD_MODE_CR) return (uint32_t)lround(voltage_mv * 1000 / load_ma);
+    return (uint32_t)lround(voltage_mv * load_ma);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the regulation at a level for a time; returns the current at the end [mA]
+static double simulate_hold(const source_t &source, uint32_t level, double duration_s) {
+
+    uint32_t updates = (uint32_t)(duration_s / UPDATE_PERIOD_S);
+    for (uint32_t update = 0; update < updates; update++) simulate_update(source, level);
+
+    return (current_ma);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs a setpoint step and measures the overshoot [part of the current change] and the settling time [ms]; the settling time is negative if the
+// current still moves in the last tenth of the step; returns the final current [mA]
+// the final current is not compared with the expected one; the mV and mA resolution of the measurement leaves a static error of a few mA
+static double simulate_step(const source_t &source, uint32_t level, double *overshoot, double *settling_ms) {
+
+    static double response[(uint32_t)(STEP_DURATION_S * LOAD_CONTROL_LOOP_RATE_HZ) + 1];
+    uint32_t updates = (uint32_t)(STEP_DURATION_S / UPDATE_PERIOD_S);
+
+    double start_ma = current_ma;
+    for (uint32_t update = 0; update < updates; update++) response[update] = simulate_update(source, level);
+
+    double final_ma = response[updates - 1];
+    double change = final_ma - start_ma;
+    double band = fabs(change) * SETTLING_BAND;
+
+    double peak = 0;
+    uint32_t settled = 0;
+
+    for (uint32_t update = 0; update < updates; update++) {
+
+        double beyond = (change >= 0) ? response[update] - final_ma : final_ma - response[update];
+        if (beyond > peak) peak = beyond;
+        if (fabs(response[update] - final_ma) > band) settled = update + 1;
+    }
+
+    *overshoot = (change != 0) ? peak / fabs(change) : 0;
+    *settling_ms = (settled < updates - updates / 10) ? settled * UPDATE_PERIOD_S * 1000 : -1;
+
+    return (final_ma);
+}
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    uint32_t relay_ma = (argc > 1) ? (uint32_t)atoi(argv[1]) : LOAD_AUTOTUNE_RELAY_MA;
+
+    if (relay_ma == 0 || relay_ma > LOAD_MAX_CC_LEVEL_MA) {
+
+        fprintf(stderr, "usage: autotune_simulation [relay_ma]\n");
+        return EXIT_FAILURE;
+    }
+
+    bool passed = true;
+    uint32_t feasible = 0, infeasible = 0;
+
+    printf("control loop rate %d Hz, power stage %.0f us, gain error %.0f %%, offset %.0f mA, relay %u mA, hysteresis %d\n\n", LOAD_CONTROL_LOOP_RATE_HZ,
+           STAGE_TIME_CONSTANT_S * 1e6, STAGE_GAIN_ERROR * 100, STAGE_OFFSET_MA, relay_ma, LOAD_AUTOTUNE_HYSTERESIS);
+    printf("%-4s %10s %8s %8s %-10s %8s %10s %10s %10s %10s %10s %14s\n", "mode", "source [V]", "[mOhm]", "[mA]", "autotune", "Tu [us]", "amplitude",
+           "kp", "ki", "final [mA]", "overshoot", "settling [ms]");
+
+    for (int mode = 0; mode < 3; mode++) {
+
+        for (const source_t &source : SOURCES) {
+
+            // the operating point leaves two thirds of the source voltage at the load; at half of it the CP level is the maximum power of the source
+            // and the CP regulation has no stable operating point
+            double operating_ma = source.voltage_mv * 1000 / source.resistance_mohm / 3;
+            if (operating_ma > OPERATING_CURRENT_MA) operating_ma = OPERATING_CURRENT_MA;
+
+            // enable and settle at the operating point with the default gains
+            load_mode = MODES[mode];
+            enabled = true;
+
+            pid_init(&pid, &MODE_GAINS[mode], 0, ISET_DAC_ZERO_LEVEL_CODE, LOAD_PID_D_FILTER_SHIFT);
+            pid_output = feedforward_q8 = feedforward = 0;
+            current_ma = 0;
+            measured_voltage = (int32_t)source.voltage_mv;
+            measured_current = 0;
+
+            uint32_t level = mode_level(MODES[mode], source, operating_ma);
+            simulate_hold(source, level, SETTLE_DURATION_S);
+
+            printf("%-4s %10.2f %8.0f %8.0f ", MODE_NAMES[mode], source.voltage_mv / 1000, source.resistance_mohm, operating_ma);
+
+            if (!load_autotune_start(relay_ma)) {
+
+                printf("%-10s\n", "infeasible");
+                infeasible++;
+                continue;
+            }
+
+            feasible++;
+
+            // the load task picks up the result; it runs far slower than the control loop, but the timing doesn't change the result
+            while (load_autotune_get_state() == LOAD_AUTOTUNE_RUNNING) {
+
+                simulate_update(source, level);
+                __autotune_finish();
+            }
+
+            uint32_t period_us, amplitude;
+            load_autotune_state_t state = load_autotune_get_result(&period_us, &amplitude);
+
+            if (state != LOAD_AUTOTUNE_DONE) {
+
+                printf("%-10s %8u %10u   (!) autotune failed\n", "failed", period_us, amplitude);
+                passed = false;
+                continue;
+            }
+
+            // settle with the tuned gains and step the load current by 10 %
+            simulate_hold(source, level, SETTLE_DURATION_S);
+
+            double overshoot, settling_ms;
+            double final_ma = simulate_step(source, mode_level(MODES[mode], source, operating_ma * (1 + STEP_SIZE)), &overshoot, &settling_ms);
+
+            bool settled = settling_ms >= 0;
+            passed &= settled;
+
+            printf("%-10s %8u %10u %10.4f %10.6f %10.1f %9.1f%% %14.2f%s\n", "done", period_us, amplitude, pid.gains.kp / 65536.0,
+                   pid.gains.ki / 65536.0, final_ma, overshoot * 100, settling_ms, settled ? "" : "   (!) not settled");
+        }
+    }
+
+    printf("\n%s (%u autotunes, %u infeasible operating points, settling band %.0f %%)\n", passed ? "passed" : "failed", feasible, infeasible,
+           SETTLING_BAND * 100);
+
+    return (passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,185 @@
+/*
+ *  VSEN/ISEN block hand-off model
+ *  Martin Kopka 2024
+ *
+ *  Simulates the ping-pong DMA blocks of vi_sense-acquisition.c for a range of block sizes and prints for each of them
+ *  the interrupt rate and the CPU load of the acquisition, the margin of the block processing before the DMA returns to the block,
+ *  and the age of the sample the control loop timer uses (the latency cost of the block hand-off)
+ *  the first row is the per-sample interrupt the blocks replaced
+ *
+ *  the cycle costs are estimates for the STM32F411 at 96 MHz; replace them with the numbers of the "prof" shell command for a measured model
+ *
+ *  build:  g++ -std=c++17 -O2 -I../include -o block_model block_model.cpp
+ *  usage:  block_model [sample_rate_hz] [control_rate_hz] [sample_irq_cycles] [block_fixed_cycles] [block_sample_cycles]
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "config.h"
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static const double CORE_CLOCK_HZ = 96e6;           // CORE_CLOCK_FREQUENCY_HZ
+static const double IRQ_OVERHEAD_CYCLES = 24;       // exception entry and return without the FPU context
+
+// default costs of the handlers without the entry and return [cycles]
+static const double SAMPLE_IRQ_CYCLES = 70;         // sample timer interrupt; SS framing and the two SPI writes
+static const double BLOCK_FIXED_CYCLES = 260;       // block interrupt without the samples; sums, integration, probe, sweep, MPPT and capture checks
+static const double BLOCK_SAMPLE_CYCLES = 45;       // block interrupt per sample; two calibrations, the sums and the power product
+static const double PER_SAMPLE_EXTRA_CYCLES = 40;   // the per-sample interrupt also waited for the SPI and handled the SPI status
+
+static const uint32_t BLOCK_SIZES[] = {1, 2, 4, 8, 16, 32, 64};
+static const uint32_t SIMULATED_SAMPLES = 1 << 18;
+static const uint32_t CONTROL_PHASES = 16;          // the control loop timer is not synchronized to the sample timer; the ages are taken over these phase offsets
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// result of one configuration
+typedef struct {
+
+    double irq_rate_hz;             // interrupts per second
+    double cpu_load;                // part of the CPU time spent in the acquisition interrupts
+    double min_margin_us;           // shortest time between the end of a block processing and the DMA writing into that block again
+    double avg_age_us;              // average age of the sample used by the control loop update
+    double max_age_us;              // maximum age of the sample used by the control loop update
+
+} model_result_t;
+
+static double sample_irq_cycles = SAMPLE_IRQ_CYCLES;
+static double block_fixed_cycles = BLOCK_FIXED_CYCLES;
+static double block_sample_cycles = BLOCK_SAMPLE_CYCLES;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// simulates the acquisition with a block size; per_sample_irq models the single interrupt per sample that converted the sample itself
+static model_result_t simulate(uint32_t block_size, double sample_rate_hz, double control_rate_hz, bool per_sample_irq, double control_phase_s) {
+
+    model_result_t result = {};
+
+    double period_s = 1.0 / sample_rate_hz;
+    double cycle_s = 1.0 / CORE_CLOCK_HZ;
+
+    // the sample timer interrupt and the block interrupt have the same priority, so a block is processed after the read of the sample that completes it
+    double sample_irq_s = (IRQ_OVERHEAD_CYCLES + sample_irq_cycles + (per_sample_irq ? PER_SAMPLE_EXTRA_CYCLES : 0)) * cycle_s;
+    double block_irq_s = (IRQ_OVERHEAD_CYCLES + block_fixed_cycles + block_sample_cycles * block_size) * cycle_s;
+    if (per_sample_irq) block_irq_s -= IRQ_OVERHEAD_CYCLES * cycle_s;
+
+    double busy_s = 0;
+    double min_margin_s = 1e9;
+    double age_sum_s = 0;
+    double max_age_s = 0;
+    uint64_t control_updates = 0;
+
+    double latest_sample_time = -1;         // acquisition time of the latest sample published by the block processing
+    double published_time = -1;             // time the latest sample was published
+    double next_control_time = control_phase_s;
+
+    for (uint32_t sample = 0; sample < SIMULATED_SAMPLES; sample++) {
+
+        // the conversion is triggered at the end of the period, its read completes at the start of the next sample timer interrupt
+        double converted = (sample + 1) * period_s;
+        double read_done = converted + sample_irq_s;
+        busy_s += sample_irq_s;
+
+        if ((sample + 1) % block_size != 0) continue;
+
+        // the DMA switches to the other block; this block is written again after the next full block
+        double processed = read_done + block_irq_s;
+        double rewritten = converted + block_size * period_s;
+        busy_s += block_irq_s;
+
+        if (rewritten - processed < min_margin_s) min_margin_s = rewritten - processed;
+
+        // the control loop timer updates between the publications use the previous sample
+        double next_published = processed;
+
+        while (next_control_time < next_published) {
+
+            if (latest_sample_time >= 0 && published_time <= next_control_time) {
+
+                double age = next_control_time - latest_sample_time;
+                age_sum_s += age;
+                if (age > max_age_s) max_age_s = age;
+                control_updates++;
+            }
+
+            next_control_time += 1.0 / control_rate_hz;
+        }
+
+        latest_sample_time = converted;
+        published_time = processed;
+    }
+
+    double duration_s = SIMULATED_SAMPLES * period_s;
+
+    result.irq_rate_hz = sample_rate_hz * (per_sample_irq ? 1.0 : 1.0 + 1.0 / block_size);
+    result.cpu_load = busy_s / duration_s;
+    result.min_margin_us = min_margin_s * 1e6;
+    result.avg_age_us = control_updates ? age_sum_s / control_updates * 1e6 : 0;
+    result.max_age_us = max_age_s * 1e6;
+
+    return result;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// simulates a block size with the control loop timer at every phase offset; the ages are averaged and the maximum is kept
+static model_result_t simulate_phases(uint32_t block_size, double sample_rate_hz, double control_rate_hz, bool per_sample_irq) {
+
+    model_result_t result = simulate(block_size, sample_rate_hz, control_rate_hz, per_sample_irq, 0);
+
+    for (uint32_t phase = 1; phase < CONTROL_PHASES; phase++) {
+
+        model_result_t run = simulate(block_size, sample_rate_hz, control_rate_hz, per_sample_irq, phase / (CONTROL_PHASES * control_rate_hz));
+
+        result.avg_age_us += run.avg_age_us;
+        if (run.max_age_us > result.max_age_us) result.max_age_us = run.max_age_us;
+    }
+
+    result.avg_age_us /= CONTROL_PHASES;
+    return result;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// prints a row of the result table
+static void print_row(const char *name, const model_result_t &result) {
+
+    printf("%-12s %12.0f %9.1f %% %12.2f %12.2f %12.2f%s\n", name, result.irq_rate_hz, result.cpu_load * 100, result.min_margin_us,
+           result.avg_age_us, result.max_age_us, (result.min_margin_us < 0) ? "   (!) overrun" : "");
+}
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    double sample_rate_hz = (argc > 1) ? atof(argv[1]) : VI_SENSE_SAMPLE_RATE_HZ;
+    double control_rate_hz = (argc > 2) ? atof(argv[2]) : LOAD_CONTROL_LOOP_RATE_HZ;
+    if (argc > 3) sample_irq_cycles = atof(argv[3]);
+    if (argc > 4) block_fixed_cycles = atof(argv[4]);
+    if (argc > 5) block_sample_cycles = atof(argv[5]);
+
+    if (sample_rate_hz <= 0 || control_rate_hz <= 0) {
+
+        fprintf(stderr, "usage: block_model [sample_rate_hz] [control_rate_hz] [sample_irq_cycles] [block_fixed_cycles] [block_sample_cycles]\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("sample rate %.0f Hz, control loop rate %.0f Hz, VI_SENSE_BLOCK_SIZE %d\n\n", sample_rate_hz, control_rate_hz, VI_SENSE_BLOCK_SIZE);
+    printf("%-12s %12s %11s %12s %12s %12s\n", "block", "IRQs [1/s]", "CPU load", "margin [us]", "avg age [us]", "max age [us]");
+
+    print_row("per sample", simulate_phases(1, sample_rate_hz, control_rate_hz, true));
+
+    for (uint32_t block_size : BLOCK_SIZES) {
+
+        char name[16];
+        snprintf(name, sizeof(name), "%u", block_size);
+        print_row(name, simulate_phases(block_size, sample_rate_hz, control_rate_hz, false));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,153 @@
+/*
+ *  Code/unit conversion test
+ *  Martin Kopka 2024
+ *
+ *  Compares the conversion macros of include/hw_config.h with the division based macros they replaced for every input code
+ *  and the whole ISET current range, prints the mismatches and the largest error, and benchmarks both versions
+ *  the benchmark runs on the host; the compiler turns a division by a constant into a multiplication there as well as with -O3 for the Cortex-M4,
+ *  so the two columns compare the instruction sequences (the signed rounding of the division against the 64-bit product of SCALE_RATIO), not a divide instruction
+ *
+ *  build:  g++ -std=c++17 -O2 -I../include -o conversion_test conversion_test.cpp
+ *  usage:  conversion_test             exits with 1 if any conversion differs from the previous macro
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "hw_config.h"
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+// the macros before SCALE_RATIO
+#define OLD_ISET_DAC_LSB_PER_MA(i_ma)       (-14919 * (int32_t)(i_ma) / 10000)
+#define OLD_ISET_DAC_MA_TO_CODE(i_ma)       (OLD_ISET_DAC_LSB_PER_MA(i_ma) + 62647)
+#define OLD_VSEN_ADC_CODE_TO_MV_INT(code)   (((int32_t)(code) * 516 / 25) - 91)
+#define OLD_VSEN_ADC_CODE_TO_MV_REM(code)   (((int32_t)(code) * 2069 / 100) - 91)
+#define OLD_ISEN_ADC_CODE_TO_MA(code)       (((int32_t)(code) * 1075 / 100) - 50)
+#define OLD_ISEN_INT_ADC_CODE_TO_MA(code)   (((int32_t)(code) * 2762 / 1000) - 12)
+
+static const uint32_t ADC_CODES = 65537;            // the 16-bit codes and the full scale used by the default calibrations (calibration.c)
+static const uint32_t INT_ADC_CODES = 4096;         // internal 12-bit ADC
+static const uint32_t ISET_MAX_MA = 143000;         // the old macro overflows int32 above ~143.9 A
+
+static const uint32_t BENCHMARK_PASSES = 2000;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// a conversion under test
+typedef struct {
+
+    const char *name;
+    int32_t (*converted)(uint32_t);
+    int32_t (*previous)(uint32_t);
+    double (*benchmark_converted)(uint32_t inputs);
+    double (*benchmark_previous)(uint32_t inputs);
+    uint32_t inputs;
+
+} conversion_t;
+
+static volatile int32_t sink;                       // keeps the benchmark loops from being optimized out
+static volatile uint32_t input_offset = 0;          // keeps the inputs from being constant-folded
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns a timestamp in the time stamp counter ticks where the CPU has one, otherwise in nanoseconds
+static uint64_t timestamp(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the average time of one conversion over all its inputs; the conversion is a template argument so it is inlined into the loop like in the firmware
+template <int32_t (*convert)(uint32_t)>
+static double benchmark(uint32_t inputs) {
+
+    uint64_t start = timestamp();
+
+    for (uint32_t pass = 0; pass < BENCHMARK_PASSES; pass++) {
+
+        uint32_t offset = input_offset;
+        for (uint32_t input = 0; input < inputs; input++) sink = convert(input + offset);
+    }
+
+    return (double)(timestamp() - start) / ((double)BENCHMARK_PASSES * inputs);
+}
+
+//---- CONVERSIONS -----------------------------------------------------------------------------------------------------------------------------------------------
+
+static int32_t iset(uint32_t i)          { return ISET_DAC_MA_TO_CODE(i); }
+static int32_t old_iset(uint32_t i)      { return OLD_ISET_DAC_MA_TO_CODE(i); }
+static int32_t vsen_int(uint32_t c)      { return VSEN_ADC_CODE_TO_MV_INT(c); }
+static int32_t old_vsen_int(uint32_t c)  { return OLD_VSEN_ADC_CODE_TO_MV_INT(c); }
+static int32_t vsen_rem(uint32_t c)      { return VSEN_ADC_CODE_TO_MV_REM(c); }
+static int32_t old_vsen_rem(uint32_t c)  { return OLD_VSEN_ADC_CODE_TO_MV_REM(c); }
+static int32_t isen(uint32_t c)          { return ISEN_ADC_CODE_TO_MA(c); }
+static int32_t old_isen(uint32_t c)      { return OLD_ISEN_ADC_CODE_TO_MA(c); }
+static int32_t isen_int(uint32_t c)      { return ISEN_INT_ADC_CODE_TO_MA(c); }
+static int32_t old_isen_int(uint32_t c)  { return OLD_ISEN_INT_ADC_CODE_TO_MA(c); }
+
+#define CONVERSION(name, converted, previous, inputs)   {name, converted, previous, benchmark<converted>, benchmark<previous>, inputs}
+
+static const conversion_t conversions[] = {
+
+    CONVERSION("ISET_DAC_MA_TO_CODE",       iset,       old_iset,       ISET_MAX_MA + 1),
+    CONVERSION("VSEN_ADC_CODE_TO_MV_INT",   vsen_int,   old_vsen_int,   ADC_CODES),
+    CONVERSION("VSEN_ADC_CODE_TO_MV_REM",   vsen_rem,   old_vsen_rem,   ADC_CODES),
+    CONVERSION("ISEN_ADC_CODE_TO_MA",       isen,       old_isen,       ADC_CODES),
+    CONVERSION("ISEN_INT_ADC_CODE_TO_MA",   isen_int,   old_isen_int,   INT_ADC_CODES),
+};
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    bool failed = false;
+
+    printf("%-24s %8s %10s %10s\n", "conversion", "inputs", "mismatches", "max error");
+
+    for (const conversion_t &conversion : conversions) {
+
+        uint32_t mismatches = 0;
+        int32_t max_error = 0;
+
+        for (uint32_t input = 0; input < conversion.inputs; input++) {
+
+            int32_t error = conversion.converted(input) - conversion.previous(input);
+            if (error < 0) error = -error;
+
+            if (error != 0) mismatches++;
+            if (error > max_error) max_error = error;
+        }
+
+        printf("%-24s %8u %10u %10d\n", conversion.name, conversion.inputs, mismatches, max_error);
+        if (mismatches) failed = true;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    printf("\n%-24s %10s %10s   [TSC ticks per conversion]\n", "conversion", "divide", "scale");
+#else
+    printf("\n%-24s %10s %10s   [ns per conversion]\n", "conversion", "divide", "scale");
+#endif
+
+    for (const conversion_t &conversion : conversions) {
+
+        double previous = conversion.benchmark_previous(conversion.inputs);
+        double converted = conversion.benchmark_converted(conversion.inputs);
+        printf("%-24s %10.2f %10.2f\n", conversion.name, previous, converted);
+    }
+
+    return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
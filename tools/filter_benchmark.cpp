@@ -0,0 +1,127 @@
+/*
+ *  Measurement filter benchmark
+ *  Martin Kopka 2024
+ *
+ *  Runs the median, CIC and IIR stages of src/vi_sense-filter.c for every stage configuration of the FILTER register
+ *  and prints the time per input window (both channels) and the output rate of each configuration
+ *  the filter source of the firmware is compiled against the host shim of host/; the times are host times and only compare the configurations
+ *
+ *  build:  gcc -std=gnu11 -O2 -Wall -Wno-unused-variable -Ihost -I../include -c ../src/vi_sense-filter.c
+ *          g++ -std=c++17 -O2 -Ihost -I../include -o filter_benchmark filter_benchmark.cpp vi_sense-filter.o
+ *  usage:  filter_benchmark
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+extern "C" {
+
+#include "vi_sense.h"
+
+// internal function of src/vi_sense-filter.c
+bool __filter_update(int32_t voltage_mv, int32_t current_ma, int32_t *filtered_voltage_mv, int32_t *filtered_current_ma);
+
+// the FILTER register write of vi_sense_set_filter; the benchmark has no CMD interface
+void cmd_write(uint8_t, uint16_t) {}
+}
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static const uint32_t INPUTS = 1 << 18;             // windows per configuration
+static const uint32_t PASSES = 4;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static int32_t voltage_input[INPUTS];
+static int32_t current_input[INPUTS];
+static volatile int32_t sink;                       // keeps the outputs from being optimized out
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns a timestamp in the time stamp counter ticks where the CPU has one, otherwise in nanoseconds
+static uint64_t timestamp(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the average time of one __filter_update call of the configuration set by vi_sense_set_filter; the first update restarts the filter
+static double benchmark(void) {
+
+    uint64_t total = 0;
+
+    for (uint32_t pass = 0; pass < PASSES; pass++) {
+
+        uint64_t start = timestamp();
+
+        for (uint32_t input = 0; input < INPUTS; input++) {
+
+            int32_t voltage, current;
+            if (__filter_update(voltage_input[input], current_input[input], &voltage, &current)) sink = voltage + current;
+        }
+
+        total += timestamp() - start;
+    }
+
+    return (double)total / ((double)PASSES * INPUTS);
+}
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+
+    // 12 V and 5 A with noise and an occasional spike for the median stage
+    srand(1);
+
+    for (uint32_t i = 0; i < INPUTS; i++) {
+
+        voltage_input[i] = 12000 + (rand() % 41) - 20 + ((rand() % 1000 == 0) ? 5000 : 0);
+        current_input[i] = 5000 + (rand() % 21) - 10;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *unit = "TSC ticks";
+#else
+    const char *unit = "ns";
+#endif
+
+    printf("window %d ms; time per window of both channels [%s]\n\n", VI_SENSE_WINDOW_MS, unit);
+    printf("%-8s %-6s %-10s %-4s %12s %12s\n", "median", "order", "decimation", "iir", "output [Hz]", "time");
+
+    for (int median = 0; median <= 1; median++) {
+
+        for (int order = 1; order <= LOAD_FILTER_MAX_CIC_ORDER; order++) {
+
+            for (int decimation = 0; decimation <= LOAD_FILTER_MAX_DECIMATION; decimation++) {
+
+                for (int iir = 0; iir <= 1; iir++) {
+
+                    uint16_t config = (order << LOAD_FILTER_CIC_ORDER_POS) | (decimation << LOAD_FILTER_DECIMATION_POS) |
+                                      ((iir ? 2 : 0) << LOAD_FILTER_IIR_SHIFT_POS) | (median ? LOAD_FILTER_MEDIAN : 0);
+
+                    // vi_sense_set_filter reduces the decimation until the CIC gain fits; the reduced configuration is listed already
+                    vi_sense_set_filter(config);
+                    if (vi_sense_get_filter() != config) continue;
+
+                    printf("%-8s %-6d %-10d %-4s %12.2f %12.2f\n", median ? "on" : "off", order, 1 << decimation, iir ? "on" : "off",
+                           1000.0 / (VI_SENSE_WINDOW_MS << decimation), benchmark());
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
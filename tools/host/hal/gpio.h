@@ -0,0 +1,7 @@
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+// host shim; common_defs.h includes the GPIO driver, the host sources don't use it
+#include "stm32f4xx.h"
+
+#endif /* _GPIO_H_ */
@@ -0,0 +1,7 @@
+#ifndef _RCC_H_
+#define _RCC_H_
+
+// host shim; common_defs.h includes the RCC driver, the host sources don't use it
+#include "stm32f4xx.h"
+
+#endif /* _RCC_H_ */
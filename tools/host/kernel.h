@@ -0,0 +1,9 @@
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+// host shim; the headers only use the time type of the kernel
+#include <stdint.h>
+
+typedef uint32_t kernel_time_t;
+
+#endif /* _KERNEL_H_ */
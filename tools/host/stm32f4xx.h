@@ -0,0 +1,26 @@
+#ifndef _STM32F4XX_H_
+#define _STM32F4XX_H_
+
+/*
+ *  Host shim of the STM32F4xx device header
+ *  Martin Kopka 2024
+ *
+ *  Lets the host tools compile the hardware-independent firmware sources with gcc and link them into the tools
+ *  the tools are single-threaded, so the interrupt masking and the memory barriers are empty
+ *  only the names used by the headers included by these sources are provided; a register access doesn't compile
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//---- FUNCTIONS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __DMB(void) {}
+static inline void __DSB(void) {}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#endif /* _STM32F4XX_H_ */
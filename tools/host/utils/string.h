@@ -0,0 +1,7 @@
+#ifndef _UTILS_STRING_H_
+#define _UTILS_STRING_H_
+
+// host shim; the string functions of the C library replace the firmware ones
+#include <string.h>
+
+#endif /* _UTILS_STRING_H_ */
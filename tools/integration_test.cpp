@@ -0,0 +1,194 @@
+/*
+ *  Charge and energy integration accuracy test
+ *  Martin Kopka 2024
+ *
+ *  Feeds a synthetic discharge profile through the block integration of src/vi_sense-integration.c and compares the charge and energy
+ *  with the exact integrals of the same samples; the profile runs through several sample rates, the period error is checked for every sample timer period
+ *  the error must stay below 2 ppm of the integral plus one unit of the integrals (1 uAs, 1 uWs)
+ *  the integration source of the firmware is compiled against the host shim of host/
+ *
+ *  build:  gcc -std=gnu11 -O2 -Wall -Wno-unused-variable -Ihost -I../include -c ../src/vi_sense-integration.c
+ *          g++ -std=c++17 -O2 -Ihost -I../include -o integration_test integration_test.cpp vi_sense-integration.o
+ *  usage:  integration_test [seconds_per_rate]       exits with 1 if any error is out of the bound
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+
+#include "vi_sense.h"
+
+// internal functions of src/vi_sense-integration.c
+void __integration_set_period(uint32_t period_ticks);
+void __integrate_block(int32_t current_sum, int64_t power_sum);
+
+// the register writes of vi_sense_latch_integrals; the test has no CMD interface
+void cmd_write(uint8_t, uint16_t) {}
+}
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static const uint32_t SAMPLE_TIMER_FREQUENCY = VI_SENSE_SAMPLE_TIMER_FREQUENCY;
+static const int PERIOD_FRACTIONAL_BITS = 36;               // fractional bits of the sample period in vi_sense-integration.c
+
+static const double MAX_ERROR_PPM = 2.0;                    // relative bound of the integration error
+static const double MAX_ERROR_UNITS = 1.0;                  // absolute bound; the integrals are whole uAs and uWs
+
+// sample rates of the profile; the minimum, the idle rate, the default, the maximum and rates with a rounded period (244897 Hz has the largest period error)
+static const uint32_t RATES_HZ[] = {VI_SENSE_MIN_SAMPLE_RATE_HZ, VI_SENSE_IDLE_SAMPLE_RATE_HZ, 33333, VI_SENSE_SAMPLE_RATE_HZ, 170000, 244897, VI_SENSE_MAX_SAMPLE_RATE_HZ};
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// exact integrals; the sums of the samples times the period in timer ticks
+static __int128 charge_exact_ua_ticks = 0;
+static __int128 energy_exact_uw_ticks = 0;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the sample period of the integration for a sample timer period [s in Q36]
+// the period is read back through the energy integral; a power sum of 2^36 uW integrates to the period in uWs
+static uint64_t integration_period(uint32_t period_ticks) {
+
+    int64_t charge, energy;
+
+    vi_sense_set_integration(true);
+    __integration_set_period(period_ticks);
+    __integrate_block(0, 1LL << PERIOD_FRACTIONAL_BITS);
+    vi_sense_read_integrals(&charge, &energy);
+
+    return (uint64_t)energy;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the current [mA] of the synthetic profile at a time [s]; a 5 A discharge with 20 A pulses, a 1 kHz ripple and noise
+static int32_t profile_current_ma(double t) {
+
+    double current = 5000 + 500 * sin(2 * M_PI * 1000 * t) + (rand() % 21) - 10;
+    if (fmod(t, 1.0) < 0.01) current += 15000;
+
+    return (int32_t)current;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the voltage [mV] of the profile; a battery with a falling open circuit voltage and 20 mOhm internal resistance
+static int32_t profile_voltage_mv(double t, int32_t current_ma) {
+
+    return (int32_t)(12600 - t * 0.5 - current_ma * 0.020);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the relative error [ppm] and checks it against the bound
+static bool check(const char *name, double value, double exact, double *error_ppm) {
+
+    double error = value - exact;
+    *error_ppm = (exact != 0) ? error / exact * 1e6 : 0;
+
+    bool passed = fabs(error) <= fabs(exact) * MAX_ERROR_PPM * 1e-6 + MAX_ERROR_UNITS;
+    if (!passed) fprintf(stderr, "(!) %s error %.3f out of the bound\n", name, error);
+
+    return passed;
+}
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    double seconds_per_rate = (argc > 1) ? atof(argv[1]) : 20;
+    if (seconds_per_rate <= 0) {
+
+        fprintf(stderr, "usage: integration_test [seconds_per_rate]\n");
+        return EXIT_FAILURE;
+    }
+
+    bool passed = true;
+
+    // the rounding error of the period is the relative error of the integrals
+    double max_period_ppm = 0;
+    uint32_t max_period_ticks = 0;
+
+    for (uint32_t ticks = SAMPLE_TIMER_FREQUENCY / VI_SENSE_MAX_SAMPLE_RATE_HZ; ticks <= SAMPLE_TIMER_FREQUENCY / VI_SENSE_MIN_SAMPLE_RATE_HZ; ticks++) {
+
+        uint64_t sample_period_q36 = integration_period(ticks);
+        double exact = (double)((uint64_t)ticks << PERIOD_FRACTIONAL_BITS) / SAMPLE_TIMER_FREQUENCY;
+        double error_ppm = fabs(sample_period_q36 - exact) / exact * 1e6;
+
+        if (error_ppm > max_period_ppm) {
+
+            max_period_ppm = error_ppm;
+            max_period_ticks = ticks;
+        }
+    }
+
+    printf("largest period error %.3f ppm at %u Hz\n\n", max_period_ppm, SAMPLE_TIMER_FREQUENCY / max_period_ticks);
+
+    if (max_period_ppm > MAX_ERROR_PPM) {
+
+        fprintf(stderr, "(!) period error out of the bound\n");
+        passed = false;
+    }
+
+    srand(1);
+
+    double t = 0;
+
+    printf("%-10s %12s %14s %14s %12s %12s\n", "rate [Hz]", "period [ns]", "charge [uAh]", "energy [uWh]", "charge [ppm]", "energy [ppm]");
+
+    for (uint32_t rate_hz : RATES_HZ) {
+
+        // the sample timer runs at whole ticks, the exact integral uses the same period
+        uint32_t period_ticks = SAMPLE_TIMER_FREQUENCY / rate_hz;
+        double period_s = (double)period_ticks / SAMPLE_TIMER_FREQUENCY;
+        uint64_t blocks = (uint64_t)(seconds_per_rate / period_s) / VI_SENSE_BLOCK_SIZE;
+
+        // every rate starts from zero like a new load enable
+        vi_sense_set_integration(true);
+        __integration_set_period(period_ticks);
+        charge_exact_ua_ticks = energy_exact_uw_ticks = 0;
+
+        for (uint64_t block = 0; block < blocks; block++) {
+
+            int32_t current_sum = 0;
+            int64_t power_sum = 0;
+
+            for (int i = 0; i < VI_SENSE_BLOCK_SIZE; i++) {
+
+                int32_t current_ma = profile_current_ma(t);
+                int32_t voltage_mv = profile_voltage_mv(t, current_ma);
+
+                current_sum += current_ma;
+                power_sum += (int64_t)voltage_mv * current_ma;
+
+                charge_exact_ua_ticks += (__int128)current_ma * 1000 * period_ticks;
+                energy_exact_uw_ticks += (__int128)voltage_mv * current_ma * period_ticks;
+
+                t += period_s;
+            }
+
+            __integrate_block(current_sum, power_sum);
+        }
+
+        int64_t charge_uas, energy_uws;
+        vi_sense_read_integrals(&charge_uas, &energy_uws);
+
+        double charge_exact = (double)charge_exact_ua_ticks / SAMPLE_TIMER_FREQUENCY;
+        double energy_exact = (double)energy_exact_uw_ticks / SAMPLE_TIMER_FREQUENCY;
+        double charge_ppm, energy_ppm;
+
+        passed &= check("charge", (double)charge_uas, charge_exact, &charge_ppm);
+        passed &= check("energy", (double)energy_uws, energy_exact, &energy_ppm);
+
+        printf("%-10u %12.1f %14.1f %14.1f %12.4f %12.4f\n", rate_hz, period_s * 1e9, charge_uas / 3600.0, energy_uws / 3600.0, charge_ppm, energy_ppm);
+    }
+
+    printf("\n%s (bound %.1f ppm + %.0f unit)\n", passed ? "passed" : "failed", MAX_ERROR_PPM, MAX_ERROR_UNITS);
+
+    return (passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,237 @@
+/*
+ *  CV, CR and CP regulation closed-loop simulation
+ *  Martin Kopka 2024
+ *
+ *  Runs the PID of src/pid.c with the mode errors and the feedforward of src/load_control-regulation.c against a model of the power stage and the source,
+ *  and prints the overshoot and the 2 % settling time of the load current for the enable step (from zero current) and a setpoint step in each mode
+ *  the source is a voltage with a series resistance; the power stage follows the ISET DAC with a first-order lag and a gain and offset error,
+ *  and the control loop sees the voltage and the current one update late (the block hand-off, see block_model.cpp)
+ *  the controller sources of the firmware are compiled against the host shim of host/; the gains are the defaults of include/config.h
+ *
+ *  build:  gcc -std=gnu11 -O2 -Wall -Wno-unused-variable -Ihost -I../include -c ../src/pid.c ../src/load_control-regulation.c
+ *          g++ -std=c++17 -O2 -Ihost -I../include -o pid_simulation pid_simulation.cpp pid.o load_control-regulation.o
+ *  usage:  pid_simulation [source_mv source_mohm]      exits with 1 if any step doesn't settle
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+
+#include "load_control.h"
+
+// internal functions of src/load_control-regulation.c
+uint32_t __regulation_error(load_mode_t mode, uint32_t level, uint32_t voltage, uint32_t current, int32_t *error, int32_t *process);
+int32_t __regulation_feedforward(int32_t *feedforward_q8, uint32_t target, bool *hold);
+}
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static const double UPDATE_PERIOD_S = 1.0 / LOAD_CONTROL_LOOP_RATE_HZ;
+static const double STEP_DURATION_S = 2.0;          // simulated time of each step; a step that doesn't settle within it fails
+
+static const double STAGE_TIME_CONSTANT_S = 20e-6;  // power stage response to the ISET DAC
+static const double STAGE_GAIN_ERROR = 0.03;        // uncalibrated gain and offset the feedforward doesn't know about; the PID trims them
+static const double STAGE_OFFSET_MA = 50;
+
+static const double SETTLING_BAND = 0.02;           // settled within 2 % of the current change
+
+// load currents of the two setpoints of each mode [mA]; the CV, CR and CP levels are computed from them for each source
+static const double FIRST_CURRENT_MA = 4000;
+static const double SECOND_CURRENT_MA = 6000;
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+// a source the load is connected to
+typedef struct {
+
+    double voltage_mv;
+    double resistance_mohm;
+
+} source_t;
+
+// result of one step
+typedef struct {
+
+    double overshoot;               // part of the current change
+    double settling_ms;             // time after which the current stays within the settling band; negative if it didn't settle
+    double final_ma;
+
+} step_result_t;
+
+// the simulated modes with their default gains
+static const load_mode_t MODES[] = {LOAD_MODE_CV, LOAD_MODE_CR, LOAD_MODE_CP};
+static const char *MODE_NAMES[] = {"CV", "CR", "CP"};
+static const pid_gains_t MODE_GAINS[] = {{LOAD_CV_PID_KP, LOAD_CV_PID_KI, LOAD_CV_PID_KD},
+                                         {LOAD_CR_PID_KP, LOAD_CR_PID_KI, LOAD_CR_PID_KD},
+                                         {LOAD_CP_PID_KP, LOAD_CP_PID_KI, LOAD_CP_PID_KD}};
+
+static const source_t SOURCES[] = {{24000, 1000}, {24000, 100}, {5000, 200}};
+
+// regulation state of load_control-pid.c
+static pid_controller_t pid;
+static int32_t feedforward_q8 = 0;
+static int32_t feedforward = 0;
+
+// plant state
+static double current_ma = 0;
+static int32_t measured_voltage = 0;
+static int32_t measured_current = 0;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// load_update_pid of load_control-pid.c without the autotune; returns the output [ISET DAC codes below ISET_DAC_ZERO_LEVEL_CODE]
+static int32_t update_pid(load_mode_t mode, uint32_t level, uint32_t voltage, uint32_t current) {
+
+    int32_t error, process;
+    bool hold;
+
+    uint32_t target = __regulation_error(mode, level, voltage, current, &error, &process);
+    feedforward = __regulation_feedforward(&feedforward_q8, target, &hold);
+
+    pid_set_output_limits(&pid, -feedforward, ISET_DAC_ZERO_LEVEL_CODE - feedforward);
+
+    return (pid_update(&pid, hold ? 0 : error, process) + feedforward);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the level of a mode [mV, mOhm, uW] that sets a load current on a source
+static uint32_t mode_level(load_mode_t mode, const source_t &source, double load_ma) {
+
+    double voltage_mv = source.voltage_mv - load_ma * source.resistance_mohm / 1000;
+
+    if (mode == LOAD_MODE_CV) return (uint32_t)lround(voltage_mv);
+    if (mode == LOAD_MODE_CR) return (uint32_t)lround(voltage_mv * 1000 / load_ma);
+    return (uint32_t)lround(voltage_mv * load_ma);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// runs the regulation at a level for STEP_DURATION_S and measures the load current response from the current at the start
+static step_result_t simulate_step(load_mode_t mode, const source_t &source, uint32_t level) {
+
+    step_result_t result = {};
+
+    double stage_alpha = 1 - exp(-UPDATE_PERIOD_S / STAGE_TIME_CONSTANT_S);
+    uint32_t updates = (uint32_t)(STEP_DURATION_S / UPDATE_PERIOD_S);
+
+    double start_ma = current_ma;
+    static double response[(uint32_t)(STEP_DURATION_S * LOAD_CONTROL_LOOP_RATE_HZ) + 1];
+
+    for (uint32_t update = 0; update < updates; update++) {
+
+        int32_t output = update_pid(mode, level, measured_voltage, measured_current);
+
+        // the control loop uses the sample taken before the update
+        double voltage_mv = source.voltage_mv - current_ma * source.resistance_mohm / 1000;
+        measured_voltage = (int32_t)lround(voltage_mv);
+        measured_current = (int32_t)lround(current_ma);
+
+        // the power stage can't source current, and the voltage limits the current of the source
+        double demand_ma = output / 1.4919 * (1 + STAGE_GAIN_ERROR) + STAGE_OFFSET_MA;
+        if (demand_ma < 0) demand_ma = 0;
+        if (demand_ma > source.voltage_mv * 1000 / source.resistance_mohm) demand_ma = source.voltage_mv * 1000 / source.resistance_mohm;
+
+        current_ma += (demand_ma - current_ma) * stage_alpha;
+        response[update] = current_ma;
+    }
+
+    double final_ma = response[updates - 1];
+    double change = final_ma - start_ma;
+    double band = fabs(change) * SETTLING_BAND;
+
+    // the overshoot is the largest excursion beyond the final current in the direction of the change
+    double peak = 0;
+    for (uint32_t update = 0; update < updates; update++) {
+
+        double beyond = (change >= 0) ? response[update] - final_ma : final_ma - response[update];
+        if (beyond > peak) peak = beyond;
+    }
+
+    // the last update outside of the band; a step still moving in the last tenth of the simulation didn't settle
+    uint32_t settled = 0;
+    for (uint32_t update = 0; update < updates; update++) if (fabs(response[update] - final_ma) > band) settled = update + 1;
+
+    double drift = fabs(response[updates - 1] - response[updates - updates / 10]);
+
+    result.overshoot = (change != 0) ? peak / fabs(change) : 0;
+    result.settling_ms = (settled < updates - updates / 10 && drift <= band) ? settled * UPDATE_PERIOD_S * 1000 : -1;
+    result.final_ma = final_ma;
+
+    return result;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// prints a row of the result table and checks the step; the final current must be within the settling band of the expected current
+static bool print_step(const char *mode, const source_t &source, const char *step, const step_result_t &result, double expected_ma, double change_ma) {
+
+    bool passed = result.settling_ms >= 0 && fabs(result.final_ma - expected_ma) <= fabs(change_ma) * SETTLING_BAND;
+
+    printf("%-4s %9.2f %10.0f %-10s %12.1f %10.1f %14.2f%s\n", mode, source.voltage_mv / 1000, source.resistance_mohm, step, result.final_ma,
+           result.overshoot * 100, result.settling_ms, passed ? "" : "   (!) not settled");
+
+    return passed;
+}
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    const source_t *sources = SOURCES;
+    uint32_t source_count = sizeof(SOURCES) / sizeof(SOURCES[0]);
+    source_t argument_source;
+
+    if (argc > 1) {
+
+        argument_source.voltage_mv = (argc > 2) ? atof(argv[1]) : 0;
+        argument_source.resistance_mohm = (argc > 2) ? atof(argv[2]) : 0;
+
+        // the source has to deliver the second current with some voltage left
+        if (argument_source.resistance_mohm <= 0 || argument_source.voltage_mv <= SECOND_CURRENT_MA * argument_source.resistance_mohm / 1000 + 500) {
+
+            fprintf(stderr, "usage: pid_simulation [source_mv source_mohm]\n");
+            return EXIT_FAILURE;
+        }
+
+        sources = &argument_source;
+        source_count = 1;
+    }
+
+    bool passed = true;
+
+    printf("control loop rate %d Hz, power stage %.0f us, gain error %.0f %%, offset %.0f mA\n\n", LOAD_CONTROL_LOOP_RATE_HZ,
+           STAGE_TIME_CONSTANT_S * 1e6, STAGE_GAIN_ERROR * 100, STAGE_OFFSET_MA);
+    printf("%-4s %9s %10s %-10s %12s %10s %14s\n", "mode", "source [V]", "[mOhm]", "step", "final [mA]", "overshoot", "settling [ms]");
+
+    for (int mode = 0; mode < 3; mode++) {
+
+        for (uint32_t i = 0; i < source_count; i++) {
+
+            const source_t &source = sources[i];
+
+            // enable; __pid_reset starts the PID and the feedforward from zero current
+            pid_init(&pid, &MODE_GAINS[mode], 0, ISET_DAC_ZERO_LEVEL_CODE, LOAD_PID_D_FILTER_SHIFT);
+            feedforward_q8 = feedforward = 0;
+            current_ma = 0;
+            measured_voltage = (int32_t)source.voltage_mv;
+            measured_current = 0;
+
+            step_result_t result = simulate_step(MODES[mode], source, mode_level(MODES[mode], source, FIRST_CURRENT_MA));
+            passed &= print_step(MODE_NAMES[mode], source, "enable", result, FIRST_CURRENT_MA, FIRST_CURRENT_MA);
+
+            // a setpoint step of the running regulation
+            result = simulate_step(MODES[mode], source, mode_level(MODES[mode], source, SECOND_CURRENT_MA));
+            passed &= print_step(MODE_NAMES[mode], source, "setpoint", result, SECOND_CURRENT_MA, SECOND_CURRENT_MA - FIRST_CURRENT_MA);
+        }
+    }
+
+    printf("\n%s (settling band %.0f %%)\n", passed ? "passed" : "failed", SETTLING_BAND * 100);
+
+    return (passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------
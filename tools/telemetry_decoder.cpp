@@ -0,0 +1,293 @@
+/*
+ *  Telemetry stream decoder
+ *  Martin Kopka 2024
+ *
+ *  Decodes the binary telemetry frames of the "stream" shell command (see include/telemetry.h) and writes them to stdout as CSV
+ *  the frame errors and the dropped samples are reported to stderr
+ *
+ *  build:  g++ -std=c++17 -O2 -o telemetry_decoder telemetry_decoder.cpp
+ *  usage:  telemetry_decoder <serial_port> <rate_hz> [channels] > log.csv    starts the stream, decodes it until Ctrl+C and stops it
+ *          telemetry_decoder - < capture.bin > log.csv                       decodes a raw capture of the stream
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+//---- CONSTANTS -------------------------------------------------------------------------------------------------------------------------------------------------
+
+static const speed_t SHELL_BAUD = B115200;      // DEBUG_UART_BAUD
+static const speed_t STREAM_BAUD = B921600;     // TELEMETRY_UART_BAUD
+
+static const uint8_t FRAME_VERSION = 1;         // TELEMETRY_FRAME_VERSION
+static const size_t HEADER_SIZE = 11;           // version, channels, sequence and time
+
+// channel bits of include/telemetry.h
+enum : uint16_t {
+
+    TELEMETRY_VOLTAGE   = 0x0001,
+    TELEMETRY_CURRENT   = 0x0002,
+    TELEMETRY_POWER     = 0x0004,
+    TELEMETRY_SINKS     = 0x0008,
+    TELEMETRY_TEMPS     = 0x0010,
+    TELEMETRY_RPM       = 0x0020,
+    TELEMETRY_STATUS    = 0x0040
+};
+
+//---- INTERNAL DATA ---------------------------------------------------------------------------------------------------------------------------------------------
+
+static volatile sig_atomic_t stop_requested = 0;
+
+//---- INTERNAL FUNCTIONS ----------------------------------------------------------------------------------------------------------------------------------------
+
+// returns the CRC-16/CCITT-FALSE of a buffer
+static uint16_t crc16(const uint8_t *data, size_t length) {
+
+    uint16_t crc = 0xffff;
+
+    for (size_t i = 0; i < length; i++) {
+
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+
+    return crc;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// decodes a COBS encoded frame without the delimiter; returns false if the encoding is invalid
+static bool cobs_decode(const std::vector<uint8_t> &input, std::vector<uint8_t> &output) {
+
+    output.clear();
+    size_t i = 0;
+
+    while (i < input.size()) {
+
+        uint8_t code = input[i++];
+        if (code == 0 || i + code - 1 > input.size()) return false;
+
+        for (int j = 1; j < code; j++) output.push_back(input[i++]);
+        if (code < 0xff && i < input.size()) output.push_back(0);
+    }
+
+    return true;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// little-endian field reader
+struct reader {
+
+    const uint8_t *pos;
+
+    uint16_t u16() { uint16_t value = pos[0] | (pos[1] << 8); pos += 2; return value; }
+    uint32_t u32() { uint32_t value = pos[0] | (pos[1] << 8) | (pos[2] << 16) | ((uint32_t)pos[3] << 24); pos += 4; return value; }
+    int32_t i32() { return (int32_t)u32(); }
+};
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// returns the size of a frame with the selected channels including the CRC [bytes]
+static size_t frame_size(uint16_t channels) {
+
+    size_t size = HEADER_SIZE + 2;
+
+    if (channels & TELEMETRY_VOLTAGE) size += 4;
+    if (channels & TELEMETRY_CURRENT) size += 4;
+    if (channels & TELEMETRY_POWER) size += 4;
+    if (channels & TELEMETRY_SINKS) size += 8;
+    if (channels & TELEMETRY_TEMPS) size += 4;
+    if (channels & TELEMETRY_RPM) size += 4;
+    if (channels & TELEMETRY_STATUS) size += 4;
+
+    return size;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// prints the CSV header for the selected channels
+static void print_header(uint16_t channels) {
+
+    printf("sequence,time_us");
+
+    if (channels & TELEMETRY_VOLTAGE) printf(",voltage_mv");
+    if (channels & TELEMETRY_CURRENT) printf(",current_ma");
+    if (channels & TELEMETRY_POWER) printf(",power_mw");
+    if (channels & TELEMETRY_SINKS) printf(",sink_l1_ma,sink_l2_ma,sink_r1_ma,sink_r2_ma");
+    if (channels & TELEMETRY_TEMPS) printf(",temp_l_c,temp_r_c");
+    if (channels & TELEMETRY_RPM) printf(",fan1_rpm,fan2_rpm");
+    if (channels & TELEMETRY_STATUS) printf(",status,faults");
+
+    printf("\n");
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// decoder state and statistics
+struct decoder {
+
+    bool header_printed = false;
+    uint16_t channels = 0;
+    bool first_frame = true;
+    uint32_t next_sequence = 0;
+    uint32_t prev_time_us = 0;
+    uint64_t time_offset_us = 0;        // unwraps the 32bit time
+
+    uint64_t frames = 0;
+    uint64_t dropped = 0;
+    uint64_t errors = 0;
+
+    // decodes a frame and prints it as a CSV line
+    void frame(const std::vector<uint8_t> &encoded) {
+
+        std::vector<uint8_t> data;
+
+        if (!cobs_decode(encoded, data) || data.size() < HEADER_SIZE + 2 || data[0] != FRAME_VERSION) { errors++; return; }
+        if (crc16(data.data(), data.size() - 2) != (data[data.size() - 2] | (data[data.size() - 1] << 8))) { errors++; return; }
+
+        reader r{data.data() + 1};
+        uint16_t frame_channels = r.u16();
+        if (data.size() != frame_size(frame_channels)) { errors++; return; }
+
+        if (!header_printed) {
+
+            channels = frame_channels;
+            print_header(channels);
+            header_printed = true;
+        }
+
+        if (frame_channels != channels) { errors++; return; }
+
+        uint32_t sequence = r.u32();
+        uint32_t time_us = r.u32();
+
+        if (!first_frame) {
+
+            dropped += (uint32_t)(sequence - next_sequence);
+            if (time_us < prev_time_us) time_offset_us += 1ull << 32;
+        }
+
+        first_frame = false;
+        next_sequence = sequence + 1;
+        prev_time_us = time_us;
+        frames++;
+
+        printf("%u,%llu", sequence, (unsigned long long)(time_offset_us + time_us));
+
+        if (channels & TELEMETRY_VOLTAGE) printf(",%d", r.i32());
+        if (channels & TELEMETRY_CURRENT) printf(",%d", r.i32());
+        if (channels & TELEMETRY_POWER) printf(",%d", r.i32());
+
+        if (channels & TELEMETRY_SINKS) for (int i = 0; i < 4; i++) printf(",%u", r.u16());
+
+        // UQ8.2 format
+        if (channels & TELEMETRY_TEMPS) for (int i = 0; i < 2; i++) { uint16_t temp = r.u16(); printf(",%u.%02u", temp >> 2, (temp & 3) * 25); }
+
+        if (channels & TELEMETRY_RPM) for (int i = 0; i < 2; i++) printf(",%u", r.u16());
+        if (channels & TELEMETRY_STATUS) for (int i = 0; i < 2; i++) printf(",0x%04x", r.u16());
+
+        printf("\n");
+    }
+};
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sets up a serial port for raw 8N1 communication
+static bool set_serial(int fd, speed_t baud) {
+
+    termios tty;
+    if (tcgetattr(fd, &tty) != 0) return false;
+
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, baud);
+    cfsetospeed(&tty, baud);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 1;        // read timeout 100ms so the stop request is noticed
+
+    return (tcsetattr(fd, TCSANOW, &tty) == 0);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// sends a shell command and waits until it is transmitted
+static void send_command(int fd, const std::string &command) {
+
+    std::string line = command + "\n";
+    if (write(fd, line.data(), line.size()) < 0) perror("write");
+    tcdrain(fd);
+}
+
+//---- MAIN ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+
+    if (argc < 2 || (std::string(argv[1]) != "-" && argc < 3)) {
+
+        fprintf(stderr, "usage: %s <serial_port> <rate_hz> [channels]\n       %s - < capture.bin\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, [](int) { stop_requested = 1; });
+
+    int fd = STDIN_FILENO;
+    bool serial = std::string(argv[1]) != "-";
+
+    if (serial) {
+
+        fd = open(argv[1], O_RDWR | O_NOCTTY);
+        if (fd < 0 || !set_serial(fd, SHELL_BAUD)) { perror(argv[1]); return 1; }
+
+        // the load switches to the stream baud rate after the response to the command
+        std::string command = std::string("stream ") + argv[2] + ((argc > 3) ? std::string(" ") + argv[3] : "");
+        send_command(fd, command);
+        usleep(100000);
+
+        set_serial(fd, STREAM_BAUD);
+        tcflush(fd, TCIFLUSH);
+    }
+
+    decoder dec;
+    std::vector<uint8_t> encoded;
+    bool synchronized = !serial;    // the first frame received from the port may be incomplete; skip it until the first delimiter
+    uint8_t buffer[4096];
+
+    while (!stop_requested) {
+
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+
+        if (length < 0) { if (!stop_requested) perror("read"); break; }
+        if (length == 0) { if (serial) continue; else break; }
+
+        for (ssize_t i = 0; i < length; i++) {
+
+            if (buffer[i] != 0) { encoded.push_back(buffer[i]); continue; }
+
+            if (synchronized && !encoded.empty()) dec.frame(encoded);
+            synchronized = true;
+            encoded.clear();
+        }
+
+        fflush(stdout);
+    }
+
+    if (serial) {
+
+        // the shell receives at the stream baud rate; the response comes at the shell baud rate and is not read
+        send_command(fd, "stream stop");
+        close(fd);
+    }
+
+    fprintf(stderr, "%llu frames, %llu dropped samples, %llu frame errors\n", (unsigned long long)dec.frames, (unsigned long long)dec.dropped, (unsigned long long)dec.errors);
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------------------------------------------------